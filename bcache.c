@@ -25,24 +25,60 @@
 #include <dirent.h>
 #include <errno.h>
 #include <limits.h>
+#include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
 #include "bcache.h"
 #include "account.h"
 #include "globals.h"
 #include "lib/lib.h"
+#include "options.h"
 #include "protos.h"
 #include "url.h"
 
+/* Name of the index file, inside the cache directory.  Dot files are ignored
+ * when scanning the directory, so it will never be mistaken for a message. */
+#define BCACHE_INDEX ".index"
+#define BCACHE_INDEX_VERSION 2
+
+/**
+ * struct BcacheEntry - A message in the Body Cache index
+ */
+struct BcacheEntry
+{
+  char *id;
+  off_t size;                /**< Size of the file on disk, -1 if unknown */
+  time_t atime;              /**< Last time the message was read or written */
+  struct BcacheEntry *prev;  /**< More recently used entry */
+  struct BcacheEntry *next;  /**< Less recently used entry */
+};
+
 /**
  * struct BodyCache - Local cache of email bodies
+ *
+ * The index is read lazily, the first time it's needed.  It records the size
+ * and last access time of every file, so that existence checks don't touch
+ * the disk and the least recently used messages can be evicted when the cache
+ * grows past $message_cache_size.
  */
 struct BodyCache
 {
   char path[_POSIX_PATH_MAX];
   size_t pathlen;
+  struct Hash *index;        /**< id -> BcacheEntry */
+  struct BcacheEntry *head;  /**< Most recently used */
+  struct BcacheEntry *tail;  /**< Least recently used */
+  off_t size;                /**< Total size of the cached files */
+  int count;                 /**< Number of entries */
+  int unsized;               /**< Number of entries of unknown size */
+  bool dirty;                /**< Index needs writing back */
 };
 
 static int bcache_path(struct Account *account, const char *mailbox, char *dst, size_t dstlen)
@@ -88,6 +124,510 @@ static int bcache_path(struct Account *account, const char *mailbox, char *dst,
   return 0;
 }
 
+/**
+ * bcache_lru_unlink - Take an entry out of the LRU list
+ * @param bcache Body Cache
+ * @param e      Entry
+ */
+static void bcache_lru_unlink(struct BodyCache *bcache, struct BcacheEntry *e)
+{
+  if (e->prev)
+    e->prev->next = e->next;
+  else
+    bcache->head = e->next;
+
+  if (e->next)
+    e->next->prev = e->prev;
+  else
+    bcache->tail = e->prev;
+
+  e->prev = e->next = NULL;
+}
+
+/**
+ * bcache_lru_push - Make an entry the most recently used
+ * @param bcache Body Cache
+ * @param e      Entry, not in the list
+ */
+static void bcache_lru_push(struct BodyCache *bcache, struct BcacheEntry *e)
+{
+  e->prev = NULL;
+  e->next = bcache->head;
+  if (bcache->head)
+    bcache->head->prev = e;
+  bcache->head = e;
+  if (!bcache->tail)
+    bcache->tail = e;
+}
+
+/**
+ * bcache_index_add - Add or update an entry in the index
+ * @param bcache Body Cache
+ * @param id     Message id
+ * @param size   Size of the file, -1 if unknown
+ * @param atime  Last access time
+ * @retval ptr Entry
+ *
+ * The entry becomes the most recently used one.
+ */
+static struct BcacheEntry *bcache_index_add(struct BodyCache *bcache,
+                                            const char *id, off_t size, time_t atime)
+{
+  struct BcacheEntry *e = hash_find(bcache->index, id);
+
+  if (e)
+  {
+    if (e->size < 0)
+      bcache->unsized--;
+    else
+      bcache->size -= e->size;
+    bcache_lru_unlink(bcache, e);
+  }
+  else
+  {
+    e = safe_calloc(1, sizeof(struct BcacheEntry));
+    e->id = safe_strdup(id);
+    hash_insert(bcache->index, e->id, e);
+    bcache->count++;
+  }
+
+  e->size = size;
+  e->atime = atime;
+  if (size < 0)
+    bcache->unsized++;
+  else
+    bcache->size += size;
+  bcache_lru_push(bcache, e);
+
+  bcache->dirty = true;
+  return e;
+}
+
+/**
+ * bcache_index_remove - Remove an entry from the index
+ * @param bcache Body Cache
+ * @param e      Entry
+ */
+static void bcache_index_remove(struct BodyCache *bcache, struct BcacheEntry *e)
+{
+  bcache_lru_unlink(bcache, e);
+  hash_delete(bcache->index, e->id, e, NULL);
+  if (e->size < 0)
+    bcache->unsized--;
+  else
+    bcache->size -= e->size;
+  bcache->count--;
+  bcache->dirty = true;
+  FREE(&e->id);
+  FREE(&e);
+}
+
+/**
+ * bcache_index_stat - Find out the size of the file of an entry
+ * @param bcache Body Cache
+ * @param e      Entry of unknown size, removed if its file is missing
+ * @retval  0 Success, the size is known
+ * @retval -1 The file is missing
+ */
+static int bcache_index_stat(struct BodyCache *bcache, struct BcacheEntry *e)
+{
+  char path[_POSIX_PATH_MAX];
+  struct stat st;
+
+  if (e->size >= 0)
+    return 0;
+
+  if ((snprintf(path, sizeof(path), "%s%s", bcache->path, e->id) >= sizeof(path)) ||
+      (stat(path, &st) < 0) || !S_ISREG(st.st_mode))
+  {
+    bcache_index_remove(bcache, e);
+    return -1;
+  }
+
+  bcache->unsized--;
+  e->size = st.st_size;
+  bcache->size += st.st_size;
+  bcache->dirty = true;
+  return 0;
+}
+
+/**
+ * bcache_index_stat_all - Find out the sizes of all the entries
+ * @param bcache Body Cache
+ *
+ * Files written with mutt_bcache_put(..., 0) are only measured when the size
+ * is needed: before evicting and before writing the index.
+ */
+static void bcache_index_stat_all(struct BodyCache *bcache)
+{
+  for (struct BcacheEntry *e = bcache->head, *next = NULL; e && (bcache->unsized > 0); e = next)
+  {
+    next = e->next;
+    bcache_index_stat(bcache, e);
+  }
+}
+
+/**
+ * bcache_mtime_cmp - Compare the modification times of two files
+ * @param a First file
+ * @param b Second file
+ * @retval <0 @a a is older
+ * @retval  0 Same time, as far as the filesystem can tell
+ * @retval >0 @a a is newer
+ */
+static int bcache_mtime_cmp(const struct stat *a, const struct stat *b)
+{
+  if (a->st_mtime != b->st_mtime)
+    return (a->st_mtime < b->st_mtime) ? -1 : 1;
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+  if (a->st_mtim.tv_nsec != b->st_mtim.tv_nsec)
+    return (a->st_mtim.tv_nsec < b->st_mtim.tv_nsec) ? -1 : 1;
+#endif
+  return 0;
+}
+
+/**
+ * bcache_mtime_nsec - Get the sub-second part of a file's modification time
+ * @param st Result of stat() on the file
+ * @retval num Nanoseconds, 0 if the system doesn't provide them
+ */
+static long bcache_mtime_nsec(const struct stat *st)
+{
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+  return st->st_mtim.tv_nsec;
+#else
+  return 0;
+#endif
+}
+
+/**
+ * bcache_index_read - Read the index file
+ * @param bcache Body Cache
+ * @param st     Result of stat() on the cache directory
+ * @retval  0 Success
+ * @retval -1 Index missing, stale or damaged
+ *
+ * The file starts with a header: "version dir-mtime dir-mtime-nsec count".
+ * The index is only trusted if the directory hasn't changed since it was
+ * written.
+ *
+ * A file added by another instance in the same clock tick as the directory's
+ * recorded mtime wouldn't change it.  So the index is also distrusted if it
+ * was written in that tick, i.e. if it isn't newer than the directory.
+ */
+static int bcache_index_read(struct BodyCache *bcache, const struct stat *st)
+{
+  char path[_POSIX_PATH_MAX + sizeof(BCACHE_INDEX)];
+  char line[_POSIX_PATH_MAX + 64];
+  long long size, atime, mtime;
+  long nsec;
+  int version, count, n = 0;
+  struct stat ist;
+  FILE *fp = NULL;
+
+  snprintf(path, sizeof(path), "%s%s", bcache->path, BCACHE_INDEX);
+  fp = fopen(path, "r");
+  if (!fp)
+    return -1;
+
+  if (!fgets(line, sizeof(line), fp) ||
+      (sscanf(line, "%d %lld %ld %d", &version, &mtime, &nsec, &count) != 4) ||
+      (version != BCACHE_INDEX_VERSION) || (mtime != (long long) st->st_mtime) ||
+      (nsec != bcache_mtime_nsec(st)) || (fstat(fileno(fp), &ist) < 0) ||
+      (bcache_mtime_cmp(&ist, st) <= 0))
+  {
+    safe_fclose(&fp);
+    return -1;
+  }
+
+  while (fgets(line, sizeof(line), fp))
+  {
+    int off = 0;
+    size_t len = mutt_strlen(line);
+
+    if ((len == 0) || (line[len - 1] != '\n'))
+      break;
+    line[len - 1] = '\0';
+
+    if ((sscanf(line, "%lld %lld %n", &size, &atime, &off) != 2) || (off == 0) ||
+        !line[off] || (size < 0))
+      break;
+
+    bcache_index_add(bcache, line + off, size, atime);
+    n++;
+  }
+  safe_fclose(&fp);
+
+  if (n != count)
+  {
+    mutt_debug(1, "bcache: index: '%s' is damaged\n", path);
+    return -1;
+  }
+
+  bcache->dirty = false;
+  return 0;
+}
+
+/**
+ * struct BcacheScan - A file found while scanning the cache directory
+ */
+struct BcacheScan
+{
+  char *id;
+  off_t size;
+  time_t atime;
+};
+
+/**
+ * bcache_scan_cmp - Compare two files by access time - Implements ::sort_t
+ */
+static int bcache_scan_cmp(const void *a, const void *b)
+{
+  const struct BcacheScan *sa = a;
+  const struct BcacheScan *sb = b;
+
+  return (sa->atime > sb->atime) - (sa->atime < sb->atime);
+}
+
+/**
+ * bcache_index_scan - Build the index from the files in the cache directory
+ * @param bcache Body Cache
+ */
+static void bcache_index_scan(struct BodyCache *bcache)
+{
+  char path[_POSIX_PATH_MAX];
+  struct BcacheScan *files = NULL;
+  size_t count = 0, alloc = 0;
+  struct dirent *de = NULL;
+  struct stat st;
+
+  DIR *d = opendir(bcache->path);
+  if (!d)
+    return;
+
+  mutt_debug(3, "bcache: scan: dir: '%s'\n", bcache->path);
+
+  while ((de = readdir(d)))
+  {
+    if (de->d_name[0] == '.')
+      continue;
+
+    if ((snprintf(path, sizeof(path), "%s%s", bcache->path, de->d_name) >= sizeof(path)) ||
+        (stat(path, &st) < 0) || !S_ISREG(st.st_mode))
+      continue;
+
+    if (count == alloc)
+    {
+      alloc += 256;
+      safe_realloc(&files, alloc * sizeof(struct BcacheScan));
+    }
+    files[count].id = safe_strdup(de->d_name);
+    files[count].size = st.st_size;
+    files[count].atime = (st.st_atime > st.st_mtime) ? st.st_atime : st.st_mtime;
+    count++;
+  }
+  closedir(d);
+
+  /* oldest first, so the most recently used file ends up at the front */
+  if (count > 1)
+    qsort(files, count, sizeof(struct BcacheScan), bcache_scan_cmp);
+
+  for (size_t i = 0; i < count; i++)
+  {
+    bcache_index_add(bcache, files[i].id, files[i].size, files[i].atime);
+    FREE(&files[i].id);
+  }
+  FREE(&files);
+
+  bcache->dirty = true;
+}
+
+/**
+ * bcache_index_write - Write the index file back to the cache directory
+ * @param bcache Body Cache
+ *
+ * The file is rewritten in place: replacing it would change the directory's
+ * mtime, which is what the index is validated against.
+ */
+static void bcache_index_write(struct BodyCache *bcache)
+{
+  char path[_POSIX_PATH_MAX + sizeof(BCACHE_INDEX)];
+  struct stat st;
+  FILE *fp = NULL;
+
+  bcache_index_stat_all(bcache);
+  snprintf(path, sizeof(path), "%s%s", bcache->path, BCACHE_INDEX);
+
+  /* don't stop an empty cache directory from being removed */
+  if (bcache->count == 0)
+  {
+    unlink(path);
+    bcache->dirty = false;
+    return;
+  }
+
+  /* create the file first, so the directory's mtime is final */
+  fp = fopen(path, "a");
+  if (!fp)
+    return;
+  safe_fclose(&fp);
+
+  if ((stat(bcache->path, &st) < 0) || !(fp = fopen(path, "w")))
+    return;
+
+  fprintf(fp, "%d %lld %ld %d\n", BCACHE_INDEX_VERSION, (long long) st.st_mtime,
+          bcache_mtime_nsec(&st), bcache->count);
+  for (struct BcacheEntry *e = bcache->tail; e; e = e->prev)
+    fprintf(fp, "%lld %lld %s\n", (long long) e->size, (long long) e->atime, e->id);
+
+  if (safe_fclose(&fp) == 0)
+    bcache->dirty = false;
+  else
+    unlink(path);
+}
+
+/**
+ * bcache_index_load - Make sure the index is in memory
+ * @param bcache Body Cache
+ */
+static void bcache_index_load(struct BodyCache *bcache)
+{
+  struct stat st;
+
+  if (bcache->index)
+    return;
+
+  bcache->index = hash_create(1024, 0);
+
+  if (stat(bcache->path, &st) < 0)
+    return;
+
+  if (bcache_index_read(bcache, &st) == 0)
+  {
+    mutt_debug(3, "bcache: index: %d entries, %lld bytes\n", bcache->count,
+               (long long) bcache->size);
+    return;
+  }
+
+  /* start again from scratch */
+  while (bcache->head)
+    bcache_index_remove(bcache, bcache->head);
+  bcache_index_scan(bcache);
+  mutt_debug(3, "bcache: scan: %d entries, %lld bytes\n", bcache->count,
+             (long long) bcache->size);
+}
+
+/**
+ * bcache_evict - Delete least recently used messages to respect the size limit
+ * @param bcache Body Cache
+ * @param keep   Entry which mustn't be evicted (optional)
+ */
+static void bcache_evict(struct BodyCache *bcache, struct BcacheEntry *keep)
+{
+  char path[_POSIX_PATH_MAX];
+
+  if (MessageCacheSize <= 0)
+    return;
+
+  const off_t limit = (off_t) MessageCacheSize * 1024 * 1024;
+
+  bcache_index_stat_all(bcache);
+  while ((bcache->size > limit) && bcache->tail && (bcache->tail != keep))
+  {
+    struct BcacheEntry *e = bcache->tail;
+
+    snprintf(path, sizeof(path), "%s%s", bcache->path, e->id);
+    mutt_debug(3, "bcache: evict: '%s' (%lld bytes)\n", path, (long long) e->size);
+    unlink(path);
+    bcache_index_remove(bcache, e);
+  }
+}
+
+#ifdef HAVE_ZLIB
+/**
+ * bcache_compress - Compress a file into the Body Cache
+ * @param src Path of the uncompressed file
+ * @param dst Path of the compressed file
+ * @retval  0 Success
+ * @retval -1 Failure, @a dst doesn't exist
+ */
+static int bcache_compress(const char *src, const char *dst)
+{
+  char buf[LONG_STRING * 4];
+  size_t len;
+  int rc = 0;
+
+  FILE *fp = fopen(src, "r");
+  if (!fp)
+    return -1;
+
+  gzFile gz = gzopen(dst, "wb");
+  if (!gz)
+  {
+    safe_fclose(&fp);
+    return -1;
+  }
+
+  while ((rc == 0) && (len = fread(buf, 1, sizeof(buf), fp)) > 0)
+    if (gzwrite(gz, buf, len) != (int) len)
+      rc = -1;
+
+  if (ferror(fp))
+    rc = -1;
+  if (gzclose(gz) != Z_OK)
+    rc = -1;
+  safe_fclose(&fp);
+
+  if (rc != 0)
+    unlink(dst);
+  return rc;
+}
+
+/**
+ * bcache_decompress - Decompress a cached file
+ * @param fp Cached file, positioned at the start
+ * @retval ptr Anonymous temporary file holding the message
+ * @retval NULL on failure
+ */
+static FILE *bcache_decompress(FILE *fp)
+{
+  char tmp[_POSIX_PATH_MAX];
+  char buf[LONG_STRING * 4];
+  int len;
+
+  int fd = dup(fileno(fp));
+  if (fd < 0)
+    return NULL;
+
+  gzFile gz = gzdopen(fd, "rb");
+  if (!gz)
+  {
+    close(fd);
+    return NULL;
+  }
+
+  mutt_mktemp(tmp, sizeof(tmp));
+  FILE *out = safe_fopen(tmp, "w+");
+  if (out)
+  {
+    unlink(tmp);
+    while ((len = gzread(gz, buf, sizeof(buf))) > 0)
+    {
+      if (fwrite(buf, 1, len, out) != (size_t) len)
+        break;
+    }
+
+    if ((len != 0) || ferror(out) || (fflush(out) != 0))
+      safe_fclose(&out);
+    else
+      rewind(out);
+  }
+  gzclose(gz);
+
+  return out;
+}
+#endif
+
 static int mutt_bcache_move(struct BodyCache *bcache, const char *id, const char *newid)
 {
   char path[_POSIX_PATH_MAX];
@@ -101,6 +641,15 @@ static int mutt_bcache_move(struct BodyCache *bcache, const char *id, const char
 
   mutt_debug(3, "bcache: mv: '%s' '%s'\n", path, newpath);
 
+#ifdef HAVE_ZLIB
+  if (option(OPT_MESSAGE_CACHE_COMPRESS))
+  {
+    if (bcache_compress(path, newpath) == 0)
+      return unlink(path);
+    mutt_debug(1, "bcache: compressing '%s' failed, storing it as is\n", path);
+  }
+#endif
+
   return rename(path, newpath);
 }
 
@@ -128,6 +677,16 @@ void mutt_bcache_close(struct BodyCache **bcache)
 {
   if (!bcache || !*bcache)
     return;
+
+  if ((*bcache)->index)
+  {
+    if ((*bcache)->dirty)
+      bcache_index_write(*bcache);
+    while ((*bcache)->head)
+      bcache_index_remove(*bcache, (*bcache)->head);
+    hash_destroy(&(*bcache)->index, NULL);
+  }
+
   FREE(bcache);
 }
 
@@ -139,6 +698,14 @@ FILE *mutt_bcache_get(struct BodyCache *bcache, const char *id)
   if (!id || !*id || !bcache)
     return NULL;
 
+  bcache_index_load(bcache);
+  struct BcacheEntry *e = hash_find(bcache->index, id);
+  if (!e)
+  {
+    mutt_debug(3, "bcache: get: '%s%s': no\n", bcache->path, id);
+    return NULL;
+  }
+
   path[0] = '\0';
   safe_strncat(path, sizeof(path), bcache->path, bcache->pathlen);
   safe_strncat(path, sizeof(path), id, mutt_strlen(id));
@@ -147,6 +714,32 @@ FILE *mutt_bcache_get(struct BodyCache *bcache, const char *id)
 
   mutt_debug(3, "bcache: get: '%s': %s\n", path, fp == NULL ? "no" : "yes");
 
+  if (!fp)
+  {
+    /* removed behind our back */
+    bcache_index_remove(bcache, e);
+    return NULL;
+  }
+
+#ifdef HAVE_ZLIB
+  if ((fgetc(fp) == 0x1f) && (fgetc(fp) == 0x8b))
+  {
+    rewind(fp);
+    FILE *plain = bcache_decompress(fp);
+    safe_fclose(&fp);
+    if (!plain)
+    {
+      mutt_debug(1, "bcache: get: '%s': can't decompress\n", path);
+      return NULL;
+    }
+    fp = plain;
+  }
+  else
+    rewind(fp);
+#endif
+
+  bcache_index_add(bcache, id, e->size, time(NULL));
+
   return fp;
 }
 
@@ -154,6 +747,7 @@ FILE *mutt_bcache_put(struct BodyCache *bcache, const char *id, int tmp)
 {
   char path[_POSIX_PATH_MAX];
   struct stat sb;
+  FILE *fp = NULL;
 
   if (!id || !*id || !bcache)
     return NULL;
@@ -178,16 +772,38 @@ FILE *mutt_bcache_put(struct BodyCache *bcache, const char *id, int tmp)
   snprintf(path, sizeof(path), "%s%s%s", bcache->path, id, tmp ? ".tmp" : "");
   mutt_debug(3, "bcache: put: '%s'\n", path);
 
-  return safe_fopen(path, "w+");
+  fp = safe_fopen(path, "w+");
+
+  /* the size isn't known until the caller has finished writing, so the file
+   * is measured when the size is needed, see bcache_index_stat_all() */
+  if (fp && !tmp)
+  {
+    bcache_index_load(bcache);
+    bcache_index_add(bcache, id, -1, time(NULL));
+  }
+
+  return fp;
 }
 
 int mutt_bcache_commit(struct BodyCache *bcache, const char *id)
 {
   char tmpid[_POSIX_PATH_MAX];
+  char path[_POSIX_PATH_MAX];
+  struct stat st;
 
   snprintf(tmpid, sizeof(tmpid), "%s.tmp", id);
 
-  return mutt_bcache_move(bcache, tmpid, id);
+  if (mutt_bcache_move(bcache, tmpid, id) < 0)
+    return -1;
+
+  bcache_index_load(bcache);
+
+  snprintf(path, sizeof(path), "%s%s", bcache->path, id);
+  struct BcacheEntry *e =
+      bcache_index_add(bcache, id, (stat(path, &st) == 0) ? st.st_size : -1, time(NULL));
+  bcache_evict(bcache, e);
+
+  return 0;
 }
 
 int mutt_bcache_del(struct BodyCache *bcache, const char *id)
@@ -203,28 +819,29 @@ int mutt_bcache_del(struct BodyCache *bcache, const char *id)
 
   mutt_debug(3, "bcache: del: '%s'\n", path);
 
+  bcache_index_load(bcache);
+  struct BcacheEntry *e = hash_find(bcache->index, id);
+  if (e)
+    bcache_index_remove(bcache, e);
+
   return unlink(path);
 }
 
 int mutt_bcache_exists(struct BodyCache *bcache, const char *id)
 {
-  char path[_POSIX_PATH_MAX];
-  struct stat st;
   int rc = 0;
 
   if (!id || !*id || !bcache)
     return -1;
 
-  path[0] = '\0';
-  safe_strncat(path, sizeof(path), bcache->path, bcache->pathlen);
-  safe_strncat(path, sizeof(path), id, mutt_strlen(id));
+  bcache_index_load(bcache);
+  struct BcacheEntry *e = hash_find(bcache->index, id);
 
-  if (stat(path, &st) < 0)
+  /* empty files don't count */
+  if (!e || (bcache_index_stat(bcache, e) < 0) || (e->size == 0))
     rc = -1;
-  else
-    rc = S_ISREG(st.st_mode) && st.st_size != 0 ? 0 : -1;
 
-  mutt_debug(3, "bcache: exists: '%s': %s\n", path, rc == 0 ? "yes" : "no");
+  mutt_debug(3, "bcache: exists: '%s%s': %s\n", bcache->path, id, rc == 0 ? "yes" : "no");
 
   return rc;
 }
@@ -233,37 +850,38 @@ int mutt_bcache_list(struct BodyCache *bcache,
                      int (*want_id)(const char *id, struct BodyCache *bcache, void *data),
                      void *data)
 {
-  DIR *d = NULL;
-  struct dirent *de = NULL;
+  char **ids = NULL;
+  int count = 0;
   int rc = -1;
 
-  if (!bcache || !(d = opendir(bcache->path)))
+  if (!bcache)
     goto out;
 
+  bcache_index_load(bcache);
   rc = 0;
 
   mutt_debug(3, "bcache: list: dir: '%s'\n", bcache->path);
 
-  while ((de = readdir(d)))
-  {
-    if ((mutt_strncmp(de->d_name, ".", 1) == 0) ||
-        (mutt_strncmp(de->d_name, "..", 2) == 0))
-      continue;
+  /* the callback may delete entries, so work on a copy of the ids */
+  ids = safe_calloc(bcache->count + 1, sizeof(char *));
+  for (struct BcacheEntry *e = bcache->head; e; e = e->next)
+    ids[count++] = safe_strdup(e->id);
 
-    mutt_debug(3, "bcache: list: dir: '%s', id :'%s'\n", bcache->path, de->d_name);
+  for (int i = 0; i < count; i++)
+  {
+    mutt_debug(3, "bcache: list: dir: '%s', id :'%s'\n", bcache->path, ids[i]);
 
-    if (want_id && want_id(de->d_name, bcache, data) != 0)
-      goto out;
+    if (want_id && want_id(ids[i], bcache, data) != 0)
+      break;
 
     rc++;
   }
 
+  for (int i = 0; i < count; i++)
+    FREE(&ids[i]);
+  FREE(&ids);
+
 out:
-  if (d)
-  {
-    if (closedir(d) < 0)
-      rc = -1;
-  }
   mutt_debug(3, "bcache: list: did %d entries\n", rc);
   return rc;
 }
@@ -93,6 +93,8 @@ int mutt_bcache_del(struct BodyCache *bcache, const char *id);
  * @param id     Per-mailbox unique identifier for the message
  * @retval 0 on success
  * @retval -1 on failure
+ *
+ * The answer comes from the cache's index, the file itself isn't checked.
  */
 int mutt_bcache_exists(struct BodyCache *bcache, const char *id);
 
@@ -105,7 +107,8 @@ int mutt_bcache_exists(struct BodyCache *bcache, const char *id);
  * @retval >=0 count of matching items
  *
  * This more or less "examines" the cache and calls a function with
- * each id it finds if given.
+ * each id it finds if given.  The ids come from the cache's index, most
+ * recently used first.
  *
  * The optional callback function gets the id of a message, the very same
  * body cache handle mutt_bcache_list() is called with (to, perhaps,
@@ -769,6 +769,7 @@ static int examine_vfolders(struct Menu *menu, struct BrowserState *state)
 
   init_state(state, menu);
 
+  nm_nonctx_begin();
   do
   {
     if (mx_is_notmuch(tmp->path))
@@ -778,6 +779,7 @@ static int examine_vfolders(struct Menu *menu, struct BrowserState *state)
       continue;
     }
   } while ((tmp = tmp->next));
+  nm_nonctx_end();
   browser_sort(state);
   return 0;
 }
@@ -23,11 +23,16 @@
 
 #include "config.h"
 #include <dirent.h>
+#include <errno.h>
 #include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#ifdef USE_INOTIFY
+#include <sys/inotify.h>
+#endif
 #include <sys/stat.h>
+#include <unistd.h>
 #include <utime.h>
 #include "buffy.h"
 #include "context.h"
@@ -57,6 +62,10 @@ static time_t BuffyStatsTime = 0; /**< last time we check performed mail_check_s
 time_t BuffyDoneTime = 0; /**< last time we knew for sure how much mail there was. */
 static short BuffyCount = 0;  /**< how many boxes with new mail */
 static short BuffyNotify = 0; /**< # of unnotified new boxes */
+#ifdef USE_INOTIFY
+static int BuffyWatchFd = -1;              /**< inotify instance for Incoming */
+static struct Hash *BuffyWatches = NULL;   /**< watch descriptor -> Buffy */
+#endif
 
 /**
  * fseek_last_message - Find the last message in the file
@@ -164,12 +173,194 @@ static struct Buffy *buffy_new(const char *path)
   strfcpy(buffy->realpath, r ? rp : path, sizeof(buffy->realpath));
   buffy->next = NULL;
   buffy->magic = 0;
+#ifdef USE_INOTIFY
+  buffy->wd[0] = buffy->wd[1] = -1;
+#endif
 
   return buffy;
 }
 
+#ifdef USE_INOTIFY
+/**
+ * buffy_watch_remove - Stop watching a mailbox
+ * @param b Mailbox
+ */
+static void buffy_watch_remove(struct Buffy *b)
+{
+  for (int i = 0; i < 2; i++)
+  {
+    if (b->wd[i] < 0)
+      continue;
+    int_hash_delete(BuffyWatches, b->wd[i], b, NULL);
+    inotify_rm_watch(BuffyWatchFd, b->wd[i]);
+    b->wd[i] = -1;
+  }
+  b->counted = false;
+}
+
+/**
+ * buffy_watch_add - Watch a local mailbox for changes
+ * @param b Mailbox, whose type is known
+ *
+ * Failing is harmless: the mailbox is then checked every time.
+ */
+static void buffy_watch_add(struct Buffy *b)
+{
+  char path[_POSIX_PATH_MAX + 8]; /* room for Buffy::path + "/new" */
+  const uint32_t mask = IN_CREATE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE |
+                        IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF;
+
+  if ((b->wd[0] >= 0) || (b->magic == 0))
+    return;
+
+  if (BuffyWatchFd < 0)
+  {
+    BuffyWatchFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (BuffyWatchFd < 0)
+    {
+      mutt_debug(1, "buffy_watch_add: inotify_init1: %s\n", strerror(errno));
+      return;
+    }
+    BuffyWatches = int_hash_create(64, MUTT_HASH_ALLOW_DUPS);
+  }
+
+  switch (b->magic)
+  {
+    case MUTT_MAILDIR:
+      snprintf(path, sizeof(path), "%s/new", b->path);
+      b->wd[0] = inotify_add_watch(BuffyWatchFd, path, mask | IN_ONLYDIR);
+      snprintf(path, sizeof(path), "%s/cur", b->path);
+      b->wd[1] = inotify_add_watch(BuffyWatchFd, path, mask | IN_ONLYDIR);
+      break;
+    case MUTT_MH:
+      b->wd[0] = inotify_add_watch(BuffyWatchFd, b->path, mask | IN_ONLYDIR);
+      break;
+    case MUTT_MBOX:
+    case MUTT_MMDF:
+      b->wd[0] = inotify_add_watch(BuffyWatchFd, b->path,
+                                   IN_MODIFY | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF);
+      break;
+    default:
+      return;
+  }
+
+  if ((b->wd[0] < 0) || ((b->magic == MUTT_MAILDIR) && (b->wd[1] < 0)))
+  {
+    mutt_debug(1, "buffy_watch_add: %s: %s\n", b->path, strerror(errno));
+    if (b->wd[0] >= 0)
+      inotify_rm_watch(BuffyWatchFd, b->wd[0]);
+    if (b->wd[1] >= 0)
+      inotify_rm_watch(BuffyWatchFd, b->wd[1]);
+    b->wd[0] = b->wd[1] = -1;
+    return;
+  }
+
+  for (int i = 0; i < 2; i++)
+    if (b->wd[i] >= 0)
+      int_hash_insert(BuffyWatches, b->wd[i], b);
+}
+
+/**
+ * buffy_watch_count - Update a maildir's counts from a filename
+ * @param b     Mailbox
+ * @param name  Name of the message file
+ * @param delta 1 if the file appeared, -1 if it went away
+ *
+ * This mirrors the counting done by buffy_maildir_check_dir().
+ */
+static void buffy_watch_count(struct Buffy *b, const char *name, int delta)
+{
+  const char *p = strstr(name, ":2,");
+
+  if (p && strchr(p + 3, 'T'))
+    return;
+
+  b->msg_count += delta;
+  if (p && strchr(p + 3, 'F'))
+    b->msg_flagged += delta;
+  if (!p || !strchr(p + 3, 'S'))
+    b->msg_unread += delta;
+
+  /* events raced with the last full count; trust a recount */
+  if ((b->msg_count < 0) || (b->msg_flagged < 0) || (b->msg_unread < 0))
+    b->counted = false;
+}
+
+/**
+ * buffy_watch_read - Mark the mailboxes whose watches fired as dirty
+ *
+ * Maildir counts are updated from the filenames in the events, so that the
+ * sidebar stays current without reading the directories.
+ */
+static void buffy_watch_read(void)
+{
+  char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  ssize_t len;
+
+  if (BuffyWatchFd < 0)
+    return;
+
+  while ((len = read(BuffyWatchFd, buf, sizeof(buf))) > 0)
+  {
+    for (char *p = buf; p < buf + len;)
+    {
+      const struct inotify_event *ie = (const struct inotify_event *) p;
+      p += sizeof(struct inotify_event) + ie->len;
+
+      if (ie->mask & IN_Q_OVERFLOW)
+      {
+        /* we don't know what we missed */
+        mutt_debug(2, "buffy_watch_read: queue overflow\n");
+        for (struct Buffy *b = Incoming; b; b = b->next)
+        {
+          b->dirty = true;
+          b->counted = false;
+        }
+        continue;
+      }
+
+      struct Buffy *b = int_hash_find(BuffyWatches, ie->wd);
+      if (!b)
+        continue;
+
+      b->dirty = true;
+
+      if (ie->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF))
+      {
+        /* it's gone, or has been replaced: watch it afresh next time */
+        buffy_watch_remove(b);
+        continue;
+      }
+
+      if (!b->counted || (b->magic != MUTT_MAILDIR) || (ie->len == 0) ||
+          (ie->name[0] == '.'))
+        continue;
+
+      if (ie->mask & (IN_CREATE | IN_MOVED_TO))
+        buffy_watch_count(b, ie->name, 1);
+      else if (ie->mask & (IN_DELETE | IN_MOVED_FROM))
+        buffy_watch_count(b, ie->name, -1);
+      else
+        continue;
+
+#ifdef USE_SIDEBAR
+      mutt_set_current_menu_redraw(REDRAW_SIDEBAR);
+#endif
+    }
+  }
+}
+#endif /* USE_INOTIFY */
+
 static void buffy_free(struct Buffy **mailbox)
 {
+#ifdef USE_INOTIFY
+  if (mailbox && *mailbox)
+    buffy_watch_remove(*mailbox);
+#endif
+#ifdef USE_NOTMUCH
+  if (mailbox && *mailbox && ((*mailbox)->magic == MUTT_NOTMUCH))
+    nm_nonctx_free((*mailbox)->path);
+#endif
   if (mailbox && *mailbox)
     FREE(&(*mailbox)->desc);
   FREE(mailbox);
@@ -181,7 +372,9 @@ static void buffy_free(struct Buffy **mailbox)
  * @param dir_name    Path to mailbox
  * @param check_new   if true, check for new mail
  * @param check_stats if true, count total, new, and flagged messages
- * @retval 1 if the dir has new mail
+ * @retval  1 if the dir has new mail
+ * @retval  0 if it hasn't
+ * @retval -1 if the dir can't be read
  *
  * Checks the specified maildir subdir (cur or new) for new mail or mail counts.
  */
@@ -214,10 +407,7 @@ static int buffy_maildir_check_dir(struct Buffy *mailbox, const char *dir_name,
     return rc;
 
   if ((dirp = opendir(path)) == NULL)
-  {
-    mailbox->magic = 0;
-    return 0;
-  }
+    return -1;
 
   while ((de = readdir(dirp)) != NULL)
   {
@@ -265,7 +455,9 @@ static int buffy_maildir_check_dir(struct Buffy *mailbox, const char *dir_name,
  * buffy_maildir_check - Check for new mail in a maildir mailbox
  * @param mailbox     Mailbox to check
  * @param check_stats if true, also count total, new, and flagged messages
- * @retval 1 if the mailbox has new mail
+ * @retval  1 if the mailbox has new mail
+ * @retval  0 if it hasn't
+ * @retval -1 if the mailbox can't be read
  */
 static int buffy_maildir_check(struct Buffy *mailbox, int check_stats)
 {
@@ -279,11 +471,16 @@ static int buffy_maildir_check(struct Buffy *mailbox, int check_stats)
   }
 
   rc = buffy_maildir_check_dir(mailbox, "new", check_new, check_stats);
+  if (rc < 0)
+    return rc;
 
   check_new = !rc && option(OPT_MAILDIR_CHECK_CUR);
   if (check_new || check_stats)
-    if (buffy_maildir_check_dir(mailbox, "cur", check_new, check_stats))
-      rc = 1;
+  {
+    int rc_cur = buffy_maildir_check_dir(mailbox, "cur", check_new, check_stats);
+    if (rc_cur != 0)
+      rc = rc_cur;
+  }
 
   return rc;
 }
@@ -341,21 +538,118 @@ static int buffy_mbox_check(struct Buffy *mailbox, struct stat *sb, int check_st
   return rc;
 }
 
-static void buffy_check(struct Buffy *tmp, struct stat *contex_sb, int check_stats)
+/**
+ * struct BuffyJob - A mailbox check that can run in parallel with others
+ */
+struct BuffyJob
 {
-  struct stat sb;
+  struct Buffy *b;
+  int check_stats;
+  int rc;                  /**< Result of the check: > 0 if there's new mail */
 #ifdef USE_SIDEBAR
   short orig_new;
   int orig_count, orig_unread, orig_flagged;
 #endif
+};
+
+/**
+ * buffy_job_run - Check a Maildir or MH mailbox - Implements ::worker_fn_t
+ *
+ * This only reads the filesystem and fills in the mailbox's own counts, so
+ * several mailboxes can be checked at once.  Anything else, including the
+ * mailbox's type, is only changed by buffy_check_done() on the main thread.
+ * Nothing here may call mutt_debug(), which isn't thread-safe.
+ */
+static void buffy_job_run(int i, void *data)
+{
+  struct BuffyJob *job = (struct BuffyJob *) data + i;
+
+  if (job->b->magic == MUTT_MAILDIR)
+    job->rc = buffy_maildir_check(job->b, job->check_stats);
+  else
+    job->rc = mh_buffy(job->b, job->check_stats);
+}
+
+/**
+ * buffy_check_done - Account for a checked mailbox
+ * @param job Mailbox check
+ */
+static void buffy_check_done(struct BuffyJob *job)
+{
+  struct Buffy *tmp = job->b;
+
+  if (job->rc > 0)
+    BuffyCount++;
+  else if ((job->rc < 0) && (tmp->magic == MUTT_MAILDIR))
+  {
+    /* the maildir has gone: find out its type again next time */
+    mutt_debug(3, "buffy_check_done: can't read %s\n", tmp->path);
+    tmp->magic = 0;
+  }
+
+#ifdef USE_INOTIFY
+  /* If the mailbox changed during the scan, the counts may or may not include
+   * the change, so they can't be updated from the events: recount next time.
+   * This holds even if they were counted before, e.g. by a forced check. */
+  if ((tmp->magic == MUTT_MAILDIR) && job->check_stats && (tmp->wd[0] >= 0))
+    tmp->counted = !tmp->dirty;
+#endif
+
+#ifdef USE_SIDEBAR
+  if ((job->orig_new != tmp->new) || (job->orig_count != tmp->msg_count) ||
+      (job->orig_unread != tmp->msg_unread) || (job->orig_flagged != tmp->msg_flagged))
+    mutt_set_current_menu_redraw(REDRAW_SIDEBAR);
+#endif
+
+  if (!tmp->new)
+    tmp->notified = false;
+  else if (!tmp->notified)
+    BuffyNotify++;
+}
+
+/**
+ * buffy_check - Check a mailbox for new mail
+ * @param tmp         Mailbox
+ * @param contex_sb   stat() info of the current mailbox
+ * @param check_stats If true, also count the messages
+ * @param force       If true, check even if nothing seems to have changed
+ * @param job         Filled in for a check that's left to the caller
+ * @retval true The Maildir/MH scan in @a job must be run, then buffy_check_done()
+ * @retval false The mailbox has been dealt with
+ */
+static bool buffy_check(struct Buffy *tmp, struct stat *contex_sb, int check_stats,
+                        bool force, struct BuffyJob *job)
+{
+  struct stat sb;
 
   sb.st_size = 0;
 
+#ifdef USE_INOTIFY
+  /* Nothing has happened to a watched mailbox: its state still holds.  A
+   * forced check (e.g. after changing folders) always looks again. */
+  if (!force && (tmp->wd[0] >= 0) && !tmp->dirty &&
+      (!check_stats || tmp->counted))
+  {
+    if (tmp->new)
+    {
+      BuffyCount++;
+      if (!tmp->notified)
+        BuffyNotify++;
+    }
+    else
+      tmp->notified = false;
+    return false;
+  }
+  tmp->dirty = false;
+#endif
+
+  memset(job, 0, sizeof(*job));
+  job->b = tmp;
 #ifdef USE_SIDEBAR
-  orig_new = tmp->new;
-  orig_count = tmp->msg_count;
-  orig_unread = tmp->msg_unread;
-  orig_flagged = tmp->msg_flagged;
+  job->orig_new = tmp->new;
+  job->orig_count = tmp->msg_count;
+  job->orig_unread = tmp->msg_unread;
+  job->orig_flagged = tmp->msg_flagged;
 #endif
 
   if (tmp->magic != MUTT_IMAP)
@@ -383,10 +677,16 @@ static void buffy_check(struct Buffy *tmp, struct stat *contex_sb, int check_sta
       tmp->newly_created = true;
       tmp->magic = 0;
       tmp->size = 0;
-      return;
+      return false;
     }
   }
 
+#ifdef USE_INOTIFY
+  /* Watch before looking, so that a change made while the mailbox is being
+   * checked is reported by the next buffy_watch_read() */
+  buffy_watch_add(tmp);
+#endif
+
   /* check to see if the folder is the currently selected folder
      * before polling */
   if (!Context || !Context->path ||
@@ -405,19 +705,19 @@ static void buffy_check(struct Buffy *tmp, struct stat *contex_sb, int check_sta
     {
       case MUTT_MBOX:
       case MUTT_MMDF:
-        if (buffy_mbox_check(tmp, &sb, check_stats) > 0)
-          BuffyCount++;
+        job->rc = buffy_mbox_check(tmp, &sb, check_stats);
         break;
 
       case MUTT_MAILDIR:
-        if (buffy_maildir_check(tmp, check_stats) > 0)
-          BuffyCount++;
-        break;
-
+#ifdef USE_INOTIFY
+        /* the counts are kept up to date: only look for new mail */
+        if (tmp->counted && !force)
+          check_stats = 0;
+#endif
+        /* fall through */
       case MUTT_MH:
-        if (mh_buffy(tmp, check_stats) > 0)
-          BuffyCount++;
-        break;
+        job->check_stats = check_stats;
+        return true;
 #ifdef USE_NOTMUCH
       case MUTT_NOTMUCH:
         tmp->msg_count = 0;
@@ -426,7 +726,7 @@ static void buffy_check(struct Buffy *tmp, struct stat *contex_sb, int check_sta
         nm_nonctx_get_count(tmp->path, &tmp->msg_count, &tmp->msg_unread);
         if (tmp->msg_unread > 0)
         {
-          BuffyCount++;
+          job->rc = 1;
           tmp->new = true;
         }
         break;
@@ -436,16 +736,8 @@ static void buffy_check(struct Buffy *tmp, struct stat *contex_sb, int check_sta
   else if (option(OPT_CHECK_MBOX_SIZE) && Context && Context->path)
     tmp->size = (off_t) sb.st_size; /* update the size of current folder */
 
-#ifdef USE_SIDEBAR
-  if ((orig_new != tmp->new) || (orig_count != tmp->msg_count) ||
-      (orig_unread != tmp->msg_unread) || (orig_flagged != tmp->msg_flagged))
-    mutt_set_current_menu_redraw(REDRAW_SIDEBAR);
-#endif
-
-  if (!tmp->new)
-    tmp->notified = false;
-  else if (!tmp->notified)
-    BuffyNotify++;
+  buffy_check_done(job);
+  return false;
 }
 
 /**
@@ -716,10 +1008,6 @@ int mutt_buffy_check(bool force)
   BuffyCount = 0;
   BuffyNotify = 0;
 
-#ifdef USE_IMAP
-  BuffyCount += imap_buffy_check(force, check_stats);
-#endif
-
   /* check device ID and serial number instead of comparing paths */
   if (!Context || Context->magic == MUTT_IMAP || Context->magic == MUTT_POP
 #ifdef USE_NNTP
@@ -731,8 +1019,42 @@ int mutt_buffy_check(bool force)
     contex_sb.st_ino = 0;
   }
 
+  int count = 0, njobs = 0;
   for (struct Buffy *b = Incoming; b; b = b->next)
-    buffy_check(b, &contex_sb, check_stats);
+    count++;
+  struct BuffyJob *jobs = safe_calloc(count, sizeof(struct BuffyJob));
+
+#ifdef USE_NOTMUCH
+  /* share one database handle between all the virtual mailboxes */
+  nm_nonctx_begin();
+#endif
+#ifdef USE_INOTIFY
+  buffy_watch_read();
+#endif
+  for (struct Buffy *b = Incoming; b; b = b->next)
+    if (buffy_check(b, &contex_sb, check_stats, force, &jobs[njobs]))
+      njobs++;
+#ifdef USE_NOTMUCH
+  nm_nonctx_end();
+#endif
+
+  /* Scan the Maildir and MH mailboxes in parallel, while waiting for the
+   * IMAP servers to answer */
+  struct Workers *workers = mutt_workers_start(WorkerThreads, njobs, buffy_job_run, jobs);
+
+#ifdef USE_IMAP
+  BuffyCount += imap_buffy_check(force, check_stats);
+#endif
+
+  mutt_workers_wait(&workers);
+#ifdef USE_INOTIFY
+  /* note the changes made while the mailboxes were being scanned */
+  if (njobs > 0)
+    buffy_watch_read();
+#endif
+  for (int i = 0; i < njobs; i++)
+    buffy_check_done(&jobs[i]);
+  FREE(&jobs);
 
   BuffyDoneTime = BuffyTime;
   return BuffyCount;
@@ -802,6 +1124,10 @@ void mutt_buffy_setnotified(const char *path)
 
   buffy->notified = true;
   time(&buffy->last_visited);
+#ifdef USE_INOTIFY
+  /* $mail_check_recent compares against last_visited */
+  buffy->dirty = true;
+#endif
 }
 
 int mutt_buffy_notify(void)
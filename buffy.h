@@ -58,6 +58,13 @@ struct Buffy
   bool newly_created;        /**< mbox or mmdf just popped into existence */
   time_t last_visited;       /**< time of last exit from this mailbox */
   time_t stats_last_checked; /**< mtime of mailbox the last time stats where checked. */
+#ifdef USE_INOTIFY
+  int wd[2];                 /**< inotify watches: "new" and "cur" for maildir,
+                              * otherwise only wd[0] is used */
+  bool dirty;                /**< mailbox changed since it was last checked */
+  bool counted;              /**< msg_count etc. are kept up to date from the
+                              * inotify events (maildir only) */
+#endif
 };
 
 WHERE struct Buffy *Incoming;
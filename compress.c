@@ -23,21 +23,32 @@
 
 #include "config.h"
 #include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
+#ifdef USE_COMPRESS_NATIVE
+#include <zlib.h>
+#endif
 #include "mutt.h"
 #include "compress.h"
+#include "address.h"
+#include "body.h"
 #include "context.h"
+#include "copy.h"
+#include "envelope.h"
 #include "format_flags.h"
 #include "globals.h"
+#include "header.h"
 #include "lib/lib.h"
 #include "mailbox.h"
 #include "mutt_curses.h"
 #include "mx.h"
 #include "options.h"
 #include "protos.h"
+#include "rfc822.h"
 
 struct Header;
 
@@ -61,6 +72,8 @@ struct CompressInfo
   struct MxOps *child_ops; /**< callbacks of de-compressed file */
   int locked;              /**< if realpath is locked */
   FILE *lockfp;            /**< fp used for locking */
+  bool native;             /**< native compressed mailbox, no hooks needed */
+  char *from;              /**< "From " line of the message being appended */
 };
 
 /**
@@ -203,6 +216,870 @@ static void store_size(const struct Context *ctx)
   ci->size = get_size(ctx->realpath);
 }
 
+#ifdef USE_COMPRESS_NATIVE
+/* A native compressed mailbox is a series of gzip members, one per message.
+ * The header of each member has an extra field, "Mu", holding the length of
+ * the member, the length of the message and its number of lines:
+ *
+ *   1f 8b 08 04 MTIME(4) 00 03 XLEN(2) 'M' 'u' LEN(2) clen(8) ulen(8) lines(4)
+ *
+ * so the messages can be found without decompressing them.  Each message is
+ * stored as in an mbox, with its "From " line and a trailing blank line:
+ * decompressing the whole file with gzip gives an mbox mailbox. */
+
+#define COMP_SI1 'M'
+#define COMP_SI2 'u'
+#define COMP_EXTRA_LEN 20
+#define COMP_HEADER_LEN (10 + 2 + 4 + COMP_EXTRA_LEN)
+#define COMP_CHUNK 16384
+
+/**
+ * struct CompFrame - Where a message is in a native compressed mailbox
+ *
+ * This is attached to each Header of the mailbox.
+ */
+struct CompFrame
+{
+  LOFF_T offset; /**< Start of the gzip member */
+  LOFF_T clen;   /**< Length of the gzip member, 0 if unknown */
+  LOFF_T ulen;   /**< Length of the message, uncompressed */
+  int lines;     /**< Number of lines of the message */
+};
+
+/**
+ * struct CompInflate - Output of comp_inflate()
+ */
+struct CompInflate
+{
+  FILE *out;       /**< Where to write the message, or NULL */
+  char *head;      /**< Start of the message, at least up to the end of its header */
+  size_t headlen;  /**< Length of @a head */
+  bool head_done;  /**< @a head holds the whole header */
+  LOFF_T ulen;     /**< Number of bytes decompressed */
+  int lines;       /**< Number of lines decompressed */
+  LOFF_T consumed; /**< Number of compressed bytes used, excluding the trailer */
+};
+
+static void comp_put_le(unsigned char *p, uint64_t v, int n)
+{
+  for (int i = 0; i < n; i++, v >>= 8)
+    p[i] = v & 0xff;
+}
+
+static uint64_t comp_get_le(const unsigned char *p, int n)
+{
+  uint64_t v = 0;
+
+  for (int i = n - 1; i >= 0; i--)
+    v = (v << 8) | p[i];
+  return v;
+}
+
+/**
+ * comp_native_probe - Is a file a native compressed mailbox?
+ * @param path File to test
+ * @retval true if the first gzip member has a "Mu" field
+ */
+static bool comp_native_probe(const char *path)
+{
+  unsigned char h[14];
+  FILE *fp = NULL;
+  bool rc;
+
+  if (!path || !(fp = fopen(path, "r")))
+    return false;
+
+  rc = (fread(h, 1, sizeof(h), fp) == sizeof(h)) && (h[0] == 0x1f) &&
+       (h[1] == 0x8b) && (h[2] == Z_DEFLATED) && (h[3] & 0x04) &&
+       (h[12] == COMP_SI1) && (h[13] == COMP_SI2);
+
+  safe_fclose(&fp);
+  return rc;
+}
+
+/**
+ * comp_read_frame - Read the header of a gzip member
+ * @param[in]  fp     Mailbox file
+ * @param[in]  offset Start of the member
+ * @param[out] f      Member, its lengths are 0 if it has no "Mu" field
+ * @retval num Length of the header; @a fp is left at the compressed data
+ * @retval -1  Not a gzip member
+ */
+static int comp_read_frame(FILE *fp, LOFF_T offset, struct CompFrame *f)
+{
+  unsigned char h[10];
+  int hlen = sizeof(h);
+  int c;
+
+  memset(f, 0, sizeof(*f));
+  f->offset = offset;
+
+  if ((fseeko(fp, offset, SEEK_SET) != 0) || (fread(h, 1, sizeof(h), fp) != sizeof(h)))
+    return -1;
+  if ((h[0] != 0x1f) || (h[1] != 0x8b) || (h[2] != Z_DEFLATED))
+    return -1;
+
+  if (h[3] & 0x04) /* FEXTRA */
+  {
+    unsigned char xl[2];
+    if (fread(xl, 1, 2, fp) != 2)
+      return -1;
+
+    size_t xlen = comp_get_le(xl, 2);
+    unsigned char *x = safe_malloc(xlen + 1);
+    if (fread(x, 1, xlen, fp) != xlen)
+    {
+      FREE(&x);
+      return -1;
+    }
+
+    for (size_t pos = 0; pos + 4 <= xlen;)
+    {
+      size_t len = comp_get_le(x + pos + 2, 2);
+      if ((x[pos] == COMP_SI1) && (x[pos + 1] == COMP_SI2) &&
+          (len >= COMP_EXTRA_LEN) && (pos + 4 + len <= xlen))
+      {
+        f->clen = comp_get_le(x + pos + 4, 8);
+        f->ulen = comp_get_le(x + pos + 12, 8);
+        f->lines = comp_get_le(x + pos + 20, 4);
+      }
+      pos += 4 + len;
+    }
+    FREE(&x);
+    hlen += 2 + xlen;
+  }
+
+  for (int flag = 0x08; flag <= 0x10; flag <<= 1) /* FNAME, FCOMMENT */
+  {
+    if (!(h[3] & flag))
+      continue;
+    while (((c = fgetc(fp)) != EOF) && (c != '\0'))
+      hlen++;
+    if (c == EOF)
+      return -1;
+    hlen++;
+  }
+
+  if (h[3] & 0x02) /* FHCRC */
+  {
+    if ((fgetc(fp) == EOF) || (fgetc(fp) == EOF))
+      return -1;
+    hlen += 2;
+  }
+
+  return hlen;
+}
+
+/**
+ * comp_inflate_output - Handle some decompressed data
+ * @param inf Output state
+ * @param buf Data
+ * @param len Length of @a buf
+ * @retval  0 Success
+ * @retval -1 Write error
+ */
+static int comp_inflate_output(struct CompInflate *inf, const char *buf, size_t len)
+{
+  if (inf->out && (fwrite(buf, 1, len, inf->out) != len))
+    return -1;
+
+  for (const char *p = buf; (p = memchr(p, '\n', buf + len - p)); p++)
+    inf->lines++;
+  inf->ulen += len;
+
+  if (!inf->head_done)
+  {
+    size_t start = (inf->headlen > 0) ? inf->headlen - 1 : 0;
+
+    safe_realloc(&inf->head, inf->headlen + len + 1);
+    memcpy(inf->head + inf->headlen, buf, len);
+    inf->headlen += len;
+    inf->head[inf->headlen] = '\0';
+
+    /* the header ends with a blank line */
+    if (strstr(inf->head + start, "\n\n"))
+      inf->head_done = true;
+  }
+
+  return 0;
+}
+
+/**
+ * comp_inflate - Decompress a gzip member
+ * @param fp    Mailbox file, at the compressed data
+ * @param inf   Output state, zeroed apart from @a out
+ * @param whole If false, stop after the message's header
+ * @retval  0 Success
+ * @retval -1 Corrupt data or write error
+ */
+static int comp_inflate(FILE *fp, struct CompInflate *inf, bool whole)
+{
+  unsigned char in[COMP_CHUNK];
+  char out[COMP_CHUNK];
+  z_stream z;
+  int rc;
+
+  memset(&z, 0, sizeof(z));
+  if (inflateInit2(&z, -MAX_WBITS) != Z_OK)
+    return -1;
+
+  do
+  {
+    if (z.avail_in == 0)
+    {
+      z.next_in = in;
+      z.avail_in = fread(in, 1, sizeof(in), fp);
+      if (z.avail_in == 0)
+      {
+        rc = Z_DATA_ERROR;
+        break;
+      }
+    }
+
+    z.next_out = (unsigned char *) out;
+    z.avail_out = sizeof(out);
+    rc = inflate(&z, Z_NO_FLUSH);
+    if ((rc != Z_OK) && (rc != Z_STREAM_END))
+      break;
+
+    if (comp_inflate_output(inf, out, sizeof(out) - z.avail_out) != 0)
+    {
+      rc = Z_ERRNO;
+      break;
+    }
+  } while ((rc != Z_STREAM_END) && (whole || !inf->head_done));
+
+  inf->consumed = z.total_in;
+  inflateEnd(&z);
+
+  if (rc == Z_STREAM_END)
+  {
+    inf->head_done = true;
+    return 0;
+  }
+  return ((rc == Z_OK) && !whole) ? 0 : -1;
+}
+
+/**
+ * comp_deflate - Compress some data into a growing buffer
+ * @param z     Compression stream
+ * @param src   Data
+ * @param len   Length of @a src
+ * @param flush Z_NO_FLUSH, or Z_FINISH for the end of the data
+ * @param buf   Buffer for the compressed data
+ * @param blen  Length of the data in @a buf
+ * @param bmax  Size of @a buf
+ * @retval  0 Success
+ * @retval -1 Error
+ */
+static int comp_deflate(z_stream *z, const char *src, size_t len, int flush,
+                        char **buf, size_t *blen, size_t *bmax)
+{
+  int rc = Z_OK;
+
+  z->next_in = (unsigned char *) src;
+  z->avail_in = len;
+
+  while ((z->avail_in > 0) || ((flush == Z_FINISH) && (rc != Z_STREAM_END)))
+  {
+    if (*bmax - *blen < COMP_CHUNK)
+    {
+      *bmax = *bmax ? *bmax * 2 : 4 * COMP_CHUNK;
+      safe_realloc(buf, *bmax);
+    }
+    z->next_out = (unsigned char *) *buf + *blen;
+    z->avail_out = *bmax - *blen;
+    rc = deflate(z, flush);
+    if ((rc != Z_OK) && (rc != Z_STREAM_END) && (rc != Z_BUF_ERROR))
+      return -1;
+    *blen = *bmax - z->avail_out;
+  }
+
+  return 0;
+}
+
+/**
+ * comp_write_frame - Compress a message into a gzip member
+ * @param[in]  out    Mailbox file, the member is written at its position
+ * @param[in]  prefix Text to put before the message, e.g. its "From " line
+ * @param[in]  in     Message, read from its position to its end
+ * @param[out] f      Lengths of the member
+ * @retval  0 Success
+ * @retval -1 Error
+ */
+static int comp_write_frame(FILE *out, const char *prefix, FILE *in, struct CompFrame *f)
+{
+  unsigned char h[COMP_HEADER_LEN];
+  unsigned char trailer[8];
+  char chunk[COMP_CHUNK];
+  char *data = NULL;
+  size_t dlen = 0, dmax = 0, n;
+  uLong crc = crc32(0L, Z_NULL, 0);
+  z_stream z;
+  int rc = -1;
+
+  memset(&z, 0, sizeof(z));
+  if (deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8,
+                   Z_DEFAULT_STRATEGY) != Z_OK)
+    return -1;
+
+  f->ulen = 0;
+  f->lines = 0;
+
+  while (prefix || ((n = fread(chunk, 1, sizeof(chunk), in)) > 0))
+  {
+    const char *src = prefix ? prefix : chunk;
+    if (prefix)
+      n = strlen(prefix);
+    prefix = NULL;
+
+    crc = crc32(crc, (const unsigned char *) src, n);
+    f->ulen += n;
+    for (const char *p = src; (p = memchr(p, '\n', src + n - p)); p++)
+      f->lines++;
+
+    if (comp_deflate(&z, src, n, Z_NO_FLUSH, &data, &dlen, &dmax) != 0)
+      goto done;
+  }
+  if (ferror(in) || (comp_deflate(&z, NULL, 0, Z_FINISH, &data, &dlen, &dmax) != 0))
+    goto done;
+
+  f->clen = COMP_HEADER_LEN + dlen + sizeof(trailer);
+
+  memset(h, 0, sizeof(h));
+  h[0] = 0x1f;
+  h[1] = 0x8b;
+  h[2] = Z_DEFLATED;
+  h[3] = 0x04; /* FEXTRA */
+  h[9] = 3;    /* Unix */
+  comp_put_le(h + 10, 4 + COMP_EXTRA_LEN, 2);
+  h[12] = COMP_SI1;
+  h[13] = COMP_SI2;
+  comp_put_le(h + 14, COMP_EXTRA_LEN, 2);
+  comp_put_le(h + 16, f->clen, 8);
+  comp_put_le(h + 24, f->ulen, 8);
+  comp_put_le(h + 32, f->lines, 4);
+
+  comp_put_le(trailer, crc, 4);
+  comp_put_le(trailer + 4, f->ulen, 4);
+
+  if ((fwrite(h, 1, sizeof(h), out) == sizeof(h)) &&
+      (fwrite(data, 1, dlen, out) == dlen) &&
+      (fwrite(trailer, 1, sizeof(trailer), out) == sizeof(trailer)))
+    rc = 0;
+
+done:
+  deflateEnd(&z);
+  FREE(&data);
+  return rc;
+}
+
+/**
+ * comp_native_parse - Create a Header from the start of a message
+ * @param inf Start of the message
+ * @param f   Where the message is
+ * @retval ptr  Header
+ * @retval NULL Error
+ */
+static struct Header *comp_native_parse(struct CompInflate *inf, struct CompFrame *f)
+{
+  char buf[HUGE_STRING], return_path[STRING];
+  struct Header *h = NULL;
+  FILE *fp = NULL;
+  time_t t;
+#ifndef USE_FMEMOPEN
+  char tempfile[_POSIX_PATH_MAX];
+#endif
+
+  if (inf->headlen == 0)
+    return NULL;
+
+#ifdef USE_FMEMOPEN
+  fp = fmemopen(inf->head, inf->headlen, "r");
+  if (!fp)
+    return NULL;
+#else
+  mutt_mktemp(tempfile, sizeof(tempfile));
+  fp = safe_fopen(tempfile, "w+");
+  if (!fp)
+  {
+    mutt_perror(tempfile);
+    return NULL;
+  }
+  unlink(tempfile);
+  if ((fwrite(inf->head, 1, inf->headlen, fp) != inf->headlen) || (fflush(fp) == EOF))
+  {
+    safe_fclose(&fp);
+    return NULL;
+  }
+  rewind(fp);
+#endif
+
+  h = mutt_new_header();
+  return_path[0] = '\0';
+  if (fgets(buf, sizeof(buf), fp) && is_from(buf, return_path, sizeof(return_path), &t))
+    h->received = t - mutt_local_tz(t);
+  else
+    rewind(fp);
+
+  h->offset = 0;
+  h->env = mutt_read_rfc822_header(fp, h, 0, 0);
+  safe_fclose(&fp);
+
+  /* the message is followed by a blank line, as in an mbox */
+  h->content->length = f->ulen - h->content->offset - 1;
+  if (h->content->length < 0)
+    h->content->length = 0;
+
+  if (!h->lines && f->lines)
+  {
+    int hlines = 0;
+    for (LOFF_T i = 0; (i < h->content->offset) && (i < (LOFF_T) inf->headlen); i++)
+      if (inf->head[i] == '\n')
+        hlines++;
+    h->lines = f->lines - hlines - 1;
+    if (h->lines < 0)
+      h->lines = 0;
+  }
+
+  if (!h->env->return_path && return_path[0])
+    h->env->return_path = rfc822_parse_adrlist(h->env->return_path, return_path);
+
+  if (!h->env->from)
+    h->env->from = rfc822_cpy_adr(h->env->return_path, 0);
+
+  h->data = safe_malloc(sizeof(struct CompFrame));
+  memcpy(h->data, f, sizeof(struct CompFrame));
+  return h;
+}
+
+/**
+ * comp_native_read - Read the headers of a native compressed mailbox
+ * @param ctx    Mailbox
+ * @param offset Where to start, e.g. the old end of the file
+ * @retval  0 Success
+ * @retval -1 Error
+ * @retval -2 Aborted
+ *
+ * Only the headers of the messages are decompressed.
+ */
+static int comp_native_read(struct Context *ctx, LOFF_T offset)
+{
+  struct CompressInfo *ci = ctx->compress_info;
+  struct Progress progress;
+  char msgbuf[STRING];
+  struct stat st;
+  FILE *fp = NULL;
+  int count = 0, rc = 0;
+
+  if (!(fp = fopen(ctx->realpath, "r")) || (fstat(fileno(fp), &st) != 0))
+  {
+    mutt_perror(ctx->realpath);
+    safe_fclose(&fp);
+    return -1;
+  }
+
+  if (!ctx->quiet)
+  {
+    snprintf(msgbuf, sizeof(msgbuf), _("Reading %s..."), ctx->realpath);
+    mutt_progress_init(&progress, msgbuf, MUTT_PROGRESS_MSG, ReadInc, 0);
+  }
+
+  while ((offset < st.st_size) && (SigInt != 1))
+  {
+    struct CompInflate inf;
+    struct CompFrame f;
+    struct Header *h = NULL;
+    int hlen = comp_read_frame(fp, offset, &f);
+
+    memset(&inf, 0, sizeof(inf));
+    /* without the "Mu" field, the whole member must be read to find its end */
+    if ((hlen < 0) || (comp_inflate(fp, &inf, (f.clen == 0)) != 0))
+    {
+      FREE(&inf.head);
+      rc = -1;
+      break;
+    }
+    if (f.clen == 0)
+    {
+      f.clen = hlen + inf.consumed + 8;
+      f.ulen = inf.ulen;
+      f.lines = inf.lines;
+    }
+
+    h = comp_native_parse(&inf, &f);
+    FREE(&inf.head);
+    if (!h)
+    {
+      rc = -1;
+      break;
+    }
+
+    if (ctx->msgcount == ctx->hdrmax)
+      mx_alloc_memory(ctx);
+    h->index = ctx->msgcount;
+    ctx->hdrs[ctx->msgcount++] = h;
+    count++;
+    offset += f.clen;
+
+    if (!ctx->quiet)
+      mutt_progress_update(&progress, count, (int) (offset / (st.st_size / 100 + 1)));
+  }
+  safe_fclose(&fp);
+
+  if (rc < 0)
+    mutt_error(_("Mailbox is corrupt!"));
+
+  ci->size = offset;
+  ctx->size = st.st_size;
+  ctx->mtime = st.st_mtime;
+
+  if (count > 0)
+    mx_update_context(ctx, count);
+
+  if (SigInt == 1)
+  {
+    SigInt = 0;
+    return -2;
+  }
+  return rc;
+}
+
+/**
+ * comp_native_open_msg - Decompress a message of a native compressed mailbox
+ * @param ctx   Mailbox
+ * @param msg   Message to fill in
+ * @param msgno Index of the message
+ * @retval  0 Success
+ * @retval -1 Error
+ */
+static int comp_native_open_msg(struct Context *ctx, struct Message *msg, int msgno)
+{
+  struct CompFrame *cf = ctx->hdrs[msgno]->data;
+  char path[_POSIX_PATH_MAX];
+  struct CompInflate inf;
+  struct CompFrame f;
+  FILE *fp = NULL;
+  int rc = -1;
+
+  if (!cf)
+    return -1;
+
+  if (!(fp = fopen(ctx->realpath, "r")))
+  {
+    mutt_perror(ctx->realpath);
+    return -1;
+  }
+
+  mutt_mktemp(path, sizeof(path));
+  if (!(msg->fp = safe_fopen(path, "w+")))
+  {
+    mutt_perror(path);
+    safe_fclose(&fp);
+    return -1;
+  }
+  unlink(path);
+
+  memset(&inf, 0, sizeof(inf));
+  inf.out = msg->fp;
+  if ((comp_read_frame(fp, cf->offset, &f) >= 0) && (comp_inflate(fp, &inf, true) == 0))
+    rc = 0;
+  FREE(&inf.head);
+  safe_fclose(&fp);
+
+  if (rc != 0)
+  {
+    mutt_error(_("Mailbox is corrupt!"));
+    safe_fclose(&msg->fp);
+    return -1;
+  }
+
+  rewind(msg->fp);
+  return 0;
+}
+
+/**
+ * comp_native_open_new_msg - Start writing a message to a native compressed mailbox
+ * @param msg Message to fill in
+ * @param ctx Mailbox
+ * @param hdr Message's header (may be NULL)
+ * @retval  0 Success
+ * @retval -1 Error
+ *
+ * The message is written to a temporary file, then compressed by
+ * comp_native_commit_msg().
+ */
+static int comp_native_open_new_msg(struct Message *msg, struct Context *ctx,
+                                    struct Header *hdr)
+{
+  struct CompressInfo *ci = ctx->compress_info;
+  char path[_POSIX_PATH_MAX];
+  char from[LONG_STRING];
+  struct Address *p = NULL;
+
+  mutt_mktemp(path, sizeof(path));
+  if (!(msg->fp = safe_fopen(path, "w+")))
+  {
+    mutt_perror(path);
+    return -1;
+  }
+  msg->path = safe_strdup(path);
+
+  /* the "From " line, in case the message doesn't come with one */
+  if (hdr)
+  {
+    if (hdr->env->return_path)
+      p = hdr->env->return_path;
+    else if (hdr->env->sender)
+      p = hdr->env->sender;
+    else
+      p = hdr->env->from;
+  }
+  snprintf(from, sizeof(from), "From %s %s", p ? p->mailbox : NONULL(Username),
+           ctime(&msg->received));
+  mutt_str_replace(&ci->from, from);
+
+  return 0;
+}
+
+/**
+ * comp_native_commit_msg - Append a message to a native compressed mailbox
+ * @param ctx Mailbox
+ * @param msg Message written by comp_native_open_new_msg()
+ * @retval  0 Success
+ * @retval -1 Error
+ *
+ * The message is added as a new gzip member; the rest of the file isn't
+ * touched.
+ */
+static int comp_native_commit_msg(struct Context *ctx, struct Message *msg)
+{
+  struct CompressInfo *ci = ctx->compress_info;
+  struct CompFrame f;
+  char buf[5];
+
+  if (!ci->lockfp)
+    return -1;
+
+  /* the blank line separating the messages */
+  if ((fseeko(msg->fp, 0, SEEK_END) != 0) || (fputc('\n', msg->fp) == EOF) ||
+      (fflush(msg->fp) == EOF))
+  {
+    mutt_perror(msg->path);
+    return -1;
+  }
+  rewind(msg->fp);
+
+  bool has_from = (fread(buf, 1, sizeof(buf), msg->fp) == sizeof(buf)) &&
+                  (strncmp(buf, "From ", 5) == 0);
+  rewind(msg->fp);
+
+  if ((comp_write_frame(ci->lockfp, has_from ? NULL : ci->from, msg->fp, &f) != 0) ||
+      (fflush(ci->lockfp) == EOF) || (fsync(fileno(ci->lockfp)) == -1))
+  {
+    mutt_perror(ctx->realpath);
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * comp_native_check - Look for messages appended to a native compressed mailbox
+ * @param ctx Mailbox
+ * @retval 0              No change
+ * @retval #MUTT_NEW_MAIL New messages were appended
+ * @retval -1             The file was changed in another way
+ */
+static int comp_native_check(struct Context *ctx)
+{
+  struct CompressInfo *ci = ctx->compress_info;
+  int count = ctx->msgcount;
+  LOFF_T size = get_size(ctx->realpath);
+
+  if (size == ci->size)
+    return 0;
+
+  if (size < ci->size)
+  {
+    mutt_error(_("Mailbox was externally modified."));
+    return -1;
+  }
+
+  /* comp_native_sync() may already hold an exclusive lock */
+  bool locked = ci->locked;
+  if (!lock_realpath(ctx, 0))
+  {
+    mutt_error(_("Unable to lock mailbox!"));
+    return -1;
+  }
+  int rc = comp_native_read(ctx, ci->size);
+  if (!locked)
+    unlock_realpath(ctx);
+
+  if ((rc == -1) && (ctx->msgcount == count))
+    return -1;
+  return (ctx->msgcount > count) ? MUTT_NEW_MAIL : 0;
+}
+
+/**
+ * comp_native_sync - Save changes to a native compressed mailbox
+ * @param ctx Mailbox
+ * @retval  0 Success
+ * @retval -1 Error
+ *
+ * The mailbox is written to a new file.  The gzip members of unchanged
+ * messages are copied as they are; only changed messages are recompressed.
+ */
+static int comp_native_sync(struct Context *ctx)
+{
+  char tmp[_POSIX_PATH_MAX];
+  char path[_POSIX_PATH_MAX];
+  char chunk[COMP_CHUNK];
+  struct CompFrame *frames = NULL;
+  FILE *in = NULL, *out = NULL, *fp = NULL;
+  struct Progress progress;
+  char msgbuf[STRING];
+  int i, kept = 0, rc = -1;
+
+  if (!(in = fopen(ctx->realpath, "r")))
+  {
+    mutt_perror(ctx->realpath);
+    return -1;
+  }
+
+  snprintf(tmp, sizeof(tmp), "%s.mutt-%s-%d", ctx->realpath, NONULL(Hostname), (int) getpid());
+  if (!(out = safe_fopen(tmp, "w")))
+  {
+    mutt_perror(tmp);
+    safe_fclose(&in);
+    return -1;
+  }
+
+  if (!ctx->quiet)
+  {
+    snprintf(msgbuf, sizeof(msgbuf), _("Writing %s..."), ctx->realpath);
+    mutt_progress_init(&progress, msgbuf, MUTT_PROGRESS_MSG, WriteInc, ctx->msgcount);
+  }
+
+  /* The new positions are only applied once the new file is in place */
+  frames = safe_calloc(ctx->msgcount ? ctx->msgcount : 1, sizeof(struct CompFrame));
+
+  for (i = 0; i < ctx->msgcount; i++)
+  {
+    struct Header *h = ctx->hdrs[i];
+    struct CompFrame *cf = h->data;
+
+    if (!ctx->quiet)
+      mutt_progress_update(&progress, i, -1);
+
+    if (h->deleted || !cf)
+      continue;
+
+    frames[i].offset = ftello(out);
+
+    if (h->changed || h->attach_del)
+    {
+      /* rewrite the message with its new flags, then recompress it */
+      mutt_mktemp(path, sizeof(path));
+      if (!(fp = safe_fopen(path, "w+")))
+      {
+        mutt_perror(path);
+        goto done;
+      }
+      unlink(path);
+
+      if ((mutt_copy_message(fp, ctx, h, MUTT_CM_UPDATE, CH_FROM | CH_UPDATE | CH_UPDATE_LEN) != 0) ||
+          (fputc('\n', fp) == EOF) || (fflush(fp) == EOF))
+        goto done;
+      rewind(fp);
+      if (comp_write_frame(out, NULL, fp, &frames[i]) != 0)
+        goto done;
+      safe_fclose(&fp);
+    }
+    else
+    {
+      /* copy the gzip member as it is */
+      LOFF_T left = cf->clen;
+      if (fseeko(in, cf->offset, SEEK_SET) != 0)
+        goto done;
+      while (left > 0)
+      {
+        size_t n = fread(chunk, 1, MIN((LOFF_T) sizeof(chunk), left), in);
+        if ((n == 0) || (fwrite(chunk, 1, n, out) != n))
+          goto done;
+        left -= n;
+      }
+      frames[i].clen = cf->clen;
+      frames[i].ulen = cf->ulen;
+      frames[i].lines = cf->lines;
+    }
+    kept++;
+  }
+
+  if ((fflush(out) == EOF) || (fsync(fileno(out)) == -1))
+    goto done;
+  safe_fclose(&out);
+
+  if ((kept == 0) && !option(OPT_SAVE_EMPTY))
+  {
+    unlink(tmp);
+    unlink(ctx->realpath);
+  }
+  else if (rename(tmp, ctx->realpath) != 0)
+  {
+    mutt_perror(ctx->realpath);
+    goto done;
+  }
+
+  /* Update the positions.  The offsets in a Header are relative to its own
+   * member, so only the rewritten messages need their header end found. */
+  for (i = 0; i < ctx->msgcount; i++)
+  {
+    struct Header *h = ctx->hdrs[i];
+    struct CompFrame *cf = h->data;
+
+    if (h->deleted || !cf)
+      continue;
+
+    *cf = frames[i];
+    if (!h->changed && !h->attach_del)
+      continue;
+
+    /* find the end of the new header */
+    struct Message *msg = mx_open_message(ctx, i);
+    if (msg)
+    {
+      char *line = NULL;
+      size_t sz = 0;
+      int n = 0;
+
+      while ((line = mutt_read_line(line, &sz, msg->fp, &n, 0)) && *line)
+        ;
+      h->content->offset = ftello(msg->fp);
+      h->content->length = cf->ulen - h->content->offset - 1;
+      if (h->content->length < 0)
+        h->content->length = 0;
+      FREE(&line);
+      mx_close_message(ctx, &msg);
+    }
+  }
+
+  rc = 0;
+
+done:
+  if (rc != 0)
+  {
+    mutt_error(_("Write failed!  Saved partial mailbox to %s"), tmp);
+  }
+  safe_fclose(&fp);
+  safe_fclose(&out);
+  safe_fclose(&in);
+  FREE(&frames);
+  return rc;
+}
+#endif /* USE_COMPRESS_NATIVE */
+
 /**
  * find_hook - Find a hook to match a path
  * @param type Type of hook, e.g. #MUTT_CLOSEHOOK
@@ -247,9 +1124,15 @@ static struct CompressInfo *set_compress_info(struct Context *ctx)
   if (ctx->compress_info)
     return ctx->compress_info;
 
-  /* Open is compulsory */
+  /* Open is compulsory, unless we can read the file ourselves */
   const char *o = find_hook(MUTT_OPENHOOK, ctx->path);
-  if (!o)
+  bool native = false;
+#ifdef USE_COMPRESS_NATIVE
+  if (comp_native_probe(ctx->path) ||
+      (o && option(OPT_COMPRESS_NATIVE) && (get_size(ctx->path) == 0)))
+    native = true;
+#endif
+  if (!o && !native)
     return NULL;
 
   const char *c = find_hook(MUTT_CLOSEHOOK, ctx->path);
@@ -261,6 +1144,7 @@ static struct CompressInfo *set_compress_info(struct Context *ctx)
   ci->open = safe_strdup(o);
   ci->close = safe_strdup(c);
   ci->append = safe_strdup(a);
+  ci->native = native;
 
   return ci;
 }
@@ -280,6 +1164,7 @@ static void free_compress_info(struct Context *ctx)
   FREE(&ci->open);
   FREE(&ci->close);
   FREE(&ci->append);
+  FREE(&ci->from);
 
   unlock_realpath(ctx);
 
@@ -452,6 +1337,27 @@ static int comp_open_mailbox(struct Context *ctx)
   if (!ci)
     return -1;
 
+#ifdef USE_COMPRESS_NATIVE
+  if (ci->native)
+  {
+    if (access(ctx->realpath, W_OK) != 0)
+      ctx->readonly = true;
+
+    if (!lock_realpath(ctx, 0))
+    {
+      mutt_error(_("Unable to lock mailbox!"));
+      free_compress_info(ctx);
+      return -1;
+    }
+
+    int rc = comp_native_read(ctx, 0);
+    unlock_realpath(ctx);
+    if (rc == -1)
+      free_compress_info(ctx);
+    return rc;
+  }
+#endif
+
   /* If there's no close-hook, or the file isn't writable */
   if (!ci->close || (access(ctx->path, W_OK) != 0))
     ctx->readonly = true;
@@ -515,6 +1421,19 @@ static int comp_open_append_mailbox(struct Context *ctx, int flags)
   if (!ci)
     return -1;
 
+#ifdef USE_COMPRESS_NATIVE
+  /* Messages are compressed one by one, straight into the file */
+  if (ci->native)
+  {
+    if (!lock_realpath(ctx, 1))
+    {
+      mutt_error(_("Unable to lock mailbox!"));
+      goto oa_fail1;
+    }
+    return 0;
+  }
+#endif
+
   /* To append we need an append-hook or a close-hook */
   if (!ci->append && !ci->close)
   {
@@ -594,6 +1513,12 @@ static int comp_close_mailbox(struct Context *ctx)
   if (!ci)
     return -1;
 
+  if (ci->native)
+  {
+    free_compress_info(ctx);
+    return 0;
+  }
+
   struct MxOps *ops = ci->child_ops;
   if (!ops)
   {
@@ -674,6 +1599,11 @@ static int comp_check_mailbox(struct Context *ctx, int *index_hint)
   if (!ci)
     return -1;
 
+#ifdef USE_COMPRESS_NATIVE
+  if (ci->native)
+    return comp_native_check(ctx);
+#endif
+
   struct MxOps *ops = ci->child_ops;
   if (!ops)
     return -1;
@@ -709,6 +1639,11 @@ static int comp_open_message(struct Context *ctx, struct Message *msg, int msgno
   if (!ci)
     return -1;
 
+#ifdef USE_COMPRESS_NATIVE
+  if (ci->native)
+    return comp_native_open_msg(ctx, msg, msgno);
+#endif
+
   struct MxOps *ops = ci->child_ops;
   if (!ops)
     return -1;
@@ -729,6 +1664,9 @@ static int comp_close_message(struct Context *ctx, struct Message *msg)
   if (!ci)
     return -1;
 
+  if (ci->native)
+    return safe_fclose(&msg->fp);
+
   struct MxOps *ops = ci->child_ops;
   if (!ops)
     return -1;
@@ -749,6 +1687,11 @@ static int comp_commit_message(struct Context *ctx, struct Message *msg)
   if (!ci)
     return -1;
 
+#ifdef USE_COMPRESS_NATIVE
+  if (ci->native)
+    return comp_native_commit_msg(ctx, msg);
+#endif
+
   struct MxOps *ops = ci->child_ops;
   if (!ops)
     return -1;
@@ -769,6 +1712,11 @@ static int comp_open_new_message(struct Message *msg, struct Context *ctx, struc
   if (!ci)
     return -1;
 
+#ifdef USE_COMPRESS_NATIVE
+  if (ci->native)
+    return comp_native_open_new_msg(msg, ctx, hdr);
+#endif
+
   struct MxOps *ops = ci->child_ops;
   if (!ops)
     return -1;
@@ -800,7 +1748,7 @@ bool mutt_comp_can_append(struct Context *ctx)
 
   /* We have an open-hook, so to append we need an append-hook,
    * or a close-hook. */
-  if (ci->append || ci->close)
+  if (ci->native || ci->append || ci->close)
     return true;
 
   mutt_error(_("Cannot append without an append-hook or close-hook : %s"), ctx->path);
@@ -813,7 +1761,8 @@ bool mutt_comp_can_append(struct Context *ctx)
  * @retval true  Yes, we can read the file
  * @retval false No, we cannot read the file
  *
- * Search for an 'open-hook' with a regex that matches the path.
+ * Search for an 'open-hook' with a regex that matches the path, or check
+ * whether the file is a native compressed mailbox.
  *
  * A match means it's our responsibility to open the file.
  */
@@ -824,8 +1773,11 @@ bool mutt_comp_can_read(const char *path)
 
   if (find_hook(MUTT_OPENHOOK, path))
     return true;
-  else
-    return false;
+#ifdef USE_COMPRESS_NATIVE
+  if (comp_native_probe(path))
+    return true;
+#endif
+  return false;
 }
 
 /**
@@ -847,6 +1799,25 @@ static int comp_sync_mailbox(struct Context *ctx, int *index_hint)
   if (!ci)
     return -1;
 
+#ifdef USE_COMPRESS_NATIVE
+  if (ci->native)
+  {
+    if (!lock_realpath(ctx, 1))
+    {
+      mutt_error(_("Unable to lock mailbox!"));
+      return -1;
+    }
+
+    int rc = comp_native_check(ctx);
+    if (rc == 0)
+      rc = comp_native_sync(ctx);
+
+    unlock_realpath(ctx);
+    store_size(ctx);
+    return rc;
+  }
+#endif
+
   if (!ci->close)
   {
     mutt_error(_("Can't sync a compressed file without a close-hook"));
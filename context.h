@@ -62,6 +62,7 @@ struct Context
   off_t vsize;
   char *pattern;                 /**< limit pattern string */
   struct Pattern *limit_pattern; /**< compiled limit pattern */
+  struct PatternResults *results; /**< cached results of the limits and searches */
   struct Header **hdrs;
   struct Header *last_tag;  /**< last tagged msg. used to link threads */
   struct MuttThread *tree;  /**< top of thread tree */
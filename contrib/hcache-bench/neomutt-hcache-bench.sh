@@ -25,16 +25,19 @@
 
 usage()
 {
-    echo "Usage: $(basename "$0") -e <mutt> -m <mdir> -t <times> -b <backends>"
+    echo "Usage: $(basename "$0") -e <mutt> -m <mdir> -t <times> -b <backends> [-c <methods>]"
     echo ""
     echo "   -e Path to the mutt executable"
     echo "   -m Path to a maildir directory"
     echo "   -t Number of times to repeat the test"
     echo "   -b List of backends to test"
+    echo "   -c List of compression methods to test (\"none\" for no compression)"
     echo ""
 }
 
-while getopts e:m:t:b: OPT; do
+COMPRESS=none
+
+while getopts e:m:t:b:c: OPT; do
     case "$OPT" in
         e)
             MUTT="$OPTARG"
@@ -48,6 +51,9 @@ while getopts e:m:t:b: OPT; do
         b)
             BACKENDS="$OPTARG"
             ;;
+        c)
+            COMPRESS="$OPTARG"
+            ;;
         *)
             usage
             exit 1
@@ -67,6 +73,8 @@ echo "Running in $TMPDIR"
 exe()
 {
     export my_backend=$1
+    export my_compress=$2
+    [ "$my_compress" = "none" ] && my_compress=""
     export my_maildir=$MAILDIR
     export my_tmpdir=$TMPDIR
     t=$(time -p $MUTT -F "$CWD"/muttrc 2>&1 > /dev/null)
@@ -88,15 +96,17 @@ width=${#TIMES}
 # generate
 for i in $(seq "$TIMES"); do
     for b in $BACKENDS; do
-        rm -f "$TMPDIR"/hcache*
-        # do it twice - the first will populate the cache, the second will reload it
-        printf "%${width}d - populating - $b\n" "$i"
-        t1=$(exe "$b")
-        printf "%${width}d - reloading  - $b\n" "$i"
-        t2=$(exe "$b")
-        s=$(du -k "$TMPDIR/hcache-$b" | awk '{print $1}')
-        echo "$b $s $t1" >> "$TMPDIR"/result-populate.txt
-        echo "$b $s $t2" >> "$TMPDIR"/result-reload.txt
+        for c in $COMPRESS; do
+            rm -f "$TMPDIR"/hcache*
+            # do it twice - the first will populate the cache, the second will reload it
+            printf "%${width}d - populating - $b/$c\n" "$i"
+            t1=$(exe "$b" "$c")
+            printf "%${width}d - reloading  - $b/$c\n" "$i"
+            t2=$(exe "$b" "$c")
+            s=$(du -k "$TMPDIR/hcache-$b" | awk '{print $1}')
+            echo "$b/$c $s $t1" >> "$TMPDIR"/result-populate.txt
+            echo "$b/$c $s $t2" >> "$TMPDIR"/result-reload.txt
+        done
     done
 done
 
@@ -104,10 +114,13 @@ for f in populate reload; do
     echo ""
     echo "*** $f"
     for b in $BACKENDS; do
-        real=$(avg "$(extract "$f" "$b" 4)")
-        user=$(avg "$(extract "$f" "$b" 6)")
-        sys=$(avg "$(extract "$f" "$b" 8)")
-        printf "%-15s" "$b"
-        echo "$real real $user user $sys sys"
+        for c in $COMPRESS; do
+            size=$(avg "$(extract "$f" "^$b/$c " 2)")
+            real=$(avg "$(extract "$f" "^$b/$c " 4)")
+            user=$(avg "$(extract "$f" "^$b/$c " 6)")
+            sys=$(avg "$(extract "$f" "^$b/$c " 8)")
+            printf "%-20s" "$b/$c"
+            echo "$real real $user user $sys sys $size KiB"
+        done
     done
 done
@@ -628,6 +628,8 @@ int _mutt_copy_message(FILE *fpout, FILE *fpin, struct Header *hdr,
       if (flags & MUTT_CM_UPDATE)
       {
         hdr->attach_del = false;
+        /* the cached results of ~b and ~B were about the old body */
+        hdr->results_known = 0;
         hdr->lines = new_lines;
         body->offset = new_offset;
 
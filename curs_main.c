@@ -410,14 +410,9 @@ void update_index(struct Menu *menu, struct Context *ctx, int check, int oldcoun
     {
       for (j = 0; j < ctx->msgcount - oldcount; j++)
       {
-        int k;
-
-        for (k = 0; k < ctx->msgcount; k++)
-        {
-          struct Header *h = ctx->hdrs[k];
-          if (h == save_new[j] && (!ctx->pattern || h->limited))
-            mutt_uncollapse_thread(ctx, h);
-        }
+        struct Header *h = save_new[j];
+        if (!ctx->pattern || h->limited)
+          mutt_uncollapse_thread(ctx, h);
       }
       FREE(&save_new);
       mutt_set_virtual(ctx);
@@ -613,7 +608,7 @@ void index_make_entry(char *s, size_t l, struct Menu *menu, int num)
   int edgemsgno, reverse = Sort & SORT_REVERSE;
   struct MuttThread *tmp = NULL;
 
-  if ((Sort & SORT_MASK) == SORT_THREADS && h->tree)
+  if ((Sort & SORT_MASK) == SORT_THREADS && mutt_thread_tree(h))
   {
     flag |= MUTT_FORMAT_TREE; /* display the thread tree */
     if (h->display_subject)
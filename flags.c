@@ -32,6 +32,7 @@
 #include "mutt_menu.h"
 #include "mx.h"
 #include "options.h"
+#include "pattern.h"
 #include "protos.h"
 #include "sort.h"
 #include "thread.h"
@@ -314,6 +315,7 @@ void _mutt_set_flag(struct Context *ctx, struct Header *h, int flag, int bf, int
 
   if (update)
   {
+    mutt_pattern_results_invalidate(ctx, h);
     mutt_set_header_color(ctx, h);
 #ifdef USE_SIDEBAR
     mutt_set_current_menu_redraw(REDRAW_SIDEBAR);
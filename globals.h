@@ -94,6 +94,7 @@ WHERE char *MessageCachedir;
 #ifdef USE_HCACHE
 WHERE char *HeaderCache;
 WHERE char *HeaderCacheBackend;
+WHERE char *HeaderCacheCompressMethod;
 #if defined(HAVE_GDBM) || defined(HAVE_BDB)
 WHERE char *HeaderCachePageSize;
 #endif /* HAVE_GDBM || HAVE_BDB */
@@ -247,6 +248,7 @@ WHERE char *DebugFile;
 WHERE short ConnectTimeout;
 WHERE short HistSize;
 WHERE short MenuContext;
+WHERE short MessageCacheSize;
 WHERE short PagerContext;
 WHERE short PagerIndexLines;
 WHERE short ReadInc;
@@ -257,6 +259,7 @@ WHERE short SleepTime;
 WHERE short SkipQuotedOffset;
 WHERE short TimeInc;
 WHERE short Timeout;
+WHERE short WorkerThreads;
 WHERE short Wrap;
 WHERE short WrapHeaders;
 WHERE short WriteInc;
@@ -270,6 +273,10 @@ WHERE short SidebarWidth;
 WHERE struct ListHead SidebarWhitelist INITVAL(STAILQ_HEAD_INITIALIZER(SidebarWhitelist));
 #endif
 
+#ifdef USE_HCACHE
+WHERE short HeaderCacheCompressLevel;
+#endif
+
 #ifdef USE_IMAP
 WHERE short ImapKeepalive;
 WHERE short ImapPipelineDepth;
@@ -1368,6 +1368,10 @@ static int multipart_handler(struct Body *a, struct State *s)
 
     if ((s->flags & MUTT_REPLYING) && (option(OPT_INCLUDE_ONLY_FIRST)) && (s->flags & MUTT_FIRSTDONE))
       break;
+
+    /* The output doesn't want any more, e.g. a search has found its match */
+    if (ferror(s->fpout))
+      break;
   }
 
   if (a->encoding == ENCBASE64 || a->encoding == ENCQUOTEDPRINTABLE || a->encoding == ENCUUENCODED)
@@ -1661,7 +1665,7 @@ static int text_plain_handler(struct Body *b, struct State *s)
   char *buf = NULL;
   size_t l = 0, sz = 0;
 
-  while ((buf = mutt_read_line(buf, &sz, s->fpin, NULL, 0)))
+  while (!ferror(s->fpout) && (buf = mutt_read_line(buf, &sz, s->fpin, NULL, 0)))
   {
     if ((mutt_strcmp(buf, "-- ") != 0) && option(OPT_TEXT_FLOWED))
     {
@@ -47,10 +47,11 @@ typedef void *(*hcache_open_t)(const char *path);
  * @param ctx    The backend-specific context retrieved via hcache_open
  * @param key    A message identification string
  * @param keylen The length of the string pointed to by key
+ * @param dlen   Set to the length of the data found
  * @retval Pointer to the message's headers on success
  * @retval NULL otherwise
  */
-typedef void *(*hcache_fetch_t)(void *ctx, const char *key, size_t keylen);
+typedef void *(*hcache_fetch_t)(void *ctx, const char *key, size_t keylen, size_t *dlen);
 
 /**
  * hcache_free_t - backend-specific routine to free fetched data
@@ -82,6 +83,65 @@ typedef int (*hcache_store_t)(void *ctx, const char *key, size_t keylen,
  */
 typedef int (*hcache_delete_t)(void *ctx, const char *key, size_t keylen);
 
+/**
+ * hcache_walk_cb_t - callback for hcache_walk_t
+ * @param key    Key of a record, not NUL-terminated
+ * @param keylen Length of the key
+ * @param data   Private data passed to hcache_walk_t
+ * @retval 0 to continue
+ * @retval non-zero to stop the walk
+ */
+typedef int (*hcache_walk_cb_t)(const char *key, size_t keylen, void *data);
+
+/**
+ * hcache_walk_t - backend-specific routine to list all the keys
+ * @param ctx  The backend-specific context retrieved via hcache_open
+ * @param cb   Function to call for each key
+ * @param data Private data for the callback
+ * @retval 0 on success
+ * @retval -1 otherwise
+ *
+ * The callback must not modify the database.
+ */
+typedef int (*hcache_walk_t)(void *ctx, hcache_walk_cb_t cb, void *data);
+
+/**
+ * hcache_compact_t - backend-specific routine to reclaim unused space
+ * @param ctx The backend-specific context retrieved via hcache_open
+ * @retval 0 on success (including backends which have nothing to do)
+ * @retval -1 otherwise
+ */
+typedef int (*hcache_compact_t)(void *ctx);
+
+/**
+ * hcache_begin_t - backend-specific routine to start a transaction
+ * @param ctx The backend-specific context retrieved via hcache_open
+ * @retval 0 on success (including backends without transactions)
+ * @retval -1 otherwise
+ *
+ * Stores and deletes made until hcache_commit_t are written together.
+ * Backends without transactions may treat this as a no-op.
+ */
+typedef int (*hcache_begin_t)(void *ctx);
+
+/**
+ * hcache_commit_t - backend-specific routine to finish a transaction
+ * @param ctx The backend-specific context retrieved via hcache_open
+ * @retval 0 on success
+ * @retval -1 otherwise
+ */
+typedef int (*hcache_commit_t)(void *ctx);
+
+/**
+ * hcache_sync_t - backend-specific routine to flush pending changes
+ * @param ctx The backend-specific context retrieved via hcache_open
+ *
+ * After this call, the changes are visible to other processes and no
+ * transaction is left open, but the context remains usable.  This is used
+ * when a database is kept open across folders, see $header_cache_shared.
+ */
+typedef void (*hcache_sync_t)(void *ctx);
+
 /**
  * hcache_close_t - backend-specific routine to close a context
  * @param ctx The backend-specific context retrieved via hcache_open
@@ -110,6 +170,11 @@ struct HcacheOps
   hcache_free_t    free;
   hcache_store_t   store;
   hcache_delete_t  delete;
+  hcache_walk_t    walk;
+  hcache_compact_t compact;
+  hcache_begin_t   begin;
+  hcache_commit_t  commit;
+  hcache_sync_t    sync;
   hcache_close_t   close;
   hcache_backend_t backend;
 };
@@ -130,6 +195,11 @@ struct HcacheOps
     .free = hcache_##_name##_free,                                             \
     .store = hcache_##_name##_store,                                           \
     .delete = hcache_##_name##_delete,                                         \
+    .walk = hcache_##_name##_walk,                                             \
+    .compact = hcache_##_name##_compact,                                       \
+    .begin = hcache_##_name##_begin,                                           \
+    .commit = hcache_##_name##_commit,                                         \
+    .sync = hcache_##_name##_sync,                                             \
     .close = hcache_##_name##_close,                                           \
     .backend = hcache_##_name##_backend,                                       \
   };
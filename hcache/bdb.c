@@ -133,7 +133,7 @@ fail_close:
   return NULL;
 }
 
-static void *hcache_bdb_fetch(void *vctx, const char *key, size_t keylen)
+static void *hcache_bdb_fetch(void *vctx, const char *key, size_t keylen, size_t *dlen)
 {
   DBT dkey;
   DBT data;
@@ -149,6 +149,7 @@ static void *hcache_bdb_fetch(void *vctx, const char *key, size_t keylen)
 
   ctx->db->get(ctx->db, NULL, &dkey, &data, 0);
 
+  *dlen = data.size;
   return data.data;
 }
 
@@ -190,6 +191,69 @@ static int hcache_bdb_delete(void *vctx, const char *key, size_t keylen)
   return ctx->db->del(ctx->db, NULL, &dkey, 0);
 }
 
+static int hcache_bdb_walk(void *vctx, hcache_walk_cb_t cb, void *data)
+{
+  DBC *cur = NULL;
+  DBT dkey;
+  DBT ddata;
+  int rc;
+
+  if (!vctx)
+    return -1;
+
+  struct HcacheDbCtx *ctx = vctx;
+
+  if (ctx->db->cursor(ctx->db, NULL, &cur, 0) != 0)
+    return -1;
+
+  dbt_empty_init(&dkey);
+  dbt_empty_init(&ddata);
+  while ((rc = cur->get(cur, &dkey, &ddata, DB_NEXT)) == 0)
+  {
+    if (cb(dkey.data, dkey.size, data) != 0)
+      break;
+  }
+
+  cur->close(cur);
+  return ((rc == 0) || (rc == DB_NOTFOUND)) ? 0 : -1;
+}
+
+static int hcache_bdb_compact(void *vctx)
+{
+  if (!vctx)
+    return -1;
+
+  struct HcacheDbCtx *ctx = vctx;
+
+  return ctx->db->compact(ctx->db, NULL, NULL, NULL, NULL, DB_FREE_SPACE, NULL) ? -1 : 0;
+}
+
+static int hcache_bdb_begin(void *vctx)
+{
+  /* The database isn't opened in a transactional environment */
+  return vctx ? 0 : -1;
+}
+
+static int hcache_bdb_commit(void *vctx)
+{
+  if (!vctx)
+    return -1;
+
+  struct HcacheDbCtx *ctx = vctx;
+
+  return ctx->db->sync(ctx->db, 0) ? -1 : 0;
+}
+
+static void hcache_bdb_sync(void *vctx)
+{
+  if (!vctx)
+    return;
+
+  struct HcacheDbCtx *ctx = vctx;
+
+  ctx->db->sync(ctx->db, 0);
+}
+
 static void hcache_bdb_close(void **vctx)
 {
   if (!vctx || !*vctx)
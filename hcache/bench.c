@@ -0,0 +1,689 @@
+/**
+ * @file
+ * Benchmark for the header cache backends
+ *
+ * @copyright
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @page hc_bench Header cache benchmark
+ *
+ * This is a standalone program which measures the header cache without
+ * running neomutt.  It generates a reproducible set of synthetic Headers and
+ * drives them through the public hcache API for every compiled-in backend
+ * and compression method:
+ *
+ * - store:   mutt_hcache_store() into a new, empty cache
+ * - open:    mutt_hcache_open() and mutt_hcache_close() of other folders
+ * - fetch:   mutt_hcache_fetch() after closing and reopening the cache
+ * - restore: mutt_hcache_restore() of the fetched data
+ * - delete:  mutt_hcache_delete() of every record
+ *
+ * For each operation, it reports the throughput and the latency percentiles.
+ * It also reports the size of the cache on disk after the store phase.
+ * With -S, $header_cache_shared is set.
+ *
+ * The program is not built by default, use `make -C hcache hcache-bench`.
+ */
+
+#include "config.h"
+#include <dirent.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "address.h"
+#include "body.h"
+#include "charset.h"
+#include "envelope.h"
+#include "globals.h"
+#include "hcache.h"
+#include "header.h"
+#include "lib/lib.h"
+#include "list.h"
+#include "mime.h"
+#include "options.h"
+#include "parameter.h"
+#include "protos.h"
+#include "rfc822.h"
+
+extern char *optarg;
+extern int optind;
+
+/* The multiplexor and the backends use these parts of neomutt's core.  The
+ * benchmark provides its own definitions, so it only needs libhcache and
+ * libmutt. */
+char *Charset;
+int Charset_is_utf8 = 1;
+char *HeaderCacheBackend;
+char *HeaderCacheCompressMethod;
+short HeaderCacheCompressLevel;
+char *HeaderCachePageSize = "16384";
+struct ReplaceList *SpamList;
+struct RxList *NoSpamList;
+unsigned char Options[(OPT_GLOBAL_MAX + 7) / 8];
+
+int mutt_convert_string(char **ps, const char *from, const char *to, int flags)
+{
+  return -1;
+}
+
+void mutt_encode_path(char *dest, size_t dlen, const char *src)
+{
+  strfcpy(dest, src, dlen);
+}
+
+void mutt_sleep(short s)
+{
+}
+
+struct Body *mutt_new_body(void)
+{
+  struct Body *p = safe_calloc(1, sizeof(struct Body));
+
+  p->disposition = DISPATTACH;
+  p->use_disp = true;
+  return p;
+}
+
+struct Envelope *mutt_new_envelope(void)
+{
+  struct Envelope *e = safe_calloc(1, sizeof(struct Envelope));
+  STAILQ_INIT(&e->references);
+  STAILQ_INIT(&e->in_reply_to);
+  STAILQ_INIT(&e->userhdrs);
+  return e;
+}
+
+/**
+ * enum BenchOp - Operations which are timed
+ */
+enum BenchOp
+{
+  OP_STORE,
+  OP_OPEN,
+  OP_FETCH,
+  OP_RESTORE,
+  OP_DELETE,
+  OP_MAX
+};
+
+static const char *const OpNames[OP_MAX] = { "store", "open", "fetch", "restore", "delete" };
+
+/**
+ * struct BenchStats - Latencies of one operation
+ */
+struct BenchStats
+{
+  uint64_t *ns;  /**< Latency of each call, in nanoseconds */
+  size_t count;  /**< Number of calls */
+  uint64_t total;
+};
+
+static uint64_t Seed = 1;
+
+static uint64_t bench_random(void)
+{
+  /* xorshift64*: good enough, and reproducible across platforms */
+  Seed ^= Seed >> 12;
+  Seed ^= Seed << 25;
+  Seed ^= Seed >> 27;
+  return Seed * 2685821657736338717ULL;
+}
+
+static unsigned int bench_range(unsigned int lo, unsigned int hi)
+{
+  return lo + (unsigned int) (bench_random() % (hi - lo + 1));
+}
+
+static uint64_t bench_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static const char *const Words[] = {
+  "account",  "agenda",  "build",    "budget",  "cache",   "change",
+  "config",   "deadline", "draft",   "error",   "feature", "fix",
+  "invoice",  "meeting", "minutes",  "patch",   "plan",    "question",
+  "release",  "report",  "review",   "schedule", "status", "summary",
+  "team",     "test",    "thread",   "update",  "urgent",  "weekly",
+};
+
+static const char *const Names[] = {
+  "Alice",  "Bob",    "Carol", "Dave",  "Eve",    "Frank", "Grace",
+  "Heidi",  "Ivan",   "Judy",  "Mallory", "Niaj", "Olivia", "Peggy",
+  "Rupert", "Sybil",  "Trent", "Victor", "Walter", "Zoe",
+};
+
+static const char *const Domains[] = {
+  "example.com", "example.net", "example.org", "lists.example.com",
+  "mail.example.de",
+};
+
+#define countof(x) (sizeof(x) / sizeof((x)[0]))
+
+static struct Address *bench_address(void)
+{
+  char buf[STRING];
+  struct Address *a = rfc822_new_address();
+  const char *name = Names[bench_random() % countof(Names)];
+
+  if (bench_random() % 4)
+  {
+    snprintf(buf, sizeof(buf), "%s %s", name, Names[bench_random() % countof(Names)]);
+    a->personal = safe_strdup(buf);
+  }
+  snprintf(buf, sizeof(buf), "%s.%u@%s", name, bench_range(1, 999),
+           Domains[bench_random() % countof(Domains)]);
+  a->mailbox = safe_strdup(buf);
+  return a;
+}
+
+static struct Address *bench_address_list(unsigned int min, unsigned int max)
+{
+  struct Address *head = NULL;
+  struct Address **tail = &head;
+
+  for (unsigned int n = bench_range(min, max); n > 0; n--)
+  {
+    *tail = bench_address();
+    tail = &(*tail)->next;
+  }
+  return head;
+}
+
+static char *bench_msgid(void)
+{
+  char buf[STRING];
+  snprintf(buf, sizeof(buf), "<%08x%08x@%s>", (unsigned int) bench_random(),
+           (unsigned int) bench_random(), Domains[bench_random() % countof(Domains)]);
+  return safe_strdup(buf);
+}
+
+/**
+ * bench_header - Generate a synthetic Header
+ * @retval ptr New Header, free with bench_free_header()
+ *
+ * The shape roughly follows a mailing list folder: a few recipients, replies
+ * with references, a plain text body.
+ */
+static struct Header *bench_header(void)
+{
+  char buf[LONG_STRING];
+  struct Header *h = mutt_new_header();
+  struct Envelope *e = mutt_new_envelope();
+  struct Body *b = mutt_new_body();
+  size_t len = 0;
+  bool reply = (bench_random() % 3) != 0;
+
+  e->from = bench_address_list(1, 1);
+  e->to = bench_address_list(1, 3);
+  e->cc = bench_address_list(0, 4);
+  e->message_id = bench_msgid();
+  if (reply)
+    len = snprintf(buf, sizeof(buf), "Re: ");
+  for (unsigned int n = bench_range(3, 10); (n > 0) && (len < sizeof(buf) - 32); n--)
+    len += snprintf(buf + len, sizeof(buf) - len, "%s%s", Words[bench_random() % countof(Words)],
+                    (n > 1) ? " " : "");
+  e->subject = safe_strdup(buf);
+  e->real_subj = e->subject + (reply ? 4 : 0);
+  e->date = safe_strdup("Mon, 1 Jan 2018 12:00:00 +0000");
+  if (reply)
+  {
+    for (unsigned int n = bench_range(1, 8); n > 0; n--)
+      mutt_list_insert_tail(&e->references, bench_msgid());
+    mutt_list_insert_tail(&e->in_reply_to,
+                          safe_strdup(STAILQ_FIRST(&e->references)->data));
+  }
+  if ((bench_random() % 8) == 0)
+    e->x_label = safe_strdup(Words[bench_random() % countof(Words)]);
+
+  b->type = TYPETEXT;
+  b->subtype = safe_strdup("plain");
+  b->encoding = (bench_random() % 2) ? ENC7BIT : ENCQUOTEDPRINTABLE;
+  b->parameter = mutt_new_parameter();
+  b->parameter->attribute = safe_strdup("charset");
+  b->parameter->value = safe_strdup("utf-8");
+  b->length = bench_range(200, 20000);
+  b->offset = bench_range(500, 3000);
+
+  h->env = e;
+  h->content = b;
+  h->read = (bench_random() % 4) != 0;
+  h->flagged = (bench_random() % 20) == 0;
+  h->replied = (bench_random() % 10) == 0;
+  h->date_sent = 1500000000 + bench_range(0, 100000000);
+  h->received = h->date_sent + bench_range(1, 600);
+  h->lines = b->length / 60;
+  return h;
+}
+
+static void bench_free_address(struct Address **a)
+{
+  while (*a)
+  {
+    struct Address *next = (*a)->next;
+    FREE(&(*a)->personal);
+    FREE(&(*a)->mailbox);
+    FREE(a);
+    *a = next;
+  }
+}
+
+/**
+ * bench_free_header - Free a generated or restored Header
+ * @param h Header to free
+ */
+static void bench_free_header(struct Header **h)
+{
+  struct Envelope *e = (*h)->env;
+  struct Body *b = (*h)->content;
+
+  if (e)
+  {
+    bench_free_address(&e->return_path);
+    bench_free_address(&e->from);
+    bench_free_address(&e->to);
+    bench_free_address(&e->cc);
+    bench_free_address(&e->bcc);
+    bench_free_address(&e->sender);
+    bench_free_address(&e->reply_to);
+    bench_free_address(&e->mail_followup_to);
+    FREE(&e->list_post);
+    FREE(&e->subject);
+    FREE(&e->message_id);
+    FREE(&e->supersedes);
+    FREE(&e->date);
+    FREE(&e->x_label);
+#ifdef USE_NNTP
+    FREE(&e->xref);
+    FREE(&e->followup_to);
+    FREE(&e->x_comment_to);
+#endif
+    mutt_buffer_free(&e->spam);
+    mutt_list_free(&e->references);
+    mutt_list_free(&e->in_reply_to);
+    mutt_list_free(&e->userhdrs);
+    FREE(&e);
+  }
+
+  if (b)
+  {
+    while (b->parameter)
+    {
+      struct Parameter *next = b->parameter->next;
+      FREE(&b->parameter->attribute);
+      FREE(&b->parameter->value);
+      FREE(&b->parameter);
+      b->parameter = next;
+    }
+    FREE(&b->xtype);
+    FREE(&b->subtype);
+    FREE(&b->description);
+    FREE(&b->form_name);
+    FREE(&b->filename);
+    FREE(&b->d_filename);
+    FREE(&b);
+  }
+
+  FREE(&(*h)->maildir_flags);
+  FREE(h);
+}
+
+static void bench_record(struct BenchStats *s, uint64_t ns)
+{
+  s->ns[s->count++] = ns;
+  s->total += ns;
+}
+
+static int bench_cmp(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *) a;
+  uint64_t y = *(const uint64_t *) b;
+  return (x > y) - (x < y);
+}
+
+static double bench_percentile(const struct BenchStats *s, double p)
+{
+  if (s->count == 0)
+    return 0;
+
+  size_t i = (size_t)(p / 100 * (s->count - 1) + 0.5);
+  return s->ns[i] / 1000.0;
+}
+
+/**
+ * bench_disk_usage - Get the space taken by the files in a directory
+ * @param dir Directory
+ * @param rm  If true, also remove the files
+ * @retval num Size in bytes
+ */
+static uint64_t bench_disk_usage(const char *dir, bool rm)
+{
+  char path[_POSIX_PATH_MAX];
+  struct dirent *de = NULL;
+  struct stat sb;
+  uint64_t size = 0;
+
+  DIR *d = opendir(dir);
+  if (!d)
+    return 0;
+
+  while ((de = readdir(d)))
+  {
+    if ((strcmp(de->d_name, ".") == 0) || (strcmp(de->d_name, "..") == 0))
+      continue;
+    if (snprintf(path, sizeof(path), "%s/%s", dir, de->d_name) >= (int) sizeof(path))
+      continue;
+    if (lstat(path, &sb) == 0)
+      size += (uint64_t) sb.st_blocks * 512;
+    if (rm)
+      unlink(path);
+  }
+  closedir(d);
+  return size;
+}
+
+static char **Keys;
+static struct Header **Headers;
+static size_t Count = 10000;
+static int Rounds = 3;
+static int Errors;
+
+/**
+ * bench_run - Run all the operations once for the current backend and method
+ * @param dir   Empty directory for the cache
+ * @param stats Statistics to update
+ * @param size  Set to the size of the cache on disk
+ * @retval 0 on success
+ * @retval -1 if the cache couldn't be opened
+ */
+static int bench_run(const char *dir, struct BenchStats *stats, uint64_t *size)
+{
+  char path[_POSIX_PATH_MAX];
+  uint64_t t0, t1, t2;
+
+  if (snprintf(path, sizeof(path), "%s/hcache", dir) >= (int) sizeof(path))
+    return -1;
+
+  header_cache_t *h = mutt_hcache_open(path, "/bench/folder", NULL);
+  if (!h)
+    return -1;
+
+  for (size_t i = 0; i < Count; i++)
+  {
+    t0 = bench_now();
+    if (mutt_hcache_store(h, Keys[i], strlen(Keys[i]), Headers[i], 0) != 0)
+      Errors++;
+    bench_record(&stats[OP_STORE], bench_now() - t0);
+  }
+  mutt_hcache_close(h);
+  mutt_hcache_close_shared();
+
+  *size = bench_disk_usage(dir, false);
+
+  /* Changing folders */
+  for (size_t i = 0; i < (Count + 99) / 100; i++)
+  {
+    char folder[STRING];
+    snprintf(folder, sizeof(folder), "/bench/other%zu", i);
+    t0 = bench_now();
+    h = mutt_hcache_open(path, folder, NULL);
+    if (!h)
+      return -1;
+    mutt_hcache_close(h);
+    bench_record(&stats[OP_OPEN], bench_now() - t0);
+  }
+
+  h = mutt_hcache_open(path, "/bench/folder", NULL);
+  if (!h)
+    return -1;
+
+  for (size_t i = 0; i < Count; i++)
+  {
+    t0 = bench_now();
+    void *data = mutt_hcache_fetch(h, Keys[i], strlen(Keys[i]));
+    t1 = bench_now();
+    if (!data)
+    {
+      Errors++;
+      continue;
+    }
+    struct Header *hdr = mutt_hcache_restore(data);
+    t2 = bench_now();
+    bench_record(&stats[OP_FETCH], t1 - t0);
+    bench_record(&stats[OP_RESTORE], t2 - t1);
+
+    if ((mutt_strcmp(hdr->env->subject, Headers[i]->env->subject) != 0) ||
+        (hdr->received != Headers[i]->received))
+      Errors++;
+
+    bench_free_header(&hdr);
+    mutt_hcache_free(h, &data);
+  }
+
+  for (size_t i = 0; i < Count; i++)
+  {
+    t0 = bench_now();
+    mutt_hcache_delete(h, Keys[i], strlen(Keys[i]));
+    bench_record(&stats[OP_DELETE], bench_now() - t0);
+  }
+  mutt_hcache_close(h);
+  mutt_hcache_close_shared();
+
+  bench_disk_usage(dir, true);
+  return 0;
+}
+
+/**
+ * bench_combination - Benchmark one backend with one compression method
+ * @param topdir  Directory for the caches
+ * @param backend Name of the backend
+ * @param method  Name of the compression method, or "none"
+ */
+static void bench_combination(const char *topdir, const char *backend, const char *method)
+{
+  char dir[_POSIX_PATH_MAX];
+  struct BenchStats stats[OP_MAX];
+  uint64_t size = 0;
+
+  mutt_str_replace(&HeaderCacheBackend, backend);
+  mutt_str_replace(&HeaderCacheCompressMethod,
+                   (strcmp(method, "none") == 0) ? NULL : method);
+
+  memset(stats, 0, sizeof(stats));
+  for (int i = 0; i < OP_MAX; i++)
+    stats[i].ns = safe_calloc(Count * Rounds, sizeof(uint64_t));
+
+  snprintf(dir, sizeof(dir), "%s/%s-%s", topdir, backend, method);
+  for (int r = 0; r < Rounds; r++)
+  {
+    if ((mkdir(dir, 0700) != 0) || (bench_run(dir, stats, &size) != 0))
+    {
+      printf("%-14s %-6s cannot create the cache in %s\n", backend, method, dir);
+      Errors++;
+      break;
+    }
+    rmdir(dir);
+  }
+
+  for (int i = 0; i < OP_MAX; i++)
+  {
+    struct BenchStats *s = &stats[i];
+
+    qsort(s->ns, s->count, sizeof(uint64_t), bench_cmp);
+    printf("%-14s %-6s %-8s %12.0f %9.2f %9.2f %9.2f %9.2f", backend, method,
+           OpNames[i], s->total ? s->count * 1e9 / s->total : 0,
+           bench_percentile(s, 50), bench_percentile(s, 90),
+           bench_percentile(s, 99), bench_percentile(s, 100));
+    if (i == OP_STORE)
+      printf(" %9llu", (unsigned long long) (size / 1024));
+    printf("\n");
+    FREE(&s->ns);
+  }
+}
+
+static void usage(const char *progname)
+{
+  fprintf(stderr,
+          "Usage: %s [-n count] [-r rounds] [-s seed] [-b backends] [-c methods] [-d dir] [-S]\n"
+          "\n"
+          "   -n Number of headers to generate (default: %zu)\n"
+          "   -r Number of times to repeat each test (default: %d)\n"
+          "   -s Seed for the header generator (default: 1)\n"
+          "   -b Comma separated list of backends (default: all)\n"
+          "   -c Comma separated list of compression methods, \"none\" for no\n"
+          "      compression (default: none and all)\n"
+          "   -d Directory for the caches (default: a new temporary directory)\n"
+          "   -S Keep the database open across folders ($header_cache_shared)\n",
+          progname, Count, Rounds);
+  exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+  char tmpdir[] = "/tmp/hcache-bench.XXXXXX";
+  char *backends = NULL;
+  char *methods = NULL;
+  const char *dir = NULL;
+  char *tok = NULL;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:r:s:b:c:d:S")) != -1)
+  {
+    switch (opt)
+    {
+      case 'n':
+        Count = strtoul(optarg, NULL, 10);
+        break;
+      case 'r':
+        Rounds = atoi(optarg);
+        break;
+      case 's':
+        Seed = strtoull(optarg, NULL, 10);
+        break;
+      case 'b':
+        backends = safe_strdup(optarg);
+        break;
+      case 'c':
+        methods = safe_strdup(optarg);
+        break;
+      case 'd':
+        dir = optarg;
+        break;
+      case 'S':
+        set_option(OPT_HCACHE_SHARED);
+        break;
+      default:
+        usage(argv[0]);
+    }
+  }
+
+  if ((optind != argc) || (Count == 0) || (Rounds < 1) || (Seed == 0))
+    usage(argv[0]);
+
+  if (!backends)
+    backends = (char *) mutt_hcache_backend_list();
+  if (!methods)
+  {
+    const char *list = mutt_hcache_compress_list();
+    methods = safe_malloc(strlen(list) + 8);
+    sprintf(methods, "none%s%s", *list ? ", " : "", list);
+    FREE(&list);
+  }
+
+  if (!dir)
+  {
+    dir = mkdtemp(tmpdir);
+    if (!dir)
+    {
+      perror("mkdtemp");
+      return 1;
+    }
+  }
+
+#if defined(HAVE_QDBM) || defined(HAVE_TC) || defined(HAVE_KC)
+  /* $header_cache_compress, as neomutt's default */
+  set_option(OPT_HCACHE_COMPRESS);
+#endif
+
+  Keys = safe_calloc(Count, sizeof(char *));
+  Headers = safe_calloc(Count, sizeof(struct Header *));
+  for (size_t i = 0; i < Count; i++)
+  {
+    char key[STRING];
+    snprintf(key, sizeof(key), "/%zu.R%08x.bench", 1500000000 + i,
+             (unsigned int) bench_random());
+    Keys[i] = safe_strdup(key);
+    Headers[i] = bench_header();
+  }
+
+  printf("%zu headers, %d rounds, caches in %s\n\n", Count, Rounds, dir);
+  printf("%-14s %-6s %-8s %12s %9s %9s %9s %9s %9s\n", "backend", "compr",
+         "op", "ops/s", "p50(us)", "p90(us)", "p99(us)", "max(us)", "size(KiB)");
+
+  for (char *b = strtok_r(backends, ", ", &tok); b; b = strtok_r(NULL, ", ", &tok))
+  {
+    if (!mutt_hcache_is_valid_backend(b))
+    {
+      printf("%s: unknown backend\n", b);
+      Errors++;
+      continue;
+    }
+
+    char *mlist = safe_strdup(methods);
+    char *mtok = NULL;
+    for (char *m = strtok_r(mlist, ", ", &mtok); m; m = strtok_r(NULL, ", ", &mtok))
+    {
+      if ((strcmp(m, "none") != 0) && !mutt_hcache_is_valid_compression(m))
+      {
+        printf("%s: unknown compression method\n", m);
+        Errors++;
+        continue;
+      }
+      bench_combination(dir, b, m);
+    }
+    FREE(&mlist);
+  }
+
+  if (dir == tmpdir)
+    rmdir(dir);
+
+  for (size_t i = 0; i < Count; i++)
+  {
+    FREE(&Keys[i]);
+    bench_free_header(&Headers[i]);
+  }
+  FREE(&Keys);
+  FREE(&Headers);
+  FREE(&backends);
+  FREE(&methods);
+  FREE(&HeaderCacheBackend);
+  FREE(&HeaderCacheCompressMethod);
+
+  if (Errors)
+  {
+    printf("\n%d errors\n", Errors);
+    return 1;
+  }
+
+  return 0;
+}
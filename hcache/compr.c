@@ -0,0 +1,189 @@
+/**
+ * @file
+ * Compression of header cache records
+ *
+ * @copyright
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @page hc_compr Header cache compression
+ *
+ * This module implements the compression of header cache records.  It's
+ * independent of the backend: the multiplexor compresses a record before
+ * handing it to the backend and decompresses it after fetching it.
+ *
+ * The available methods are zlib, lz4 and zstd, depending on the libraries
+ * found by configure.
+ */
+
+#include "config.h"
+#include <limits.h>
+#include <string.h>
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#include "compr.h"
+
+#ifdef HAVE_LZ4
+static size_t compr_lz4_bound(size_t len)
+{
+  return LZ4_compressBound(len);
+}
+
+static int compr_lz4_compress(void *dst, size_t *dlen, const void *src,
+                              size_t slen, int level)
+{
+  if ((slen > INT_MAX) || (*dlen > INT_MAX))
+    return -1;
+
+  /* for lz4, the level is the "acceleration": higher is faster */
+  int len = LZ4_compress_fast(src, dst, slen, *dlen, (level > 0) ? level : 1);
+  if (len <= 0)
+    return -1;
+
+  *dlen = len;
+  return 0;
+}
+
+static int compr_lz4_decompress(void *dst, size_t dlen, const void *src, size_t slen)
+{
+  if ((slen > INT_MAX) || (dlen > INT_MAX))
+    return -1;
+
+  int len = LZ4_decompress_safe(src, dst, slen, dlen);
+  return (len == (int) dlen) ? 0 : -1;
+}
+
+static const struct HcacheComprOps compr_lz4_ops = {
+  .name = "lz4",
+  .bound = compr_lz4_bound,
+  .compress = compr_lz4_compress,
+  .decompress = compr_lz4_decompress,
+};
+#endif
+
+#ifdef HAVE_ZLIB
+static size_t compr_zlib_bound(size_t len)
+{
+  return compressBound(len);
+}
+
+static int compr_zlib_compress(void *dst, size_t *dlen, const void *src,
+                               size_t slen, int level)
+{
+  uLongf len = *dlen;
+
+  if ((level <= 0) || (level > Z_BEST_COMPRESSION))
+    level = Z_DEFAULT_COMPRESSION;
+
+  if (compress2(dst, &len, src, slen, level) != Z_OK)
+    return -1;
+
+  *dlen = len;
+  return 0;
+}
+
+static int compr_zlib_decompress(void *dst, size_t dlen, const void *src, size_t slen)
+{
+  uLongf len = dlen;
+
+  if (uncompress(dst, &len, src, slen) != Z_OK)
+    return -1;
+
+  return (len == dlen) ? 0 : -1;
+}
+
+static const struct HcacheComprOps compr_zlib_ops = {
+  .name = "zlib",
+  .bound = compr_zlib_bound,
+  .compress = compr_zlib_compress,
+  .decompress = compr_zlib_decompress,
+};
+#endif
+
+#ifdef HAVE_ZSTD
+static size_t compr_zstd_bound(size_t len)
+{
+  return ZSTD_compressBound(len);
+}
+
+static int compr_zstd_compress(void *dst, size_t *dlen, const void *src,
+                               size_t slen, int level)
+{
+  if ((level <= 0) || (level > ZSTD_maxCLevel()))
+    level = 3; /* zstd's default */
+
+  size_t len = ZSTD_compress(dst, *dlen, src, slen, level);
+  if (ZSTD_isError(len))
+    return -1;
+
+  *dlen = len;
+  return 0;
+}
+
+static int compr_zstd_decompress(void *dst, size_t dlen, const void *src, size_t slen)
+{
+  size_t len = ZSTD_decompress(dst, dlen, src, slen);
+  if (ZSTD_isError(len))
+    return -1;
+
+  return (len == dlen) ? 0 : -1;
+}
+
+static const struct HcacheComprOps compr_zstd_ops = {
+  .name = "zstd",
+  .bound = compr_zstd_bound,
+  .compress = compr_zstd_compress,
+  .decompress = compr_zstd_decompress,
+};
+#endif
+
+/* Keep this list sorted as it is in configure.ac */
+const struct HcacheComprOps *hcache_compr_ops[] = {
+#ifdef HAVE_LZ4
+  &compr_lz4_ops,
+#endif
+#ifdef HAVE_ZLIB
+  &compr_zlib_ops,
+#endif
+#ifdef HAVE_ZSTD
+  &compr_zstd_ops,
+#endif
+  NULL,
+};
+
+/**
+ * hcache_get_compr_ops - Get the compression functions for a method
+ * @param name Name of the method, e.g. "zlib"
+ * @retval ptr Compression functions
+ * @retval NULL if @a name is empty or unknown
+ */
+const struct HcacheComprOps *hcache_get_compr_ops(const char *name)
+{
+  if (!name || !*name)
+    return NULL;
+
+  for (const struct HcacheComprOps **ops = hcache_compr_ops; *ops; ops++)
+    if (strcmp(name, (*ops)->name) == 0)
+      return *ops;
+
+  return NULL;
+}
@@ -0,0 +1,71 @@
+/**
+ * @file
+ * Compression of header cache records
+ *
+ * @copyright
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _MUTT_HCACHE_COMPR_H
+#define _MUTT_HCACHE_COMPR_H
+
+#include <stdlib.h>
+
+/**
+ * hcache_compr_bound_t - Get the worst-case size of compressed data
+ * @param len Length of the uncompressed data
+ * @retval num Size of the buffer needed by hcache_compr_compress_t
+ */
+typedef size_t (*hcache_compr_bound_t)(size_t len);
+
+/**
+ * hcache_compr_compress_t - Compress a block of data
+ * @param[out]    dst   Buffer for the compressed data
+ * @param[in,out] dlen  Size of @a dst; on success, length of the compressed data
+ * @param[in]     src   Data to compress
+ * @param[in]     slen  Length of @a src
+ * @param[in]     level Compression level, 0 for the library's default
+ * @retval 0 on success
+ * @retval -1 otherwise
+ */
+typedef int (*hcache_compr_compress_t)(void *dst, size_t *dlen, const void *src,
+                                       size_t slen, int level);
+
+/**
+ * hcache_compr_decompress_t - Decompress a block of data
+ * @param dst  Buffer for the uncompressed data
+ * @param dlen Exact length of the uncompressed data
+ * @param src  Compressed data
+ * @param slen Length of @a src
+ * @retval 0 on success
+ * @retval -1 otherwise (corrupt data or wrong length)
+ */
+typedef int (*hcache_compr_decompress_t)(void *dst, size_t dlen, const void *src, size_t slen);
+
+/**
+ * struct HcacheComprOps - Header cache compression API
+ */
+struct HcacheComprOps
+{
+  const char                *name;
+  hcache_compr_bound_t       bound;
+  hcache_compr_compress_t    compress;
+  hcache_compr_decompress_t  decompress;
+};
+
+extern const struct HcacheComprOps *hcache_compr_ops[];
+
+const struct HcacheComprOps *hcache_get_compr_ops(const char *name);
+
+#endif /* _MUTT_HCACHE_COMPR_H */
@@ -46,11 +46,13 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <time.h>
 #include <unistd.h>
 #include "address.h"
 #include "backend.h"
 #include "body.h"
 #include "charset.h"
+#include "compr.h"
 #include "envelope.h"
 #include "globals.h"
 #include "hcache.h"
@@ -60,12 +62,31 @@
 #include "list.h"
 #include "mbyte.h"
 #include "mutt_regex.h"
+#include "options.h"
 #include "parameter.h"
 #include "protos.h"
 #include "rfc822.h"
 
 static unsigned int hcachever = 0x0;
 
+/**
+ * struct HcacheShared - A database kept open across folders
+ *
+ * With $header_cache_shared, a database is opened once and used by all the
+ * folders whose header cache resolves to the same file.  Their records are
+ * kept apart by the folder prefix of the keys, see HeaderCache::prefix.
+ */
+struct HcacheShared
+{
+  char *path;                  /**< Path of the database file */
+  const struct HcacheOps *ops; /**< Backend which opened the database */
+  void *ctx;                   /**< Backend-specific context */
+  int refs;                    /**< Number of open header_cache_t using it */
+  struct HcacheShared *next;
+};
+
+static struct HcacheShared *SharedDbs = NULL;
+
 /**
  * struct HeaderCache - header cache structure
  *
@@ -77,8 +98,15 @@ static unsigned int hcachever = 0x0;
 struct HeaderCache
 {
   char *folder;
+  char *prefix;                       /**< Prefix of the keys of this folder */
+  char *path;                         /**< Path of the database file */
   unsigned int crc;
   void *ctx;
+  const struct HcacheComprOps *compr; /**< Record compression, may be NULL */
+  void **bufs;                        /**< Decompressed records not yet freed */
+  size_t nbufs;
+  size_t maxbufs;
+  struct HcacheShared *shared;        /**< Shared database, may be NULL */
 };
 
 /**
@@ -135,6 +163,9 @@ static const struct HcacheOps *hcache_get_backend_ops(const char *backend)
 
 #define hcache_get_ops() hcache_get_backend_ops(HeaderCacheBackend)
 
+/* Records start with a validity datum and a crc, which are never compressed */
+#define HCACHE_PREFIX_LEN (sizeof(union Validate) + sizeof(unsigned int))
+
 static void *lazy_malloc(size_t siz)
 {
   if (siz < 4096)
@@ -569,6 +600,7 @@ static bool create_hcache_dir(const char *path)
  * @param path   Base directory, from $header_cache
  * @param folder Mailbox name (including protocol)
  * @param namer  Callback to generate database filename
+ * @param own    Set if the database belongs to @a folder alone
  * @retval ptr Full pathname to the database (to be generated)
  *             (path must be freed by the caller)
  *
@@ -587,8 +619,12 @@ static bool create_hcache_dir(const char *path)
  * If @a path has a trailing '/' it is assumed to be a directory.
  * If ICONV isn't being used, then a suffix is added to the path, e.g. '-utf-8'.
  * Otherise @a path is assumed to be a file.
+ *
+ * If $header_cache_shared is set, all the folders use a single database in
+ * the directory, named after the backend, e.g. BASE/shared-lmdb.hcache
  */
-static const char *hcache_per_folder(const char *path, const char *folder, hcache_namer_t namer)
+static const char *hcache_per_folder(const char *path, const char *folder,
+                                     hcache_namer_t namer, bool *own)
 {
   static char hcpath[_POSIX_PATH_MAX];
   char suffix[32] = "";
@@ -598,6 +634,7 @@ static const char *hcache_per_folder(const char *path, const char *folder, hcach
   int ret = stat(path, &sb);
   int slash = (path[plen - 1] == '/');
 
+  *own = false;
   if (((ret == 0) && !S_ISDIR(sb.st_mode)) || ((ret == -1) && !slash))
   {
     /* An existing file or a non-existing path not ending with a slash */
@@ -606,8 +643,14 @@ static const char *hcache_per_folder(const char *path, const char *folder, hcach
   }
 
   /* We have a directory - no matter whether it exists, or not */
+  *own = !option(OPT_HCACHE_SHARED);
 
-  if (namer)
+  if (option(OPT_HCACHE_SHARED))
+  {
+    ret = snprintf(hcpath, sizeof(hcpath), "%s%sshared-%s.hcache%s", path,
+                   slash ? "" : "/", hcache_get_ops()->name, suffix);
+  }
+  else if (namer)
   {
     /* We have a mailbox-specific namer function */
     snprintf(hcpath, sizeof(hcpath), "%s%s", path, slash ? "" : "/");
@@ -637,6 +680,97 @@ static const char *hcache_per_folder(const char *path, const char *folder, hcach
   return hcpath;
 }
 
+/**
+ * hcache_compress - Compress a serialised Header
+ * @param[in]     h    Header cache
+ * @param[in]     data Record created by hcache_dump()
+ * @param[in,out] dlen Length of the record
+ * @retval ptr Compressed record, to be freed by the caller
+ * @retval NULL on error
+ *
+ * The validity datum and the crc stay in clear, so they can be checked
+ * without decompressing.  They're followed by the lengths of the original and
+ * the compressed data:
+ *
+ *     | Validate | crc | raw length | compressed length | compressed data |
+ */
+static void *hcache_compress(header_cache_t *h, const unsigned char *data, int *dlen)
+{
+  const size_t hdrlen = HCACHE_PREFIX_LEN + 2 * sizeof(unsigned int);
+  size_t rawlen = *dlen - HCACHE_PREFIX_LEN;
+  size_t clen = h->compr->bound(rawlen);
+  unsigned int len;
+
+  unsigned char *d = safe_malloc(hdrlen + clen);
+  if (h->compr->compress(d + hdrlen, &clen, data + HCACHE_PREFIX_LEN, rawlen,
+                         HeaderCacheCompressLevel) != 0)
+  {
+    mutt_debug(1, "hcache: %s compression failed\n", h->compr->name);
+    FREE(&d);
+    return NULL;
+  }
+
+  memcpy(d, data, HCACHE_PREFIX_LEN);
+  len = rawlen;
+  memcpy(d + HCACHE_PREFIX_LEN, &len, sizeof(len));
+  len = clen;
+  memcpy(d + HCACHE_PREFIX_LEN + sizeof(len), &len, sizeof(len));
+
+  *dlen = hdrlen + clen;
+  return d;
+}
+
+/**
+ * hcache_decompress - Decompress a record fetched from the backend
+ * @param h    Header cache
+ * @param data Record created by hcache_compress()
+ * @param dlen Length of the record
+ * @retval ptr Uncompressed record, as created by hcache_dump()
+ * @retval NULL on error, or if the record is corrupt
+ *
+ * The returned record is remembered, so that mutt_hcache_free() can tell it
+ * apart from the data owned by the backend.
+ */
+static void *hcache_decompress(header_cache_t *h, const unsigned char *data, size_t dlen)
+{
+  const size_t hdrlen = HCACHE_PREFIX_LEN + 2 * sizeof(unsigned int);
+  unsigned int rawlen, clen;
+
+  if (dlen < hdrlen)
+    return NULL;
+
+  memcpy(&rawlen, data + HCACHE_PREFIX_LEN, sizeof(rawlen));
+  memcpy(&clen, data + HCACHE_PREFIX_LEN + sizeof(rawlen), sizeof(clen));
+
+  /* the compressed data must fill the rest of the record, and must not be
+   * larger than the compression of rawlen bytes could have produced */
+  if ((clen != dlen - hdrlen) || (rawlen == 0) || (rawlen > INT_MAX) ||
+      (h->compr->bound(rawlen) < clen))
+  {
+    mutt_debug(1, "hcache: corrupt %s record (%u/%u bytes of %zu)\n",
+               h->compr->name, clen, rawlen, dlen);
+    return NULL;
+  }
+
+  unsigned char *d = safe_malloc(HCACHE_PREFIX_LEN + rawlen);
+  if (h->compr->decompress(d + HCACHE_PREFIX_LEN, rawlen, data + hdrlen, clen) != 0)
+  {
+    mutt_debug(1, "hcache: %s decompression failed\n", h->compr->name);
+    FREE(&d);
+    return NULL;
+  }
+  memcpy(d, data, HCACHE_PREFIX_LEN);
+
+  if (h->nbufs == h->maxbufs)
+  {
+    h->maxbufs += 4;
+    safe_realloc(&h->bufs, h->maxbufs * sizeof(void *));
+  }
+  h->bufs[h->nbufs++] = d;
+
+  return d;
+}
+
 /**
  * hcache_dump - Serialise a Header object
  *
@@ -675,6 +809,8 @@ static void *hcache_dump(header_cache_t *h, struct Header *header, int *off,
   nh.recip_valid = false;
   nh.searched = false;
   nh.matched = false;
+  nh.results_known = 0;
+  nh.results_matched = 0;
   nh.collapsed = false;
   nh.limited = false;
   nh.num_hidden = 0;
@@ -682,7 +818,6 @@ static void *hcache_dump(header_cache_t *h, struct Header *header, int *off,
   nh.pair = 0;
   nh.attach_valid = false;
   nh.path = NULL;
-  nh.tree = NULL;
   nh.thread = NULL;
 #ifdef MIXMASTER
   STAILQ_INIT(&nh.chain);
@@ -727,6 +862,61 @@ struct Header *mutt_hcache_restore(const unsigned char *d)
   return h;
 }
 
+/**
+ * hcache_shared_open - Get a shared database
+ * @param ops  Backend
+ * @param path Path of the database file
+ * @retval ptr Shared database, with a new reference
+ * @retval NULL if it couldn't be opened
+ */
+static struct HcacheShared *hcache_shared_open(const struct HcacheOps *ops, const char *path)
+{
+  struct HcacheShared **pp = &SharedDbs;
+
+  while (*pp)
+  {
+    struct HcacheShared *db = *pp;
+    if (mutt_strcmp(db->path, path) != 0)
+    {
+      pp = &db->next;
+      continue;
+    }
+
+    if (db->ops == ops)
+    {
+      db->refs++;
+      return db;
+    }
+
+    /* The backend has changed since the database was opened */
+    if (db->refs > 0)
+      return NULL;
+
+    db->ops->close(&db->ctx);
+    *pp = db->next;
+    FREE(&db->path);
+    FREE(&db);
+  }
+
+  void *ctx = ops->open(path);
+  if (!ctx)
+  {
+    mutt_debug(1, "hcache: can't open shared database %s\n", path);
+    return NULL;
+  }
+
+  struct HcacheShared *db = safe_calloc(1, sizeof(struct HcacheShared));
+  db->path = safe_strdup(path);
+  db->ops = ops;
+  db->ctx = ctx;
+  db->refs = 1;
+  db->next = SharedDbs;
+  SharedDbs = db;
+
+  mutt_debug(2, "hcache: opened shared database %s\n", path);
+  return db;
+}
+
 static char *get_foldername(const char *folder)
 {
   char *p = NULL;
@@ -790,6 +980,24 @@ header_cache_t *mutt_hcache_open(const char *path, const char *folder, hcache_na
   h->folder = get_foldername(folder);
   h->crc = hcachever;
 
+  /* Records compressed with different methods mustn't be mixed up, so the
+   * method is part of the crc */
+  h->compr = hcache_get_compr_ops(HeaderCacheCompressMethod);
+  if (h->compr)
+  {
+    union {
+      unsigned char charval[16];
+      unsigned int intval;
+    } digest;
+    struct Md5Ctx ctx;
+
+    md5_init_ctx(&ctx);
+    md5_process_bytes(&hcachever, sizeof(hcachever), &ctx);
+    md5_process_bytes(h->compr->name, strlen(h->compr->name), &ctx);
+    md5_finish_ctx(&ctx, digest.charval);
+    h->crc = digest.intval;
+  }
+
   if (!path || path[0] == '\0')
   {
     FREE(&h->folder);
@@ -797,13 +1005,39 @@ header_cache_t *mutt_hcache_open(const char *path, const char *folder, hcache_na
     return NULL;
   }
 
-  path = hcache_per_folder(path, h->folder, namer);
+  bool own = false;
+  path = hcache_per_folder(path, h->folder, namer, &own);
+  h->path = safe_strdup(path);
 
-  h->ctx = ops->open(path);
-  if (h->ctx)
-    return h;
+  /* If the database holds several folders, the keys must say where the
+   * folder ends: with MH's numeric keys, "/mail/inbox" + "12" would be the
+   * same as "/mail/inbox1" + "2" */
+  if (own)
+    h->prefix = safe_strdup(h->folder);
   else
   {
+    char prefix[_POSIX_PATH_MAX + 16];
+    snprintf(prefix, sizeof(prefix), "%zu:%s", mutt_strlen(h->folder), h->folder);
+    h->prefix = safe_strdup(prefix);
+  }
+
+  if (option(OPT_HCACHE_SHARED))
+  {
+    /* Other folders and other instances use the same database, so it mustn't
+     * be removed if it can't be opened, e.g. because it's locked */
+    h->shared = hcache_shared_open(ops, path);
+    if (h->shared)
+    {
+      h->ctx = h->shared->ctx;
+      return h;
+    }
+  }
+  else
+  {
+    h->ctx = ops->open(path);
+    if (h->ctx)
+      return h;
+
     /* remove a possibly incompatible version */
     if (unlink(path) == 0)
     {
@@ -811,11 +1045,13 @@ header_cache_t *mutt_hcache_open(const char *path, const char *folder, hcache_na
       if (h->ctx)
         return h;
     }
-    FREE(&h->folder);
-    FREE(&h);
-
-    return NULL;
   }
+
+  FREE(&h->folder);
+  FREE(&h->prefix);
+  FREE(&h->path);
+  FREE(&h);
+  return NULL;
 }
 
 void mutt_hcache_close(header_cache_t *h)
@@ -824,41 +1060,79 @@ void mutt_hcache_close(header_cache_t *h)
   if (!h || !ops)
     return;
 
-  ops->close(&h->ctx);
+  if (h->shared)
+  {
+    /* Keep the database open for the next folder, but don't hold any
+     * transaction or lock that other processes could be waiting for */
+    h->shared->ops->sync(h->shared->ctx);
+    h->shared->refs--;
+  }
+  else
+    ops->close(&h->ctx);
+  for (size_t i = 0; i < h->nbufs; i++)
+    FREE(&h->bufs[i]);
+  FREE(&h->bufs);
   FREE(&h->folder);
+  FREE(&h->prefix);
+  FREE(&h->path);
   FREE(&h);
 }
 
+/**
+ * hcache_fetch - Fetch a record from the backend
+ * @param[in]  h      Header cache
+ * @param[in]  key    Key of the record
+ * @param[in]  keylen Length of the key
+ * @param[out] dlen   Length of the record
+ * @retval ptr Record, to be freed with mutt_hcache_free()
+ * @retval NULL if there's no such record
+ */
+static void *hcache_fetch(header_cache_t *h, const char *key, size_t keylen, size_t *dlen)
+{
+  char path[_POSIX_PATH_MAX];
+  const struct HcacheOps *ops = hcache_get_ops();
+
+  *dlen = 0;
+  if (!h || !ops)
+    return NULL;
+
+  keylen = snprintf(path, sizeof(path), "%s%s", h->prefix, key);
+
+  return ops->fetch(h->ctx, path, keylen, dlen);
+}
+
 void *mutt_hcache_fetch(header_cache_t *h, const char *key, size_t keylen)
 {
   void *data = NULL;
+  size_t dlen;
 
-  data = mutt_hcache_fetch_raw(h, key, keylen);
+  data = hcache_fetch(h, key, keylen, &dlen);
   if (!data)
   {
     return NULL;
   }
 
-  if (!crc_matches(data, h->crc))
+  if ((dlen < HCACHE_PREFIX_LEN) || !crc_matches(data, h->crc))
   {
     mutt_hcache_free(h, &data);
     return NULL;
   }
 
+  if (h->compr)
+  {
+    void *raw = hcache_decompress(h, data, dlen);
+    mutt_hcache_free(h, &data);
+    return raw;
+  }
+
   return data;
 }
 
 void *mutt_hcache_fetch_raw(header_cache_t *h, const char *key, size_t keylen)
 {
-  char path[_POSIX_PATH_MAX];
-  const struct HcacheOps *ops = hcache_get_ops();
-
-  if (!h || !ops)
-    return NULL;
-
-  keylen = snprintf(path, sizeof(path), "%s%s", h->folder, key);
+  size_t dlen;
 
-  return ops->fetch(h->ctx, path, keylen);
+  return hcache_fetch(h, key, keylen, &dlen);
 }
 
 void mutt_hcache_free(header_cache_t *h, void **data)
@@ -868,6 +1142,17 @@ void mutt_hcache_free(header_cache_t *h, void **data)
   if (!h || !ops)
     return;
 
+  for (size_t i = 0; data && *data && (i < h->nbufs); i++)
+  {
+    if (h->bufs[i] != *data)
+      continue;
+
+    /* a decompressed record, owned by us */
+    FREE(data);
+    h->bufs[i] = h->bufs[--h->nbufs];
+    return;
+  }
+
   ops->free(h->ctx, data);
 }
 
@@ -882,6 +1167,16 @@ int mutt_hcache_store(header_cache_t *h, const char *key, size_t keylen,
     return -1;
 
   data = hcache_dump(h, header, &dlen, uidvalidity);
+
+  if (h->compr)
+  {
+    char *cdata = hcache_compress(h, (unsigned char *) data, &dlen);
+    FREE(&data);
+    if (!cdata)
+      return -1;
+    data = cdata;
+  }
+
   ret = mutt_hcache_store_raw(h, key, keylen, data, dlen);
 
   FREE(&data);
@@ -898,7 +1193,7 @@ int mutt_hcache_store_raw(header_cache_t *h, const char *key, size_t keylen,
   if (!h || !ops)
     return -1;
 
-  keylen = snprintf(path, sizeof(path), "%s%s", h->folder, key);
+  keylen = snprintf(path, sizeof(path), "%s%s", h->prefix, key);
 
   return ops->store(h->ctx, path, keylen, data, dlen);
 }
@@ -911,11 +1206,155 @@ int mutt_hcache_delete(header_cache_t *h, const char *key, size_t keylen)
   if (!h)
     return -1;
 
-  keylen = snprintf(path, sizeof(path), "%s%s", h->folder, key);
+  keylen = snprintf(path, sizeof(path), "%s%s", h->prefix, key);
 
   return ops->delete (h->ctx, path, keylen);
 }
 
+int mutt_hcache_begin(header_cache_t *h)
+{
+  const struct HcacheOps *ops = hcache_get_ops();
+
+  if (!h || !ops)
+    return -1;
+
+  return ops->begin(h->ctx);
+}
+
+int mutt_hcache_commit(header_cache_t *h)
+{
+  const struct HcacheOps *ops = hcache_get_ops();
+
+  if (!h || !ops)
+    return -1;
+
+  return ops->commit(h->ctx);
+}
+
+/* Record holding the time of a folder's last compaction */
+#define HCACHE_COMPACTED "#compacted"
+/* Minimum time between two automatic compactions of a folder */
+#define HCACHE_COMPACT_INTERVAL (24 * 60 * 60)
+
+/**
+ * struct HcacheCompact - State of a compaction walk
+ */
+struct HcacheCompact
+{
+  const char *prefix; /**< Prefix of the folder's keys */
+  size_t prefixlen;
+  hcache_keep_t keep;
+  void *data;
+  struct ListHead stale; /**< Keys to delete, without the folder */
+};
+
+static int hcache_compact_cb(const char *key, size_t keylen, void *data)
+{
+  struct HcacheCompact *hc = data;
+
+  /* Records of other folders, if they share the database */
+  if ((keylen < hc->prefixlen) || (strncmp(key, hc->prefix, hc->prefixlen) != 0))
+    return 0;
+
+  key += hc->prefixlen;
+  keylen -= hc->prefixlen;
+  if ((keylen == sizeof(HCACHE_COMPACTED) - 1) &&
+      (strncmp(key, HCACHE_COMPACTED, keylen) == 0))
+    return 0;
+
+  if (!hc->keep(key, keylen, hc->data))
+    mutt_list_insert_tail(&hc->stale, mutt_substrdup(key, key + keylen));
+
+  return 0;
+}
+
+static LOFF_T hcache_file_size(const char *path)
+{
+  struct stat sb;
+  return (stat(path, &sb) == 0) ? sb.st_size : 0;
+}
+
+int mutt_hcache_compact(header_cache_t *h, hcache_keep_t keep, void *data,
+                        bool force, LOFF_T *reclaimed)
+{
+  const struct HcacheOps *ops = hcache_get_ops();
+  struct HcacheCompact hc;
+  struct ListNode *np = NULL;
+  int removed = 0;
+
+  if (reclaimed)
+    *reclaimed = 0;
+
+  if (!h || !ops || !keep)
+    return -1;
+
+  time_t now = time(NULL);
+  if (!force)
+  {
+    time_t last = 0;
+    size_t dlen;
+    void *d = hcache_fetch(h, HCACHE_COMPACTED, sizeof(HCACHE_COMPACTED) - 1, &dlen);
+    if (d && (dlen == sizeof(last)))
+      memcpy(&last, d, sizeof(last));
+    if (d)
+      mutt_hcache_free(h, &d);
+    if ((now >= last) && (now - last < HCACHE_COMPACT_INTERVAL))
+      return 0;
+  }
+
+  hc.prefix = h->prefix;
+  hc.prefixlen = mutt_strlen(h->prefix);
+  hc.keep = keep;
+  hc.data = data;
+  STAILQ_INIT(&hc.stale);
+
+  /* The keys can't be deleted while walking the database */
+  if (ops->walk(h->ctx, hcache_compact_cb, &hc) != 0)
+  {
+    mutt_list_free(&hc.stale);
+    return -1;
+  }
+
+  LOFF_T before = hcache_file_size(h->path);
+
+  STAILQ_FOREACH(np, &hc.stale, entries)
+  {
+    if (mutt_hcache_delete(h, np->data, strlen(np->data)) == 0)
+      removed++;
+  }
+  mutt_list_free(&hc.stale);
+  mutt_hcache_store_raw(h, HCACHE_COMPACTED, sizeof(HCACHE_COMPACTED) - 1, &now, sizeof(now));
+
+  if ((removed > 0) || force)
+  {
+    if (ops->compact(h->ctx) != 0)
+      mutt_debug(1, "hcache: compacting %s failed\n", h->path);
+    ops->sync(h->ctx);
+  }
+
+  LOFF_T after = hcache_file_size(h->path);
+  if (reclaimed && (after < before))
+    *reclaimed = before - after;
+
+  mutt_debug(2, "hcache: %s: removed %d records of %s\n", h->path, removed, h->folder);
+  return removed;
+}
+
+void mutt_hcache_close_shared(void)
+{
+  while (SharedDbs)
+  {
+    struct HcacheShared *db = SharedDbs;
+    SharedDbs = db->next;
+
+    if (db->refs > 0)
+      mutt_debug(1, "hcache: %s still has %d users\n", db->path, db->refs);
+    db->ops->close(&db->ctx);
+    FREE(&db->path);
+    FREE(&db);
+  }
+}
+
 const char *mutt_hcache_backend_list(void)
 {
   char tmp[STRING] = { 0 };
@@ -938,3 +1377,26 @@ int mutt_hcache_is_valid_backend(const char *s)
 {
   return hcache_get_backend_ops(s) != NULL;
 }
+
+const char *mutt_hcache_compress_list(void)
+{
+  char tmp[STRING] = { 0 };
+  const struct HcacheComprOps **ops = hcache_compr_ops;
+  size_t len = 0;
+
+  for (; *ops; ++ops)
+  {
+    if (len != 0)
+    {
+      len += snprintf(tmp + len, STRING - len, ", ");
+    }
+    len += snprintf(tmp + len, STRING - len, "%s", (*ops)->name);
+  }
+
+  return safe_strdup(tmp);
+}
+
+int mutt_hcache_is_valid_compression(const char *s)
+{
+  return hcache_get_compr_ops(s) != NULL;
+}
@@ -39,11 +39,18 @@
  * -# @subpage hc_lmdb
  * -# @subpage hc_qdbm
  * -# @subpage hc_tc
+ *
+ * Records can be compressed independently of the backend, see
+ * @subpage hc_compr
+ *
+ * The database also holds the text index of local mailboxes, see
+ * @subpage hc_textindex
  */
 
 #ifndef _MUTT_HCACHE_H
 #define _MUTT_HCACHE_H
 
+#include <stdbool.h>
 #include <stddef.h>
 
 struct Header;
@@ -51,6 +58,20 @@ typedef struct HeaderCache header_cache_t;
 
 typedef int (*hcache_namer_t)(const char *path, char *dest, size_t dlen);
 
+/**
+ * hcache_keep_t - Decide whether a record is still in use
+ * @param key    Key of the record, as passed to mutt_hcache_store (not
+ *               NUL-terminated)
+ * @param keylen Length of the key
+ * @param data   Private data passed to mutt_hcache_compact
+ * @retval true  Keep the record
+ * @retval false Delete the record
+ *
+ * If the database is shared with other folders, the key may belong to one of
+ * them.  Unrecognised keys should be kept.
+ */
+typedef bool (*hcache_keep_t)(const char *key, size_t keylen, void *data);
+
 /**
  * mutt_hcache_open - open the connection to the header cache
  * @param path   Location of the header cache (often as specified by the user)
@@ -68,6 +89,14 @@ header_cache_t *mutt_hcache_open(const char *path, const char *folder, hcache_na
  */
 void mutt_hcache_close(header_cache_t *h);
 
+/**
+ * mutt_hcache_close_shared - close the databases kept open across folders
+ *
+ * With $header_cache_shared, mutt_hcache_close() leaves the database open
+ * for the next folder.  This closes them all, e.g. before exiting.
+ */
+void mutt_hcache_close_shared(void);
+
 /**
  * mutt_hcache_fetch - fetch and validate a  message's header from the cache
  * @param h      Pointer to the header_cache_t structure got by mutt_hcache_open
@@ -79,6 +108,7 @@ void mutt_hcache_close(header_cache_t *h);
  *       comparing it with the crc value of the header_cache_t structure.
  * @note The returned pointer must be freed by calling mutt_hcache_free. This
  *       must be done before closing the header cache with mutt_hcache_close.
+ * @note If $header_cache_compress_method is set, the data is decompressed.
  */
 void *mutt_hcache_fetch(header_cache_t *h, const char *key, size_t keylen);
 
@@ -148,6 +178,42 @@ int mutt_hcache_store_raw(header_cache_t *h, const char *key, size_t keylen,
  */
 int mutt_hcache_delete(header_cache_t *h, const char *key, size_t keylen);
 
+/**
+ * mutt_hcache_begin - start a batch of changes
+ * @param h Pointer to the header_cache_t structure got by mutt_hcache_open
+ * @retval 0 on success
+ * @retval -1 otherwise
+ *
+ * The stores and deletes up to mutt_hcache_commit() are written in a single
+ * transaction, if the backend supports them.
+ */
+int mutt_hcache_begin(header_cache_t *h);
+
+/**
+ * mutt_hcache_commit - write a batch of changes started by mutt_hcache_begin
+ * @param h Pointer to the header_cache_t structure got by mutt_hcache_open
+ * @retval 0 on success
+ * @retval -1 otherwise
+ */
+int mutt_hcache_commit(header_cache_t *h);
+
+/**
+ * mutt_hcache_compact - delete stale records and reclaim unused space
+ * @param[in]  h         Pointer to the header_cache_t structure got by mutt_hcache_open
+ * @param[in]  keep      Function deciding which records of the folder to keep
+ * @param[in]  data      Private data for @a keep
+ * @param[in]  force     If false, skip folders compacted within the last day,
+ *                       and reclaim space only if records were deleted
+ * @param[out] reclaimed Number of bytes the database shrank by (may be NULL)
+ * @retval num Number of records deleted
+ * @retval -1  on error
+ *
+ * Only the records of the folder the cache was opened for are considered.
+ * The time of the compaction is stored in the folder's "#compacted" record.
+ */
+int mutt_hcache_compact(header_cache_t *h, hcache_keep_t keep, void *data,
+                        bool force, LOFF_T *reclaimed);
+
 /**
  * mutt_hcache_backend_list - get a list of backend identification strings
  * @retval Comma separated string describing the compiled-in backends
@@ -163,4 +229,19 @@ const char *mutt_hcache_backend_list(void);
  */
 int mutt_hcache_is_valid_backend(const char *s);
 
+/**
+ * mutt_hcache_compress_list - get a list of compression method names
+ * @retval Comma separated string describing the compiled-in methods
+ * @note The returned string must be free'd by the caller
+ */
+const char *mutt_hcache_compress_list(void);
+
+/**
+ * mutt_hcache_is_valid_compression - Is the string a valid compression method
+ * @param s String identifying a compression method
+ * @retval 1 if s is recognized as a valid method
+ * @retval 0 otherwise
+ */
+int mutt_hcache_is_valid_compression(const char *s);
+
 #endif /* _MUTT_HCACHE_H */
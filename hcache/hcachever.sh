@@ -1,6 +1,6 @@
 #!/bin/sh
 
-BASEVERSION=2
+BASEVERSION=3
 
 cleanstruct () {
   echo "$1" | sed -e 's/.* //'
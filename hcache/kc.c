@@ -68,15 +68,14 @@ static void *hcache_kyotocabinet_open(const char *path)
   }
 }
 
-static void *hcache_kyotocabinet_fetch(void *ctx, const char *key, size_t keylen)
+static void *hcache_kyotocabinet_fetch(void *ctx, const char *key,
+                                       size_t keylen, size_t *dlen)
 {
-  size_t sp;
-
   if (!ctx)
     return NULL;
 
   KCDB *db = ctx;
-  return kcdbget(db, key, keylen, &sp);
+  return kcdbget(db, key, keylen, dlen);
 }
 
 static void hcache_kyotocabinet_free(void *vctx, void **data)
@@ -114,6 +113,88 @@ static int hcache_kyotocabinet_delete(void *ctx, const char *key, size_t keylen)
   return 0;
 }
 
+static int hcache_kyotocabinet_walk(void *ctx, hcache_walk_cb_t cb, void *data)
+{
+  size_t ksize, vsize;
+  const char *vbuf = NULL;
+  char *kbuf = NULL;
+
+  if (!ctx)
+    return -1;
+
+  KCDB *db = ctx;
+  KCCUR *cur = kcdbcursor(db);
+  if (!cur)
+    return -1;
+
+  kccurjump(cur);
+  while ((kbuf = kccurget(cur, &ksize, &vbuf, &vsize, 1)))
+  {
+    int stop = cb(kbuf, ksize, data);
+    kcfree(kbuf);
+    if (stop != 0)
+      break;
+  }
+
+  kccurdel(cur);
+  return 0;
+}
+
+static int hcache_kyotocabinet_compact(void *ctx)
+{
+  /* Tree databases are defragmented on the fly */
+  return 0;
+}
+
+static int hcache_kyotocabinet_begin(void *ctx)
+{
+  if (!ctx)
+    return -1;
+
+  KCDB *db = ctx;
+  if (!kcdbbegintran(db, 0))
+  {
+#ifdef DEBUG
+    int ecode = kcdbecode(db);
+    mutt_debug(2, "kcdbbegintran failed: %s (ecode %d)\n", kcdbemsg(db), ecode);
+#endif
+    return -1;
+  }
+  return 0;
+}
+
+static int hcache_kyotocabinet_commit(void *ctx)
+{
+  if (!ctx)
+    return -1;
+
+  KCDB *db = ctx;
+  if (!kcdbendtran(db, 1))
+  {
+#ifdef DEBUG
+    int ecode = kcdbecode(db);
+    mutt_debug(2, "kcdbendtran failed: %s (ecode %d)\n", kcdbemsg(db), ecode);
+#endif
+    return -1;
+  }
+  return 0;
+}
+
+static void hcache_kyotocabinet_sync(void *ctx)
+{
+  if (!ctx)
+    return;
+
+  KCDB *db = ctx;
+  if (!kcdbsync(db, 0, NULL, NULL))
+  {
+#ifdef DEBUG
+    int ecode = kcdbecode(db);
+    mutt_debug(2, "kcdbsync failed: %s (ecode %d)\n", kcdbemsg(db), ecode);
+#endif
+  }
+}
+
 static void hcache_kyotocabinet_close(void **ctx)
 {
   if (!ctx || !*ctx)
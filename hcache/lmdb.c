@@ -158,7 +158,7 @@ fail_env:
   return NULL;
 }
 
-static void *hcache_lmdb_fetch(void *vctx, const char *key, size_t keylen)
+static void *hcache_lmdb_fetch(void *vctx, const char *key, size_t keylen, size_t *dlen)
 {
   MDB_val dkey;
   MDB_val data;
@@ -191,6 +191,7 @@ static void *hcache_lmdb_fetch(void *vctx, const char *key, size_t keylen)
     return NULL;
   }
 
+  *dlen = data.mv_size;
   return data.mv_data;
 }
 
@@ -261,6 +262,105 @@ static int hcache_lmdb_delete(void *vctx, const char *key, size_t keylen)
   return rc;
 }
 
+static int hcache_lmdb_walk(void *vctx, hcache_walk_cb_t cb, void *data)
+{
+  MDB_cursor *cur = NULL;
+  MDB_val dkey;
+  MDB_val ddata;
+  int rc;
+
+  if (!vctx)
+    return -1;
+
+  struct HcacheLmdbCtx *ctx = vctx;
+
+  rc = mdb_get_r_txn(ctx);
+  if (rc != MDB_SUCCESS)
+    return -1;
+
+  rc = mdb_cursor_open(ctx->txn, ctx->db, &cur);
+  if (rc != MDB_SUCCESS)
+  {
+    mutt_debug(2, "hcache_lmdb_walk: mdb_cursor_open: %s\n", mdb_strerror(rc));
+    return -1;
+  }
+
+  while ((rc = mdb_cursor_get(cur, &dkey, &ddata, MDB_NEXT)) == MDB_SUCCESS)
+  {
+    if (cb(dkey.mv_data, dkey.mv_size, data) != 0)
+      break;
+  }
+
+  mdb_cursor_close(cur);
+  return ((rc == MDB_SUCCESS) || (rc == MDB_NOTFOUND)) ? 0 : -1;
+}
+
+static int hcache_lmdb_compact(void *vctx)
+{
+  /* Free pages are reused by later writes; the file never shrinks */
+  return 0;
+}
+
+static int hcache_lmdb_begin(void *vctx)
+{
+  if (!vctx)
+    return -1;
+
+  /* Stores already share a write transaction until the next sync; take the
+   * writer lock up front, so the batch can't fail half-way on it */
+  return (mdb_get_w_txn(vctx) == MDB_SUCCESS) ? 0 : -1;
+}
+
+static int hcache_lmdb_commit(void *vctx)
+{
+  int rc;
+
+  if (!vctx)
+    return -1;
+
+  struct HcacheLmdbCtx *ctx = vctx;
+
+  if (!ctx->txn || ctx->txn_mode != TXN_WRITE)
+    return 0;
+
+  rc = mdb_txn_commit(ctx->txn);
+  ctx->txn_mode = TXN_UNINITIALIZED;
+  ctx->txn = NULL;
+  if (rc != MDB_SUCCESS)
+  {
+    mutt_debug(2, "hcache_lmdb_commit: mdb_txn_commit: %s\n", mdb_strerror(rc));
+    return -1;
+  }
+  return 0;
+}
+
+static void hcache_lmdb_sync(void *vctx)
+{
+  int rc;
+
+  if (!vctx)
+    return;
+
+  struct HcacheLmdbCtx *ctx = vctx;
+
+  if (ctx->txn && ctx->txn_mode == TXN_WRITE)
+  {
+    /* A write transaction holds the writer lock, which other processes
+     * would block on */
+    rc = mdb_txn_commit(ctx->txn);
+    if (rc != MDB_SUCCESS)
+      mutt_debug(2, "hcache_lmdb_sync: mdb_txn_commit: %s\n", mdb_strerror(rc));
+    ctx->txn_mode = TXN_UNINITIALIZED;
+    ctx->txn = NULL;
+  }
+  else if (ctx->txn && ctx->txn_mode == TXN_READ)
+  {
+    /* Release the snapshot, so that the next read sees other writers' changes */
+    mdb_txn_reset(ctx->txn);
+    ctx->txn_mode = TXN_UNINITIALIZED;
+  }
+}
+
 static void hcache_lmdb_close(void **vctx)
 {
   if (!vctx || !*vctx)
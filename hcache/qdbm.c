@@ -48,13 +48,17 @@ static void *hcache_qdbm_open(const char *path)
   return vlopen(path, flags, VL_CMPLEX);
 }
 
-static void *hcache_qdbm_fetch(void *ctx, const char *key, size_t keylen)
+static void *hcache_qdbm_fetch(void *ctx, const char *key, size_t keylen, size_t *dlen)
 {
+  int sp = 0;
+
   if (!ctx)
     return NULL;
 
   VILLA *db = ctx;
-  return vlget(db, key, keylen, NULL);
+  void *data = vlget(db, key, keylen, &sp);
+  *dlen = sp;
+  return data;
 }
 
 static void hcache_qdbm_free(void *ctx, void **data)
@@ -86,6 +90,69 @@ static int hcache_qdbm_delete(void *ctx, const char *key, size_t keylen)
   return success ? 0 : dpecode ? dpecode : -1;
 }
 
+static int hcache_qdbm_walk(void *ctx, hcache_walk_cb_t cb, void *data)
+{
+  char *key = NULL;
+  int ksize;
+
+  if (!ctx)
+    return -1;
+
+  VILLA *db = ctx;
+
+  if (!vlcurfirst(db))
+    return 0;
+
+  do
+  {
+    key = vlcurkey(db, &ksize);
+    if (!key)
+      break;
+    int stop = cb(key, ksize, data);
+    FREE(&key);
+    if (stop != 0)
+      break;
+  } while (vlcurnext(db));
+
+  return 0;
+}
+
+static int hcache_qdbm_compact(void *ctx)
+{
+  if (!ctx)
+    return -1;
+
+  VILLA *db = ctx;
+  return vloptimize(db) ? 0 : -1;
+}
+
+static int hcache_qdbm_begin(void *ctx)
+{
+  if (!ctx)
+    return -1;
+
+  VILLA *db = ctx;
+  return vltranbegin(db) ? 0 : -1;
+}
+
+static int hcache_qdbm_commit(void *ctx)
+{
+  if (!ctx)
+    return -1;
+
+  VILLA *db = ctx;
+  return vltrancommit(db) ? 0 : -1;
+}
+
+static void hcache_qdbm_sync(void *ctx)
+{
+  if (!ctx)
+    return;
+
+  VILLA *db = ctx;
+  vlsync(db);
+}
+
 static void hcache_qdbm_close(void **ctx)
 {
   if (!ctx || !*ctx)
@@ -32,6 +32,7 @@
 
 #include "config.h"
 #include <stddef.h>
+#include <stdint.h>
 #include <tcbdb.h>
 #include <tcutil.h>
 #include "backend.h"
@@ -59,15 +60,18 @@ static void *hcache_tokyocabinet_open(const char *path)
   }
 }
 
-static void *hcache_tokyocabinet_fetch(void *ctx, const char *key, size_t keylen)
+static void *hcache_tokyocabinet_fetch(void *ctx, const char *key,
+                                       size_t keylen, size_t *dlen)
 {
-  int sp;
+  int sp = 0;
 
   if (!ctx)
     return NULL;
 
   TCBDB *db = ctx;
-  return tcbdbget(db, key, keylen, &sp);
+  void *data = tcbdbget(db, key, keylen, &sp);
+  *dlen = sp;
+  return data;
 }
 
 static void hcache_tokyocabinet_free(void *ctx, void **data)
@@ -104,6 +108,99 @@ static int hcache_tokyocabinet_delete(void *ctx, const char *key, size_t keylen)
   return 0;
 }
 
+static int hcache_tokyocabinet_walk(void *ctx, hcache_walk_cb_t cb, void *data)
+{
+  const void *key = NULL;
+  int ksize;
+
+  if (!ctx)
+    return -1;
+
+  TCBDB *db = ctx;
+  BDBCUR *cur = tcbdbcurnew(db);
+  if (!cur)
+    return -1;
+
+  if (tcbdbcurfirst(cur))
+  {
+    do
+    {
+      key = tcbdbcurkey3(cur, &ksize);
+      if (!key || (cb(key, ksize, data) != 0))
+        break;
+    } while (tcbdbcurnext(cur));
+  }
+
+  tcbdbcurdel(cur);
+  return 0;
+}
+
+static int hcache_tokyocabinet_compact(void *ctx)
+{
+  if (!ctx)
+    return -1;
+
+  TCBDB *db = ctx;
+  if (!tcbdboptimize(db, 0, 0, 0, -1, -1, UINT8_MAX))
+  {
+#ifdef DEBUG
+    int ecode = tcbdbecode(db);
+    mutt_debug(2, "tcbdboptimize failed: %s (ecode %d)\n", tcbdberrmsg(ecode), ecode);
+#endif
+    return -1;
+  }
+  return 0;
+}
+
+static int hcache_tokyocabinet_begin(void *ctx)
+{
+  if (!ctx)
+    return -1;
+
+  TCBDB *db = ctx;
+  if (!tcbdbtranbegin(db))
+  {
+#ifdef DEBUG
+    int ecode = tcbdbecode(db);
+    mutt_debug(2, "tcbdbtranbegin failed: %s (ecode %d)\n", tcbdberrmsg(ecode), ecode);
+#endif
+    return -1;
+  }
+  return 0;
+}
+
+static int hcache_tokyocabinet_commit(void *ctx)
+{
+  if (!ctx)
+    return -1;
+
+  TCBDB *db = ctx;
+  if (!tcbdbtrancommit(db))
+  {
+#ifdef DEBUG
+    int ecode = tcbdbecode(db);
+    mutt_debug(2, "tcbdbtrancommit failed: %s (ecode %d)\n", tcbdberrmsg(ecode), ecode);
+#endif
+    return -1;
+  }
+  return 0;
+}
+
+static void hcache_tokyocabinet_sync(void *ctx)
+{
+  if (!ctx)
+    return;
+
+  TCBDB *db = ctx;
+  if (!tcbdbsync(db))
+  {
+#ifdef DEBUG
+    int ecode = tcbdbecode(db);
+    mutt_debug(2, "tcbdbsync failed: %s (ecode %d)\n", tcbdberrmsg(ecode), ecode);
+#endif
+  }
+}
+
 static void hcache_tokyocabinet_close(void **ctx)
 {
   if (!ctx || !*ctx)
@@ -0,0 +1,645 @@
+/**
+ * @file
+ * Text index of local mailboxes, for body and header searches
+ *
+ * @copyright
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @page hc_textindex Text index
+ *
+ * An inverted index of the trigrams of the messages, which tells which
+ * messages can't match a ~b, ~B or ~h search, without reading them.
+ *
+ * Each message (document) gets a number when it's indexed.  For each trigram
+ * (three bytes of a line, ASCII letters folded to lower case), the index lists
+ * the documents containing it.  A search for a text only has to read the
+ * messages whose documents contain all of its trigrams.
+ *
+ * The records share the header cache database of the mailbox:
+ *
+ * | Key                | Data                                             |
+ * | :----------------- | :----------------------------------------------- |
+ * | `#textM:next`      | Next free document number                        |
+ * | `#textM:doc:KEY`   | struct TextIndexDoc of the message KEY           |
+ * | `#textM:XXXXXX`    | Documents containing the trigram XXXXXX (in hex) |
+ *
+ * M is 'r' for the raw messages, 'd' for the decoded ones ($thorough_search).
+ * KEY is the header cache key of the message.
+ *
+ * The lists of documents are delta-encoded varints, following a struct
+ * TextIndexPosting.  The documents are numbered in increasing order, so new
+ * ones are appended.  The number of a message that was deleted, or changed,
+ * stays in the lists: it just makes the index find more candidates.
+ *
+ * Compacting the header cache removes the documents of the messages that are
+ * gone.  Once most of the numbers are dead, the whole index is dropped, and
+ * built again as the messages are searched.
+ *
+ * The messages are indexed lazily, when a search reads them.  The new
+ * documents are written in one transaction, when the index is closed, so a
+ * message is never found in the index before all its trigrams are.
+ */
+
+#include "config.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include "lib/lib.h"
+#include "mutt.h"
+#include "textindex.h"
+#include "context.h"
+#include "globals.h"
+#include "hcache.h"
+#include "header.h"
+#include "list.h"
+#include "mx.h"
+#include "ncrypt/ncrypt.h"
+#include "options.h"
+#include "protos.h"
+
+#define TI_PREFIX "#text"
+#define TI_TRIGRAMS (1 << 24)
+/* Write the index when this many (trigram, document) pairs are waiting */
+#define TI_FLUSH (1 << 22)
+/* Drop the index when it has more dead documents than this, and than live */
+#define TI_STALE 1024
+
+/**
+ * struct TextIndexDoc - A message of the index
+ */
+struct TextIndexDoc
+{
+  unsigned int docid; /**< Document number */
+  off_t size;         /**< Size of the message file, when it was indexed */
+  time_t mtime;       /**< Modification time of the message file */
+};
+
+/**
+ * struct TextIndexPosting - Start of the list of documents of a trigram
+ */
+struct TextIndexPosting
+{
+  unsigned int len;  /**< Length of the varints following the struct */
+  unsigned int last; /**< Last document of the list */
+};
+
+/**
+ * struct TextIndexNew - A message indexed, to be written
+ */
+struct TextIndexNew
+{
+  int msgno;
+  struct TextIndexDoc doc;
+};
+
+/**
+ * struct TextIndex - Text index of a mailbox
+ */
+struct TextIndex
+{
+  header_cache_t *hc;
+  struct Context *ctx;
+  char mode;               /**< 'r' raw text, 'd' decoded text */
+  unsigned int first;      /**< First document number of this session */
+  unsigned int next;       /**< Next free document number */
+  unsigned int *docids;    /**< Document of each message, 0 if none */
+  unsigned char *seen;     /**< Trigrams of the current document, a bitmap */
+  uint64_t *pending;       /**< (trigram << 32) | document, waiting to be written */
+  size_t npending;
+  size_t pending_max;
+  struct TextIndexNew *added; /**< Documents waiting to be written */
+  size_t nadded;
+  size_t added_max;
+};
+
+/**
+ * tindex_fold - Fold a byte for the index
+ */
+static inline unsigned int tindex_fold(unsigned char c)
+{
+  return ((c >= 'A') && (c <= 'Z')) ? (c - 'A' + 'a') : c;
+}
+
+static int tindex_pending_cmp(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *) a;
+  uint64_t y = *(const uint64_t *) b;
+  return (x > y) - (x < y);
+}
+
+static int tindex_docid_cmp(const void *a, const void *b)
+{
+  unsigned int x = *(const unsigned int *) a;
+  unsigned int y = *(const unsigned int *) b;
+  return (x > y) - (x < y);
+}
+
+static void tindex_message_path(struct TextIndex *idx, int msgno, char *buf, size_t buflen)
+{
+  snprintf(buf, buflen, "%s/%s", idx->ctx->path, idx->ctx->hdrs[msgno]->path);
+}
+
+static size_t tindex_doc_key(struct TextIndex *idx, int msgno, char *buf, size_t buflen)
+{
+  size_t keylen;
+  const char *key = mh_hcache_key(idx->ctx, idx->ctx->hdrs[msgno], &keylen);
+
+  return snprintf(buf, buflen, TI_PREFIX "%c:doc:%.*s", idx->mode, (int) keylen, key);
+}
+
+static size_t tindex_trigram_key(struct TextIndex *idx, unsigned int t, char *buf, size_t buflen)
+{
+  return snprintf(buf, buflen, TI_PREFIX "%c:%06x", idx->mode, t);
+}
+
+static size_t tindex_next_key(char mode, char *buf, size_t buflen)
+{
+  return snprintf(buf, buflen, TI_PREFIX "%c:next", mode);
+}
+
+static unsigned int tindex_fetch_next(header_cache_t *hc, char mode)
+{
+  char key[32];
+  unsigned int next = 1;
+
+  size_t keylen = tindex_next_key(mode, key, sizeof(key));
+  void *data = mutt_hcache_fetch_raw(hc, key, keylen);
+  if (data)
+  {
+    memcpy(&next, data, sizeof(next));
+    mutt_hcache_free(hc, &data);
+  }
+  return next;
+}
+
+struct TextIndex *mutt_tindex_open(struct Context *ctx)
+{
+  if (!option(OPT_SEARCH_INDEX) || !ctx || !HeaderCache ||
+      ((ctx->magic != MUTT_MAILDIR) && (ctx->magic != MUTT_MH)))
+    return NULL;
+
+  header_cache_t *hc = mutt_hcache_open(HeaderCache, ctx->path, NULL);
+  if (!hc)
+    return NULL;
+
+  struct TextIndex *idx = safe_calloc(1, sizeof(struct TextIndex));
+  idx->hc = hc;
+  idx->ctx = ctx;
+  idx->mode = option(OPT_THOROUGH_SRC) ? 'd' : 'r';
+  idx->next = idx->first = tindex_fetch_next(hc, idx->mode);
+  return idx;
+}
+
+/**
+ * tindex_load_docs - Find the documents of the messages
+ * @param idx Text index
+ *
+ * A document is only used if its message hasn't changed since it was indexed.
+ */
+static void tindex_load_docs(struct TextIndex *idx)
+{
+  struct Context *ctx = idx->ctx;
+  char key[_POSIX_PATH_MAX + 32];
+  struct TextIndexDoc doc;
+
+  if (idx->docids)
+    return;
+
+  idx->docids = safe_calloc(MAX(ctx->msgcount, 1), sizeof(unsigned int));
+
+  struct BulkRead *reqs = safe_calloc(MAX(ctx->msgcount, 1), sizeof(struct BulkRead));
+  char **paths = safe_calloc(MAX(ctx->msgcount, 1), sizeof(char *));
+  for (int i = 0; i < ctx->msgcount; i++)
+  {
+    tindex_message_path(idx, i, key, sizeof(key));
+    paths[i] = safe_strdup(key);
+    reqs[i].path = paths[i];
+  }
+  mutt_bulk_read(reqs, ctx->msgcount, WorkerThreads);
+
+  for (int i = 0; i < ctx->msgcount; i++)
+  {
+    if (reqs[i].err)
+      continue;
+
+    size_t keylen = tindex_doc_key(idx, i, key, sizeof(key));
+    void *data = mutt_hcache_fetch_raw(idx->hc, key, keylen);
+    if (!data)
+      continue;
+
+    memcpy(&doc, data, sizeof(doc));
+    mutt_hcache_free(idx->hc, &data);
+    if ((doc.size == reqs[i].size) && (doc.mtime == reqs[i].mtime))
+      idx->docids[i] = doc.docid;
+  }
+
+  for (int i = 0; i < ctx->msgcount; i++)
+    FREE(&paths[i]);
+  FREE(&paths);
+  FREE(&reqs);
+}
+
+/**
+ * tindex_write - Write the new documents to the database
+ * @param idx Text index
+ *
+ * If another process has indexed documents meanwhile, their numbers may
+ * clash: the new documents are dropped, to be indexed again later.
+ */
+static void tindex_write(struct TextIndex *idx)
+{
+  char key[_POSIX_PATH_MAX + 32];
+  struct TextIndexPosting post;
+  unsigned char *buf = NULL;
+  size_t bufsize = 0;
+  size_t keylen;
+
+  if (idx->nadded == 0)
+    return;
+
+  mutt_hcache_begin(idx->hc);
+
+  unsigned int next = tindex_fetch_next(idx->hc, idx->mode);
+  if (next != idx->first)
+  {
+    mutt_debug(1, "tindex_write: %s was indexed by another process\n", idx->ctx->path);
+    for (size_t i = 0; i < idx->nadded; i++)
+      idx->docids[idx->added[i].msgno] = 0;
+    idx->first = idx->next = next;
+    goto done;
+  }
+
+  qsort(idx->pending, idx->npending, sizeof(uint64_t), tindex_pending_cmp);
+
+  for (size_t i = 0; i < idx->npending;)
+  {
+    unsigned int t = idx->pending[i] >> 32;
+    size_t j;
+
+    post.len = 0;
+    post.last = 0;
+    keylen = tindex_trigram_key(idx, t, key, sizeof(key));
+    void *data = mutt_hcache_fetch_raw(idx->hc, key, keylen);
+    if (data)
+      memcpy(&post, data, sizeof(post));
+
+    for (j = i; (j < idx->npending) && ((idx->pending[j] >> 32) == t); j++)
+      ;
+
+    /* Each new document takes at most five bytes */
+    size_t need = sizeof(post) + post.len + 5 * (j - i);
+    if (need > bufsize)
+    {
+      bufsize = need;
+      safe_realloc(&buf, bufsize);
+    }
+    if (data)
+    {
+      memcpy(buf + sizeof(post), (unsigned char *) data + sizeof(post), post.len);
+      mutt_hcache_free(idx->hc, &data);
+    }
+
+    for (; i < j; i++)
+    {
+      unsigned int docid = (unsigned int) idx->pending[i];
+      unsigned int delta = docid - post.last;
+      while (delta >= 0x80)
+      {
+        buf[sizeof(post) + post.len++] = (delta & 0x7f) | 0x80;
+        delta >>= 7;
+      }
+      buf[sizeof(post) + post.len++] = delta;
+      post.last = docid;
+    }
+
+    memcpy(buf, &post, sizeof(post));
+    mutt_hcache_store_raw(idx->hc, key, keylen, buf, sizeof(post) + post.len);
+  }
+
+  /* The documents last, so they're never found without their trigrams */
+  for (size_t i = 0; i < idx->nadded; i++)
+  {
+    keylen = tindex_doc_key(idx, idx->added[i].msgno, key, sizeof(key));
+    mutt_hcache_store_raw(idx->hc, key, keylen, &idx->added[i].doc,
+                          sizeof(struct TextIndexDoc));
+  }
+
+  keylen = tindex_next_key(idx->mode, key, sizeof(key));
+  mutt_hcache_store_raw(idx->hc, key, keylen, &idx->next, sizeof(idx->next));
+  idx->first = idx->next;
+
+  mutt_debug(2, "tindex_write: %s: %zu documents, %zu trigrams\n",
+             idx->ctx->path, idx->nadded, idx->npending);
+
+done:
+  mutt_hcache_commit(idx->hc);
+  FREE(&buf);
+  idx->npending = 0;
+  idx->nadded = 0;
+}
+
+void mutt_tindex_close(struct TextIndex **idx)
+{
+  if (!idx || !*idx)
+    return;
+
+  tindex_write(*idx);
+  mutt_hcache_close((*idx)->hc);
+  FREE(&(*idx)->docids);
+  FREE(&(*idx)->seen);
+  FREE(&(*idx)->pending);
+  FREE(&(*idx)->added);
+  FREE(idx);
+}
+
+bool mutt_tindex_wants(struct TextIndex *idx, int msgno)
+{
+  if (!idx || (msgno < 0) || (msgno >= idx->ctx->msgcount))
+    return false;
+
+  tindex_load_docs(idx);
+  if (idx->docids[msgno] != 0)
+    return false;
+
+  /* Never store the text of decrypted messages */
+  if ((idx->mode == 'd') && WithCrypto && idx->ctx->hdrs[msgno]->security)
+    return false;
+
+  return true;
+}
+
+/**
+ * tindex_add_text - Add the trigrams of some text to the current document
+ * @param idx   Text index
+ * @param docid Document
+ * @param s     Text
+ * @param len   Length of the text
+ * @param t     Last bytes of the previous text, updated
+ * @param n     Number of bytes in @a t, updated
+ *
+ * Lines, and strings (the searches use C strings), are indexed separately.
+ */
+static void tindex_add_text(struct TextIndex *idx, unsigned int docid,
+                            const char *s, size_t len, unsigned int *t, int *n)
+{
+  for (size_t i = 0; i < len; i++)
+  {
+    unsigned char c = s[i];
+    if ((c == '\n') || (c == '\0'))
+    {
+      *n = 0;
+      continue;
+    }
+
+    *t = ((*t << 8) | tindex_fold(c)) & (TI_TRIGRAMS - 1);
+    if ((++*n < 3) || (idx->seen[*t >> 3] & (1 << (*t & 7))))
+      continue;
+
+    idx->seen[*t >> 3] |= (1 << (*t & 7));
+    if (idx->npending == idx->pending_max)
+    {
+      idx->pending_max = MAX(2 * idx->pending_max, 4096);
+      safe_realloc(&idx->pending, idx->pending_max * sizeof(uint64_t));
+    }
+    idx->pending[idx->npending++] = ((uint64_t) *t << 32) | docid;
+  }
+}
+
+void mutt_tindex_add(struct TextIndex *idx, int msgno, FILE *fp)
+{
+  char path[_POSIX_PATH_MAX];
+  char block[BUFSIZ];
+  struct stat st;
+  unsigned int t = 0;
+  int n;
+  size_t len;
+
+  if (!mutt_tindex_wants(idx, msgno))
+    return;
+
+  tindex_message_path(idx, msgno, path, sizeof(path));
+  if (stat(path, &st) != 0)
+    return;
+
+  if (!idx->seen)
+    idx->seen = safe_calloc(1, TI_TRIGRAMS / 8);
+
+  unsigned int docid = idx->next++;
+  size_t start = idx->npending;
+  LOFF_T offset = ftello(fp);
+
+  /* The searches of ~h read the header fields unfolded */
+  size_t blen = STRING;
+  char *buf = safe_malloc(blen);
+  while (*(buf = mutt_read_rfc822_line(fp, buf, &blen)) != '\0')
+  {
+    n = 0;
+    tindex_add_text(idx, docid, buf, strlen(buf), &t, &n);
+  }
+  FREE(&buf);
+
+  /* and the others read the lines, header included */
+  fseeko(fp, offset, SEEK_SET);
+  n = 0;
+  while ((len = fread(block, 1, sizeof(block), fp)) > 0)
+    tindex_add_text(idx, docid, block, len, &t, &n);
+
+  for (size_t i = start; i < idx->npending; i++)
+  {
+    t = (idx->pending[i] >> 32);
+    idx->seen[t >> 3] &= ~(1 << (t & 7));
+  }
+
+  if (idx->nadded == idx->added_max)
+  {
+    idx->added_max = MAX(2 * idx->added_max, 64);
+    safe_realloc(&idx->added, idx->added_max * sizeof(struct TextIndexNew));
+  }
+  idx->added[idx->nadded].msgno = msgno;
+  idx->added[idx->nadded].doc.docid = docid;
+  idx->added[idx->nadded].doc.size = st.st_size;
+  idx->added[idx->nadded].doc.mtime = st.st_mtime;
+  idx->nadded++;
+  idx->docids[msgno] = docid;
+
+  if (idx->npending >= TI_FLUSH)
+    tindex_write(idx);
+}
+
+/**
+ * tindex_fetch_docs - Get the documents containing a trigram
+ * @param[in]  idx  Text index
+ * @param[in]  t    Trigram
+ * @param[out] docs Documents, in increasing order
+ * @retval num Number of documents
+ */
+static size_t tindex_fetch_docs(struct TextIndex *idx, unsigned int t, unsigned int **docs)
+{
+  char key[32];
+  struct TextIndexPosting post;
+  size_t count = 0;
+  unsigned int docid = 0;
+
+  *docs = NULL;
+  size_t keylen = tindex_trigram_key(idx, t, key, sizeof(key));
+  void *data = mutt_hcache_fetch_raw(idx->hc, key, keylen);
+  if (!data)
+    return 0;
+
+  memcpy(&post, data, sizeof(post));
+  const unsigned char *p = (unsigned char *) data + sizeof(post);
+
+  /* Every document takes at least one byte */
+  *docs = safe_malloc(MAX(post.len, 1) * sizeof(unsigned int));
+  for (unsigned int i = 0; i < post.len;)
+  {
+    unsigned int delta = 0;
+    for (int shift = 0; i < post.len; shift += 7)
+    {
+      delta |= (unsigned int) (p[i] & 0x7f) << shift;
+      if (!(p[i++] & 0x80))
+        break;
+    }
+    docid += delta;
+    (*docs)[count++] = docid;
+  }
+
+  mutt_hcache_free(idx->hc, &data);
+  return count;
+}
+
+unsigned char *mutt_tindex_query(struct TextIndex *idx, const struct ListHead *literals, bool icase)
+{
+  struct ListNode *np = NULL;
+  unsigned int *trigrams = NULL;
+  size_t ntrigrams = 0, maxtrigrams = 0;
+  unsigned int *docs = NULL, *more = NULL;
+  size_t ndocs = 0, nmore;
+
+  if (!idx)
+    return NULL;
+
+  /* The trigrams written so far have to be found */
+  tindex_write(idx);
+
+  STAILQ_FOREACH(np, literals, entries)
+  {
+    const unsigned char *s = (const unsigned char *) np->data;
+    unsigned int t = 0;
+    int n = 0;
+
+    for (; *s; s++)
+    {
+      /* Other bytes may match several encodings of a letter, ignoring case */
+      if ((*s == '\n') || (icase && (*s >= 0x80)))
+      {
+        n = 0;
+        continue;
+      }
+      t = ((t << 8) | tindex_fold(*s)) & (TI_TRIGRAMS - 1);
+      if (++n < 3)
+        continue;
+      if (ntrigrams == maxtrigrams)
+      {
+        maxtrigrams = MAX(2 * maxtrigrams, 16);
+        safe_realloc(&trigrams, maxtrigrams * sizeof(unsigned int));
+      }
+      trigrams[ntrigrams++] = t;
+    }
+  }
+
+  if (ntrigrams == 0)
+    return NULL;
+
+  tindex_load_docs(idx);
+
+  for (size_t i = 0; i < ntrigrams; i++)
+  {
+    nmore = tindex_fetch_docs(idx, trigrams[i], &more);
+    if (i == 0)
+    {
+      docs = more;
+      ndocs = nmore;
+    }
+    else
+    {
+      /* Intersect the sorted lists */
+      size_t k = 0;
+      for (size_t a = 0, b = 0; (a < ndocs) && (b < nmore);)
+      {
+        if (docs[a] < more[b])
+          a++;
+        else if (docs[a] > more[b])
+          b++;
+        else
+        {
+          docs[k++] = docs[a++];
+          b++;
+        }
+      }
+      ndocs = k;
+      FREE(&more);
+    }
+    if (ndocs == 0)
+      break;
+  }
+  FREE(&trigrams);
+
+  unsigned char *hits = safe_calloc(MAX(idx->ctx->msgcount, 1), 1);
+  for (int i = 0; i < idx->ctx->msgcount; i++)
+  {
+    if (idx->docids[i] == 0)
+      hits[i] = TI_UNINDEXED;
+    else if (ndocs && bsearch(&idx->docids[i], docs, ndocs, sizeof(unsigned int), tindex_docid_cmp))
+      hits[i] = TI_MAYBE;
+    else
+      hits[i] = TI_NO_MATCH;
+  }
+
+  FREE(&docs);
+  return hits;
+}
+
+int mutt_tindex_record(const char *key, size_t keylen, const char **msgkey, size_t *msgkeylen)
+{
+  const size_t plen = sizeof(TI_PREFIX) - 1;
+
+  *msgkey = NULL;
+  if ((keylen < plen + 2) || (strncmp(key, TI_PREFIX, plen) != 0) ||
+      ((key[plen] != 'r') && (key[plen] != 'd')) || (key[plen + 1] != ':'))
+    return 0;
+
+  if ((keylen > plen + 6) && (strncmp(key + plen + 2, "doc:", 4) == 0))
+  {
+    *msgkey = key + plen + 6;
+    *msgkeylen = keylen - plen - 6;
+  }
+  return key[plen];
+}
+
+bool mutt_tindex_stale(struct HeaderCache *hc, char mode, int msgcount)
+{
+  /* Every message has at most one live document */
+  unsigned int docs = tindex_fetch_next(hc, mode) - 1;
+  unsigned int live = MAX(msgcount, 0);
+
+  return (docs > live) && (docs - live > MAX(live, TI_STALE));
+}
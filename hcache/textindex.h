@@ -0,0 +1,116 @@
+/**
+ * @file
+ * Text index of local mailboxes, for body and header searches
+ *
+ * @copyright
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _MUTT_HCACHE_TEXTINDEX_H
+#define _MUTT_HCACHE_TEXTINDEX_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+struct Context;
+struct HeaderCache;
+struct ListHead;
+struct TextIndex;
+
+/**
+ * enum TextIndexHit - Can a message contain a text, according to the index
+ */
+enum TextIndexHit
+{
+  TI_NO_MATCH = 0, /**< The message doesn't contain the text */
+  TI_MAYBE,        /**< The message has to be searched */
+  TI_UNINDEXED,    /**< The message isn't indexed yet; it has to be searched */
+};
+
+/**
+ * mutt_tindex_open - Open the text index of a mailbox
+ * @param ctx Mailbox
+ * @retval ptr  Text index
+ * @retval NULL If $search_index is unset, or the mailbox can't be indexed
+ *
+ * Only maildir and MH mailboxes are indexed.  The index is stored in the
+ * header cache, keyed like the cached headers.  It indexes the text that
+ * $thorough_search makes the searches read: raw or decoded.
+ */
+struct TextIndex *mutt_tindex_open(struct Context *ctx);
+
+/**
+ * mutt_tindex_close - Write the new documents and close the text index
+ * @param idx Text index
+ */
+void mutt_tindex_close(struct TextIndex **idx);
+
+/**
+ * mutt_tindex_wants - Should a message be added to the text index
+ * @param idx   Text index
+ * @param msgno Index of the message in the mailbox
+ * @retval true If the message isn't indexed yet, and may be
+ */
+bool mutt_tindex_wants(struct TextIndex *idx, int msgno);
+
+/**
+ * mutt_tindex_add - Add a message to the text index
+ * @param idx   Text index
+ * @param msgno Index of the message in the mailbox
+ * @param fp    Text of the message, positioned at the start of its header
+ *
+ * The whole text, up to the end of @a fp, is indexed.  The position of @a fp
+ * is undefined afterwards.
+ */
+void mutt_tindex_add(struct TextIndex *idx, int msgno, FILE *fp);
+
+/**
+ * mutt_tindex_query - Find the messages which may contain some texts
+ * @param idx      Text index
+ * @param literals Texts that all have to be found, struct ListHead of strings
+ * @param icase    If true, the texts are searched ignoring their case
+ * @retval ptr  #TextIndexHit of each message, to be freed by the caller
+ * @retval NULL The texts are too short to use the index
+ */
+unsigned char *mutt_tindex_query(struct TextIndex *idx, const struct ListHead *literals, bool icase);
+
+/**
+ * mutt_tindex_record - Recognise a record of the text index
+ * @param[in]  key       Key of a header cache record, without the folder
+ * @param[in]  keylen    Length of the key
+ * @param[out] msgkey    Header cache key of the message, if it's a document
+ * @param[out] msgkeylen Length of @a msgkey
+ * @retval 'r' A record of the index of the raw messages
+ * @retval 'd' A record of the index of the decoded messages
+ * @retval 0   Not a record of the text index
+ *
+ * A document record lives as long as its message.  @a msgkey is set to NULL
+ * for the other records.
+ */
+int mutt_tindex_record(const char *key, size_t keylen, const char **msgkey, size_t *msgkeylen);
+
+/**
+ * mutt_tindex_stale - Is a text index made mostly of dead documents
+ * @param hc       Header cache of the mailbox
+ * @param mode     Index: 'r' raw messages, 'd' decoded messages
+ * @param msgcount Number of messages in the mailbox
+ * @retval true If the index should be dropped, to be built again
+ *
+ * The documents of deleted or changed messages stay in the lists of
+ * trigrams.  Once they dominate, the lists are dropped with the rest of the
+ * index, when the header cache is compacted.
+ */
+bool mutt_tindex_stale(struct HeaderCache *hc, char mode, int msgcount);
+
+#endif /* _MUTT_HCACHE_TEXTINDEX_H */
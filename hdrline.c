@@ -1045,11 +1045,11 @@ static const char *hdr_format_str(char *dest, size_t destlen, size_t col, int co
           colorlen = add_index_color(dest, destlen, flags, MT_COLOR_INDEX_SUBJECT);
           mutt_format_s(dest + colorlen, destlen - colorlen, "", NONULL(subj));
           add_index_color(dest + colorlen, destlen - colorlen, flags, MT_COLOR_INDEX);
-          snprintf(buf2, sizeof(buf2), "%s%s", hdr->tree, dest);
+          snprintf(buf2, sizeof(buf2), "%s%s", mutt_thread_tree(hdr), dest);
           mutt_format_s_tree(dest, destlen, prefix, buf2);
         }
         else
-          mutt_format_s_tree(dest, destlen, prefix, hdr->tree);
+          mutt_format_s_tree(dest, destlen, prefix, mutt_thread_tree(hdr));
       }
       else
       {
@@ -69,6 +69,8 @@ struct Header
   /* bits used for caching when searching */
   bool searched : 1;
   bool matched : 1;
+  unsigned char results_known;   /**< entries of Context.results cached, one bit each */
+  unsigned char results_matched; /**< entries of Context.results that matched */
 
   /* tells whether the attachment count is valid */
   bool attach_valid : 1;
@@ -94,7 +96,6 @@ struct Header
   struct Body *content;      /**< list of MIME parts */
   char *path;
 
-  char *tree; /**< character string to print thread tree */
   struct MuttThread *thread;
 
   /* Number of qualifying attachments in message, if attach_valid */
@@ -40,6 +40,7 @@
 #include "mutt_idna.h"
 #include "ncrypt/ncrypt.h"
 #include "options.h"
+#include "pattern.h"
 #include "protos.h"
 
 void mutt_edit_headers(const char *editor, const char *body, struct Header *msg,
@@ -274,6 +275,7 @@ static int label_message(struct Context *ctx, struct Header *hdr, char *new)
   mutt_str_replace(&hdr->env->x_label, new);
   if (hdr->env->x_label != NULL)
     label_ref_inc(ctx, hdr->env->x_label);
+  mutt_pattern_results_invalidate(ctx, hdr);
 
   return hdr->changed = hdr->xlabel_changed = true;
 }
@@ -27,6 +27,7 @@
 
 #include "config.h"
 #include <ctype.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -54,7 +55,8 @@
 static const char *const Capabilities[] = {
   "IMAP4",         "IMAP4rev1",   "STATUS",         "ACL",      "NAMESPACE",
   "AUTH=CRAM-MD5", "AUTH=GSSAPI", "AUTH=ANONYMOUS", "STARTTLS", "LOGINDISABLED",
-  "IDLE",          "SASL-IR",     "X-GM-EXT1",      "ENABLE",   NULL,
+  "IDLE",          "SASL-IR",     "X-GM-EXT1",      "ENABLE",   "ESEARCH",
+  NULL,
 };
 
 /* Gmail document one string but use another.  Support both. */
@@ -555,6 +557,60 @@ static void cmd_parse_search(struct ImapData *idata, const char *s)
   }
 }
 
+/**
+ * cmd_parse_esearch - store ESEARCH response for later use
+ *
+ * Only the UIDs of the matches, "ALL" of RFC4731, are used:
+ * `* ESEARCH (TAG "a3") UID ALL 4:19,21,28`
+ */
+static void cmd_parse_esearch(struct ImapData *idata, const char *s)
+{
+  unsigned int uid, last;
+  struct Header *h = NULL;
+  char *end = NULL;
+
+  mutt_debug(2, "Handling ESEARCH\n");
+
+  s = imap_next_word((char *) s);
+  if (*s == '(')
+  {
+    /* search correlator */
+    s = strchr(s, ')');
+    if (!s)
+      return;
+    s = imap_next_word((char *) s);
+  }
+  if (mutt_strncasecmp("UID", s, 3) == 0)
+    s = imap_next_word((char *) s);
+  if (mutt_strncasecmp("ALL", s, 3) != 0)
+    return;
+  s = imap_next_word((char *) s);
+
+  while (*s && !ISSPACE(*s))
+  {
+    uid = last = strtoul(s, &end, 10);
+    if (*end == ':')
+      last = strtoul(end + 1, &end, 10);
+    if (end == s)
+      return;
+    if (last < uid)
+    {
+      unsigned int tmp = uid;
+      uid = last;
+      last = tmp;
+    }
+    for (; uid <= last; uid++)
+    {
+      h = (struct Header *) int_hash_find(idata->uid_hash, uid);
+      if (h)
+        h->matched = true;
+      if (uid == UINT_MAX)
+        break;
+    }
+    s = (*end == ',') ? end + 1 : end;
+  }
+}
+
 /**
  * cmd_parse_status - Parse status from server
  *
@@ -799,6 +855,8 @@ static int cmd_handle_untagged(struct ImapData *idata)
     cmd_parse_myrights(idata, s);
   else if (mutt_strncasecmp("SEARCH", s, 6) == 0)
     cmd_parse_search(idata, s);
+  else if (mutt_strncasecmp("ESEARCH", s, 7) == 0)
+    cmd_parse_esearch(idata, s);
   else if (mutt_strncasecmp("STATUS", s, 6) == 0)
     cmd_parse_status(idata, s);
   else if (mutt_strncasecmp("ENABLED", s, 7) == 0)
@@ -1844,6 +1844,70 @@ static int do_search(const struct Pattern *search, int allpats)
   return rc;
 }
 
+/**
+ * compile_text - Convert a text pattern to an IMAP search key
+ * @param ctx Mailbox
+ * @param pat Pattern, ~b, ~B, ~h or ~/, matched as a string
+ * @param buf Buffer for the search key
+ * @retval  0 Success
+ * @retval -1 The pattern can't be searched for
+ */
+static int compile_text(struct Context *ctx, const struct Pattern *pat, struct Buffer *buf)
+{
+  char term[STRING];
+  char *delim = NULL;
+
+  switch (pat->op)
+  {
+    case MUTT_HEADER:
+      mutt_buffer_addstr(buf, "HEADER ");
+
+      /* extract header name */
+      if (!(delim = strchr(pat->p.str, ':')))
+      {
+        mutt_error(_("Header search without header name: %s"), pat->p.str);
+        return -1;
+      }
+      *delim = '\0';
+      imap_quote_string(term, sizeof(term), pat->p.str);
+      mutt_buffer_addstr(buf, term);
+      mutt_buffer_addch(buf, ' ');
+
+      /* and field */
+      *delim = ':';
+      delim++;
+      SKIPWS(delim);
+      imap_quote_string(term, sizeof(term), delim);
+      mutt_buffer_addstr(buf, term);
+      break;
+    case MUTT_BODY:
+      mutt_buffer_addstr(buf, "BODY ");
+      imap_quote_string(term, sizeof(term), pat->p.str);
+      mutt_buffer_addstr(buf, term);
+      break;
+    case MUTT_WHOLE_MSG:
+      mutt_buffer_addstr(buf, "TEXT ");
+      imap_quote_string(term, sizeof(term), pat->p.str);
+      mutt_buffer_addstr(buf, term);
+      break;
+    case MUTT_SERVERSEARCH:
+    {
+      struct ImapData *idata = ctx->data;
+      if (!mutt_bit_isset(idata->capabilities, X_GM_EXT1))
+      {
+        mutt_error(_("Server-side custom search not supported: %s"), pat->p.str);
+        return -1;
+      }
+    }
+      mutt_buffer_addstr(buf, "X-GM-RAW ");
+      imap_quote_string(term, sizeof(term), pat->p.str);
+      mutt_buffer_addstr(buf, term);
+      break;
+  }
+
+  return 0;
+}
+
 /**
  * imap_compile_search - Convert Mutt pattern to IMAP search
  *
@@ -1890,88 +1954,422 @@ static int imap_compile_search(struct Context *ctx, const struct Pattern *pat,
       mutt_buffer_addch(buf, ')');
     }
   }
-  else
-  {
-    char term[STRING];
-    char *delim = NULL;
+  else if (compile_text(ctx, pat, buf) < 0)
+    return -1;
 
-    switch (pat->op)
+  return 0;
+}
+
+/**
+ * enum ImapTerm - Messages found by a search key, see compile_term()
+ */
+enum ImapTerm
+{
+  IMAP_TERM_ALL = 0, /**< All the messages; nothing was written */
+  IMAP_TERM_NONE,    /**< No message; nothing was written */
+  IMAP_TERM_SOME,    /**< The messages found by the key that was written */
+};
+
+/**
+ * search_string - Write a search key with an ASCII string
+ * @param buf Buffer for the search key
+ * @param fmt Search key, with a %s for each copy of the string
+ * @param s   String, may be NULL
+ * @retval true  The key was written
+ * @retval false The string isn't plain ASCII
+ *
+ * Without a CHARSET, the servers are only required to search ASCII strings.
+ */
+static bool search_string(struct Buffer *buf, const char *fmt, const char *s)
+{
+  char term[STRING];
+
+  if (!s || !*s)
+    return false;
+  for (const char *t = s; *t; t++)
+    if (*t & 0x80)
+      return false;
+
+  imap_quote_string(term, sizeof(term), s);
+  mutt_buffer_printf(buf, fmt, term, term, term, term);
+  return true;
+}
+
+/**
+ * address_literal - Can a text be searched for in the address fields
+ * @param s Literal of an address pattern, may be NULL
+ * @retval true If it can't span the parts of an address
+ *
+ * Servers may search the name and the address separately, while the local
+ * match may find a text that runs from one into the other.
+ */
+static bool address_literal(const char *s)
+{
+  return s && !strpbrk(s, "<>\" \t\r\n");
+}
+
+/**
+ * search_day - Write a search key with a date
+ * @param buf Buffer for the search key
+ * @param key Search key, e.g. "SINCE"
+ * @param t   Time, its day is used
+ */
+static void search_day(struct Buffer *buf, const char *key, time_t t)
+{
+  struct tm *tm = gmtime(&t);
+
+  mutt_buffer_printf(buf, "%s %d-%s-%d", key, tm->tm_mday, Months[tm->tm_mon],
+                     tm->tm_year + 1900);
+}
+
+static int compile_term(struct Context *ctx, const struct Pattern *pat,
+                        struct Buffer *buf, bool narrow, bool *exact);
+
+/**
+ * compile_list - Convert the children of ~( ~| to IMAP search keys
+ * @param ctx    Mailbox
+ * @param pat    Pattern, MUTT_AND or MUTT_OR
+ * @param buf    Buffer for the search key
+ * @param narrow See compile_term()
+ * @param exact  See compile_term()
+ * @retval enum #ImapTerm
+ * @retval -1   Error
+ */
+static int compile_list(struct Context *ctx, const struct Pattern *pat,
+                        struct Buffer *buf, bool narrow, bool *exact)
+{
+  struct ListHead terms = STAILQ_HEAD_INITIALIZER(terms);
+  struct ListNode *np = NULL;
+  struct Buffer term;
+  bool or = (pat->op == MUTT_OR);
+  int rc = or ? IMAP_TERM_NONE : IMAP_TERM_ALL;
+  int count = 0;
+
+  for (pat = pat->child; pat; pat = pat->next)
+  {
+    mutt_buffer_init(&term);
+    rc = compile_term(ctx, pat, &term, narrow, exact);
+    if (rc == IMAP_TERM_SOME)
     {
-      case MUTT_HEADER:
-        mutt_buffer_addstr(buf, "HEADER ");
+      mutt_list_insert_tail(&terms, term.data);
+      count++;
+      continue;
+    }
+    FREE(&term.data);
+    /* an error, an ALL of ~| or a NONE of ~( decides */
+    if ((rc < 0) || (rc == (or ? IMAP_TERM_ALL : IMAP_TERM_NONE)))
+    {
+      mutt_list_free(&terms);
+      return rc;
+    }
+  }
 
-        /* extract header name */
-        if (!(delim = strchr(pat->p.str, ':')))
-        {
-          mutt_error(_("Header search without header name: %s"), pat->p.str);
-          return -1;
-        }
-        *delim = '\0';
-        imap_quote_string(term, sizeof(term), pat->p.str);
-        mutt_buffer_addstr(buf, term);
-        mutt_buffer_addch(buf, ' ');
+  if (count == 0)
+    return or ? IMAP_TERM_NONE : IMAP_TERM_ALL;
 
-        /* and field */
-        *delim = ':';
-        delim++;
-        SKIPWS(delim);
-        imap_quote_string(term, sizeof(term), delim);
-        mutt_buffer_addstr(buf, term);
-        break;
-      case MUTT_BODY:
-        mutt_buffer_addstr(buf, "BODY ");
-        imap_quote_string(term, sizeof(term), pat->p.str);
-        mutt_buffer_addstr(buf, term);
-        break;
-      case MUTT_WHOLE_MSG:
-        mutt_buffer_addstr(buf, "TEXT ");
-        imap_quote_string(term, sizeof(term), pat->p.str);
-        mutt_buffer_addstr(buf, term);
+  /* OR takes two keys: "OR OR a b c" */
+  for (int i = 1; or && (i < count); i++)
+    mutt_buffer_addstr(buf, "OR ");
+  if (!or && (count > 1))
+    mutt_buffer_addch(buf, '(');
+  STAILQ_FOREACH(np, &terms, entries)
+  {
+    mutt_buffer_addstr(buf, np->data);
+    if (STAILQ_NEXT(np, entries))
+      mutt_buffer_addch(buf, ' ');
+  }
+  if (!or && (count > 1))
+    mutt_buffer_addch(buf, ')');
+
+  mutt_list_free(&terms);
+  return IMAP_TERM_SOME;
+}
+
+/**
+ * compile_term - Convert a pattern to an IMAP search key
+ * @param[in]  ctx    Mailbox
+ * @param[in]  pat    Pattern, on its own
+ * @param[in]  buf    Buffer for the search key
+ * @param[in]  narrow If true, the key may find fewer messages than the pattern
+ *                    matches, otherwise more
+ * @param[out] exact  Set to false if the key doesn't find exactly the messages
+ * @retval enum #ImapTerm
+ * @retval -1   Error
+ *
+ * The flags are searched if they're all synced.  The other patterns only have
+ * approximations: the dates are widened to whole days, ~z compares the length
+ * of the body but the server the size of the message, and the texts of the
+ * envelope patterns, or of ~b if $thorough_search is set, are searched for as
+ * substrings, see set_literal().  The texts of the address patterns are only
+ * used if they can't span the parts of an address, see address_literal().
+ * The patterns that can't be converted find all the messages, or none if
+ * @a narrow is true.
+ */
+static int compile_term(struct Context *ctx, const struct Pattern *pat,
+                        struct Buffer *buf, bool narrow, bool *exact)
+{
+  size_t start = buf->dptr - buf->data;
+  const char *flag = NULL;
+  int rc = IMAP_TERM_SOME;
+
+  if (pat->not)
+  {
+    mutt_buffer_addstr(buf, "NOT ");
+    narrow = !narrow;
+  }
+
+  switch (pat->op)
+  {
+    case MUTT_AND:
+    case MUTT_OR:
+      rc = compile_list(ctx, pat, buf, narrow, exact);
+      break;
+    case MUTT_ALL:
+      rc = IMAP_TERM_ALL;
+      break;
+    case MUTT_FLAG:
+      flag = "FLAGGED";
+      break;
+    case MUTT_DELETED:
+      flag = "DELETED";
+      break;
+    case MUTT_REPLIED:
+      flag = "ANSWERED";
+      break;
+    case MUTT_READ:
+      flag = "SEEN";
+      break;
+    case MUTT_UNREAD:
+      flag = "UNSEEN";
+      break;
+    case MUTT_BODY:
+    case MUTT_HEADER:
+    case MUTT_WHOLE_MSG:
+    case MUTT_SERVERSEARCH:
+      if (pat->stringmatch || (pat->op == MUTT_SERVERSEARCH))
+      {
+        if (compile_text(ctx, pat, buf) < 0)
+          rc = -1;
         break;
-      case MUTT_SERVERSEARCH:
+      }
+      if ((pat->op != MUTT_BODY) || narrow || !option(OPT_THOROUGH_SRC) ||
+          !search_string(buf, "BODY %s", pat->literal))
+        rc = narrow ? IMAP_TERM_NONE : IMAP_TERM_ALL;
+      *exact = false;
+      break;
+    case MUTT_FROM:
+    case MUTT_TO:
+    case MUTT_CC:
+    case MUTT_SUBJECT:
+    case MUTT_SENDER:
+    case MUTT_ID:
+    case MUTT_REFERENCE:
+    case MUTT_RECIPIENT:
+    case MUTT_ADDRESS:
+    {
+      const char *fmt = NULL;
+      bool address = true;
+
+      switch (pat->op)
       {
-        struct ImapData *idata = ctx->data;
-        if (!mutt_bit_isset(idata->capabilities, X_GM_EXT1))
-        {
-          mutt_error(_("Server-side custom search not supported: %s"), pat->p.str);
-          return -1;
-        }
+        case MUTT_FROM:
+          fmt = "FROM %s";
+          break;
+        case MUTT_TO:
+          fmt = "TO %s";
+          break;
+        case MUTT_CC:
+          fmt = "CC %s";
+          break;
+        case MUTT_SUBJECT:
+          fmt = "SUBJECT %s";
+          address = false;
+          break;
+        case MUTT_SENDER:
+          fmt = "HEADER Sender %s";
+          break;
+        case MUTT_ID:
+          fmt = "HEADER Message-ID %s";
+          address = false;
+          break;
+        case MUTT_REFERENCE:
+          fmt = "OR HEADER References %s HEADER In-Reply-To %s";
+          address = false;
+          break;
+        case MUTT_RECIPIENT:
+          fmt = "OR TO %s CC %s";
+          break;
+        default:
+          fmt = "OR OR FROM %s HEADER Sender %s OR TO %s CC %s";
       }
-        mutt_buffer_addstr(buf, "X-GM-RAW ");
-        imap_quote_string(term, sizeof(term), pat->p.str);
-        mutt_buffer_addstr(buf, term);
-        break;
+
+      /* ^~f also matches the messages without a From */
+      if (narrow || pat->alladdr || pat->isalias || pat->groupmatch ||
+          (address && !address_literal(pat->literal)) ||
+          !search_string(buf, fmt, pat->literal))
+        rc = narrow ? IMAP_TERM_NONE : IMAP_TERM_ALL;
+      *exact = false;
+      break;
     }
+    case MUTT_DATE:
+    case MUTT_DATE_RECEIVED:
+      /* the server compares the days, in the timezone of its choice */
+      if (narrow)
+        rc = IMAP_TERM_NONE;
+      else
+      {
+        bool sent = (pat->op == MUTT_DATE);
+
+        mutt_buffer_addch(buf, '(');
+        search_day(buf, sent ? "SENTSINCE" : "SINCE", MAX((time_t) pat->min - 86400, 0));
+        mutt_buffer_addch(buf, ' ');
+        search_day(buf, sent ? "SENTBEFORE" : "BEFORE", (time_t) pat->max + 2 * 86400);
+        mutt_buffer_addch(buf, ')');
+      }
+      *exact = false;
+      break;
+    case MUTT_SIZE:
+      /* RFC822.SIZE counts the header too, so it's never smaller */
+      if (!narrow && (pat->min > 0))
+        mutt_buffer_printf(buf, "LARGER %d", pat->min - 1);
+      else if (narrow && (pat->min <= 0) && (pat->max >= 0))
+        mutt_buffer_printf(buf, "SMALLER %d", pat->max + 1);
+      else
+        rc = narrow ? IMAP_TERM_NONE : IMAP_TERM_ALL;
+      *exact = false;
+      break;
+    default:
+      rc = narrow ? IMAP_TERM_NONE : IMAP_TERM_ALL;
+      *exact = false;
   }
 
-  return 0;
+  if (flag)
+  {
+    /* the server doesn't know the changes that aren't synced yet */
+    if (ctx->changed)
+    {
+      rc = narrow ? IMAP_TERM_NONE : IMAP_TERM_ALL;
+      *exact = false;
+    }
+    else
+      mutt_buffer_addstr(buf, flag);
+  }
+
+  if (rc != IMAP_TERM_SOME)
+  {
+    if (buf->data)
+    {
+      buf->dptr = buf->data + start;
+      *buf->dptr = '\0';
+    }
+    if (pat->not && (rc >= 0))
+      rc = (rc == IMAP_TERM_ALL) ? IMAP_TERM_NONE : IMAP_TERM_ALL;
+  }
+  return rc;
+}
+
+/**
+ * search_fetches - Does matching a pattern locally fetch the messages
+ * @param pat Pattern
+ * @retval true If it has ~b, ~B or ~h regexes
+ */
+static bool search_fetches(const struct Pattern *pat)
+{
+  for (; pat; pat = pat->next)
+  {
+    if (((pat->op == MUTT_BODY) || (pat->op == MUTT_HEADER) || (pat->op == MUTT_WHOLE_MSG)) &&
+        !pat->stringmatch)
+      return true;
+    if (pat->child && search_fetches(pat->child))
+      return true;
+  }
+  return false;
 }
 
+/**
+ * search_exec - Run an IMAP search, setting Header.matched of the matches
+ * @param idata    Server data
+ * @param criteria Search keys
+ * @retval  0 Success
+ * @retval -1 Error
+ *
+ * With ESEARCH, the matches come back as ranges of UIDs rather than one by
+ * one.
+ */
+static int search_exec(struct ImapData *idata, const char *criteria)
+{
+  struct Buffer buf;
+  int rc;
+
+  mutt_buffer_init(&buf);
+  mutt_buffer_printf(&buf, "UID SEARCH %s%s",
+                     mutt_bit_isset(idata->capabilities, ESEARCH) ? "RETURN (ALL) " : "",
+                     criteria);
+  rc = imap_exec(idata, buf.data, 0);
+  FREE(&buf.data);
+  return (rc < 0) ? -1 : 0;
+}
+
+/**
+ * imap_search - Find the messages matching a pattern on the server
+ * @param ctx Mailbox
+ * @param pat Pattern
+ * @retval enum #ImapSearch
+ * @retval -1   Error
+ *
+ * The server is only asked if some of the pattern has to be: the text
+ * patterns matched as strings, or the regexes of ~b, ~B and ~h that would
+ * fetch the messages.  If the whole pattern converts exactly, the server
+ * matches all of it.  Otherwise, the server finds the messages the text
+ * patterns match, or else the messages that may match, so that the others
+ * aren't fetched.
+ */
 int imap_search(struct Context *ctx, const struct Pattern *pat)
 {
   struct Buffer buf;
   struct ImapData *idata = ctx->data;
+  bool text, exact = true;
+  int rc;
+
   for (int i = 0; i < ctx->msgcount; i++)
     ctx->hdrs[i]->matched = false;
 
-  if (!do_search(pat, 1))
-    return 0;
+  text = do_search(pat, 1);
+  if (!text && !search_fetches(pat))
+    return IMAP_SEARCH_TEXT;
 
   mutt_buffer_init(&buf);
-  mutt_buffer_addstr(&buf, "UID SEARCH ");
-  if (imap_compile_search(ctx, pat, &buf) < 0)
+  rc = compile_term(ctx, pat, &buf, false, &exact);
+  if ((rc >= 0) && (exact || (!text && (rc != IMAP_TERM_ALL))))
   {
+    mutt_debug(2, "imap_search: %s search: %s\n", exact ? "exact" : "candidate",
+               NONULL(buf.data));
+    if (rc == IMAP_TERM_ALL)
+    {
+      for (int i = 0; i < ctx->msgcount; i++)
+        ctx->hdrs[i]->matched = true;
+    }
+    else if ((rc == IMAP_TERM_SOME) && (search_exec(idata, buf.data) < 0))
+      rc = -1;
     FREE(&buf.data);
-    return -1;
+    if (rc < 0)
+      return -1;
+    return exact ? IMAP_SEARCH_ALL : IMAP_SEARCH_CANDIDATES;
   }
-  if (imap_exec(idata, buf.data, 0) < 0)
+  FREE(&buf.data);
+  if ((rc < 0) || !text)
+    return (rc < 0) ? -1 : IMAP_SEARCH_TEXT;
+
+  /* parts of the pattern are matched locally: the server only does the texts */
+  mutt_buffer_init(&buf);
+  if ((imap_compile_search(ctx, pat, &buf) < 0) || (search_exec(idata, buf.data) < 0))
   {
     FREE(&buf.data);
     return -1;
   }
 
   FREE(&buf.data);
-  return 0;
+  return IMAP_SEARCH_TEXT;
 }
 
 int imap_subscribe(char *path, int subscribe)
@@ -2301,6 +2699,53 @@ out:
   return rc < 0 ? -1 : rc;
 }
 
+#ifdef USE_HCACHE
+/**
+ * imap_hcache_keep - Is a header cache record still in use? - Implements ::hcache_keep_t
+ *
+ * Only message records ("/<uid>") are judged; "/UIDVALIDITY", "/UIDNEXT" and
+ * anything else are kept.
+ */
+static bool imap_hcache_keep(const char *key, size_t keylen, void *data)
+{
+  struct ImapData *idata = data;
+  unsigned int uid = 0;
+
+  if ((keylen < 2) || (keylen > 11) || (key[0] != '/'))
+    return true;
+
+  for (size_t i = 1; i < keylen; i++)
+  {
+    if (!isdigit((unsigned char) key[i]))
+      return true;
+    uid = uid * 10 + (key[i] - '0');
+  }
+
+  return int_hash_find(idata->uid_hash, uid) != NULL;
+}
+
+/**
+ * imap_hcache_compact - Remove stale header cache records - Implements MxOps::hcache_compact
+ */
+static int imap_hcache_compact(struct Context *ctx, bool force, LOFF_T *reclaimed)
+{
+  struct ImapData *idata = ctx->data;
+  header_cache_t *hc = NULL;
+  int rc;
+
+  if (!idata || !idata->uid_hash)
+    return -1;
+
+  hc = imap_hcache_open(idata, NULL);
+  if (!hc)
+    return -1;
+
+  rc = mutt_hcache_compact(hc, imap_hcache_keep, idata, force, reclaimed);
+  mutt_hcache_close(hc);
+  return rc;
+}
+#endif
+
 struct MxOps mx_imap_ops = {
   .open = imap_open_mailbox,
   .open_append = imap_open_mailbox_append,
@@ -2311,4 +2756,7 @@ struct MxOps mx_imap_ops = {
   .open_new_msg = imap_open_new_message,
   .check = imap_check_mailbox_reopen,
   .sync = NULL, /* imap syncing is handled by imap_sync_mailbox */
+#ifdef USE_HCACHE
+  .hcache_compact = imap_hcache_compact,
+#endif
 };
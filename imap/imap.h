@@ -43,6 +43,16 @@ struct ImapMbox
   char *mbox;
 };
 
+/**
+ * enum ImapSearch - What imap_search() left in Header.matched
+ */
+enum ImapSearch
+{
+  IMAP_SEARCH_TEXT = 0,   /**< Matches of the text patterns, if any, see mutt_pattern_exec() */
+  IMAP_SEARCH_ALL,        /**< Matches of the whole pattern */
+  IMAP_SEARCH_CANDIDATES, /**< Messages that may match the pattern; the others don't */
+};
+
 /* imap.c */
 int imap_access(const char *path);
 int imap_check_mailbox(struct Context *ctx, int force);
@@ -134,6 +134,7 @@ enum ImapCaps
   SASL_IR,       /**< SASL initial response draft */
   ENABLE,        /**< RFC5161 */
   X_GM_EXT1,     /**< https://developers.google.com/gmail/imap/imap-extensions */
+  ESEARCH,       /**< RFC4731: IMAP4 Extension to SEARCH Command */
 
   CAPMAX
 };
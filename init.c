@@ -965,6 +965,51 @@ static int finish_source(struct Buffer *tmp, struct Buffer *s,
   return 1;
 }
 
+#ifdef USE_HCACHE
+/**
+ * parse_hcache_compact - 'hcache-compact' command: clean the header cache
+ * @param tmp  Temporary space shared by all command handlers
+ * @param s    Current line of the config file
+ * @param data data field from init.h:struct Command
+ * @param err  Buffer for any error message
+ * @retval  0 Success
+ * @retval -1 Failed
+ *
+ * Remove the header cache records of messages which are no longer in the
+ * current mailbox and reclaim the space they used.
+ */
+static int parse_hcache_compact(struct Buffer *tmp, struct Buffer *s,
+                                unsigned long data, struct Buffer *err)
+{
+  char size[SHORT_STRING];
+  LOFF_T reclaimed;
+
+  if (MoreArgs(s))
+  {
+    snprintf(err->data, err->dsize, _("hcache-compact: too many arguments"));
+    return -1;
+  }
+
+  if (!Context)
+  {
+    snprintf(err->data, err->dsize, _("No mailbox is open."));
+    return -1;
+  }
+
+  int removed = mx_hcache_compact(Context, true, &reclaimed);
+  if (removed < 0)
+  {
+    snprintf(err->data, err->dsize,
+             _("hcache-compact: not supported for this mailbox"));
+    return -1;
+  }
+
+  mutt_pretty_size(size, sizeof(size), reclaimed);
+  mutt_message(_("Header cache: %d stale records removed, %s reclaimed."), removed, size);
+  return 0;
+}
+#endif
+
 /**
  * parse_ifdef - 'ifdef' command: conditional config
  * @param tmp  Temporary space shared by all command handlers
@@ -2751,6 +2796,15 @@ static int parse_set(struct Buffer *tmp, struct Buffer *s, unsigned long data,
                      MuttVars[idx].option, tmp->data);
             return -1;
           }
+#ifdef USE_HCACHE
+          if ((mutt_strcmp(MuttVars[idx].option, "header_cache_compress_method") == 0) &&
+              *tmp->data && !mutt_hcache_is_valid_compression(tmp->data))
+          {
+            snprintf(err->data, err->dsize, _("%s: invalid compression method"),
+                     tmp->data);
+            return -1;
+          }
+#endif
 
           FREE((void *) MuttVars[idx].data);
           *((char **) MuttVars[idx].data) = safe_strdup(tmp->data);
@@ -466,6 +466,22 @@ struct Option MuttVars[] = {
   ** See the text describing the $$status_format option for more
   ** information on how to set $$compose_format.
   */
+#if defined(USE_COMPRESSED) && defined(USE_COMPRESS_NATIVE)
+  { "compress_native",  DT_BOOL, R_NONE, OPT_COMPRESS_NATIVE, 0 },
+  /*
+  ** .pp
+  ** When \fIset\fP, a new or empty mailbox matching an \fCopen-hook\fP is
+  ** written by Mutt itself, in a ``seekable'' gzip format: one gzip member
+  ** per message, with an index of its size in the gzip header.  Opening such
+  ** a mailbox only decompresses the message headers, a message is
+  ** decompressed when it is read, and saving a message to it just appends a
+  ** member.  The file remains a valid gzip file of an mbox mailbox.
+  ** .pp
+  ** Mailboxes in this format are recognized, and handled without the hooks,
+  ** whatever the value of this variable.  This needs Mutt to be built with
+  ** zlib, see the \fC--enable-compress-native\fP configure option.
+  */
+#endif
   { "config_charset",   DT_STR,  R_NONE, UL &ConfigCharset, UL 0 },
   /*
   ** .pp
@@ -1133,6 +1149,17 @@ struct Option MuttVars[] = {
   ** .pp
   ** This variable specifies the header cache backend.
   */
+  { "header_cache_compact", DT_BOOL, R_NONE, OPT_HCACHE_COMPACT, 0 },
+  /*
+  ** .pp
+  ** When this variable is \fIset\fP, closing a maildir, MH, IMAP or POP
+  ** mailbox removes the header cache records of messages which are no longer
+  ** in it, e.g. after they were renamed or expunged by another client, and
+  ** then reclaims the space they used.  This is done at most once a day for
+  ** each mailbox, because it reads the whole database.
+  ** .pp
+  ** The same can be done at any time with the \fChcache-compact\fP command.
+  */
 #if defined(HAVE_QDBM) || defined(HAVE_TC) || defined(HAVE_KC)
   { "header_cache_compress", DT_BOOL, R_NONE, OPT_HCACHE_COMPRESS, 1 },
   /*
@@ -1146,6 +1173,26 @@ struct Option MuttVars[] = {
   ** cached folders.
   */
 #endif /* HAVE_QDBM */
+  { "header_cache_compress_level", DT_NUM, R_NONE, UL &HeaderCacheCompressLevel, 0 },
+  /*
+  ** .pp
+  ** This variable sets the compression level used by
+  ** $$header_cache_compress_method.  Its meaning depends on the method:
+  ** for zlib (1-9) and zstd (1-22) higher values compress better but more
+  ** slowly, for lz4 higher values are faster but compress less.  The
+  ** default of 0 uses the library's own default.
+  */
+  { "header_cache_compress_method", DT_STR, R_NONE, UL &HeaderCacheCompressMethod, 0 },
+  /*
+  ** .pp
+  ** When set, each header cache record is compressed before it is stored,
+  ** whatever the backend.  Valid values depend on the libraries Mutt was
+  ** compiled with: ``lz4'', ``zlib'' and ``zstd''.  When \fIunset\fP, the
+  ** records aren't compressed.
+  ** .pp
+  ** Records written with another method are ignored and re-cached, so the
+  ** method can be changed at any time.
+  */
 #if defined(HAVE_GDBM) || defined(HAVE_BDB)
   { "header_cache_pagesize", DT_STR, R_NONE, UL &HeaderCachePageSize, UL "16384" },
   /*
@@ -1156,6 +1203,21 @@ struct Option MuttVars[] = {
   ** or less optimal for most use cases.
   */
 #endif /* HAVE_GDBM || HAVE_BDB */
+  { "header_cache_shared", DT_BOOL, R_NONE, OPT_HCACHE_SHARED, 0 },
+  /*
+  ** .pp
+  ** When this variable is \fIset\fP, neomutt keeps the header cache database
+  ** open when leaving a folder and uses it for the next one, instead of
+  ** opening a database for each folder.  If $$header_cache points to a
+  ** directory, all the folders are stored in a single database in it, named
+  ** after the backend, e.g. ``shared-lmdb.hcache''.
+  ** .pp
+  ** This makes changing folders faster.  However, backends which lock the
+  ** whole database while it's open (all but lmdb) can't be used by another
+  ** instance of neomutt at the same time.  If the database can't be opened,
+  ** e.g. because another instance holds its lock, the folder is read without
+  ** a header cache.
+  */
 #endif /* USE_HCACHE */
   { "header_color_partial", DT_BOOL, R_PAGER_FLOW, OPT_HEADER_COLOR_PARTIAL, 0 },
   /*
@@ -1816,6 +1878,26 @@ struct Option MuttVars[] = {
   ** every once in a while, since it can be a little slow
   ** (especially for large folders).
   */
+#ifdef HAVE_ZLIB
+  { "message_cache_compress", DT_BOOL, R_NONE, OPT_MESSAGE_CACHE_COMPRESS, 0 },
+  /*
+  ** .pp
+  ** If \fIset\fP, messages are compressed with zlib before they are stored
+  ** in the message cache.  This typically halves its size, at the cost of
+  ** decompressing a message each time it's read from the cache.  Messages
+  ** already in the cache are not affected.
+  */
+#endif
+  { "message_cache_size", DT_NUM, R_NONE, UL &MessageCacheSize, 0 },
+  /*
+  ** .pp
+  ** The maximum size, in megabytes, of the message cache of each mailbox.
+  ** When a new message would take the cache over this limit, the least
+  ** recently read messages are removed from it.  The default, 0, means no
+  ** limit.
+  ** .pp
+  ** Also see the $$message_cachedir variable.
+  */
   { "message_cachedir", DT_PATH,        R_NONE, UL &MessageCachedir, 0 },
   /*
   ** .pp
@@ -1827,7 +1909,7 @@ struct Option MuttVars[] = {
   ** remote message only once and can perform regular expression searches
   ** as fast as for local folders.
   ** .pp
-  ** Also see the $$message_cache_clean variable.
+  ** Also see the $$message_cache_clean and $$message_cache_size variables.
   */
 #endif
   { "message_format",   DT_STR,  R_NONE, UL &MsgFmt, UL "%s" },
@@ -3172,6 +3254,28 @@ struct Option MuttVars[] = {
   ** For the pager, this variable specifies the number of lines shown
   ** before search results. By default, search results will be top-aligned.
   */
+#ifdef USE_HCACHE
+  { "search_index",     DT_BOOL, R_NONE, OPT_SEARCH_INDEX, 0 },
+  /*
+  ** .pp
+  ** When this variable is \fIset\fP, the \fC~b\fP, \fC~B\fP and \fC~h\fP
+  ** patterns of \fC<limit>\fP, \fC<tag-pattern>\fP and \fC<delete-pattern>\fP
+  ** use an index of the text of the messages, to skip the messages which
+  ** can't match.  The messages are added to the index as they're searched,
+  ** so the first search of a folder isn't faster.
+  ** .pp
+  ** The index is kept in the $$header_cache, for maildir and MH folders
+  ** only.  It holds the text that $$thorough_search makes the patterns
+  ** search: the raw or the decoded messages.  Encrypted messages aren't
+  ** indexed when the messages are decoded.  The decoded text depends on
+  ** settings such as $$charset and ``$auto_view''; after changing them, remove
+  ** the header cache to rebuild the index.
+  ** .pp
+  ** Compacting the header cache, see $$header_cache_compact, removes the
+  ** index entries of the messages which are gone.  When they outnumber the
+  ** messages of the folder, the index is dropped and built again.
+  */
+#endif
   { "send_charset",     DT_STR,  R_NONE, UL &SendCharset, UL "us-ascii:iso-8859-1:utf-8" },
   /*
   ** .pp
@@ -4344,6 +4448,19 @@ struct Option MuttVars[] = {
   ** When \fIset\fP, mutt will weed headers when displaying, forwarding,
   ** printing, or replying to messages.
   */
+  { "worker_threads",   DT_NUM,  R_NONE, UL &WorkerThreads, 0 },
+  /*
+  ** .pp
+  ** The number of threads mutt may use for work that can be done in
+  ** parallel, such as checking local mailboxes for new mail, renaming
+  ** the files of a Maildir or MH mailbox when it is synced, and matching
+  ** the patterns of \fC<limit>\fP, \fC<tag-pattern>\fP and
+  ** \fC<delete-pattern>\fP against the messages.  The default,
+  ** 0, uses one thread per processor, up to 16.  Setting it to 1 does all
+  ** the work in the main thread.
+  ** .pp
+  ** This has no effect unless mutt was built with thread support.
+  */
   { "wrap",             DT_NUM,  R_PAGER, UL &Wrap, 0 },
   /*
   ** .pp
@@ -4545,6 +4662,10 @@ static int finish_source(struct Buffer *buf, struct Buffer *s,
                          unsigned long data, struct Buffer *err);
 static int parse_ifdef(struct Buffer *buf, struct Buffer *s, unsigned long data,
                        struct Buffer *err);
+#ifdef USE_HCACHE
+static int parse_hcache_compact(struct Buffer *buf, struct Buffer *s,
+                                unsigned long data, struct Buffer *err);
+#endif
 static int parse_ignore(struct Buffer *buf, struct Buffer *s,
                         unsigned long data, struct Buffer *err);
 static int parse_unignore(struct Buffer *buf, struct Buffer *s,
@@ -4620,6 +4741,9 @@ const struct Command Commands[] = {
   { "finish",              finish_source,          0 },
   { "folder-hook",         mutt_parse_hook,        MUTT_FOLDERHOOK },
   { "group",               parse_group,            MUTT_GROUP },
+#ifdef USE_HCACHE
+  { "hcache-compact",      parse_hcache_compact,   0 },
+#endif
   { "hdr_order",           parse_stailq,           UL &HeaderOrderList },
   { "iconv-hook",          mutt_parse_hook,        MUTT_ICONVHOOK },
   { "ifdef",               parse_ifdef,            0 },
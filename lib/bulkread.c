@@ -0,0 +1,497 @@
+/**
+ * @file
+ * Read the start of many files at once
+ *
+ * @copyright
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @page bulkread Read the start of many files at once
+ *
+ * Opening a large mailbox means reading the headers of thousands of small
+ * files.  Done one at a time, each open, stat and read waits for the disk or
+ * the network.  mutt_bulk_read() keeps many of these requests in flight.
+ *
+ * On Linux, the requests are queued to the kernel with io_uring: the files of
+ * a group are opened and stat'd in one go, then read in one go.  Elsewhere,
+ * or if the kernel refuses io_uring, the files are shared out between worker
+ * threads, see @ref workers.
+ *
+ * | Function         | Description
+ * | :--------------- | :--------------------------------------
+ * | mutt_bulk_read() | Read the start of many files at once
+ */
+
+#include "config.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef USE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+#include "bulkread.h"
+#include "debug.h"
+#include "memory.h"
+#include "workers.h"
+
+/**
+ * bulk_read_one - Read one file the usual way - Implements ::worker_fn_t
+ */
+static void bulk_read_one(int i, void *data)
+{
+  struct BulkRead *req = (struct BulkRead *) data + i;
+  struct stat st;
+  ssize_t n;
+  int fd;
+
+  req->err = 0;
+  req->len = 0;
+
+  if (req->want == 0)
+  {
+    if (stat(req->path, &st) != 0)
+    {
+      req->err = errno;
+      return;
+    }
+    req->size = st.st_size;
+    req->mtime = st.st_mtime;
+    return;
+  }
+
+  fd = open(req->path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+  {
+    req->err = errno;
+    return;
+  }
+
+  if (fstat(fd, &st) != 0)
+  {
+    req->err = errno;
+    close(fd);
+    return;
+  }
+  req->size = st.st_size;
+  req->mtime = st.st_mtime;
+
+  while (req->len < req->want)
+  {
+    n = read(fd, req->buf + req->len, req->want - req->len);
+    if (n < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      req->err = errno;
+      break;
+    }
+    if (n == 0)
+      break;
+    req->len += n;
+  }
+  req->buf[req->len] = '\0';
+  close(fd);
+}
+
+#ifdef USE_IO_URING
+
+#define URING_ENTRIES 256
+
+/**
+ * struct Uring - A minimal io_uring
+ *
+ * Only what mutt_bulk_read() needs: a batch of requests is queued, submitted,
+ * then all its completions are reaped before the next batch.
+ */
+struct Uring
+{
+  int fd;
+  unsigned int entries;      /**< Size of the submission queue */
+  unsigned int *sq_tail;
+  unsigned int *sq_mask;
+  unsigned int *sq_array;
+  struct io_uring_sqe *sqes;
+  unsigned int *cq_head;
+  unsigned int *cq_tail;
+  unsigned int *cq_mask;
+  struct io_uring_cqe *cqes;
+  void *sq_ring;
+  void *cq_ring;
+  size_t sq_ring_size;
+  size_t cq_ring_size;
+  size_t sqes_size;
+  unsigned int queued;       /**< Requests queued, but not yet submitted */
+};
+
+/**
+ * uring_free - Release an io_uring
+ * @param u io_uring
+ */
+static void uring_free(struct Uring *u)
+{
+  if (u->sqes && (u->sqes != MAP_FAILED))
+    munmap(u->sqes, u->sqes_size);
+  if (u->cq_ring && (u->cq_ring != MAP_FAILED) && (u->cq_ring != u->sq_ring))
+    munmap(u->cq_ring, u->cq_ring_size);
+  if (u->sq_ring && (u->sq_ring != MAP_FAILED))
+    munmap(u->sq_ring, u->sq_ring_size);
+  if (u->fd >= 0)
+    close(u->fd);
+}
+
+/**
+ * uring_init - Set up an io_uring
+ * @param u       io_uring
+ * @param entries Size of the submission queue
+ * @retval  0 Success
+ * @retval -1 io_uring isn't available
+ */
+static int uring_init(struct Uring *u, unsigned int entries)
+{
+  struct io_uring_params p;
+
+  memset(u, 0, sizeof(*u));
+  memset(&p, 0, sizeof(p));
+
+  u->fd = syscall(__NR_io_uring_setup, entries, &p);
+  if (u->fd < 0)
+  {
+    mutt_debug(1, "io_uring_setup: %s\n", strerror(errno));
+    return -1;
+  }
+
+  u->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+  u->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP)
+  {
+    if (u->cq_ring_size > u->sq_ring_size)
+      u->sq_ring_size = u->cq_ring_size;
+    u->cq_ring_size = u->sq_ring_size;
+  }
+
+  u->sq_ring = mmap(NULL, u->sq_ring_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+  if (u->sq_ring == MAP_FAILED)
+    goto fail;
+
+  if (p.features & IORING_FEAT_SINGLE_MMAP)
+    u->cq_ring = u->sq_ring;
+  else
+  {
+    u->cq_ring = mmap(NULL, u->cq_ring_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+    if (u->cq_ring == MAP_FAILED)
+      goto fail;
+  }
+
+  u->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+  u->sqes = mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+  if (u->sqes == MAP_FAILED)
+    goto fail;
+
+  u->entries = p.sq_entries;
+  u->sq_tail = (unsigned int *) ((char *) u->sq_ring + p.sq_off.tail);
+  u->sq_mask = (unsigned int *) ((char *) u->sq_ring + p.sq_off.ring_mask);
+  u->sq_array = (unsigned int *) ((char *) u->sq_ring + p.sq_off.array);
+  u->cq_head = (unsigned int *) ((char *) u->cq_ring + p.cq_off.head);
+  u->cq_tail = (unsigned int *) ((char *) u->cq_ring + p.cq_off.tail);
+  u->cq_mask = (unsigned int *) ((char *) u->cq_ring + p.cq_off.ring_mask);
+  u->cqes = (struct io_uring_cqe *) ((char *) u->cq_ring + p.cq_off.cqes);
+  return 0;
+
+fail:
+  mutt_debug(1, "io_uring mmap: %s\n", strerror(errno));
+  uring_free(u);
+  return -1;
+}
+
+/**
+ * uring_queue - Queue a request
+ * @param u         io_uring
+ * @param opcode    Operation, e.g. IORING_OP_READ
+ * @param fd        File descriptor, or AT_FDCWD
+ * @param addr      Buffer or path
+ * @param len       Length of the buffer, or flags
+ * @param off       File offset, or another buffer
+ * @param user_data Tag returned with the completion
+ * @retval ptr Request, for setting opcode-specific fields
+ *
+ * At most u->entries requests may be queued between uring_wait()s.
+ */
+static struct io_uring_sqe *uring_queue(struct Uring *u, int opcode, int fd,
+                                        const void *addr, unsigned int len,
+                                        uint64_t off, uint64_t user_data)
+{
+  /* only this thread writes the tail, so a plain read is safe */
+  unsigned int tail = *u->sq_tail;
+  unsigned int idx = tail & *u->sq_mask;
+  struct io_uring_sqe *sqe = &u->sqes[idx];
+
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = opcode;
+  sqe->fd = fd;
+  sqe->addr = (uintptr_t) addr;
+  sqe->len = len;
+  sqe->off = off;
+  sqe->user_data = user_data;
+  u->sq_array[idx] = idx;
+
+  __atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+  u->queued++;
+  return sqe;
+}
+
+/**
+ * uring_complete_t - Handle a completed request
+ * @param user_data Tag given to uring_queue()
+ * @param res       Result: a count, an fd or -errno
+ * @param data      Private data passed to uring_wait()
+ */
+typedef void (*uring_complete_t)(uint64_t user_data, int res, void *data);
+
+/**
+ * uring_wait - Submit the queued requests and wait for all of them
+ * @param u    io_uring
+ * @param cb   Function to handle each completion
+ * @param data Private data for @a cb
+ * @retval  0 Success
+ * @retval -1 The requests couldn't be submitted
+ */
+static int uring_wait(struct Uring *u, uring_complete_t cb, void *data)
+{
+  unsigned int submitted = 0, reaped = 0;
+
+  while (reaped < u->queued)
+  {
+    unsigned int head = *u->cq_head;
+    unsigned int tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+
+    for (; head != tail; head++, reaped++)
+    {
+      struct io_uring_cqe *cqe = &u->cqes[head & *u->cq_mask];
+      cb(cqe->user_data, cqe->res, data);
+    }
+    __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+
+    if (reaped >= u->queued)
+      break;
+
+    int rc = syscall(__NR_io_uring_enter, u->fd, u->queued - submitted, 1,
+                     IORING_ENTER_GETEVENTS, NULL, 0);
+    if (rc < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      mutt_debug(1, "io_uring_enter: %s\n", strerror(errno));
+      if (submitted == 0)
+      {
+        /* nothing reached the kernel: forget the requests */
+        *u->sq_tail -= u->queued;
+        u->queued = 0;
+        return -1;
+      }
+      /* the submitted requests still have to complete */
+      continue;
+    }
+    submitted += rc;
+  }
+
+  u->queued = 0;
+  return 0;
+}
+
+/**
+ * struct BulkUring - State of one group of requests
+ */
+struct BulkUring
+{
+  struct BulkRead *reqs;
+  int *fds;              /**< Open files, -1 if not open */
+  struct statx *stx;     /**< Results of the statx requests */
+  bool *retry;           /**< The kernel doesn't support the request */
+};
+
+/* The low bits of the user_data say which request of a file completed */
+#define BULK_OPEN  0
+#define BULK_STATX 1
+#define BULK_READ  2
+#define BULK_SHIFT 2
+
+/**
+ * bulk_uring_complete - Handle a completed request - Implements ::uring_complete_t
+ */
+static void bulk_uring_complete(uint64_t user_data, int res, void *data)
+{
+  struct BulkUring *b = data;
+  int i = user_data >> BULK_SHIFT;
+  struct BulkRead *req = &b->reqs[i];
+
+  if ((res == -EINVAL) || (res == -EOPNOTSUPP))
+  {
+    /* an older kernel, without this opcode */
+    b->retry[i] = true;
+    return;
+  }
+
+  switch (user_data & ((1 << BULK_SHIFT) - 1))
+  {
+    case BULK_OPEN:
+      if (res >= 0)
+        b->fds[i] = res;
+      else if (!req->err)
+        req->err = -res;
+      break;
+    case BULK_STATX:
+      if (res < 0)
+      {
+        if (!req->err)
+          req->err = -res;
+        break;
+      }
+      req->size = b->stx[i].stx_size;
+      req->mtime = b->stx[i].stx_mtime.tv_sec;
+      break;
+    case BULK_READ:
+      if (res < 0)
+        req->err = -res;
+      else
+        req->len = res;
+      req->buf[req->len] = '\0';
+      break;
+  }
+}
+
+/**
+ * bulk_read_uring - Read a group of files using io_uring
+ * @param u     io_uring
+ * @param reqs  Files to read
+ * @param count Number of files, at most half the size of the queue
+ * @retval  0 Success
+ * @retval -1 io_uring failed, nothing was read
+ */
+static int bulk_read_uring(struct Uring *u, struct BulkRead *reqs, int count)
+{
+  struct BulkUring b;
+  int i, rc = -1;
+
+  b.reqs = reqs;
+  b.fds = safe_malloc(count * sizeof(int));
+  b.stx = safe_calloc(count, sizeof(struct statx));
+  b.retry = safe_calloc(count, sizeof(bool));
+
+  /* First, open and stat every file */
+  for (i = 0; i < count; i++)
+  {
+    b.fds[i] = -1;
+    reqs[i].err = 0;
+    reqs[i].len = 0;
+    if (reqs[i].want > 0)
+    {
+      struct io_uring_sqe *sqe =
+          uring_queue(u, IORING_OP_OPENAT, AT_FDCWD, reqs[i].path, 0, 0,
+                      ((uint64_t) i << BULK_SHIFT) | BULK_OPEN);
+      sqe->open_flags = O_RDONLY | O_CLOEXEC;
+    }
+    uring_queue(u, IORING_OP_STATX, AT_FDCWD, reqs[i].path,
+                STATX_SIZE | STATX_MTIME, (uintptr_t) &b.stx[i],
+                ((uint64_t) i << BULK_SHIFT) | BULK_STATX);
+  }
+  if (uring_wait(u, bulk_uring_complete, &b) != 0)
+    goto done;
+
+  /* Then read the start of the files which opened */
+  for (i = 0; i < count; i++)
+  {
+    if ((b.fds[i] >= 0) && !b.retry[i] && !reqs[i].err)
+      uring_queue(u, IORING_OP_READ, b.fds[i], reqs[i].buf, reqs[i].want, 0,
+                  ((uint64_t) i << BULK_SHIFT) | BULK_READ);
+  }
+  if (uring_wait(u, bulk_uring_complete, &b) != 0)
+    goto done;
+
+  rc = 0;
+
+done:
+  for (i = 0; i < count; i++)
+  {
+    if (b.fds[i] >= 0)
+      close(b.fds[i]);
+    if ((rc == 0) && b.retry[i])
+      bulk_read_one(i, reqs);
+  }
+  FREE(&b.fds);
+  FREE(&b.stx);
+  FREE(&b.retry);
+  return rc;
+}
+#endif /* USE_IO_URING */
+
+/**
+ * mutt_bulk_read - Read the start of many files at once
+ * @param reqs    Files to read
+ * @param count   Number of files
+ * @param threads Number of threads for the fallback, see mutt_workers_count()
+ *
+ * For each file, up to @a want bytes are read into a new buffer, and its size
+ * and modification time are filled in.  A file which can't be read has its
+ * @a err set; the others are unaffected.
+ */
+void mutt_bulk_read(struct BulkRead *reqs, int count, int threads)
+{
+  int i;
+
+  for (i = 0; i < count; i++)
+  {
+    reqs[i].buf = NULL;
+    if (reqs[i].want > 0)
+      reqs[i].buf = safe_malloc(reqs[i].want + 1);
+  }
+
+#ifdef USE_IO_URING
+  /* once io_uring has failed, don't try it again */
+  static bool uring_broken = false;
+  struct Uring u;
+
+  if (!uring_broken && (count > 1) && (uring_init(&u, URING_ENTRIES) == 0))
+  {
+    /* each file needs up to two requests at once */
+    int group = u.entries / 2;
+
+    for (i = 0; i < count; i += group)
+    {
+      int n = ((count - i) < group) ? (count - i) : group;
+      if (bulk_read_uring(&u, reqs + i, n) != 0)
+        break;
+    }
+    uring_free(&u);
+
+    if (i >= count)
+      return;
+
+    uring_broken = true;
+    reqs += i;
+    count -= i;
+  }
+#endif
+
+  mutt_workers_run(threads, count, bulk_read_one, reqs);
+}
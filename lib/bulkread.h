@@ -0,0 +1,43 @@
+/**
+ * @file
+ * Read the start of many files at once
+ *
+ * @copyright
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _LIB_BULKREAD_H
+#define _LIB_BULKREAD_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <time.h>
+
+/**
+ * struct BulkRead - A file to read with mutt_bulk_read()
+ */
+struct BulkRead
+{
+  const char *path; /**< File to read */
+  size_t want;      /**< Bytes to read from the start, 0 to only stat the file */
+  char *buf;        /**< Bytes read, NUL-terminated; the caller frees it */
+  size_t len;       /**< Number of bytes read */
+  off_t size;       /**< Size of the file */
+  time_t mtime;     /**< Modification time of the file */
+  int err;          /**< errno if the file couldn't be read, else 0 */
+};
+
+void mutt_bulk_read(struct BulkRead *reqs, int count, int threads);
+
+#endif /* _LIB_BULKREAD_H */
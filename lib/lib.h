@@ -30,6 +30,7 @@
  *
  * -# @subpage base64
  * -# @subpage buffer
+ * -# @subpage bulkread
  * -# @subpage date
  * -# @subpage debug
  * -# @subpage exit
@@ -40,6 +41,7 @@
  * -# @subpage message
  * -# @subpage sha1
  * -# @subpage string
+ * -# @subpage workers
  */
 
 #ifndef _LIB_LIB_H
@@ -47,6 +49,7 @@
 
 #include "base64.h"
 #include "buffer.h"
+#include "bulkread.h"
 #include "date.h"
 #include "debug.h"
 #include "exit.h"
@@ -57,5 +60,6 @@
 #include "message.h"
 #include "sha1.h"
 #include "string2.h"
+#include "workers.h"
 
 #endif /* _LIB_LIB_H */
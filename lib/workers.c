@@ -0,0 +1,196 @@
+/**
+ * @file
+ * Run independent jobs on a pool of threads
+ *
+ * @copyright
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @page workers Run independent jobs on a pool of threads
+ *
+ * A batch of jobs, numbered 0 to count-1, is shared out between a few
+ * threads, which each take the next job until there are none left.  The
+ * caller can do something else in the meantime, then wait for the batch.
+ *
+ * Without thread support, or when only one thread is wanted, the jobs are
+ * simply run in order by mutt_workers_start().
+ *
+ * | Function             | Description
+ * | :------------------- | :-------------------------------------------------
+ * | mutt_workers_count() | How many threads to use
+ * | mutt_workers_run()   | Run a batch of jobs and wait for them
+ * | mutt_workers_start() | Start running a batch of jobs
+ * | mutt_workers_wait()  | Wait for a batch of jobs to finish
+ */
+
+#include "config.h"
+#include <stdbool.h>
+#include <unistd.h>
+#ifdef USE_PTHREAD
+#include <pthread.h>
+#include <signal.h>
+#endif
+#include "workers.h"
+#include "debug.h"
+#include "memory.h"
+
+#define WORKERS_MAX 16
+
+/**
+ * struct Workers - A batch of jobs being run
+ */
+struct Workers
+{
+  worker_fn_t fn;  /**< Function running one job */
+  void *data;      /**< Private data for @a fn */
+  int count;       /**< Number of jobs */
+#ifdef USE_PTHREAD
+  int next;              /**< Next job to hand out */
+  pthread_mutex_t lock;  /**< Protects @a next */
+  pthread_t *threads;
+  int nthreads;
+#endif
+};
+
+/**
+ * mutt_workers_count - How many threads to use
+ * @param wanted Number of threads configured, 0 or less for automatic
+ * @retval num Number of threads, at least 1
+ */
+int mutt_workers_count(int wanted)
+{
+#ifdef USE_PTHREAD
+  if (wanted <= 0)
+  {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    wanted = (cpus > 0) ? cpus : 1;
+  }
+  return (wanted > WORKERS_MAX) ? WORKERS_MAX : wanted;
+#else
+  return 1;
+#endif
+}
+
+#ifdef USE_PTHREAD
+/**
+ * workers_main - Take jobs until there are none left
+ * @param arg Batch of jobs
+ * @retval NULL Always
+ */
+static void *workers_main(void *arg)
+{
+  struct Workers *w = arg;
+
+  while (true)
+  {
+    pthread_mutex_lock(&w->lock);
+    int i = w->next++;
+    pthread_mutex_unlock(&w->lock);
+
+    if (i >= w->count)
+      break;
+    w->fn(i, w->data);
+  }
+
+  return NULL;
+}
+#endif
+
+/**
+ * mutt_workers_start - Start running a batch of jobs
+ * @param threads Number of threads, see mutt_workers_count()
+ * @param count   Number of jobs
+ * @param fn      Function to run each job
+ * @param data    Private data passed to @a fn
+ * @retval ptr  Batch, to pass to mutt_workers_wait()
+ * @retval NULL The jobs have all been run already
+ */
+struct Workers *mutt_workers_start(int threads, int count, worker_fn_t fn, void *data)
+{
+  if (count <= 0)
+    return NULL;
+
+  threads = mutt_workers_count(threads);
+  if (threads > count)
+    threads = count;
+
+#ifdef USE_PTHREAD
+  if (threads > 1)
+  {
+    struct Workers *w = safe_calloc(1, sizeof(struct Workers));
+    sigset_t all, old;
+
+    w->fn = fn;
+    w->data = data;
+    w->count = count;
+    pthread_mutex_init(&w->lock, NULL);
+    w->threads = safe_calloc(threads, sizeof(pthread_t));
+
+    /* signals are for the main thread: the workers inherit this mask */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    for (; w->nthreads < threads; w->nthreads++)
+      if (pthread_create(&w->threads[w->nthreads], NULL, workers_main, w) != 0)
+        break;
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (w->nthreads > 0)
+      return w;
+
+    mutt_debug(1, "mutt_workers_start: can't create threads\n");
+    pthread_mutex_destroy(&w->lock);
+    FREE(&w->threads);
+    FREE(&w);
+  }
+#endif
+
+  for (int i = 0; i < count; i++)
+    fn(i, data);
+
+  return NULL;
+}
+
+/**
+ * mutt_workers_wait - Wait for a batch of jobs to finish
+ * @param workers Batch from mutt_workers_start(); it will be freed
+ */
+void mutt_workers_wait(struct Workers **workers)
+{
+  if (!workers || !*workers)
+    return;
+
+#ifdef USE_PTHREAD
+  struct Workers *w = *workers;
+  for (int i = 0; i < w->nthreads; i++)
+    pthread_join(w->threads[i], NULL);
+  pthread_mutex_destroy(&w->lock);
+  FREE(&w->threads);
+#endif
+
+  FREE(workers);
+}
+
+/**
+ * mutt_workers_run - Run a batch of jobs and wait for them
+ * @param threads Number of threads, see mutt_workers_count()
+ * @param count   Number of jobs
+ * @param fn      Function to run each job
+ * @param data    Private data passed to @a fn
+ */
+void mutt_workers_run(int threads, int count, worker_fn_t fn, void *data)
+{
+  struct Workers *w = mutt_workers_start(threads, count, fn, data);
+  mutt_workers_wait(&w);
+}
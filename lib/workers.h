@@ -0,0 +1,40 @@
+/**
+ * @file
+ * Run independent jobs on a pool of threads
+ *
+ * @copyright
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _LIB_WORKERS_H
+#define _LIB_WORKERS_H
+
+struct Workers;
+
+/**
+ * worker_fn_t - Run one job
+ * @param i    Index of the job, 0 to count-1
+ * @param data Private data passed to mutt_workers_start()
+ *
+ * Jobs run concurrently: they mustn't touch the screen or any shared state
+ * that isn't their own.
+ */
+typedef void (*worker_fn_t)(int i, void *data);
+
+int             mutt_workers_count(int wanted);
+void            mutt_workers_run(int threads, int count, worker_fn_t fn, void *data);
+struct Workers *mutt_workers_start(int threads, int count, worker_fn_t fn, void *data);
+void            mutt_workers_wait(struct Workers **workers);
+
+#endif /* _LIB_WORKERS_H */
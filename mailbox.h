@@ -90,6 +90,9 @@ int mx_close_message(struct Context *ctx, struct Message **msg);
 int mx_get_magic(const char *path);
 int mx_set_magic(const char *s);
 int mx_check_mailbox(struct Context *ctx, int *index_hint);
+#ifdef USE_HCACHE
+int mx_hcache_compact(struct Context *ctx, bool force, LOFF_T *reclaimed);
+#endif
 #ifdef USE_IMAP
 bool mx_is_imap(const char *p);
 #endif
@@ -62,6 +62,9 @@
 #ifdef USE_SIDEBAR
 #include "sidebar.h"
 #endif
+#ifdef USE_HCACHE
+#include "hcache/hcache.h"
+#endif
 #ifdef USE_SASL
 #include "mutt_sasl.h"
 #endif
@@ -71,6 +74,9 @@
 #ifdef USE_NNTP
 #include "nntp.h"
 #endif
+#ifdef USE_NOTMUCH
+#include "mutt_notmuch.h"
+#endif
 
 char **envlist = NULL;
 
@@ -942,6 +948,12 @@ int main(int argc, char **argv, char **env)
 #endif
 #ifdef USE_SASL
     mutt_sasl_done();
+#endif
+#ifdef USE_HCACHE
+    mutt_hcache_close_shared();
+#endif
+#ifdef USE_NOTMUCH
+    nm_nonctx_free(NULL);
 #endif
     mutt_free_opts();
     mutt_free_windows();
@@ -38,6 +38,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#ifdef USE_INOTIFY
+#include <sys/inotify.h>
+#endif
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <time.h>
@@ -56,6 +59,7 @@
 #include "mutt_curses.h"
 #include "mx.h"
 #include "options.h"
+#include "pattern.h"
 #include "protos.h"
 #include "sort.h"
 #include "thread.h"
@@ -64,6 +68,7 @@
 #endif
 #ifdef USE_HCACHE
 #include "hcache/hcache.h"
+#include "hcache/textindex.h"
 #endif
 
 #define INS_SORT_THRESHOLD 6
@@ -80,13 +85,35 @@ struct Maildir
   struct Maildir *next;
 };
 
+/**
+ * struct MhRange - A run of consecutive message numbers
+ */
+struct MhRange
+{
+  int first;
+  int last;
+};
+
+/**
+ * struct MhSequence - Message numbers in one MH sequence
+ *
+ * The numbers are kept as sorted, disjoint and non-adjacent ranges, the way
+ * they're written in .mh_sequences.
+ */
+struct MhSequence
+{
+  struct MhRange *ranges;
+  int count; /**< Number of ranges in use */
+  int alloc; /**< Number of ranges allocated */
+};
+
 /**
  * struct MhSequences - Set of MH sequence numbers
  */
 struct MhSequences
 {
-  int max;
-  short *flags;
+  int max;                  /**< Highest message number in any sequence */
+  struct MhSequence seq[3]; /**< One per MH_SEQ_* flag, in bit order */
 };
 
 /**
@@ -96,6 +123,12 @@ struct MhData
 {
   time_t mtime_cur;
   mode_t mh_umask;
+#ifdef USE_INOTIFY
+  bool watching;  /**< Changes are tracked by inotify */
+  int watch_fd;   /**< inotify instance */
+  int wd_new;     /**< Watch on "new" (maildir only) */
+  int wd_cur;     /**< Watch on "cur" (maildir), or on the folder (MH) */
+#endif
 };
 
 /* mh_sequences support */
@@ -109,41 +142,166 @@ static inline struct MhData *mh_data(struct Context *ctx)
   return (struct MhData *) ctx->data;
 }
 
-static void mhs_alloc(struct MhSequences *mhs, int i)
+/**
+ * mhs_insert - Add a range of numbers to a sequence
+ * @param seq   Sequence
+ * @param first First number of the range
+ * @param last  Last number of the range
+ *
+ * Ranges which overlap or touch the new one are merged with it.
+ */
+static void mhs_insert(struct MhSequence *seq, int first, int last)
 {
-  int j;
-  int newmax;
+  int lo = 0, hi = seq->count, end;
 
-  if (i > mhs->max || !mhs->flags)
+  /* Usually, the numbers come in increasing order */
+  if (seq->count > 0)
   {
-    newmax = i + 128;
-    j = mhs->flags ? mhs->max + 1 : 0;
-    safe_realloc(&mhs->flags, sizeof(mhs->flags[0]) * (newmax + 1));
-    while (j <= newmax)
-      mhs->flags[j++] = 0;
+    struct MhRange *r = &seq->ranges[seq->count - 1];
+    if ((first >= r->first) && (first - 1 <= r->last))
+    {
+      if (last > r->last)
+        r->last = last;
+      return;
+    }
+    if (first - 1 > r->last)
+      lo = seq->count;
+  }
+
+  /* Find the first range which ends at, or just before, the new one */
+  while (lo < hi)
+  {
+    int mid = (lo + hi) / 2;
+    if (seq->ranges[mid].last < first - 1)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  /* and the ranges after it which the new one reaches */
+  for (end = lo; (end < seq->count) && (seq->ranges[end].first - 1 <= last); end++)
+    ;
+
+  if (end > lo)
+  {
+    if (seq->ranges[lo].first < first)
+      first = seq->ranges[lo].first;
+    if (seq->ranges[end - 1].last > last)
+      last = seq->ranges[end - 1].last;
+    memmove(&seq->ranges[lo + 1], &seq->ranges[end],
+            (seq->count - end) * sizeof(struct MhRange));
+    seq->count -= end - lo - 1;
+  }
+  else
+  {
+    if (seq->count == seq->alloc)
+    {
+      seq->alloc = seq->alloc ? seq->alloc * 2 : 16;
+      safe_realloc(&seq->ranges, seq->alloc * sizeof(struct MhRange));
+    }
+    memmove(&seq->ranges[lo + 1], &seq->ranges[lo],
+            (seq->count - lo) * sizeof(struct MhRange));
+    seq->count++;
+  }
 
-    mhs->max = newmax;
+  seq->ranges[lo].first = first;
+  seq->ranges[lo].last = last;
+}
+
+/**
+ * mhs_contains - Is a number in a sequence?
+ * @param seq Sequence
+ * @param i   Message number
+ * @retval true if @a i is in @a seq
+ */
+static bool mhs_contains(const struct MhSequence *seq, int i)
+{
+  int lo = 0, hi = seq->count;
+
+  while (lo < hi)
+  {
+    int mid = (lo + hi) / 2;
+    if (seq->ranges[mid].last < i)
+      lo = mid + 1;
+    else
+      hi = mid;
   }
+
+  return (lo < seq->count) && (seq->ranges[lo].first <= i);
+}
+
+/**
+ * mhs_size - Count the numbers in a sequence
+ * @param seq Sequence
+ * @retval num Number of messages
+ */
+static int mhs_size(const struct MhSequence *seq)
+{
+  int n = 0;
+
+  for (int r = 0; r < seq->count; r++)
+    n += seq->ranges[r].last - seq->ranges[r].first + 1;
+  return n;
+}
+
+/**
+ * mhs_get - Get the sequence for a flag
+ * @param mhs Sequences
+ * @param f   Flag, e.g. #MH_SEQ_UNSEEN
+ * @retval ptr Sequence
+ */
+static struct MhSequence *mhs_get(struct MhSequences *mhs, short f)
+{
+  int bit = 0;
+
+  while ((f >>= 1))
+    bit++;
+  return &mhs->seq[bit];
 }
 
 static void mhs_free_sequences(struct MhSequences *mhs)
 {
-  FREE(&mhs->flags);
+  for (size_t j = 0; j < mutt_array_size(mhs->seq); j++)
+    FREE(&mhs->seq[j].ranges);
+  memset(mhs, 0, sizeof(*mhs));
 }
 
 static short mhs_check(struct MhSequences *mhs, int i)
 {
-  if (!mhs->flags || i > mhs->max)
+  short f = 0;
+
+  if (i > mhs->max)
     return 0;
-  else
-    return mhs->flags[i];
+
+  for (size_t j = 0; j < mutt_array_size(mhs->seq); j++)
+    if (mhs_contains(&mhs->seq[j], i))
+      f |= (1 << j);
+  return f;
+}
+
+/**
+ * mhs_set_range - Add a range of messages to some sequences
+ * @param mhs   Sequences
+ * @param first First message number
+ * @param last  Last message number
+ * @param f     Flags, e.g. #MH_SEQ_UNSEEN
+ */
+static void mhs_set_range(struct MhSequences *mhs, int first, int last, short f)
+{
+  if (first > last)
+    return;
+
+  for (size_t j = 0; j < mutt_array_size(mhs->seq); j++)
+    if (f & (1 << j))
+      mhs_insert(&mhs->seq[j], first, last);
+
+  if (last > mhs->max)
+    mhs->max = last;
 }
 
-static short mhs_set(struct MhSequences *mhs, int i, short f)
+static void mhs_set(struct MhSequences *mhs, int i, short f)
 {
-  mhs_alloc(mhs, i);
-  mhs->flags[i] |= f;
-  return mhs->flags[i];
+  mhs_set_range(mhs, i, i, f);
 }
 
 static int mh_read_token(char *t, int *first, int *last)
@@ -170,6 +328,7 @@ static int mh_read_sequences(struct MhSequences *mhs, const char *path)
   int line = 1;
   char *buff = NULL;
   char *t = NULL;
+  char *save = NULL;
   size_t sz = 0;
 
   short f;
@@ -183,7 +342,8 @@ static int mh_read_sequences(struct MhSequences *mhs, const char *path)
 
   while ((buff = mutt_read_line(buff, &sz, fp, &line, 0)))
   {
-    if (!(t = strtok(buff, " \t:")))
+    /* this may run on a worker thread, see mh_buffy() */
+    if (!(t = strtok_r(buff, " \t:", &save)))
       continue;
 
     if (mutt_strcmp(t, MhUnseen) == 0)
@@ -195,7 +355,7 @@ static int mh_read_sequences(struct MhSequences *mhs, const char *path)
     else /* unknown sequence */
       continue;
 
-    while ((t = strtok(NULL, " \t:")))
+    while ((t = strtok_r(NULL, " \t:", &save)))
     {
       if (mh_read_token(t, &first, &last) < 0)
       {
@@ -203,8 +363,7 @@ static int mh_read_sequences(struct MhSequences *mhs, const char *path)
         rc = -1;
         goto out;
       }
-      for (; first <= last; first++)
-        mhs_set(mhs, first, f);
+      mhs_set_range(mhs, first, last, f);
     }
   }
 
@@ -326,29 +485,25 @@ int mh_buffy(struct Buffy *mailbox, int check_stats)
     mailbox->msg_flagged = 0;
   }
 
-  for (int i = mhs.max; i > 0; i--)
+  if (check_stats)
+  {
+    mailbox->msg_flagged = mhs_size(mhs_get(&mhs, MH_SEQ_FLAGGED));
+    mailbox->msg_unread = mhs_size(mhs_get(&mhs, MH_SEQ_UNSEEN));
+  }
+
+  if (check_new)
   {
-    if (check_stats && (mhs_check(&mhs, i) & MH_SEQ_FLAGGED))
-      mailbox->msg_flagged++;
-    if (mhs_check(&mhs, i) & MH_SEQ_UNSEEN)
+    struct MhSequence *unseen = mhs_get(&mhs, MH_SEQ_UNSEEN);
+
+    /* Only the highest unseen message matters: if it was in the mailbox
+     * during the last visit, don't notify about it */
+    if (unseen->count > 0)
     {
-      if (check_stats)
-        mailbox->msg_unread++;
-      if (check_new)
+      int i = unseen->ranges[unseen->count - 1].last;
+      if (!option(OPT_MAIL_CHECK_RECENT) || mh_already_notified(mailbox, i) == 0)
       {
-        /* if the first unseen message we encounter was in the mailbox during the
-           last visit, don't notify about it */
-        if (!option(OPT_MAIL_CHECK_RECENT) || mh_already_notified(mailbox, i) == 0)
-        {
-          mailbox->new = true;
-          rc = 1;
-        }
-        /* Because we are traversing from high to low, we can stop
-         * checking for new mail after the first unseen message.
-         * Whether it resulted in "new mail" or not. */
-        check_new = 0;
-        if (!check_stats)
-          break;
+        mailbox->new = true;
+        rc = 1;
       }
     }
   }
@@ -413,39 +568,16 @@ static int mh_mkstemp(struct Context *dest, FILE **fp, char **tgt)
 
 static void mhs_write_one_sequence(FILE *fp, struct MhSequences *mhs, short f, const char *tag)
 {
-  int first, last;
-  fprintf(fp, "%s:", tag);
-
-  first = -1;
-  last = -1;
-
-  for (int i = 0; i <= mhs->max; i++)
-  {
-    if ((mhs_check(mhs, i) & f))
-    {
-      if (first < 0)
-        first = i;
-      else
-        last = i;
-    }
-    else if (first >= 0)
-    {
-      if (last < 0)
-        fprintf(fp, " %d", first);
-      else
-        fprintf(fp, " %d-%d", first, last);
+  struct MhSequence *seq = mhs_get(mhs, f);
 
-      first = -1;
-      last = -1;
-    }
-  }
+  fprintf(fp, "%s:", tag);
 
-  if (first >= 0)
+  for (int r = 0; r < seq->count; r++)
   {
-    if (last < 0)
-      fprintf(fp, " %d", first);
+    if (seq->ranges[r].first == seq->ranges[r].last)
+      fprintf(fp, " %d", seq->ranges[r].first);
     else
-      fprintf(fp, " %d-%d", first, last);
+      fprintf(fp, " %d-%d", seq->ranges[r].first, seq->ranges[r].last);
   }
 
   fputc('\n', fp);
@@ -768,28 +900,29 @@ static void maildir_update_mtime(struct Context *ctx)
 }
 
 /**
- * maildir_parse_stream - Parse a Maildir message
- *
- * Actually parse a maildir message.  This may also be used to fill
- * out a fake header structure generated by lazy maildir parsing.
+ * maildir_parse_header - Parse the header of a Maildir or MH message
+ * @param magic  Mailbox type, e.g. #MUTT_MAILDIR
+ * @param f      Stream positioned at the start of the message
+ * @param fname  Path of the message file
+ * @param is_old true if the message is in cur/
+ * @param _h     Header to fill in, or NULL for a new one
+ * @param size   Size of the message file
+ * @retval ptr Header
  */
-struct Header *maildir_parse_stream(int magic, FILE *f, const char *fname,
-                                    int is_old, struct Header *_h)
+static struct Header *maildir_parse_header(int magic, FILE *f, const char *fname,
+                                           int is_old, struct Header *_h, LOFF_T size)
 {
   struct Header *h = _h;
-  struct stat st;
 
   if (!h)
     h = mutt_new_header();
   h->env = mutt_read_rfc822_header(f, h, 0, 0);
 
-  fstat(fileno(f), &st);
-
   if (!h->received)
     h->received = h->date_sent;
 
   /* always update the length since we have fresh information available. */
-  h->content->length = st.st_size - h->content->offset;
+  h->content->length = size - h->content->offset;
 
   h->index = -1;
 
@@ -806,6 +939,21 @@ struct Header *maildir_parse_stream(int magic, FILE *f, const char *fname,
   return h;
 }
 
+/**
+ * maildir_parse_stream - Parse a Maildir message
+ *
+ * Actually parse a maildir message.  This may also be used to fill
+ * out a fake header structure generated by lazy maildir parsing.
+ */
+struct Header *maildir_parse_stream(int magic, FILE *f, const char *fname,
+                                    int is_old, struct Header *_h)
+{
+  struct stat st;
+
+  fstat(fileno(f), &st);
+  return maildir_parse_header(magic, f, fname, is_old, _h, st.st_size);
+}
+
 /**
  * maildir_parse_message - Actually parse a maildir message
  *
@@ -1113,8 +1261,73 @@ static struct Maildir *skip_duplicates(struct Maildir *p, struct Maildir **last)
   return p;
 }
 
+/* Bytes read from the start of each message, enough for most headers */
+#define MH_HEADER_READ 16384
+/* Messages whose headers are read at once */
+#define MH_READ_BATCH 512
+
+/**
+ * maildir_parse_bulk - Parse a message's header from mutt_bulk_read()
+ * @param magic  Mailbox type, e.g. #MUTT_MAILDIR
+ * @param req    Start of the message file
+ * @param is_old true if the message is in cur/
+ * @param h      Header to fill in
+ * @retval ptr  Header
+ * @retval NULL The header wasn't all read, use maildir_parse_message()
+ *
+ * Without fmemopen(), the headers aren't read in bulk: the files are only
+ * stat'ed, and maildir_parse_message() reads them.
+ */
+static struct Header *maildir_parse_bulk(int magic, struct BulkRead *req,
+                                         int is_old, struct Header *h)
+{
+#ifdef USE_FMEMOPEN
+  FILE *f = NULL;
+
+  if (req->err || (req->len == 0))
+    return NULL;
+
+  /* the header ends at the first blank line */
+  if ((req->len < (size_t) req->size) && (req->buf[0] != '\n') &&
+      !strstr(req->buf, "\n\n"))
+    return NULL;
+
+  f = fmemopen(req->buf, req->len, "r");
+  if (!f)
+    return NULL;
+
+  h = maildir_parse_header(magic, f, req->path, is_old, h, req->size);
+  safe_fclose(&f);
+  return h;
+#else
+  return NULL;
+#endif
+}
+
+/**
+ * struct MhReadJob - A message whose header maildir_delayed_parsing() needs
+ */
+struct MhReadJob
+{
+  struct Maildir *md;
+  int count;             /**< Position in the list, for the progress bar */
+  char *path;            /**< Path of the message file */
+  struct BulkRead *req;  /**< File read, or NULL if the header cache will do */
+#ifdef USE_HCACHE
+  void *data;            /**< Header cache record */
+  bool store;            /**< The header was parsed, and has to be cached */
+#endif
+};
+
 /**
  * maildir_delayed_parsing - This function does the second parsing pass
+ *
+ * The message files are read in batches by mutt_bulk_read(), so that many
+ * requests are in flight at once.  The headers are parsed in the main thread.
+ *
+ * The cached records of a batch may point into the database, and a store can
+ * invalidate them (e.g. LMDB aborts its read transaction), so the new headers
+ * are only stored once the batch's records have all been restored.
  */
 static void maildir_delayed_parsing(struct Context *ctx, struct Maildir **md,
                                     struct Progress *progress)
@@ -1123,14 +1336,14 @@ static void maildir_delayed_parsing(struct Context *ctx, struct Maildir **md,
   char fn[_POSIX_PATH_MAX];
   int count;
   int sort = 0;
+  struct MhReadJob *jobs = NULL;
+  struct BulkRead *reqs = NULL;
+  int njobs = 0, maxjobs = 0;
 #ifdef USE_HCACHE
   header_cache_t *hc = NULL;
-  void *data = NULL;
   const char *key = NULL;
   size_t keylen;
   struct timeval *when = NULL;
-  struct stat lastchanged;
-  int ret;
 #endif
 
 #ifdef USE_HCACHE
@@ -1145,9 +1358,6 @@ static void maildir_delayed_parsing(struct Context *ctx, struct Maildir **md,
       continue;
     }
 
-    if (!ctx->quiet && progress)
-      mutt_progress_update(progress, count, -1);
-
     if (!sort)
     {
       mutt_debug(4, "maildir: need to sort %s by inode\n", ctx->path);
@@ -1158,74 +1368,130 @@ static void maildir_delayed_parsing(struct Context *ctx, struct Maildir **md,
         last->next = p;
       sort = 1;
       p = skip_duplicates(p, &last);
-      snprintf(fn, sizeof(fn), "%s/%s", ctx->path, p->h->path);
     }
 
-    snprintf(fn, sizeof(fn), "%s/%s", ctx->path, p->h->path);
-
-#ifdef USE_HCACHE
-    if (option(OPT_HCACHE_VERIFY))
-    {
-      ret = stat(fn, &lastchanged);
-    }
-    else
+    if (njobs == maxjobs)
     {
-      lastchanged.st_mtime = 0;
-      ret = 0;
+      maxjobs += MH_READ_BATCH;
+      safe_realloc(&jobs, maxjobs * sizeof(struct MhReadJob));
     }
+    memset(&jobs[njobs], 0, sizeof(struct MhReadJob));
+    jobs[njobs].md = p;
+    jobs[njobs].count = count;
+    njobs++;
+    last = p;
+  }
 
-    if (ctx->magic == MUTT_MH)
-    {
-      key = p->h->path;
-      keylen = strlen(key);
-    }
-    else
-    {
-      key = p->h->path + 3;
-      keylen = maildir_hcache_keylen(key);
-    }
-    data = mutt_hcache_fetch(hc, key, keylen);
-    when = (struct timeval *) data;
+  if (njobs > 0)
+    reqs = safe_calloc(MH_READ_BATCH, sizeof(struct BulkRead));
 
-    if (data != NULL && !ret && lastchanged.st_mtime <= when->tv_sec)
+  for (int first = 0; first < njobs; first += MH_READ_BATCH)
+  {
+    int n = MIN(MH_READ_BATCH, njobs - first);
+    int nreqs = 0;
+
+    /* Decide which files need reading, or only stat'ing */
+    for (int i = first; i < first + n; i++)
     {
-      struct Header *h = mutt_hcache_restore((unsigned char *) data);
-      h->old = p->h->old;
-      h->path = safe_strdup(p->h->path);
-      mutt_free_header(&p->h);
-      p->h = h;
-      if (ctx->magic == MUTT_MAILDIR)
-        maildir_parse_flags(p->h, fn);
+      struct MhReadJob *job = &jobs[i];
+      struct BulkRead *req = &reqs[nreqs];
+
+      p = job->md;
+      snprintf(fn, sizeof(fn), "%s/%s", ctx->path, p->h->path);
+      memset(req, 0, sizeof(*req));
+#ifdef USE_FMEMOPEN
+      req->want = MH_HEADER_READ;
+#endif
+
+#ifdef USE_HCACHE
+      if (ctx->magic == MUTT_MH)
+      {
+        key = p->h->path;
+        keylen = strlen(key);
+      }
+      else
+      {
+        key = p->h->path + 3;
+        keylen = maildir_hcache_keylen(key);
+      }
+      job->data = mutt_hcache_fetch(hc, key, keylen);
+
+      if (job->data)
+      {
+        if (!option(OPT_HCACHE_VERIFY))
+          continue;
+        req->want = 0;
+      }
+#endif
+      job->path = safe_strdup(fn);
+      req->path = job->path;
+      job->req = req;
+      nreqs++;
     }
-    else
+
+    mutt_bulk_read(reqs, nreqs, WorkerThreads);
+
+    /* Parse the headers, in order */
+    for (int i = first; i < first + n; i++)
     {
-#endif /* USE_HCACHE */
+      struct MhReadJob *job = &jobs[i];
+      struct BulkRead *req = job->req;
+
+      p = job->md;
+      if (!ctx->quiet && progress)
+        mutt_progress_update(progress, job->count, -1);
+
+      snprintf(fn, sizeof(fn), "%s/%s", ctx->path, p->h->path);
 
-      if (maildir_parse_message(ctx->magic, fn, p->h->old, p->h))
-      {
-        p->header_parsed = 1;
 #ifdef USE_HCACHE
-        if (ctx->magic == MUTT_MH)
+      when = (struct timeval *) job->data;
+
+      if (job->data && (!req || (!req->err && (req->mtime <= when->tv_sec))))
+      {
+        struct Header *h = mutt_hcache_restore((unsigned char *) job->data);
+        h->old = p->h->old;
+        h->path = safe_strdup(p->h->path);
+        mutt_free_header(&p->h);
+        p->h = h;
+        if (ctx->magic == MUTT_MAILDIR)
+          maildir_parse_flags(p->h, fn);
+      }
+      else
+      {
+#endif /* USE_HCACHE */
+
+        if ((req && maildir_parse_bulk(ctx->magic, req, p->h->old, p->h)) ||
+            maildir_parse_message(ctx->magic, fn, p->h->old, p->h))
         {
-          key = p->h->path;
-          keylen = strlen(key);
+          p->header_parsed = 1;
+#ifdef USE_HCACHE
+          job->store = true;
+#endif
         }
         else
-        {
-          key = p->h->path + 3;
-          keylen = maildir_hcache_keylen(key);
-        }
-        mutt_hcache_store(hc, key, keylen, p->h, 0);
-#endif
+          mutt_free_header(&p->h);
+#ifdef USE_HCACHE
       }
-      else
-        mutt_free_header(&p->h);
+      mutt_hcache_free(hc, &job->data);
+#endif
+      if (req)
+        FREE(&req->buf);
+      FREE(&job->path);
+    }
+
 #ifdef USE_HCACHE
+    for (int i = first; i < first + n; i++)
+    {
+      if (!jobs[i].store)
+        continue;
+      p = jobs[i].md;
+      key = mh_hcache_key(ctx, p->h, &keylen);
+      mutt_hcache_store(hc, key, keylen, p->h, 0);
     }
-    mutt_hcache_free(hc, &data);
 #endif
-    last = p;
   }
+  FREE(&reqs);
+  FREE(&jobs);
 #ifdef USE_HCACHE
   mutt_hcache_close(hc);
 #endif
@@ -1233,8 +1499,76 @@ static void maildir_delayed_parsing(struct Context *ctx, struct Maildir **md,
   mh_sort_natural(ctx, md);
 }
 
+#ifdef USE_INOTIFY
+#define MH_WATCH_MASK                                                          \
+  (IN_CREATE | IN_MOVED_TO | IN_CLOSE_WRITE | IN_DELETE | IN_MOVED_FROM |      \
+   IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+
+/**
+ * mh_watch_stop - Stop watching a mailbox
+ * @param ctx Mailbox
+ */
+static void mh_watch_stop(struct Context *ctx)
+{
+  struct MhData *data = mh_data(ctx);
+
+  if (!data || !data->watching)
+    return;
+
+  close(data->watch_fd);
+  data->watching = false;
+}
+
+/**
+ * mh_watch_start - Watch a mailbox's directories for changes
+ * @param ctx Mailbox
+ *
+ * If this fails, for instance because the user's limit of watches has been
+ * reached, the mailbox is simply checked by scanning its directories.
+ */
+static void mh_watch_start(struct Context *ctx)
+{
+  char buf[_POSIX_PATH_MAX];
+
+  if (!ctx->data)
+    ctx->data = safe_calloc(1, sizeof(struct MhData));
+  struct MhData *data = mh_data(ctx);
+
+  data->watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (data->watch_fd < 0)
+  {
+    mutt_debug(1, "mh_watch_start: inotify_init1: %s\n", strerror(errno));
+    return;
+  }
+  data->watching = true;
+
+  if (ctx->magic == MUTT_MAILDIR)
+  {
+    snprintf(buf, sizeof(buf), "%s/new", ctx->path);
+    data->wd_new = inotify_add_watch(data->watch_fd, buf, MH_WATCH_MASK);
+    snprintf(buf, sizeof(buf), "%s/cur", ctx->path);
+    data->wd_cur = inotify_add_watch(data->watch_fd, buf, MH_WATCH_MASK);
+  }
+  else
+  {
+    data->wd_new = -1;
+    data->wd_cur = inotify_add_watch(data->watch_fd, ctx->path, MH_WATCH_MASK);
+  }
+
+  if ((data->wd_cur < 0) || ((ctx->magic == MUTT_MAILDIR) && (data->wd_new < 0)))
+  {
+    mutt_debug(1, "mh_watch_start: inotify_add_watch %s: %s\n", ctx->path,
+               strerror(errno));
+    mh_watch_stop(ctx);
+  }
+}
+#endif /* USE_INOTIFY */
+
 static int mh_close_mailbox(struct Context *ctx)
 {
+#ifdef USE_INOTIFY
+  mh_watch_stop(ctx);
+#endif
   FREE(&ctx->data);
 
   return 0;
@@ -1319,6 +1653,10 @@ static int maildir_read_dir(struct Context *ctx)
 
 static int maildir_open_mailbox(struct Context *ctx)
 {
+#ifdef USE_INOTIFY
+  /* start watching first, so nothing is missed while reading */
+  mh_watch_start(ctx);
+#endif
   return maildir_read_dir(ctx);
 }
 
@@ -1370,6 +1708,9 @@ static int maildir_open_mailbox_append(struct Context *ctx, int flags)
 
 static int mh_open_mailbox(struct Context *ctx)
 {
+#ifdef USE_INOTIFY
+  mh_watch_start(ctx);
+#endif
   return mh_read_dir(ctx, NULL);
 }
 
@@ -1822,53 +2163,70 @@ static int mh_sync_message(struct Context *ctx, int msgno)
   return 0;
 }
 
-static int maildir_sync_message(struct Context *ctx, int msgno)
+/**
+ * maildir_sync_path - Get the name a message's file should have
+ * @param[in]  h       Email header
+ * @param[out] partpath Path relative to the mailbox, e.g. "cur/123.abc:2,S"
+ * @param[in]  len     Length of @a partpath
+ * @retval  0 The file needs renaming
+ * @retval  1 The file already has the right name
+ * @retval -1 Error
+ */
+static int maildir_sync_path(struct Header *h, char *partpath, size_t len)
 {
-  struct Header *h = ctx->hdrs[msgno];
+  char newpath[_POSIX_PATH_MAX];
+  char suffix[16];
+  char *p = NULL;
 
-  if (h->attach_del || h->xlabel_changed ||
-      (h->env && (h->env->refs_changed || h->env->irt_changed)))
+  if ((p = strrchr(h->path, '/')) == NULL)
   {
-    /* when doing attachment deletion/rethreading, fall back to the MH case. */
-    if (mh_rewrite_message(ctx, msgno) != 0)
-      return -1;
+    mutt_debug(1, "maildir_sync_message: %s: unable to find subdir!\n", h->path);
+    return -1;
+  }
+  p++;
+  strfcpy(newpath, p, sizeof(newpath));
+
+  /* kill the previous flags */
+  if ((p = strchr(newpath, ':')) != NULL)
+    *p = '\0';
+
+  maildir_flags(suffix, sizeof(suffix), h);
+
+  snprintf(partpath, len, "%s/%s%s", (h->read || h->old) ? "cur" : "new", newpath, suffix);
+
+  return (mutt_strcmp(partpath, h->path) == 0) ? 1 : 0;
+}
+
+static int maildir_sync_message(struct Context *ctx, int msgno)
+{
+  struct Header *h = ctx->hdrs[msgno];
+
+  if (h->attach_del || h->xlabel_changed ||
+      (h->env && (h->env->refs_changed || h->env->irt_changed)))
+  {
+    /* when doing attachment deletion/rethreading, fall back to the MH case. */
+    if (mh_rewrite_message(ctx, msgno) != 0)
+      return -1;
   }
   else
   {
     /* we just have to rename the file. */
 
-    char newpath[_POSIX_PATH_MAX];
     char partpath[_POSIX_PATH_MAX];
     char fullpath[_POSIX_PATH_MAX];
     char oldpath[_POSIX_PATH_MAX];
-    char suffix[16];
-    char *p = NULL;
+    int rc;
 
-    if ((p = strrchr(h->path, '/')) == NULL)
+    rc = maildir_sync_path(h, partpath, sizeof(partpath));
+    if (rc != 0)
     {
-      mutt_debug(1, "maildir_sync_message: %s: unable to find subdir!\n", h->path);
-      return -1;
+      /* 1: message hasn't really changed */
+      return (rc < 0) ? -1 : 0;
     }
-    p++;
-    strfcpy(newpath, p, sizeof(newpath));
-
-    /* kill the previous flags */
-    if ((p = strchr(newpath, ':')) != NULL)
-      *p = '\0';
 
-    maildir_flags(suffix, sizeof(suffix), h);
-
-    snprintf(partpath, sizeof(partpath), "%s/%s%s",
-             (h->read || h->old) ? "cur" : "new", newpath, suffix);
     snprintf(fullpath, sizeof(fullpath), "%s/%s", ctx->path, partpath);
     snprintf(oldpath, sizeof(oldpath), "%s/%s", ctx->path, h->path);
 
-    if (mutt_strcmp(fullpath, oldpath) == 0)
-    {
-      /* message hasn't really changed */
-      return 0;
-    }
-
     /* record that the message is possibly marked as trashed on disk */
     h->trash = h->deleted;
 
@@ -2007,6 +2365,333 @@ static void maildir_update_tables(struct Context *ctx, int *index_hint)
   mutt_clear_threads(ctx);
 }
 
+/**
+ * maildir_merge_flags - Merge the flags found on disk into a message
+ * @param ctx Mailbox
+ * @param o   Message in the mailbox
+ * @param n   Header holding the flags parsed from the filename
+ * @retval true if the message's flags changed
+ */
+static bool maildir_merge_flags(struct Context *ctx, struct Header *o, struct Header *n)
+{
+  bool flags_changed = false;
+
+  /* if the user hasn't modified the flags on this message, update
+   * the flags we just detected.
+   */
+  if (!o->changed)
+    if (maildir_update_flags(ctx, o, n))
+      flags_changed = true;
+
+  if (o->deleted == o->trash)
+    if (o->deleted != n->deleted)
+    {
+      o->deleted = n->deleted;
+      mutt_pattern_results_invalidate(ctx, o);
+      flags_changed = true;
+    }
+  o->trash = n->trash;
+
+  return flags_changed;
+}
+
+#ifdef USE_INOTIFY
+/**
+ * struct MhEvent - Net effect of the inotify events about one message
+ */
+struct MhEvent
+{
+  char *canon;          /**< Canonical filename, the key */
+  char *path;           /**< Current path, relative to the folder; NULL if gone */
+  char *gone;           /**< Last path reported as removed */
+  bool replaced;        /**< Removed, then a file with the same name appeared */
+  struct MhEvent *next;
+};
+
+/**
+ * mh_watch_record - Record an inotify event about a message
+ * @param events  Events so far, indexed by canonical filename
+ * @param list    List of events, in order of arrival
+ * @param canon   Canonical filename of the message
+ * @param path    Path of the file, relative to the folder
+ * @param present True if the file appeared, false if it was removed
+ */
+static void mh_watch_record(struct Hash *events, struct MhEvent ***list,
+                            const char *canon, const char *path, bool present)
+{
+  struct MhEvent *ev = hash_find(events, canon);
+
+  if (!ev)
+  {
+    ev = safe_calloc(1, sizeof(struct MhEvent));
+    ev->canon = safe_strdup(canon);
+    hash_insert(events, ev->canon, ev);
+    **list = ev;
+    *list = &ev->next;
+  }
+
+  if (present)
+  {
+    /* the same name again, after a removal: a different message */
+    if (ev->gone && (mutt_strcmp(ev->gone, path) == 0))
+      ev->replaced = true;
+    mutt_str_replace(&ev->path, path);
+  }
+  else if (!ev->path || (mutt_strcmp(ev->path, path) == 0))
+  {
+    /* a maildir rename reports the old name after the new one has been
+     * recorded from the other directory; that doesn't mean it's gone */
+    FREE(&ev->path);
+    mutt_str_replace(&ev->gone, path);
+  }
+}
+
+/**
+ * mh_watch_read - Collect the pending inotify events
+ * @param[in]  ctx     Mailbox
+ * @param[in]  events  Table to fill, indexed by canonical filename
+ * @param[out] list    List of events, in order of arrival
+ * @param[out] seq     Set if .mh_sequences changed
+ * @retval  0 Success
+ * @retval -1 Events were lost, the mailbox must be scanned
+ */
+static int mh_watch_read(struct Context *ctx, struct Hash *events,
+                         struct MhEvent **list, bool *seq)
+{
+  char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  char canon[_POSIX_PATH_MAX];
+  char path[_POSIX_PATH_MAX];
+  struct MhData *data = mh_data(ctx);
+  struct MhEvent **last = list;
+  bool lost = false, stop = false;
+  ssize_t len;
+
+  while ((len = read(data->watch_fd, buf, sizeof(buf))) > 0)
+  {
+    for (char *p = buf; p < buf + len;)
+    {
+      const struct inotify_event *ie = (const struct inotify_event *) p;
+      p += sizeof(struct inotify_event) + ie->len;
+
+      if (ie->mask & (IN_Q_OVERFLOW | IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF))
+      {
+        mutt_debug(2, "mh_watch_read: %s: lost track (mask 0x%x)\n", ctx->path, ie->mask);
+        if (ie->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF))
+          stop = true;
+        lost = true;
+        continue;
+      }
+      if ((ie->len == 0) || lost)
+        continue;
+
+      const bool present = ie->mask & (IN_CREATE | IN_MOVED_TO | IN_CLOSE_WRITE);
+
+      if (ctx->magic == MUTT_MH)
+      {
+        if (mutt_strcmp(ie->name, ".mh_sequences") == 0)
+        {
+          *seq = true;
+          continue;
+        }
+        if (!mh_valid_message(ie->name))
+          continue;
+        mh_watch_record(events, &last, ie->name, ie->name, present);
+      }
+      else
+      {
+        if (ie->name[0] == '.')
+          continue;
+        snprintf(path, sizeof(path), "%s/%s", (ie->wd == data->wd_new) ? "new" : "cur",
+                 ie->name);
+        maildir_canon_filename(canon, ie->name, sizeof(canon));
+        mh_watch_record(events, &last, canon, path, present);
+      }
+    }
+  }
+
+  if ((len < 0) && (errno != EAGAIN) && (errno != EINTR))
+  {
+    mutt_debug(1, "mh_watch_read: %s: %s\n", ctx->path, strerror(errno));
+    stop = true;
+    lost = true;
+  }
+
+  /* a directory went away: leave it to the scan from now on */
+  if (stop)
+    mh_watch_stop(ctx);
+
+  return lost ? -1 : 0;
+}
+
+/**
+ * mh_watch_check - Apply the inotify events to the open mailbox
+ * @param[in]  ctx        Mailbox
+ * @param[in]  index_hint Remember our place in the index
+ * @param[out] rc         Result, as for MxOps::check
+ * @retval  0 The mailbox is up to date, @a rc is set
+ * @retval -1 The mailbox isn't watched, or events were lost; it must be scanned
+ *
+ * Only the messages named in the events are looked at, so a change costs the
+ * same whatever the size of the mailbox.
+ */
+static int mh_watch_check(struct Context *ctx, int *index_hint, int *rc)
+{
+  char buf[_POSIX_PATH_MAX];
+  struct MhData *data = mh_data(ctx);
+  struct MhEvent *events = NULL, *ev = NULL;
+  struct Maildir *md = NULL, **last = &md;
+  struct Hash *table = NULL, *msgs = NULL;
+  bool seq = false, occult = false, flags_changed = false;
+  bool have_new = false;
+  int result = 0;
+
+  if (!data || !data->watching)
+    return -1;
+
+  table = hash_create(64, 0);
+  if (mh_watch_read(ctx, table, &events, &seq) < 0)
+  {
+    /* make sure the scan doesn't skip anything */
+    ctx->mtime = 0;
+    data->mtime_cur = 0;
+    result = -1;
+    goto cleanup;
+  }
+
+  *rc = 0;
+  if (!events && !seq)
+    goto cleanup;
+
+  mutt_debug(2, "mh_watch_check: %s: applying events\n", ctx->path);
+
+  msgs = hash_create(MAX(ctx->msgcount, 32), MUTT_HASH_STRDUP_KEYS);
+  for (int i = 0; i < ctx->msgcount; i++)
+  {
+    ctx->hdrs[i]->active = true;
+    if (ctx->magic == MUTT_MH)
+      hash_insert(msgs, ctx->hdrs[i]->path, ctx->hdrs[i]);
+    else
+    {
+      maildir_canon_filename(buf, ctx->hdrs[i]->path, sizeof(buf));
+      hash_insert(msgs, buf, ctx->hdrs[i]);
+    }
+  }
+
+  for (ev = events; ev; ev = ev->next)
+  {
+    struct Header *h = hash_find(msgs, ev->canon);
+
+    if (h && (!ev->path || ev->replaced))
+    {
+      /* a stale removal, for a name we've already moved past */
+      if (!ev->replaced && (mutt_strcmp(ev->gone, h->path) != 0))
+      {
+        struct stat st;
+        snprintf(buf, sizeof(buf), "%s/%s", ctx->path, h->path);
+        if (stat(buf, &st) == 0)
+          continue;
+      }
+
+      h->active = false;
+      occult = true;
+      h = NULL;
+    }
+
+    if (!ev->path)
+      continue;
+
+    if (h)
+    {
+      if (ctx->magic == MUTT_MH)
+        continue;
+
+      /* renamed, by us or someone else */
+      struct Header *n = mutt_new_header();
+      maildir_parse_flags(n, ev->path);
+      if (mutt_strcmp(h->path, ev->path) != 0)
+        mutt_str_replace(&h->path, ev->path);
+      if (maildir_merge_flags(ctx, h, n))
+        flags_changed = true;
+      mutt_free_header(&n);
+    }
+    else
+    {
+      /* a new message; it'll be parsed below */
+      struct Maildir *entry = safe_calloc(1, sizeof(struct Maildir));
+      entry->h = mutt_new_header();
+      entry->h->path = safe_strdup(ev->path);
+      if (ctx->magic == MUTT_MAILDIR)
+      {
+        entry->h->old = option(OPT_MARK_OLD) ? (strncmp(ev->path, "cur/", 4) == 0) : false;
+        maildir_parse_flags(entry->h, ev->path);
+      }
+      *last = entry;
+      last = &entry->next;
+    }
+  }
+
+  if (ctx->magic == MUTT_MH)
+  {
+    /* new messages and changed sequences both need the flags */
+    if (md || seq)
+    {
+      struct MhSequences mhs;
+      memset(&mhs, 0, sizeof(mhs));
+      if (mh_read_sequences(&mhs, ctx->path) == 0)
+      {
+        if (seq)
+        {
+          struct Maildir tmp;
+          memset(&tmp, 0, sizeof(tmp));
+          tmp.h = mutt_new_header();
+          for (int i = 0; i < ctx->msgcount; i++)
+          {
+            if (!ctx->hdrs[i]->active || ctx->hdrs[i]->changed)
+              continue;
+            mutt_str_replace(&tmp.h->path, ctx->hdrs[i]->path);
+            mh_update_maildir(&tmp, &mhs);
+            if (maildir_update_flags(ctx, ctx->hdrs[i], tmp.h))
+              flags_changed = true;
+          }
+          mutt_free_header(&tmp.h);
+        }
+        mh_update_maildir(md, &mhs);
+        mhs_free_sequences(&mhs);
+      }
+    }
+  }
+
+  if (occult)
+    maildir_update_tables(ctx, index_hint);
+
+  maildir_delayed_parsing(ctx, &md, NULL);
+  have_new = maildir_move_to_context(ctx, &md);
+
+  maildir_update_mtime(ctx);
+
+  if (occult)
+    *rc = MUTT_REOPENED;
+  else if (have_new)
+    *rc = MUTT_NEW_MAIL;
+  else if (flags_changed)
+    *rc = MUTT_FLAGS;
+
+cleanup:
+  while (events)
+  {
+    ev = events;
+    events = ev->next;
+    FREE(&ev->canon);
+    FREE(&ev->path);
+    FREE(&ev->gone);
+    FREE(&ev);
+  }
+  hash_destroy(&table, NULL);
+  hash_destroy(&msgs, NULL);
+  return result;
+}
+#endif /* USE_INOTIFY */
+
 /**
  * maildir_check_mailbox - Check for new mail
  *
@@ -2039,6 +2724,12 @@ static int maildir_check_mailbox(struct Context *ctx, int *index_hint)
   if (!option(OPT_CHECK_NEW))
     return 0;
 
+#ifdef USE_INOTIFY
+  int rc;
+  if (mh_watch_check(ctx, index_hint, &rc) == 0)
+    return rc;
+#endif
+
   snprintf(buf, sizeof(buf), "%s/new", ctx->path);
   if (stat(buf, &st_new) == -1)
     return -1;
@@ -2100,20 +2791,8 @@ static int maildir_check_mailbox(struct Context *ctx, int *index_hint)
       if (mutt_strcmp(ctx->hdrs[i]->path, p->h->path) != 0)
         mutt_str_replace(&ctx->hdrs[i]->path, p->h->path);
 
-      /* if the user hasn't modified the flags on this message, update
-       * the flags we just detected.
-       */
-      if (!ctx->hdrs[i]->changed)
-        if (maildir_update_flags(ctx, ctx->hdrs[i], p->h))
-          flags_changed = true;
-
-      if (ctx->hdrs[i]->deleted == ctx->hdrs[i]->trash)
-        if (ctx->hdrs[i]->deleted != p->h->deleted)
-        {
-          ctx->hdrs[i]->deleted = p->h->deleted;
-          flags_changed = true;
-        }
-      ctx->hdrs[i]->trash = p->h->trash;
+      if (maildir_merge_flags(ctx, ctx->hdrs[i], p->h))
+        flags_changed = true;
 
       /* this is a duplicate of an existing header, so remove it */
       mutt_free_header(&p->h);
@@ -2188,6 +2867,12 @@ static int mh_check_mailbox(struct Context *ctx, int *index_hint)
   if (!option(OPT_CHECK_NEW))
     return 0;
 
+#ifdef USE_INOTIFY
+  int rc;
+  if (mh_watch_check(ctx, index_hint, &rc) == 0)
+    return rc;
+#endif
+
   strfcpy(buf, ctx->path, sizeof(buf));
   if (stat(buf, &st) == -1)
     return -1;
@@ -2282,14 +2967,158 @@ static int mh_check_mailbox(struct Context *ctx, int *index_hint)
   return 0;
 }
 
+/**
+ * struct MhSyncOp - A file operation planned by mh_sync_mailbox()
+ *
+ * The paths are relative to the mailbox directory.
+ */
+struct MhSyncOp
+{
+  int msgno;
+  const char *from; /**< Current name, borrowed from the Header */
+  char *to;         /**< New name, or NULL to delete the file */
+  bool replace;     /**< Delete an existing @a to first (MH ",NNN" files) */
+  int err;          /**< errno if the operation failed, else 0 */
+};
+
+/**
+ * struct MhSyncBatch - File operations to run in parallel
+ */
+struct MhSyncBatch
+{
+  int dirfd; /**< The mailbox directory */
+  struct MhSyncOp *ops;
+};
+
+/**
+ * mh_sync_op_run - Rename or delete one file - Implements ::worker_fn_t
+ *
+ * This runs in a worker thread: it may only touch its own MhSyncOp.
+ */
+static void mh_sync_op_run(int i, void *data)
+{
+  struct MhSyncBatch *batch = data;
+  struct MhSyncOp *op = &batch->ops[i];
+  int rc;
+
+  if (op->to)
+  {
+    if (op->replace)
+      unlinkat(batch->dirfd, op->to, 0);
+    rc = renameat(batch->dirfd, op->from, batch->dirfd, op->to);
+  }
+  else
+    rc = unlinkat(batch->dirfd, op->from, 0);
+
+  op->err = (rc == 0) ? 0 : errno;
+}
+
+/**
+ * mh_sync_plan - Decide what to do with a message's file
+ * @param[in]  ctx   Mailbox
+ * @param[in]  msgno Index of the message
+ * @param[out] op    File operation to run
+ * @retval  1 @a op was filled in
+ * @retval  0 Nothing left to do
+ * @retval -1 Error
+ *
+ * Messages which need rewriting are handled here, straight away.  Everything
+ * else is a rename or an unlink, left to mh_sync_op_run().  This mirrors
+ * mh_sync_mailbox_message().
+ */
+static int mh_sync_plan(struct Context *ctx, int msgno, struct MhSyncOp *op)
+{
+  char path[_POSIX_PATH_MAX];
+  struct Header *h = ctx->hdrs[msgno];
+  int rc;
+
+  memset(op, 0, sizeof(*op));
+  op->msgno = msgno;
+  op->from = h->path;
+
+  if (h->deleted && (ctx->magic != MUTT_MAILDIR || !option(OPT_MAILDIR_TRASH)))
+  {
+    if (ctx->magic == MUTT_MAILDIR || option(OPT_MH_PURGE))
+      return 1;
+
+    /* MH just moves files out of the way when you delete them */
+    if (*h->path == ',')
+      return 0;
+    snprintf(path, sizeof(path), ",%s", h->path);
+    op->to = safe_strdup(path);
+    op->replace = true;
+    return 1;
+  }
+
+  if (!(h->changed || h->attach_del || h->xlabel_changed ||
+        (ctx->magic == MUTT_MAILDIR &&
+         (option(OPT_MAILDIR_TRASH) || h->trash) && (h->deleted != h->trash))))
+    return 0;
+
+  if (h->attach_del || h->xlabel_changed ||
+      (h->env && (h->env->refs_changed || h->env->irt_changed)))
+    return (mh_rewrite_message(ctx, msgno) == 0) ? 0 : -1;
+
+  /* MH keeps the flags in .mh_sequences */
+  if (ctx->magic != MUTT_MAILDIR)
+    return 0;
+
+  rc = maildir_sync_path(h, path, sizeof(path));
+  if (rc != 0)
+    return (rc < 0) ? -1 : 0;
+
+  /* record that the message is possibly marked as trashed on disk */
+  h->trash = h->deleted;
+  op->to = safe_strdup(path);
+  return 1;
+}
+
+#ifdef USE_HCACHE
+/**
+ * mh_hcache_key - Get the header cache key of a message
+ * @param[in]  ctx    Mailbox
+ * @param[in]  h      Email header
+ * @param[out] keylen Length of the key
+ * @retval ptr Key, pointing into h->path
+ */
+const char *mh_hcache_key(struct Context *ctx, struct Header *h, size_t *keylen)
+{
+  if (ctx->magic == MUTT_MH)
+  {
+    *keylen = strlen(h->path);
+    return h->path;
+  }
+
+  *keylen = maildir_hcache_keylen(h->path + 3);
+  return h->path + 3;
+}
+#endif
+
+/**
+ * mh_sync_mailbox - Save changes to the mailbox
+ * @param ctx        Mailbox
+ * @param index_hint Current message, see mh_check_mailbox()
+ * @retval  0 Success
+ * @retval -1 Error
+ * @retval >0 The mailbox changed, see mh_check_mailbox()
+ *
+ * The work is done in three passes.  First, the messages needing a rewrite
+ * are rewritten and the renames and deletes are planned.  Second, the
+ * renames and deletes are run in parallel, see $worker_threads.  Finally,
+ * the headers are updated and the header cache is written in a single
+ * transaction.  A failed rename doesn't stop the others.
+ */
 static int mh_sync_mailbox(struct Context *ctx, int *index_hint)
 {
-  int i, j;
+  int i, j, planned, nops = 0, rc = 0;
 #ifdef USE_HCACHE
   header_cache_t *hc = NULL;
+  const char *key = NULL;
+  size_t keylen;
 #endif /* USE_HCACHE */
   char msgbuf[STRING];
   struct Progress progress;
+  struct MhSyncBatch batch;
 
   if (ctx->magic == MUTT_MH)
     i = mh_check_mailbox(ctx, index_hint);
@@ -2299,10 +3128,13 @@ static int mh_sync_mailbox(struct Context *ctx, int *index_hint)
   if (i != 0)
     return i;
 
-#ifdef USE_HCACHE
-  if (ctx->magic == MUTT_MAILDIR || ctx->magic == MUTT_MH)
-    hc = mutt_hcache_open(HeaderCache, ctx->path, NULL);
-#endif /* USE_HCACHE */
+  batch.dirfd = open(ctx->path, O_RDONLY | O_DIRECTORY);
+  if (batch.dirfd < 0)
+  {
+    mutt_perror(ctx->path);
+    return -1;
+  }
+  batch.ops = safe_calloc(ctx->msgcount ? ctx->msgcount : 1, sizeof(struct MhSyncOp));
 
   if (!ctx->quiet)
   {
@@ -2315,19 +3147,86 @@ static int mh_sync_mailbox(struct Context *ctx, int *index_hint)
     if (!ctx->quiet)
       mutt_progress_update(&progress, i, -1);
 
+    j = mh_sync_plan(ctx, i, &batch.ops[nops]);
+    if (j < 0)
+    {
+      rc = -1;
+      break;
+    }
+    nops += j;
+  }
+  planned = i;
+
+  mutt_workers_run(WorkerThreads, nops, mh_sync_op_run, &batch);
+  close(batch.dirfd);
+
 #ifdef USE_HCACHE
-    if (mh_sync_mailbox_message(ctx, i, hc) == -1)
-      goto err;
-#else
-    if (mh_sync_mailbox_message(ctx, i) == -1)
-      goto err;
-#endif
+  hc = mutt_hcache_open(HeaderCache, ctx->path, NULL);
+  mutt_hcache_begin(hc);
+#endif /* USE_HCACHE */
+
+  /* the operations are in message order */
+  for (i = 0, j = 0; i < planned; i++)
+  {
+    struct Header *h = ctx->hdrs[i];
+    struct MhSyncOp *op = NULL;
+#ifdef USE_HCACHE
+    bool cache = h->changed;
+#endif /* USE_HCACHE */
+
+    if ((j < nops) && (batch.ops[j].msgno == i))
+      op = &batch.ops[j++];
+
+    if (op && !op->to)
+    {
+#ifdef USE_HCACHE
+      /* as before, a file which couldn't be deleted is forgotten anyway */
+      cache = false;
+      if (hc)
+      {
+        key = mh_hcache_key(ctx, h, &keylen);
+        mutt_hcache_delete(hc, key, keylen);
+      }
+#endif /* USE_HCACHE */
+    }
+    else if (op && op->replace)
+    {
+      /* MH deletion: the header keeps the old name */
+    }
+    else if (op && op->err)
+    {
+      errno = op->err;
+      mutt_perror("rename");
+      rc = -1;
+#ifdef USE_HCACHE
+      cache = false;
+#endif /* USE_HCACHE */
+    }
+    else if (op)
+      mutt_str_replace(&h->path, op->to);
+
+#ifdef USE_HCACHE
+    if (hc && cache)
+    {
+      key = mh_hcache_key(ctx, h, &keylen);
+      mutt_hcache_store(hc, key, keylen, h, 0);
+    }
+#endif /* USE_HCACHE */
+    if (op)
+      FREE(&op->to);
   }
 
 #ifdef USE_HCACHE
-  if (ctx->magic == MUTT_MAILDIR || ctx->magic == MUTT_MH)
+  if (hc)
+  {
+    mutt_hcache_commit(hc);
     mutt_hcache_close(hc);
+  }
 #endif /* USE_HCACHE */
+  FREE(&batch.ops);
+
+  if (rc != 0)
+    return rc;
 
   if (ctx->magic == MUTT_MH)
     mh_update_sequences(ctx);
@@ -2348,14 +3247,102 @@ static int mh_sync_mailbox(struct Context *ctx, int *index_hint)
   }
 
   return 0;
+}
 
-err:
 #ifdef USE_HCACHE
-  if (ctx->magic == MUTT_MAILDIR || ctx->magic == MUTT_MH)
-    mutt_hcache_close(hc);
-#endif /* USE_HCACHE */
-  return -1;
+/**
+ * struct MhHcacheKeep - Messages whose header cache records are in use
+ */
+struct MhHcacheKeep
+{
+  int magic;
+  struct Hash *keys;
+  char stale[3]; /**< Text indexes to drop, see mutt_tindex_stale() */
+};
+
+/**
+ * mh_hcache_keep - Is a header cache record still in use? - Implements ::hcache_keep_t
+ */
+static bool mh_hcache_keep(const char *key, size_t keylen, void *data)
+{
+  struct MhHcacheKeep *keep = data;
+  char buf[_POSIX_PATH_MAX];
+  const char *msgkey = NULL;
+
+  /* A document of the text index lives as long as its message */
+  int mode = mutt_tindex_record(key, keylen, &msgkey, &keylen);
+  if (mode && strchr(keep->stale, mode))
+    return false;
+  if (mode && !msgkey)
+    return true;
+  if (msgkey)
+    key = msgkey;
+
+  if ((keylen == 0) || (keylen >= sizeof(buf)))
+    return true;
+
+  /* Only judge the keys we could have written: maildir uses "/name", MH uses
+   * the message number.  Other records of the folder, e.g. from a later
+   * version, are kept. */
+  if (keep->magic == MUTT_MH)
+  {
+    for (size_t i = 0; i < keylen; i++)
+      if (!isdigit((unsigned char) key[i]))
+        return true;
+  }
+  else if ((key[0] != '/') || memchr(key + 1, '/', keylen - 1))
+    return true;
+
+  memcpy(buf, key, keylen);
+  buf[keylen] = '\0';
+  return hash_find(keep->keys, buf) != NULL;
+}
+
+/**
+ * mh_hcache_compact - Remove stale header cache records - Implements MxOps::hcache_compact
+ */
+static int mh_hcache_compact(struct Context *ctx, bool force, LOFF_T *reclaimed)
+{
+  struct MhHcacheKeep keep;
+  char buf[_POSIX_PATH_MAX];
+  int rc;
+
+  header_cache_t *hc = mutt_hcache_open(HeaderCache, ctx->path, NULL);
+  if (!hc)
+    return -1;
+
+  keep.magic = ctx->magic;
+  keep.keys = hash_create(MAX(ctx->msgcount, 32), MUTT_HASH_STRDUP_KEYS);
+  memset(keep.stale, 0, sizeof(keep.stale));
+  for (const char *m = "rd"; *m; m++)
+    if (mutt_tindex_stale(hc, *m, ctx->msgcount))
+      keep.stale[strlen(keep.stale)] = *m;
+  for (int i = 0; i < ctx->msgcount; i++)
+  {
+    const char *path = ctx->hdrs[i]->path;
+    if (!path)
+      continue;
+
+    if (ctx->magic == MUTT_MH)
+      strfcpy(buf, path, sizeof(buf));
+    else
+    {
+      size_t len = maildir_hcache_keylen(path + 3);
+      if (len >= sizeof(buf))
+        continue;
+      memcpy(buf, path + 3, len);
+      buf[len] = '\0';
+    }
+    hash_insert(keep.keys, buf, ctx->hdrs[i]);
+  }
+
+  rc = mutt_hcache_compact(hc, mh_hcache_keep, &keep, force, reclaimed);
+
+  hash_destroy(&keep.keys, NULL);
+  mutt_hcache_close(hc);
+  return rc;
 }
+#endif /* USE_HCACHE */
 
 bool maildir_update_flags(struct Context *ctx, struct Header *o, struct Header *n)
 {
@@ -2610,6 +3597,9 @@ struct MxOps mx_maildir_ops = {
   .open_new_msg = maildir_open_new_message,
   .check = maildir_check_mailbox,
   .sync = mh_sync_mailbox,
+#ifdef USE_HCACHE
+  .hcache_compact = mh_hcache_compact,
+#endif
 };
 
 struct MxOps mx_mh_ops = {
@@ -2622,4 +3612,7 @@ struct MxOps mx_mh_ops = {
   .open_new_msg = mh_open_new_message,
   .check = mh_check_mailbox,
   .sync = mh_sync_mailbox,
+#ifdef USE_HCACHE
+  .hcache_compact = mh_hcache_compact,
+#endif
 };
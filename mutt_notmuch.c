@@ -153,9 +153,13 @@ struct NmCtxData
   int oldmsgcount;
   int ignmsgcount; /**< Ignored messages */
 
+  unsigned long db_revision; /**< Database revision at the last check */
+  char *db_uuid;             /**< Database UUID the revision belongs to */
+
   bool noprogress : 1;     /**< Don't show the progress bar */
   bool longrun : 1;        /**< A long-lived action is in progress */
   bool trans : 1;          /**< Atomic transaction in progress */
+  bool batch : 1;          /**< Keep the transaction open for further changes */
   bool progress_ready : 1; /**< A progress bar has been initialised */
 };
 
@@ -372,6 +376,7 @@ static void free_ctxdata(struct NmCtxData *data)
 
   FREE(&data->db_filename);
   FREE(&data->db_query);
+  FREE(&data->db_uuid);
   url_free_tags(data->query_items);
   FREE(&data);
 }
@@ -729,24 +734,6 @@ static notmuch_database_t *get_db(struct NmCtxData *data, int writable)
   return data->db;
 }
 
-static int release_db(struct NmCtxData *data)
-{
-  if (data && data->db)
-  {
-    mutt_debug(1, "nm: db close\n");
-#ifdef NOTMUCH_API_3
-    notmuch_database_destroy(data->db);
-#else
-    notmuch_database_close(data->db);
-#endif
-    data->db = NULL;
-    data->longrun = false;
-    return 0;
-  }
-
-  return -1;
-}
-
 /**
  * db_trans_begin - Start a NotMuch database transaction
  * @param data Header data
@@ -771,12 +758,21 @@ static int db_trans_begin(struct NmCtxData *data)
   return 0;
 }
 
+/**
+ * db_trans_end - End a NotMuch database transaction
+ * @param data Header data
+ * @retval  0 Success
+ * @retval -1 Error
+ *
+ * While a batch is open (see db_batch_begin()) the transaction is kept open
+ * and committed by db_batch_end().
+ */
 static int db_trans_end(struct NmCtxData *data)
 {
   if (!data || !data->db)
     return -1;
 
-  if (data->trans)
+  if (data->trans && !data->batch)
   {
     mutt_debug(2, "nm: db trans end\n");
     data->trans = false;
@@ -787,6 +783,69 @@ static int db_trans_end(struct NmCtxData *data)
   return 0;
 }
 
+/**
+ * db_batch_begin - Collect the following database changes in one transaction
+ * @param data Header data
+ * @retval true  A new batch was started
+ * @retval false A batch is already open
+ *
+ * Every write to the database while the batch is open joins the same atomic
+ * transaction, so Xapian commits once for all of them, rather than once per
+ * message.  The transaction itself is started lazily by the first write.
+ */
+static bool db_batch_begin(struct NmCtxData *data)
+{
+  if (!data || data->batch)
+    return false;
+
+  mutt_debug(2, "nm: db batch start\n");
+  data->batch = true;
+  return true;
+}
+
+/**
+ * db_batch_end - Commit all the changes collected by db_batch_begin()
+ * @param data Header data
+ * @retval  0 Success
+ * @retval -1 Error
+ */
+static int db_batch_end(struct NmCtxData *data)
+{
+  if (!data || !data->batch)
+    return -1;
+
+  mutt_debug(2, "nm: db batch end\n");
+  data->batch = false;
+  if (!data->trans)
+    return 0;
+
+  return db_trans_end(data);
+}
+
+static int release_db(struct NmCtxData *data)
+{
+  if (data && data->db)
+  {
+    /* closing the database would discard an open transaction */
+    if (data->batch)
+      db_batch_end(data);
+
+    mutt_debug(1, "nm: db close\n");
+#ifdef NOTMUCH_API_3
+    notmuch_database_destroy(data->db);
+#else
+    notmuch_database_close(data->db);
+#endif
+    data->db = NULL;
+    data->longrun = false;
+    data->trans = false;
+    data->batch = false;
+    return 0;
+  }
+
+  return -1;
+}
+
 /**
  * is_longrun - Is NotMuch in the middle of a long-running transaction
  * @param data Header data
@@ -827,6 +886,27 @@ static int get_database_mtime(struct NmCtxData *data, time_t *mtime)
   return 0;
 }
 
+/**
+ * update_db_revision - Remember the current database revision
+ * @param data Struct holding database info
+ *
+ * The revision (and the UUID it belongs to) is the starting point for the
+ * next incremental check, see check_mailbox_incremental().
+ */
+static void update_db_revision(struct NmCtxData *data)
+{
+#if LIBNOTMUCH_CHECK_VERSION(4, 3, 0)
+  const char *uuid = NULL;
+
+  if (!data || !data->db)
+    return;
+
+  data->db_revision = notmuch_database_get_revision(data->db, &uuid);
+  mutt_str_replace(&data->db_uuid, uuid);
+  mutt_debug(2, "nm: db revision %lu (%s)\n", data->db_revision, NONULL(uuid));
+#endif
+}
+
 static void apply_exclude_tags(notmuch_query_t *query)
 {
   char *buf = NULL, *p = NULL, *end = NULL, *tag = NULL;
@@ -1751,6 +1831,14 @@ char *nm_header_get_tag_transformed(char *tag, struct Header *h)
   return NULL;
 }
 
+/**
+ * nm_longrun_init - Start a long transaction
+ * @param ctx      A mailbox CONTEXT
+ * @param writable Will the database be changed?
+ *
+ * Keep the database open until nm_longrun_done().  If it's writable, all the
+ * changes are batched into a single atomic transaction.
+ */
 void nm_longrun_init(struct Context *ctx, int writable)
 {
   struct NmCtxData *data = get_ctxdata(ctx);
@@ -1758,15 +1846,27 @@ void nm_longrun_init(struct Context *ctx, int writable)
   if (data && get_db(data, writable))
   {
     data->longrun = true;
+    if (writable)
+      db_batch_begin(data);
     mutt_debug(2, "nm: long run initialized\n");
   }
 }
 
+/**
+ * nm_longrun_done - End a long transaction
+ * @param ctx A mailbox CONTEXT
+ *
+ * Commit any batched changes and close the database.
+ */
 void nm_longrun_done(struct Context *ctx)
 {
   struct NmCtxData *data = get_ctxdata(ctx);
 
-  if (data && (release_db(data) == 0))
+  if (!data)
+    return;
+
+  db_batch_end(data);
+  if (release_db(data) == 0)
     mutt_debug(2, "nm: long run deinitialized\n");
 }
 
@@ -1964,7 +2064,7 @@ int nm_modify_message_tags(struct Context *ctx, struct Header *hdr, char *buf)
   struct NmCtxData *data = get_ctxdata(ctx);
   notmuch_database_t *db = NULL;
   notmuch_message_t *msg = NULL;
-  int rc = -1;
+  int rc = -1, trans = 0;
 
   if (!buf || !*buf || !data)
     return -1;
@@ -1974,6 +2074,10 @@ int nm_modify_message_tags(struct Context *ctx, struct Header *hdr, char *buf)
 
   mutt_debug(1, "nm: tags modify: '%s'\n", buf);
 
+  trans = db_trans_begin(data);
+  if (trans < 0)
+    goto done;
+
   update_tags(msg, buf);
   update_header_flags(ctx, hdr, buf);
   update_header_tags(hdr, msg);
@@ -1982,6 +2086,10 @@ int nm_modify_message_tags(struct Context *ctx, struct Header *hdr, char *buf)
   rc = 0;
   hdr->changed = true;
 done:
+  if (msg)
+    notmuch_message_destroy(msg);
+  if (trans == 1)
+    db_trans_end(data);
   if (!is_longrun(data))
     release_db(data);
   if (hdr->changed)
@@ -2074,11 +2182,194 @@ int nm_update_filename(struct Context *ctx, const char *old, const char *new,
   return rc;
 }
 
+/**
+ * struct NmCount - Cached message counts of a virtual mailbox
+ *
+ * The counts stay valid while the database revision doesn't change.
+ *
+ * @sa nm_nonctx_get_count()
+ */
+struct NmCount
+{
+  char *path;             /**< Virtual mailbox URI */
+  unsigned long revision; /**< Database revision of the counts */
+  char *uuid;             /**< Database UUID of the counts */
+  int all;                /**< Number of messages */
+  int new;                /**< Number of unread messages */
+  struct NmCount *next;
+};
+
+/**
+ * struct NmCountState - Database shared by a cycle of mailbox counts
+ *
+ * @sa nm_nonctx_begin(), nm_nonctx_end()
+ */
+struct NmCountState
+{
+  notmuch_database_t *db; /**< Read-only database, open during a cycle */
+  char *db_filename;      /**< Filename of the open database */
+  unsigned long revision; /**< Revision of the open database */
+  const char *uuid;       /**< UUID of the open database */
+  struct NmCount *counts; /**< Counts of all the virtual mailboxes */
+  char *unread_tag;       /**< NotmuchUnreadTag used for the counts */
+  char *exclude_tags;     /**< NotmuchExcludeTags used for the counts */
+  int cycle;              /**< Nesting level of nm_nonctx_begin() */
+};
+
+static struct NmCountState NmCounts;
+
+/**
+ * nonctx_close_db - Close the database shared by the counts
+ */
+static void nonctx_close_db(void)
+{
+  if (!NmCounts.db)
+    return;
+
+#ifdef NOTMUCH_API_3
+  notmuch_database_destroy(NmCounts.db);
+#else
+  notmuch_database_close(NmCounts.db);
+#endif
+  mutt_debug(1, "nm: count close DB\n");
+  NmCounts.db = NULL;
+  NmCounts.uuid = NULL;
+  NmCounts.revision = 0;
+  FREE(&NmCounts.db_filename);
+}
+
+/**
+ * nonctx_get_db - Get the database for counting
+ * @param db_filename Filename of the database
+ * @retval ptr NotMuch database, or NULL on error
+ *
+ * The database stays open until nm_nonctx_end().  It's read-only, so it's a
+ * snapshot: all the counts of one cycle see the same revision.
+ */
+static notmuch_database_t *nonctx_get_db(const char *db_filename)
+{
+  if (NmCounts.db && (mutt_strcmp(NmCounts.db_filename, db_filename) == 0))
+    return NmCounts.db;
+
+  nonctx_close_db();
+
+  /* don't be verbose about connection, as we're called from
+   * sidebar/buffy very often */
+  NmCounts.db = do_database_open(db_filename, false, false);
+  if (!NmCounts.db)
+    return NULL;
+
+  NmCounts.db_filename = safe_strdup(db_filename);
+#if LIBNOTMUCH_CHECK_VERSION(4, 3, 0)
+  NmCounts.revision = notmuch_database_get_revision(NmCounts.db, &NmCounts.uuid);
+#endif
+  return NmCounts.db;
+}
+
+/**
+ * nonctx_find_count - Find the cached counts of a virtual mailbox
+ * @param path Virtual mailbox URI
+ * @retval ptr Cache entry (created if necessary)
+ *
+ * If the notmuch config has changed, all the cached counts are invalidated.
+ */
+static struct NmCount *nonctx_find_count(const char *path)
+{
+  struct NmCount *c = NULL;
+
+  if ((mutt_strcmp(NmCounts.unread_tag, NotmuchUnreadTag) != 0) ||
+      (mutt_strcmp(NmCounts.exclude_tags, NotmuchExcludeTags) != 0))
+  {
+    mutt_debug(2, "nm: count config changed, flushing cache\n");
+    for (c = NmCounts.counts; c; c = c->next)
+      FREE(&c->uuid);
+    mutt_str_replace(&NmCounts.unread_tag, NotmuchUnreadTag);
+    mutt_str_replace(&NmCounts.exclude_tags, NotmuchExcludeTags);
+  }
+
+  for (c = NmCounts.counts; c; c = c->next)
+    if (mutt_strcmp(c->path, path) == 0)
+      return c;
+
+  c = safe_calloc(1, sizeof(struct NmCount));
+  c->path = safe_strdup(path);
+  c->next = NmCounts.counts;
+  NmCounts.counts = c;
+  return c;
+}
+
+/**
+ * nm_nonctx_begin - Start a cycle of mailbox counts
+ *
+ * Until nm_nonctx_end(), nm_nonctx_get_count() shares one database handle,
+ * rather than opening the database for every virtual mailbox.
+ */
+void nm_nonctx_begin(void)
+{
+  NmCounts.cycle++;
+}
+
+/**
+ * nm_nonctx_end - Finish a cycle of mailbox counts
+ *
+ * Close the database shared by the counts.
+ */
+void nm_nonctx_end(void)
+{
+  if (NmCounts.cycle > 0)
+    NmCounts.cycle--;
+  if (NmCounts.cycle == 0)
+    nonctx_close_db();
+}
+
+/**
+ * nm_nonctx_free - Free the cached counts of virtual mailboxes
+ * @param path Virtual mailbox URI, or NULL to free all of them
+ *
+ * Called when a virtual mailbox is removed and before quitting.
+ */
+void nm_nonctx_free(const char *path)
+{
+  for (struct NmCount **c = &NmCounts.counts; *c;)
+  {
+    if (path && (mutt_strcmp((*c)->path, path) != 0))
+    {
+      c = &(*c)->next;
+      continue;
+    }
+
+    struct NmCount *next = (*c)->next;
+    FREE(&(*c)->path);
+    FREE(&(*c)->uuid);
+    FREE(c);
+    *c = next;
+  }
+
+  if (!path)
+  {
+    FREE(&NmCounts.unread_tag);
+    FREE(&NmCounts.exclude_tags);
+  }
+}
+
+/**
+ * nm_nonctx_get_count - Count the messages of a virtual mailbox
+ * @param[in]  path Virtual mailbox URI
+ * @param[out] all  Number of messages
+ * @param[out] new  Number of unread messages
+ * @retval  0 Success
+ * @retval -1 Error
+ *
+ * The counts are cached and only recalculated when the database revision
+ * changes.  Use nm_nonctx_begin() and nm_nonctx_end() around a group of
+ * calls to share the database.
+ */
 int nm_nonctx_get_count(char *path, int *all, int *new)
 {
   struct UriTag *query_items = NULL, *item = NULL;
   char *db_filename = NULL, *db_query = NULL;
   notmuch_database_t *db = NULL;
+  struct NmCount *count = NULL;
   int rc = -1;
   bool dflt = false;
 
@@ -2118,37 +2409,39 @@ int nm_nonctx_get_count(char *path, int *all, int *new)
     dflt = true;
   }
 
-  /* don't be verbose about connection, as we're called from
-   * sidebar/buffy very often */
-  db = do_database_open(db_filename, false, false);
+  db = nonctx_get_db(db_filename);
   if (!db)
     goto done;
 
-  /* all emails */
-  if (all)
-    *all = count_query(db, db_query);
-
-  /* new messages */
-  if (new)
+  count = nonctx_find_count(path);
+  if (!NmCounts.uuid || (mutt_strcmp(count->uuid, NmCounts.uuid) != 0) ||
+      (count->revision != NmCounts.revision))
   {
     char *qstr = NULL;
 
+    /* all emails */
+    count->all = count_query(db, db_query);
+
+    /* new messages */
     safe_asprintf(&qstr, "( %s ) tag:%s", db_query, NotmuchUnreadTag);
-    *new = count_query(db, qstr);
+    count->new = count_query(db, qstr);
     FREE(&qstr);
+
+    count->revision = NmCounts.revision;
+    mutt_str_replace(&count->uuid, NmCounts.uuid);
   }
+  else
+    mutt_debug(2, "nm: count unchanged (revision %lu)\n", count->revision);
+
+  if (all)
+    *all = count->all;
+  if (new)
+    *new = count->new;
 
   rc = 0;
 done:
-  if (db)
-  {
-#ifdef NOTMUCH_API_3
-    notmuch_database_destroy(db);
-#else
-    notmuch_database_close(db);
-#endif
-    mutt_debug(1, "nm: count close DB\n");
-  }
+  if (NmCounts.cycle == 0)
+    nonctx_close_db();
   if (!dflt)
     FREE(&db_filename);
   url_free_tags(query_items);
@@ -2306,6 +2599,7 @@ static int nm_open_mailbox(struct Context *ctx)
   if (q)
   {
     rc = 0;
+    update_db_revision(data);
     switch (get_query_type(data))
     {
       case NM_QUERY_TYPE_MESGS:
@@ -2359,6 +2653,170 @@ static int nm_close_mailbox(struct Context *ctx)
   return 0;
 }
 
+/**
+ * merge_message - Merge the state of a NotMuch message into its Header
+ * @param ctx A mailbox CONTEXT
+ * @param h   Email Header already in the Context
+ * @param m   NotMuch message
+ * @retval true if the tags have changed
+ */
+static bool merge_message(struct Context *ctx, struct Header *h, notmuch_message_t *m)
+{
+  char old[_POSIX_PATH_MAX];
+  const char *new = NULL;
+
+  h->active = true;
+
+  /* Check to see if the message has moved to a different subdirectory.
+   * If so, update the associated filename.
+   */
+  new = get_message_last_filename(m);
+  header_get_fullpath(h, old, sizeof(old));
+
+  if (mutt_strcmp(old, new) != 0)
+    update_message_path(h, new);
+
+  if (!h->changed)
+  {
+    /* if the user hasn't modified the flags on
+     * this message, update the flags we just
+     * detected.
+     */
+    struct Header tmp;
+    memset(&tmp, 0, sizeof(tmp));
+    maildir_parse_flags(&tmp, new);
+    maildir_update_flags(ctx, h, &tmp);
+  }
+
+  return (update_header_tags(h, m) == 0);
+}
+
+#if LIBNOTMUCH_CHECK_VERSION(4, 3, 0)
+/**
+ * check_mailbox_incremental - Apply database changes since the last check
+ * @param[in]  ctx       A mailbox CONTEXT
+ * @param[out] new_flags Number of messages with changed tags
+ * @param[out] occult    Set if messages have left the query
+ * @retval  0 Success
+ * @retval -1 Not possible, a full rescan is needed
+ *
+ * Only the messages modified since the last recorded database revision are
+ * read, using a "lastmod:" range.  Messages that were removed from the
+ * database aren't visible this way, so the number of matching messages is
+ * compared against the Context afterwards.
+ *
+ * The full rescan is still used for thread queries and limited queries,
+ * because their results depend on messages that haven't changed.
+ */
+static int check_mailbox_incremental(struct Context *ctx, int *new_flags, bool *occult)
+{
+  struct NmCtxData *data = get_ctxdata(ctx);
+  notmuch_database_t *db = NULL;
+  notmuch_query_t *q = NULL;
+  notmuch_messages_t *msgs = NULL;
+  const char *uuid = NULL;
+  const char *str = NULL;
+  char *qstr = NULL;
+  unsigned long revision;
+  unsigned int count = 0, active = 0;
+  int i, oldmsgcount = ctx->msgcount;
+
+  if (!data || !data->db_uuid || (get_limit(data) != 0) ||
+      (get_query_type(data) != NM_QUERY_TYPE_MESGS))
+    return -1;
+
+  db = get_db(data, false);
+  str = get_query_string(data, true);
+  if (!db || !str)
+    return -1;
+
+  revision = notmuch_database_get_revision(db, &uuid);
+  if (mutt_strcmp(uuid, data->db_uuid) != 0)
+  {
+    mutt_debug(1, "nm: database UUID changed, full check\n");
+    return -1;
+  }
+  if (revision == data->db_revision)
+  {
+    mutt_debug(2, "nm: db revision unchanged (%lu)\n", revision);
+    return 0;
+  }
+
+  mutt_debug(1, "nm: incremental check (revision %lu..%lu)\n",
+             data->db_revision + 1, revision);
+
+  /* modified messages which (still) match the query */
+  safe_asprintf(&qstr, "(%s) and lastmod:%lu..%lu", str, data->db_revision + 1, revision);
+  q = notmuch_query_create(db, qstr);
+  FREE(&qstr);
+  if (!q)
+    return -1;
+  apply_exclude_tags(q);
+  if (notmuch_query_search_messages_st(q, &msgs) != NOTMUCH_STATUS_SUCCESS)
+  {
+    notmuch_query_destroy(q);
+    return -1;
+  }
+  for (; notmuch_messages_valid(msgs); notmuch_messages_move_to_next(msgs))
+  {
+    notmuch_message_t *m = notmuch_messages_get(msgs);
+    struct Header *h = get_mutt_header(ctx, m);
+
+    if (!h)
+      append_message(ctx, NULL, m, 0);
+    else if (merge_message(ctx, h, m))
+      (*new_flags)++;
+    notmuch_message_destroy(m);
+  }
+  notmuch_query_destroy(q);
+
+  if (ctx->msgcount > oldmsgcount)
+    mx_update_context(ctx, ctx->msgcount - oldmsgcount);
+
+  /* modified messages which don't match the query any more */
+  safe_asprintf(&qstr, "lastmod:%lu..%lu and not (%s)", data->db_revision + 1,
+                revision, str);
+  q = notmuch_query_create(db, qstr);
+  FREE(&qstr);
+  if (!q)
+    return -1;
+  if (notmuch_query_search_messages_st(q, &msgs) != NOTMUCH_STATUS_SUCCESS)
+  {
+    notmuch_query_destroy(q);
+    return -1;
+  }
+  for (; notmuch_messages_valid(msgs); notmuch_messages_move_to_next(msgs))
+  {
+    notmuch_message_t *m = notmuch_messages_get(msgs);
+    struct Header *h = get_mutt_header(ctx, m);
+
+    if (h && h->active)
+    {
+      h->active = false;
+      *occult = true;
+    }
+    notmuch_message_destroy(m);
+  }
+  notmuch_query_destroy(q);
+
+  /* messages removed from the database leave no trace in the lastmod range */
+  count = count_query(db, str);
+  for (i = 0; i < ctx->msgcount; i++)
+    if (ctx->hdrs[i]->active)
+      active++;
+
+  if (count != active)
+  {
+    mutt_debug(1, "nm: %u messages in the query, %u in the mailbox, full check\n",
+               count, active);
+    return -1;
+  }
+
+  data->db_revision = revision;
+  return 0;
+}
+#endif
+
 /**
  * nm_check_mailbox - Check a notmuch mailbox for new mail
  * @param ctx         A mailbox CONTEXT
@@ -2375,7 +2833,7 @@ static int nm_check_mailbox(struct Context *ctx, int *index_hint)
   time_t mtime = 0;
   notmuch_query_t *q = NULL;
   notmuch_messages_t *msgs = NULL;
-  int i, limit, new_flags = 0;
+  int i, limit, msgcount, new_flags = 0;
   bool occult = false;
 
   if (!data || (get_database_mtime(data, &mtime) != 0))
@@ -2389,13 +2847,21 @@ static int nm_check_mailbox(struct Context *ctx, int *index_hint)
 
   mutt_debug(1, "nm: checking (db=%lu ctx=%lu)\n", mtime, ctx->mtime);
 
+  data->oldmsgcount = ctx->msgcount;
+  data->noprogress = true;
+
+#if LIBNOTMUCH_CHECK_VERSION(4, 3, 0)
+  if (check_mailbox_incremental(ctx, &new_flags, &occult) == 0)
+    goto done;
+#endif
+
   q = get_query(data, false);
   if (!q)
     goto done;
 
   mutt_debug(1, "nm: start checking (count=%d)\n", ctx->msgcount);
-  data->oldmsgcount = ctx->msgcount;
-  data->noprogress = true;
+  msgcount = ctx->msgcount;
+  update_db_revision(data);
 
   for (i = 0; i < ctx->msgcount; i++)
     ctx->hdrs[i]->active = false;
@@ -2412,9 +2878,6 @@ static int nm_check_mailbox(struct Context *ctx, int *index_hint)
   for (i = 0; notmuch_messages_valid(msgs) && ((limit == 0) || (i < limit));
        notmuch_messages_move_to_next(msgs), i++)
   {
-    char old[_POSIX_PATH_MAX];
-    const char *new = NULL;
-
     notmuch_message_t *m = notmuch_messages_get(msgs);
     struct Header *h = get_mutt_header(ctx, m);
 
@@ -2427,30 +2890,7 @@ static int nm_check_mailbox(struct Context *ctx, int *index_hint)
     }
 
     /* message already exists, merge flags */
-    h->active = true;
-
-    /* Check to see if the message has moved to a different subdirectory.
-     * If so, update the associated filename.
-     */
-    new = get_message_last_filename(m);
-    header_get_fullpath(h, old, sizeof(old));
-
-    if (mutt_strcmp(old, new) != 0)
-      update_message_path(h, new);
-
-    if (!h->changed)
-    {
-      /* if the user hasn't modified the flags on
-       * this message, update the flags we just
-       * detected.
-       */
-      struct Header tmp;
-      memset(&tmp, 0, sizeof(tmp));
-      maildir_parse_flags(&tmp, new);
-      maildir_update_flags(ctx, h, &tmp);
-    }
-
-    if (update_header_tags(h, m) == 0)
+    if (merge_message(ctx, h, m))
       new_flags++;
 
     notmuch_message_destroy(m);
@@ -2465,8 +2905,8 @@ static int nm_check_mailbox(struct Context *ctx, int *index_hint)
     }
   }
 
-  if (ctx->msgcount > data->oldmsgcount)
-    mx_update_context(ctx, ctx->msgcount - data->oldmsgcount);
+  if (ctx->msgcount > msgcount)
+    mx_update_context(ctx, ctx->msgcount - msgcount);
 done:
   if (q)
     notmuch_query_destroy(q);
@@ -2496,13 +2936,16 @@ static int nm_sync_mailbox(struct Context *ctx, int *index_hint)
   char msgbuf[STRING];
   struct Progress progress;
   char *uri = ctx->path;
-  bool changed = false;
+  bool changed = false, batch;
 
   if (!data)
     return -1;
 
   mutt_debug(1, "nm: sync start ...\n");
 
+  /* commit all the renames and removals at once */
+  batch = db_batch_begin(data);
+
   if (!ctx->quiet)
   {
     /* all is in this function so we don't use data->progress here */
@@ -2560,6 +3003,8 @@ static int nm_sync_mailbox(struct Context *ctx, int *index_hint)
   ctx->path = uri;
   ctx->magic = MUTT_NOTMUCH;
 
+  if (batch)
+    db_batch_end(data);
   if (!is_longrun(data))
     release_db(data);
   if (changed)
@@ -57,6 +57,9 @@ int nm_get_all_tags(struct Context *ctx, char **tag_list, int *tag_count);
  * functions usable outside notmuch Context
  */
 int nm_nonctx_get_count(char *path, int *all, int *new);
+void nm_nonctx_begin(void);
+void nm_nonctx_end(void);
+void nm_nonctx_free(const char *path);
 
 char *nm_header_get_tag_transformed(char *tag, struct Header *h);
 char *nm_header_get_tags_transformed(struct Header *h);
@@ -161,7 +161,6 @@ void mutt_free_header(struct Header **h)
   mutt_free_envelope(&(*h)->env);
   mutt_free_body(&(*h)->content);
   FREE(&(*h)->maildir_flags);
-  FREE(&(*h)->tree);
   FREE(&(*h)->path);
 #ifdef MIXMASTER
   mutt_list_free(&(*h)->chain);
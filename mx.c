@@ -546,6 +546,7 @@ void mx_fastclose_mailbox(struct Context *ctx)
   FREE(&ctx->pattern);
   if (ctx->limit_pattern)
     mutt_pattern_free(&ctx->limit_pattern);
+  mutt_pattern_results_free(&ctx->results);
   safe_fclose(&ctx->fp);
   memset(ctx, 0, sizeof(struct Context));
 }
@@ -649,6 +650,12 @@ int mx_close_mailbox(struct Context *ctx, int *index_hint)
 
   ctx->closing = true;
 
+#ifdef USE_HCACHE
+  /* this is rate-limited, so that most closes don't walk the database */
+  if (option(OPT_HCACHE_COMPACT) && !ctx->append && ctx->mx_ops->hcache_compact)
+    mx_hcache_compact(ctx, false, NULL);
+#endif
+
   if (ctx->readonly || ctx->dontwrite || ctx->append)
   {
     mx_fastclose_mailbox(ctx);
@@ -1033,6 +1040,7 @@ int mx_sync_mailbox(struct Context *ctx, int *index_hint)
         {
           ctx->hdrs[i]->deleted = false;
           ctx->hdrs[i]->purge = false;
+          mutt_pattern_results_invalidate(ctx, ctx->hdrs[i]);
         }
         ctx->deleted = 0;
       }
@@ -1182,6 +1190,31 @@ int mx_check_mailbox(struct Context *ctx, int *index_hint)
   return ctx->mx_ops->check(ctx, index_hint);
 }
 
+#ifdef USE_HCACHE
+/**
+ * mx_hcache_compact - Remove stale records from a mailbox's header cache
+ * @param[in]  ctx       Context
+ * @param[in]  force     If false, reclaim space only if records were removed
+ * @param[out] reclaimed Bytes reclaimed (may be NULL)
+ * @retval num Number of records removed
+ * @retval -1  Error, or not supported by the mailbox type
+ */
+int mx_hcache_compact(struct Context *ctx, bool force, LOFF_T *reclaimed)
+{
+  if (reclaimed)
+    *reclaimed = 0;
+
+  if (!ctx || !ctx->mx_ops || !ctx->mx_ops->hcache_compact)
+  {
+    mutt_debug(1, "mx_hcache_compact: not supported for mailbox type %d.\n",
+               ctx ? ctx->magic : 0);
+    return -1;
+  }
+
+  return ctx->mx_ops->hcache_compact(ctx, force, reclaimed);
+}
+#endif
+
 /**
  * mx_open_message - return a stream pointer for a message
  */
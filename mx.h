@@ -51,6 +51,7 @@ struct stat;
  *
  * Optional operations
  *  - open_new_msg
+ *  - hcache_compact
  */
 struct MxOps
 {
@@ -63,6 +64,17 @@ struct MxOps
   int (*close_msg)(struct Context *ctx, struct Message *msg);
   int (*commit_msg)(struct Context *ctx, struct Message *msg);
   int (*open_new_msg)(struct Message *msg, struct Context *ctx, struct Header *hdr);
+#ifdef USE_HCACHE
+  /**
+   * hcache_compact - Remove header cache records of messages not in the mailbox
+   * @param[in]  ctx       Context
+   * @param[in]  force     If false, reclaim space only if records were removed
+   * @param[out] reclaimed Bytes reclaimed (may be NULL)
+   * @retval num Number of records removed
+   * @retval -1  Error
+   */
+  int (*hcache_compact)(struct Context *ctx, bool force, LOFF_T *reclaimed);
+#endif
 };
 
 /**
@@ -100,6 +112,7 @@ void maildir_flags(char *dest, size_t destlen, struct Header *hdr);
 
 #ifdef USE_HCACHE
 int mh_sync_mailbox_message(struct Context *ctx, int msgno, header_cache_t *hc);
+const char *mh_hcache_key(struct Context *ctx, struct Header *h, size_t *keylen);
 #else
 int mh_sync_mailbox_message(struct Context *ctx, int msgno);
 #endif
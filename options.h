@@ -48,6 +48,9 @@ enum GlobalBool
   OPT_COLLAPSE_ALL,
   OPT_COLLAPSE_UNREAD,
   OPT_COLLAPSE_FLAGGED,
+#if defined(USE_COMPRESSED) && defined(USE_COMPRESS_NATIVE)
+  OPT_COMPRESS_NATIVE,
+#endif
   OPT_CONFIRM_APPEND,
   OPT_CONFIRM_CREATE,
   OPT_DELETE_UNTAG,
@@ -66,6 +69,8 @@ enum GlobalBool
   OPT_FORW_REF,
 #ifdef USE_HCACHE
   OPT_HCACHE_VERIFY,
+  OPT_HCACHE_SHARED,
+  OPT_HCACHE_COMPACT,
 #if defined(HAVE_QDBM) || defined(HAVE_TC) || defined(HAVE_KC)
   OPT_HCACHE_COMPRESS,
 #endif /* HAVE_QDBM */
@@ -124,6 +129,9 @@ enum GlobalBool
   OPT_MENU_MOVE_OFF, /**< allow menu to scroll past last entry */
 #if defined(USE_IMAP) || defined(USE_POP)
   OPT_MESSAGE_CACHE_CLEAN,
+#endif
+#ifdef HAVE_ZLIB
+  OPT_MESSAGE_CACHE_COMPRESS,
 #endif
   OPT_METAKEY, /**< interpret ALT-x as ESC-x */
   OPT_ME_TOO,
@@ -161,6 +169,9 @@ enum GlobalBool
   OPT_SAVE_EMPTY,
   OPT_SAVE_NAME,
   OPT_SCORE,
+#ifdef USE_HCACHE
+  OPT_SEARCH_INDEX,
+#endif
 #ifdef USE_SIDEBAR
   OPT_SIDEBAR,
   OPT_SIDEBAR_FOLDER_INDENT,
@@ -34,6 +34,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <time.h>
 #include <unistd.h>
 #include <wchar.h>
@@ -55,15 +56,18 @@
 #include "mutt_curses.h"
 #include "mutt_menu.h"
 #include "mutt_regex.h"
+#include "mx.h"
 #include "ncrypt/ncrypt.h"
 #include "opcodes.h"
 #include "options.h"
 #include "protos.h"
 #include "state.h"
 #include "thread.h"
+#ifdef USE_HCACHE
+#include "hcache/textindex.h"
+#endif
 #ifdef USE_IMAP
 #include "imap/imap.h"
-#include "mx.h"
 #endif
 #ifdef USE_NOTMUCH
 #include "mutt_notmuch.h"
@@ -122,7 +126,7 @@ static bool eat_regexp(struct Pattern *pat, struct Buffer *s, struct Buffer *err
       FREE(&pat->p.rx);
       return false;
     }
-    FREE(&buf.data);
+    pat->expr = buf.data;
   }
 
   return true;
@@ -923,16 +927,374 @@ static int patmatch(const struct Pattern *pat, const char *buf)
     return regexec(pat->p.rx, buf, 0, NULL, 0);
 }
 
+/**
+ * pattern_icase - Does a pattern ignore the case of the text
+ * @param pat Pattern, with a string or a regex
+ * @retval true If the case is ignored
+ */
+static bool pattern_icase(const struct Pattern *pat)
+{
+  if (pat->stringmatch)
+    return pat->ign_case;
+  return pat->expr && (mutt_which_case(pat->expr) == REG_ICASE);
+}
+
+/* Bytes read at once by search_file() */
+#define SEARCH_FIRST_BLOCK 4096
+#define SEARCH_BLOCK 65536
+
+/**
+ * struct PatternWorker - A thread matching a pattern, see match_parallel()
+ */
+struct PatternWorker
+{
+  struct Pattern *pat; /**< Private copy of the pattern */
+  FILE *fp;            /**< Private handle on an mbox or mmdf mailbox */
+  bool retry;          /**< The message couldn't be read */
+};
+
+/**
+ * seek_message - Find the part of a raw message to search
+ * @param pat Pattern, ~b, ~h or ~B
+ * @param fp  File of the message
+ * @param h   Message
+ * @retval num Number of bytes to search
+ */
+static long seek_message(const struct Pattern *pat, FILE *fp, struct Header *h)
+{
+  long lng = 0;
+
+  if (pat->op != MUTT_BODY)
+  {
+    fseeko(fp, h->offset, SEEK_SET);
+    lng = h->content->offset - h->offset;
+  }
+  if (pat->op != MUTT_HEADER)
+  {
+    if (pat->op == MUTT_BODY)
+      fseeko(fp, h->content->offset, SEEK_SET);
+    lng += h->content->length;
+  }
+  return lng;
+}
+
+/**
+ * search_stream - Search the lines of a message
+ * @param pat Pattern to find
+ * @param fp  File, positioned at the start of the text
+ * @param lng Number of bytes to search
+ * @retval 1 The pattern was found
+ * @retval 0 Otherwise
+ */
+static int search_stream(const struct Pattern *pat, FILE *fp, long lng)
+{
+  size_t blen = STRING;
+  char *buf = safe_malloc(blen);
+  int match = 0;
+
+  while (lng > 0)
+  {
+    if (pat->op == MUTT_HEADER)
+    {
+      if (*(buf = mutt_read_rfc822_line(fp, buf, &blen)) == '\0')
+        break;
+    }
+    else if (fgets(buf, blen - 1, fp) == NULL)
+      break; /* don't loop forever */
+    if (patmatch(pat, buf) == 0)
+    {
+      match = 1;
+      break;
+    }
+    lng -= mutt_strlen(buf);
+  }
+
+  FREE(&buf);
+  return match;
+}
+
+/**
+ * search_buffer - Search the lines of a buffer
+ * @param pat  Pattern to find, ~b or ~B
+ * @param text Lines; one byte past the end must be writable
+ * @param len  Length of the lines
+ * @retval 1 The pattern was found
+ * @retval 0 Otherwise
+ *
+ * If the pattern has a literal, the regex only runs on the lines containing
+ * it.
+ */
+static int search_buffer(const struct Pattern *pat, char *text, size_t len)
+{
+  size_t llen = mutt_strlen(pat->literal);
+  char *hay = text, *folded = NULL;
+  char *line = text, *end = text + len, *eol = NULL, *hit = NULL;
+  int match = 0;
+
+  /* The literal of a pattern ignoring case is in lower case */
+  if (llen && pattern_icase(pat))
+  {
+    folded = safe_malloc(len);
+    for (size_t i = 0; i < len; i++)
+    {
+      unsigned char c = text[i];
+      folded[i] = c + (((unsigned char) (c - 'A') < 26) ? ('a' - 'A') : 0);
+    }
+    hay = folded;
+  }
+
+  while (line < end)
+  {
+    if (llen)
+    {
+      hit = memmem(hay + (line - text), end - line, pat->literal, llen);
+      if (!hit)
+        break;
+      for (line = text + (hit - hay); (line > text) && (line[-1] != '\n'); line--)
+        ;
+    }
+
+    eol = memchr(line, '\n', end - line);
+    eol = eol ? eol + 1 : end;
+
+    /* The lines are matched with their newline, like fgets() reads them */
+    char c = *eol;
+    *eol = '\0';
+    match = (patmatch(pat, line) == 0);
+    *eol = c;
+    if (match)
+      break;
+    line = eol;
+  }
+
+  FREE(&folded);
+  return match;
+}
+
+/**
+ * search_file - Search a range of a file
+ * @param pat Pattern to find
+ * @param fp  File, positioned at the start of the text
+ * @param lng Number of bytes to search
+ * @retval 1 The pattern was found
+ * @retval 0 Otherwise
+ *
+ * The text is read in blocks of whole lines, and searched by search_buffer().
+ * The headers of ~h are unfolded by search_stream().
+ */
+static int search_file(const struct Pattern *pat, FILE *fp, long lng)
+{
+  size_t size, have = 0, done, n;
+  char *buf = NULL;
+  int match = 0;
+
+  if (pat->op == MUTT_HEADER)
+    return search_stream(pat, fp, lng);
+
+  /* Start small: the first lines often match */
+  size = MIN(MAX(lng, 1), SEARCH_FIRST_BLOCK);
+  buf = safe_malloc(size + 1);
+
+  while ((lng > 0) && !match)
+  {
+    n = fread(buf + have, 1, MIN(size - have, (size_t) lng), fp);
+    if (n == 0)
+      break;
+    lng -= n;
+    have += n;
+
+    /* Keep the last, partial, line for the next block */
+    done = have;
+    if (lng > 0)
+    {
+      while ((done > 0) && (buf[done - 1] != '\n'))
+        done--;
+    }
+
+    if (done > 0)
+    {
+      match = search_buffer(pat, buf, done);
+      memmove(buf, buf + done, have - done);
+      have -= done;
+    }
+
+    /* Grow the blocks, or fit a line longer than the buffer */
+    if ((lng > 0) && !match && ((have == size) || (size < SEARCH_BLOCK)))
+    {
+      size *= 2;
+      safe_realloc(&buf, size + 1);
+    }
+  }
+
+  /* The file may end before the range: search its last line */
+  if (!match && (have > 0))
+    match = search_buffer(pat, buf, have);
+
+  FREE(&buf);
+  return match;
+}
+
+/**
+ * worker_search - Search a raw message, in a worker thread
+ * @param pat Pattern, a copy private to the worker
+ * @param ctx Mailbox
+ * @param h   Message
+ * @retval 1 The pattern was found
+ * @retval 0 Otherwise
+ *
+ * The message is read directly from the mailbox.  If it can't be, the worker
+ * leaves it to the main thread, which can report the error.
+ */
+static int worker_search(struct Pattern *pat, struct Context *ctx, struct Header *h)
+{
+  char path[_POSIX_PATH_MAX];
+  FILE *fp = pat->worker->fp;
+  int match;
+
+  if (!fp)
+  {
+    snprintf(path, sizeof(path), "%s/%s", ctx->path, h->path);
+    fp = fopen(path, "r");
+    if (!fp)
+    {
+      pat->worker->retry = true;
+      return 0;
+    }
+  }
+
+  match = search_file(pat, fp, seek_message(pat, fp, h));
+
+  if (fp != pat->worker->fp)
+    safe_fclose(&fp);
+  return match;
+}
+
+static bool SearchFailed = false; /* msg_search() couldn't read a message */
+
+#ifdef HAVE_FOPENCOOKIE
+/**
+ * struct SearchSink - Decoded text, matched as it's written, see sink_search()
+ */
+struct SearchSink
+{
+  const struct Pattern *pat;
+  char *buf;   /**< Last, partial, line; one more byte is allocated */
+  size_t len;  /**< Length of the partial line */
+  size_t size; /**< Size of the buffer */
+  int match;   /**< The pattern was found */
+};
+
+/**
+ * sink_write - Match the complete lines written to a search sink
+ * @param cookie Search sink, struct SearchSink
+ * @param data   Text written
+ * @param size   Length of the text
+ * @retval num Number of bytes written; 0 once the pattern is found
+ *
+ * Once the pattern is found, the writes fail, so the handlers can stop
+ * decoding.  Implements cookie_write_function_t.
+ */
+static ssize_t sink_write(void *cookie, const char *data, size_t size)
+{
+  struct SearchSink *sink = cookie;
+  size_t done;
+
+  if (sink->match)
+    return 0;
+
+  if (sink->len + size > sink->size)
+  {
+    sink->size = MAX(2 * sink->size, sink->len + size);
+    safe_realloc(&sink->buf, sink->size + 1);
+  }
+  memcpy(sink->buf + sink->len, data, size);
+  sink->len += size;
+
+  /* Only the new text can end the partial line */
+  for (done = sink->len; (done > sink->len - size) && (sink->buf[done - 1] != '\n'); done--)
+    ;
+  if (done > sink->len - size)
+  {
+    sink->match = search_buffer(sink->pat, sink->buf, done);
+    memmove(sink->buf, sink->buf + done, sink->len - done);
+    sink->len -= done;
+  }
+
+  return sink->match ? 0 : size;
+}
+
+/**
+ * sink_search - Search a message as it's decoded
+ * @param ctx Mailbox
+ * @param pat Pattern, ~b or ~B
+ * @param msg Message, open
+ * @param h   Header of the message
+ * @retval 1 The pattern was found
+ * @retval 0 Otherwise
+ *
+ * The decoded text isn't stored: its lines are matched as the handlers write
+ * them, and the decoding stops at the first match.
+ */
+static int sink_search(struct Context *ctx, struct Pattern *pat,
+                       struct Message *msg, struct Header *h)
+{
+  static const cookie_io_functions_t sink_io = { NULL, sink_write, NULL, NULL };
+  struct SearchSink sink;
+  struct State s;
+
+  mutt_parse_mime_message(ctx, h);
+  if (WithCrypto && (h->security & ENCRYPT) && !crypt_valid_passphrase(h->security))
+  {
+    SearchFailed = true;
+    return 0;
+  }
+
+  memset(&sink, 0, sizeof(sink));
+  sink.pat = pat;
+
+  memset(&s, 0, sizeof(s));
+  s.fpin = msg->fp;
+  s.flags = MUTT_CHARCONV;
+  s.fpout = fopencookie(&sink, "w", sink_io);
+  if (!s.fpout)
+  {
+    mutt_perror("fopencookie");
+    SearchFailed = true;
+    return 0;
+  }
+
+  if (pat->op != MUTT_BODY)
+    mutt_copy_header(msg->fp, h, s.fpout, CH_FROM | CH_DECODE, NULL);
+  if (!ferror(s.fpout))
+  {
+    fseeko(msg->fp, h->offset, SEEK_SET);
+    mutt_body_handler(h->content, &s);
+  }
+  fclose(s.fpout);
+
+  /* The last line may have no newline */
+  if (!sink.match && (sink.len > 0))
+    sink.match = search_buffer(pat, sink.buf, sink.len);
+
+  FREE(&sink.buf);
+  return sink.match;
+}
+#endif
+
+#ifdef USE_HCACHE
+static struct TextIndex *SearchIndex = NULL; /* text index of the mailbox searched */
+#endif
+
 static int msg_search(struct Context *ctx, struct Pattern *pat, int msgno)
 {
   struct Message *msg = NULL;
   struct State s;
   FILE *fp = NULL;
   long lng = 0;
+  LOFF_T hdrlen = 0;
   int match = 0;
+  bool indexing = false;
   struct Header *h = ctx->hdrs[msgno];
-  char *buf = NULL;
-  size_t blen;
 #ifdef USE_FMEMOPEN
   char *temp = NULL;
   size_t tempsize;
@@ -941,10 +1303,40 @@ static int msg_search(struct Context *ctx, struct Pattern *pat, int msgno)
   struct stat st;
 #endif
 
+#ifdef USE_HCACHE
+  if (pat->candidates)
+  {
+    if (pat->candidates[msgno] == TI_NO_MATCH)
+      return 0;
+    /* Only the main thread can add the message to the index */
+    if (pat->worker && (pat->candidates[msgno] == TI_UNINDEXED))
+    {
+      pat->worker->retry = true;
+      return 0;
+    }
+  }
+#endif
+
+  if (pat->worker)
+    return worker_search(pat, ctx, h);
+
+#ifdef USE_HCACHE
+  indexing = mutt_tindex_wants(SearchIndex, msgno);
+#endif
+
   if ((msg = mx_open_message(ctx, msgno)) != NULL)
   {
     if (option(OPT_THOROUGH_SRC))
     {
+#ifdef HAVE_FOPENCOOKIE
+      /* The index needs the whole text, and ~h the unfolded header fields */
+      if (!indexing && (pat->op != MUTT_HEADER))
+      {
+        match = sink_search(ctx, pat, msg, h);
+        mx_close_message(ctx, &msg);
+        return match;
+      }
+#endif
       /* decode the header / body */
       memset(&s, 0, sizeof(s));
       s.fpin = msg->fp;
@@ -954,6 +1346,8 @@ static int msg_search(struct Context *ctx, struct Pattern *pat, int msgno)
       if (!s.fpout)
       {
         mutt_perror(_("Error opening memstream"));
+        mx_close_message(ctx, &msg);
+        SearchFailed = true;
         return 0;
       }
 #else
@@ -961,14 +1355,18 @@ static int msg_search(struct Context *ctx, struct Pattern *pat, int msgno)
       if ((s.fpout = safe_fopen(tempfile, "w+")) == NULL)
       {
         mutt_perror(tempfile);
+        mx_close_message(ctx, &msg);
+        SearchFailed = true;
         return 0;
       }
 #endif
 
-      if (pat->op != MUTT_BODY)
+      /* The index needs the whole message */
+      if (indexing || (pat->op != MUTT_BODY))
         mutt_copy_header(msg->fp, h, s.fpout, CH_FROM | CH_DECODE, NULL);
+      hdrlen = ftello(s.fpout);
 
-      if (pat->op != MUTT_HEADER)
+      if (indexing || (pat->op != MUTT_HEADER))
       {
         mutt_parse_mime_message(ctx, h);
 
@@ -984,6 +1382,7 @@ static int msg_search(struct Context *ctx, struct Pattern *pat, int msgno)
             unlink(tempfile);
 #endif
           }
+          SearchFailed = true;
           return 0;
         }
 
@@ -1001,6 +1400,9 @@ static int msg_search(struct Context *ctx, struct Pattern *pat, int msgno)
         if (!fp)
         {
           mutt_perror(_("Error re-opening memstream"));
+          mx_close_message(ctx, &msg);
+          FREE(&temp);
+          SearchFailed = true;
           return 0;
         }
       }
@@ -1010,6 +1412,8 @@ static int msg_search(struct Context *ctx, struct Pattern *pat, int msgno)
         if (!fp)
         {
           mutt_perror(_("Error opening /dev/null"));
+          mx_close_message(ctx, &msg);
+          SearchFailed = true;
           return 0;
         }
       }
@@ -1020,46 +1424,33 @@ static int msg_search(struct Context *ctx, struct Pattern *pat, int msgno)
       fstat(fileno(fp), &st);
       lng = (long) st.st_size;
 #endif
+
+#ifdef USE_HCACHE
+      if (indexing)
+        mutt_tindex_add(SearchIndex, msgno, fp);
+#endif
+      if (pat->op == MUTT_BODY)
+        lng -= hdrlen;
+      else if (pat->op == MUTT_HEADER)
+        lng = hdrlen;
+      fseeko(fp, (pat->op == MUTT_BODY) ? hdrlen : 0, SEEK_SET);
     }
     else
     {
       /* raw header / body */
       fp = msg->fp;
-      if (pat->op != MUTT_BODY)
+#ifdef USE_HCACHE
+      if (indexing)
       {
         fseeko(fp, h->offset, SEEK_SET);
-        lng = h->content->offset - h->offset;
-      }
-      if (pat->op != MUTT_HEADER)
-      {
-        if (pat->op == MUTT_BODY)
-          fseeko(fp, h->content->offset, SEEK_SET);
-        lng += h->content->length;
+        mutt_tindex_add(SearchIndex, msgno, fp);
       }
+#endif
+      lng = seek_message(pat, fp, h);
     }
 
-    blen = STRING;
-    buf = safe_malloc(blen);
-
     /* search the file "fp" */
-    while (lng > 0)
-    {
-      if (pat->op == MUTT_HEADER)
-      {
-        if (*(buf = mutt_read_rfc822_line(fp, buf, &blen)) == '\0')
-          break;
-      }
-      else if (fgets(buf, blen - 1, fp) == NULL)
-        break; /* don't loop forever */
-      if (patmatch(pat, buf) == 0)
-      {
-        match = 1;
-        break;
-      }
-      lng -= mutt_strlen(buf);
-    }
-
-    FREE(&buf);
+    match = search_file(pat, fp, lng);
 
     mx_close_message(ctx, &msg);
 
@@ -1074,6 +1465,8 @@ static int msg_search(struct Context *ctx, struct Pattern *pat, int msgno)
 #endif
     }
   }
+  else
+    SearchFailed = true;
 
   return match;
 }
@@ -1123,13 +1516,23 @@ void mutt_pattern_free(struct Pattern **pat)
       FREE(&tmp->p.rx);
     }
 
+    FREE(&tmp->expr);
+    FREE(&tmp->literal);
+
     if (tmp->child)
       mutt_pattern_free(&tmp->child);
     FREE(&tmp);
   }
 }
 
-struct Pattern *mutt_pattern_comp(/* const */ char *s, int flags, struct Buffer *err)
+/**
+ * pattern_comp - Compile a pattern, as written
+ * @param s     Pattern string
+ * @param flags Flags, e.g. #MUTT_FULL_MSG
+ * @param err   Buffer for error messages
+ * @retval ptr Pattern tree
+ */
+static struct Pattern *pattern_comp(/* const */ char *s, int flags, struct Buffer *err)
 {
   struct Pattern *curlist = NULL;
   struct Pattern *tmp = NULL, *tmp2 = NULL;
@@ -1236,7 +1639,7 @@ struct Pattern *mutt_pattern_comp(/* const */ char *s, int flags, struct Buffer
           isalias = false;
           /* compile the sub-expression */
           buf = mutt_substrdup(ps.dptr + 1, p);
-          if ((tmp2 = mutt_pattern_comp(buf, flags, err)) == NULL)
+          if ((tmp2 = pattern_comp(buf, flags, err)) == NULL)
           {
             FREE(&buf);
             mutt_pattern_free(&curlist);
@@ -1318,7 +1721,7 @@ struct Pattern *mutt_pattern_comp(/* const */ char *s, int flags, struct Buffer
         }
         /* compile the sub-expression */
         buf = mutt_substrdup(ps.dptr + 1, p);
-        if ((tmp = mutt_pattern_comp(buf, flags, err)) == NULL)
+        if ((tmp = pattern_comp(buf, flags, err)) == NULL)
         {
           FREE(&buf);
           mutt_pattern_free(&curlist);
@@ -1359,37 +1762,444 @@ struct Pattern *mutt_pattern_comp(/* const */ char *s, int flags, struct Buffer
   return curlist;
 }
 
-static bool perform_and(struct Pattern *pat, enum PatternExecFlag flags,
-                        struct Context *ctx, struct Header *hdr, struct PatternCache *cache)
+/**
+ * enum PatternCost - How expensive a pattern is to match
+ */
+enum PatternCost
 {
-  for (; pat; pat = pat->next)
-    if (mutt_pattern_exec(pat, flags, ctx, hdr, cache) <= 0)
-      return false;
-  return true;
-}
+  PAT_COST_FLAG,     /**< Bits and numbers of the Header */
+  PAT_COST_ENVELOPE, /**< Fields of the Envelope */
+  PAT_COST_HEADER,   /**< Header read from the mailbox */
+  PAT_COST_BODY,     /**< Message read from the mailbox, maybe decoded */
+  PAT_COST_THREAD,   /**< Pattern matched against other messages */
+};
 
-static int perform_or(struct Pattern *pat, enum PatternExecFlag flags,
-                      struct Context *ctx, struct Header *hdr, struct PatternCache *cache)
+/**
+ * pattern_cost - Estimate the cost of matching a pattern
+ * @param pat Pattern
+ * @retval enum #PatternCost
+ *
+ * A logical op costs as much as its most expensive child.
+ */
+static enum PatternCost pattern_cost(const struct Pattern *pat)
 {
-  for (; pat; pat = pat->next)
-    if (mutt_pattern_exec(pat, flags, ctx, hdr, cache) > 0)
-      return true;
-  return false;
+  enum PatternCost cost = PAT_COST_FLAG, c;
+
+  switch (pat->op)
+  {
+    case MUTT_AND:
+    case MUTT_OR:
+      for (pat = pat->child; pat; pat = pat->next)
+        if ((c = pattern_cost(pat)) > cost)
+          cost = c;
+      return cost;
+    case MUTT_THREAD:
+    case MUTT_PARENT:
+    case MUTT_CHILDREN:
+      return PAT_COST_THREAD;
+    case MUTT_BODY:
+    case MUTT_WHOLE_MSG:
+    case MUTT_MIMEATTACH:
+      return PAT_COST_BODY;
+    case MUTT_HEADER:
+      return PAT_COST_HEADER;
+    case MUTT_SENDER:
+    case MUTT_FROM:
+    case MUTT_TO:
+    case MUTT_CC:
+    case MUTT_SUBJECT:
+    case MUTT_ID:
+    case MUTT_REFERENCE:
+    case MUTT_ADDRESS:
+    case MUTT_RECIPIENT:
+    case MUTT_LIST:
+    case MUTT_SUBSCRIBED_LIST:
+    case MUTT_PERSONAL_RECIP:
+    case MUTT_PERSONAL_FROM:
+    case MUTT_XLABEL:
+    case MUTT_HORMEL:
+#ifdef USE_NOTMUCH
+    case MUTT_NOTMUCH_LABEL:
+#endif
+#ifdef USE_NNTP
+    case MUTT_NEWSGROUPS:
+#endif
+      return PAT_COST_ENVELOPE;
+    default:
+      return PAT_COST_FLAG;
+  }
 }
 
-static int match_adrlist(struct Pattern *pat, int match_personal, int n, ...)
+/**
+ * pattern_equal - Do two patterns match the same messages
+ * @param a First pattern
+ * @param b Second pattern
+ * @retval true If they are written the same way
+ */
+static bool pattern_equal(const struct Pattern *a, const struct Pattern *b)
 {
-  va_list ap;
-  struct Address *a = NULL;
+  if (a->op != b->op || a->not != b->not || a->alladdr != b->alladdr ||
+      a->stringmatch != b->stringmatch || a->groupmatch != b->groupmatch ||
+      a->ign_case != b->ign_case || a->isalias != b->isalias ||
+      a->min != b->min || a->max != b->max)
+    return false;
 
-  va_start(ap, n);
-  for (; n; n--)
+  if (a->stringmatch)
   {
-    for (a = va_arg(ap, struct Address *); a; a = a->next)
-    {
-      if (pat->alladdr ^ ((!pat->isalias || alias_reverse_lookup(a)) &&
-                          ((a->mailbox && !patmatch(pat, a->mailbox)) ||
-                           (match_personal && a->personal && !patmatch(pat, a->personal)))))
+    if (mutt_strcmp(a->p.str, b->p.str) != 0)
+      return false;
+  }
+  else if (a->groupmatch)
+  {
+    if (a->p.g != b->p.g)
+      return false;
+  }
+  else if (!a->p.rx != !b->p.rx || mutt_strcmp(a->expr, b->expr) != 0)
+    return false;
+
+  for (a = a->child, b = b->child; a && b; a = a->next, b = b->next)
+    if (!pattern_equal(a, b))
+      return false;
+  return !a && !b;
+}
+
+/**
+ * optimize_pattern - Rewrite a pattern so that it's cheaper to match
+ * @param pat Pattern, on its own
+ * @retval ptr Pattern matching the same messages
+ *
+ * The children of the logical ops are matched cheapest first, so that e.g.
+ * "~b foo ~F" only reads the bodies of the flagged messages.  Nested ops of
+ * the same kind are merged, constants (~A) are folded and duplicate children
+ * are dropped.
+ */
+static struct Pattern *optimize_pattern(struct Pattern *pat)
+{
+  struct Pattern *list = NULL, *cur = NULL, *next = NULL, *tmp = NULL;
+  struct Pattern **tail = &list, **pp = NULL;
+  bool or = (pat->op == MUTT_OR), decided = false;
+  enum PatternCost cost;
+
+  switch (pat->op)
+  {
+    case MUTT_THREAD:
+    case MUTT_PARENT:
+    case MUTT_CHILDREN:
+      pat->child = optimize_pattern(pat->child);
+      return pat;
+    case MUTT_AND:
+    case MUTT_OR:
+      break;
+    default:
+      return pat;
+  }
+
+  /* (A & B) & C == A & B & C */
+  for (cur = pat->child; cur; cur = next)
+  {
+    next = cur->next;
+    cur->next = NULL;
+    cur = optimize_pattern(cur);
+    if (cur->op == pat->op && !cur->not)
+    {
+      *tail = cur->child;
+      cur->child = NULL;
+      mutt_pattern_free(&cur);
+    }
+    else
+      *tail = cur;
+    while (*tail)
+      tail = &(*tail)->next;
+  }
+  pat->child = NULL;
+
+  for (cur = list; cur; cur = next)
+  {
+    next = cur->next;
+    cur->next = NULL;
+
+    /* ~A changes nothing in an AND, nor does !~A in an OR */
+    if (!decided && cur->op == MUTT_ALL && cur->not == or)
+    {
+      mutt_pattern_free(&cur);
+      continue;
+    }
+    if (decided || cur->op == MUTT_ALL)
+    {
+      decided = true;
+      mutt_pattern_free(&cur);
+      continue;
+    }
+
+    for (tmp = pat->child; tmp; tmp = tmp->next)
+      if (pattern_equal(tmp, cur))
+        break;
+    if (tmp)
+    {
+      mutt_pattern_free(&cur);
+      continue;
+    }
+
+    /* keep the children in order of cost, the cheapest first */
+    cost = pattern_cost(cur);
+    for (pp = &pat->child; *pp && pattern_cost(*pp) <= cost; pp = &(*pp)->next)
+      ;
+    cur->next = *pp;
+    *pp = cur;
+  }
+
+  if (decided || !pat->child)
+  {
+    /* an AND without children matches everything, an OR nothing */
+    mutt_pattern_free(&pat->child);
+    pat->not = !(pat->not ^ (decided ? or : !or));
+    pat->op = MUTT_ALL;
+  }
+  else if (!pat->child->next && !pat->not)
+  {
+    tmp = pat->child;
+    pat->child = NULL;
+    mutt_pattern_free(&pat);
+    pat = tmp;
+  }
+
+  return pat;
+}
+
+/**
+ * add_literal - Add a run of plain characters to a list
+ * @param literals List of strings
+ * @param run      Characters
+ * @param len      Number of characters, reset
+ */
+static void add_literal(struct ListHead *literals, const char *run, size_t *len)
+{
+  if (*len > 0)
+    mutt_list_insert_tail(literals, mutt_substrdup(run, run + *len));
+  *len = 0;
+}
+
+/**
+ * pattern_literals - Find the texts a message has to contain to match a pattern
+ * @param[in]  pat      Pattern matching a text, e.g. ~b or ~f
+ * @param[out] literals Texts, struct ListHead of strings
+ *
+ * For a regex, the texts are its runs of plain characters, outside of groups
+ * and brackets, less the optional ones.  If the regex has alternatives outside
+ * of groups, no text is required.
+ */
+static void pattern_literals(const struct Pattern *pat, struct ListHead *literals)
+{
+  struct ListHead runs = STAILQ_HEAD_INITIALIZER(runs);
+
+  if (pat->stringmatch)
+  {
+    mutt_list_insert_tail(literals, safe_strdup(pat->p.str));
+    return;
+  }
+  if (pat->groupmatch || !pat->expr)
+    return;
+
+  const char *s = pat->expr;
+  char *run = safe_malloc(strlen(s) + 1);
+  size_t len = 0;
+  int depth = 0;
+
+  for (; *s; s++)
+  {
+    switch (*s)
+    {
+      case '|':
+        /* Alternatives within a group don't matter */
+        if (depth > 0)
+          break;
+        mutt_list_free(&runs);
+        FREE(&run);
+        return;
+      case '\\':
+        /* \w, \<, \1, etc. aren't plain characters */
+        if (!s[1] || isalnum((unsigned char) s[1]) || (s[1] == '<') ||
+            (s[1] == '>') || (s[1] == '`') || (s[1] == '\''))
+        {
+          add_literal(&runs, run, &len);
+          if (s[1])
+            s++;
+        }
+        else if (depth == 0)
+          run[len++] = *++s;
+        else
+          s++;
+        break;
+      case '[':
+        add_literal(&runs, run, &len);
+        s++;
+        if (*s == '^')
+          s++;
+        if (*s == ']')
+          s++;
+        for (; *s && (*s != ']'); s++)
+        {
+          /* [:alpha:], [=e=] and [.-.] */
+          if ((*s == '[') && ((s[1] == ':') || (s[1] == '=') || (s[1] == '.')))
+          {
+            const char *end = strchr(s + 2, s[1]);
+            while (end && (end[1] != ']'))
+              end = strchr(end + 1, s[1]);
+            if (!end)
+              break;
+            s = end + 1;
+          }
+        }
+        if (!*s)
+          s--;
+        break;
+      case '(':
+        add_literal(&runs, run, &len);
+        depth++;
+        break;
+      case ')':
+        if (depth > 0)
+          depth--;
+        break;
+      case '*':
+      case '?':
+      case '{':
+        /* The last character is optional: drop it, with all its bytes */
+        while ((len > 0) && ((run[len - 1] & 0xc0) == 0x80))
+          len--;
+        if (len > 0)
+          len--;
+        add_literal(&runs, run, &len);
+        if (*s == '{')
+          while (s[1] && (*s != '}'))
+            s++;
+        break;
+      case '+':
+      case '.':
+      case '^':
+      case '$':
+        add_literal(&runs, run, &len);
+        break;
+      default:
+        if (depth == 0)
+          run[len++] = *s;
+    }
+  }
+  add_literal(&runs, run, &len);
+  FREE(&run);
+
+  STAILQ_CONCAT(literals, &runs);
+}
+
+/**
+ * set_literal - Find the longest text the matches of the text patterns contain
+ * @param pat Pattern
+ *
+ * search_buffer() only runs the regex of a ~b or ~B pattern on the lines
+ * containing the text.  If the case is ignored, the text is in lower case,
+ * and only has ASCII characters: the other ones can match in several ways.
+ * The texts of the envelope patterns, e.g. ~f or ~s, are searched for by
+ * imap_search().
+ */
+static void set_literal(struct Pattern *pat)
+{
+  struct ListHead literals = STAILQ_HEAD_INITIALIZER(literals);
+  struct ListNode *np = NULL;
+  size_t best = 0;
+
+  for (; pat; pat = pat->next)
+  {
+    if (pat->child)
+      set_literal(pat->child);
+    switch (pat->op)
+    {
+      case MUTT_BODY:
+      case MUTT_WHOLE_MSG:
+      case MUTT_TO:
+      case MUTT_CC:
+      case MUTT_SUBJECT:
+      case MUTT_FROM:
+      case MUTT_ID:
+      case MUTT_SENDER:
+      case MUTT_REFERENCE:
+      case MUTT_RECIPIENT:
+      case MUTT_ADDRESS:
+        break;
+      default:
+        continue;
+    }
+
+    bool icase = pattern_icase(pat);
+    pattern_literals(pat, &literals);
+    best = 0;
+    STAILQ_FOREACH(np, &literals, entries)
+    {
+      for (const char *t = np->data; *t;)
+      {
+        size_t len = 0;
+        while (t[len] && !(icase && (t[len] & 0x80)))
+          len++;
+        if (len > best)
+        {
+          best = len;
+          FREE(&pat->literal);
+          pat->literal = mutt_substrdup(t, t + len);
+        }
+        for (t += len; *t & 0x80; t++)
+          ;
+      }
+    }
+    mutt_list_free(&literals);
+
+    if (pat->literal && icase)
+      for (char *t = pat->literal; *t; t++)
+        *t = tolower((unsigned char) *t);
+  }
+}
+
+struct Pattern *mutt_pattern_comp(/* const */ char *s, int flags, struct Buffer *err)
+{
+  struct Pattern *pat = pattern_comp(s, flags, err);
+
+  if (pat)
+  {
+    pat = optimize_pattern(pat);
+    set_literal(pat);
+  }
+  return pat;
+}
+
+static bool perform_and(struct Pattern *pat, enum PatternExecFlag flags,
+                        struct Context *ctx, struct Header *hdr, struct PatternCache *cache)
+{
+  for (; pat; pat = pat->next)
+    if (mutt_pattern_exec(pat, flags, ctx, hdr, cache) <= 0)
+      return false;
+  return true;
+}
+
+static int perform_or(struct Pattern *pat, enum PatternExecFlag flags,
+                      struct Context *ctx, struct Header *hdr, struct PatternCache *cache)
+{
+  for (; pat; pat = pat->next)
+    if (mutt_pattern_exec(pat, flags, ctx, hdr, cache) > 0)
+      return true;
+  return false;
+}
+
+static int match_adrlist(struct Pattern *pat, int match_personal, int n, ...)
+{
+  va_list ap;
+  struct Address *a = NULL;
+
+  va_start(ap, n);
+  for (; n; n--)
+  {
+    for (a = va_arg(ap, struct Address *); a; a = a->next)
+    {
+      if (pat->alladdr ^ ((!pat->isalias || alias_reverse_lookup(a)) &&
+                          ((a->mailbox && !patmatch(pat, a->mailbox)) ||
+                           (match_personal && a->personal && !patmatch(pat, a->personal)))))
       {
         va_end(ap);
         return (!pat->alladdr); /* Found match, or non-match if alladdr */
@@ -1878,12 +2688,557 @@ bool mutt_limit_current_thread(struct Header *h)
   return true;
 }
 
+#define PAT_NO_MATCH 0
+#define PAT_MATCH    1
+#define PAT_RETRY    2 /**< Match the message again in the main thread */
+
+#define PATTERN_CHUNK 16  /**< Messages taken at once by a worker */
+#define PATTERN_ROUND 128 /**< Messages per worker between progress updates */
+/* Patterns that don't read the messages aren't worth the threads for fewer
+ * messages than this */
+#define PATTERN_PARALLEL_MIN 8192
+
+/**
+ * struct PatternRun - Match a pattern against many messages, in threads
+ */
+struct PatternRun
+{
+  struct Context *ctx;
+  struct PatternWorker *workers; /**< One per thread */
+  bool virtual;                  /**< Match the messages through ctx->v2r */
+  int results;                   /**< Entry of the pattern in ctx->results, or -1 */
+  int next;                      /**< Next message to match, shared by the workers */
+  int end;                       /**< End of the current round */
+  unsigned char *result;         /**< PAT_MATCH etc, for each message */
+};
+
+/**
+ * pattern_dup - Copy a pattern for a worker thread
+ * @param pat    Pattern
+ * @param worker Thread that will match the copy
+ * @retval ptr  Copy of the pattern, with its own regexes
+ * @retval NULL A regex couldn't be compiled
+ *
+ * The threads can't share the regexes: regexec() serialises the callers of
+ * each one.
+ */
+static struct Pattern *pattern_dup(const struct Pattern *pat, struct PatternWorker *worker)
+{
+  struct Pattern *copy = NULL, *tmp = NULL, **tail = &copy;
+
+  for (; pat; pat = pat->next)
+  {
+    tmp = new_pattern();
+    *tmp = *pat;
+    tmp->next = NULL;
+    tmp->child = NULL;
+    tmp->expr = NULL;
+    tmp->literal = safe_strdup(pat->literal);
+    tmp->worker = worker;
+    *tail = tmp;
+    tail = &tmp->next;
+
+    if (pat->stringmatch)
+      tmp->p.str = safe_strdup(pat->p.str);
+    else if (!pat->groupmatch && pat->p.rx)
+    {
+      tmp->p.rx = safe_malloc(sizeof(regex_t));
+      if (REGCOMP(tmp->p.rx, pat->expr, REG_NEWLINE | REG_NOSUB | mutt_which_case(pat->expr)) != 0)
+      {
+        FREE(&tmp->p.rx);
+        mutt_pattern_free(&copy);
+        return NULL;
+      }
+      tmp->expr = safe_strdup(pat->expr);
+    }
+
+    if (pat->child && !(tmp->child = pattern_dup(pat->child, worker)))
+    {
+      mutt_pattern_free(&copy);
+      return NULL;
+    }
+  }
+
+  return copy;
+}
+
+#define PATTERN_RESULTS 8 /**< Patterns whose results are cached, see Header.results_known */
+
+/**
+ * enum PatternStability - How long the result of a pattern holds
+ */
+enum PatternStability
+{
+  PAT_STABLE = 0, /**< Until the message is edited, i.e. replaced */
+  PAT_STATUS,     /**< Until the flags, score or label of the message change */
+  PAT_VOLATILE,   /**< Not long enough to be cached */
+};
+
+/**
+ * struct PatternResult - A pattern whose results are cached
+ */
+struct PatternResult
+{
+  struct Pattern *pat;  /**< Compiled pattern, compared with pattern_equal() */
+  bool thorough;        /**< $thorough_search, when the pattern was matched */
+  unsigned int used;    /**< When the pattern was last used, for the eviction */
+};
+
+/**
+ * struct PatternResults - Cached results of the limits and searches
+ *
+ * Entry i caches whether each message matched in bit i of its
+ * Header.results_matched, if bit i of Header.results_known is set.  The bits
+ * live in the headers so that new, reopened or renumbered messages start
+ * unknown.
+ */
+struct PatternResults
+{
+  struct PatternResult entry[PATTERN_RESULTS];
+  unsigned char status; /**< Entries that mutt_pattern_results_invalidate() clears */
+  unsigned int clock;   /**< Last value of PatternResult.used */
+};
+
+/**
+ * pattern_stability - How long the result of a pattern holds
+ * @param pat Pattern
+ * @retval enum #PatternStability of the least stable part of the pattern
+ *
+ * The thread patterns depend on other messages, ~m on the sort order, the
+ * dates may be relative to now and the lists, alternates, aliases, groups,
+ * attachment counts and crypto status depend on settings or on the message
+ * having been viewed.
+ */
+static enum PatternStability pattern_stability(const struct Pattern *pat)
+{
+  enum PatternStability stability = PAT_STABLE;
+
+  for (; pat; pat = pat->next)
+  {
+    if (pat->isalias || pat->groupmatch)
+      return PAT_VOLATILE;
+
+    switch (pat->op)
+    {
+      case MUTT_AND:
+      case MUTT_OR:
+        stability = MAX(stability, pattern_stability(pat->child));
+        break;
+      case MUTT_ALL:
+      case MUTT_EXPIRED:
+      case MUTT_TO:
+      case MUTT_CC:
+      case MUTT_SUBJECT:
+      case MUTT_FROM:
+      case MUTT_DATE:
+      case MUTT_DATE_RECEIVED:
+      case MUTT_ID:
+      case MUTT_BODY:
+      case MUTT_HEADER:
+      case MUTT_WHOLE_MSG:
+      case MUTT_HORMEL:
+      case MUTT_SENDER:
+      case MUTT_SIZE:
+      case MUTT_REFERENCE:
+      case MUTT_RECIPIENT:
+      case MUTT_ADDRESS:
+#ifdef USE_NNTP
+      case MUTT_NEWSGROUPS:
+#endif
+        break;
+      case MUTT_FLAG:
+      case MUTT_TAG:
+      case MUTT_NEW:
+      case MUTT_UNREAD:
+      case MUTT_REPLIED:
+      case MUTT_OLD:
+      case MUTT_READ:
+      case MUTT_DELETED:
+      case MUTT_SCORE:
+      case MUTT_XLABEL:
+        stability = MAX(stability, PAT_STATUS);
+        break;
+      default:
+        return PAT_VOLATILE;
+    }
+  }
+  return stability;
+}
+
+/**
+ * results_entry - Find the cached results of a pattern
+ * @param ctx Mailbox
+ * @param pat Pattern
+ * @retval num Entry of the pattern in ctx->results
+ * @retval -1  The results of the pattern can't be cached
+ *
+ * A pattern not cached yet takes the least recently used entry, whose bits
+ * are cleared in all the messages.
+ */
+static int results_entry(struct Context *ctx, struct Pattern *pat)
+{
+  enum PatternStability stability = pattern_stability(pat);
+  bool thorough = option(OPT_THOROUGH_SRC);
+  struct PatternResult *e = NULL;
+  int i, old = 0;
+
+  if (stability == PAT_VOLATILE)
+    return -1;
+
+  if (!ctx->results)
+    ctx->results = safe_calloc(1, sizeof(struct PatternResults));
+
+  for (i = 0; i < PATTERN_RESULTS; i++)
+  {
+    e = &ctx->results->entry[i];
+    if (e->pat && (e->thorough == thorough) && pattern_equal(e->pat, pat))
+      break;
+    if (e->used < ctx->results->entry[old].used)
+      old = i;
+  }
+
+  if (i == PATTERN_RESULTS)
+  {
+    i = old;
+    e = &ctx->results->entry[i];
+    if (e->pat)
+    {
+      for (int j = 0; j < ctx->msgcount; j++)
+        ctx->hdrs[j]->results_known &= ~(1 << i);
+      mutt_pattern_free(&e->pat);
+    }
+    if (!(e->pat = pattern_dup(pat, NULL)))
+      return -1;
+    e->thorough = thorough;
+    if (stability == PAT_STATUS)
+      ctx->results->status |= (1 << i);
+    else
+      ctx->results->status &= ~(1 << i);
+  }
+
+  e->used = ++ctx->results->clock;
+  return i;
+}
+
+/**
+ * results_missing - Count the messages whose results aren't cached
+ * @param ctx     Mailbox
+ * @param entry   Entry of the pattern, see results_entry()
+ * @param virtual If true, count the visible messages, otherwise all of them
+ * @param count   Number of messages
+ * @retval num Messages to match
+ */
+static int results_missing(struct Context *ctx, int entry, bool virtual, int count)
+{
+  int missing = 0;
+
+  if (entry < 0)
+    return count;
+
+  for (int i = 0; i < count; i++)
+    if (!(ctx->hdrs[virtual ? ctx->v2r[i] : i]->results_known & (1 << entry)))
+      missing++;
+  return missing;
+}
+
+/**
+ * mutt_pattern_results_invalidate - Forget the results that a message's status changed
+ * @param ctx Mailbox
+ * @param h   Message whose flags, score or label changed
+ */
+void mutt_pattern_results_invalidate(struct Context *ctx, struct Header *h)
+{
+  if (ctx && ctx->results && h)
+    h->results_known &= ~ctx->results->status;
+}
+
+/**
+ * mutt_pattern_results_free - Free the cached results of a mailbox
+ * @param results Cached results, see Context.results
+ *
+ * The bits in the headers are only meaningful with the results; the headers
+ * have to be freed as well.
+ */
+void mutt_pattern_results_free(struct PatternResults **results)
+{
+  if (!*results)
+    return;
+
+  for (int i = 0; i < PATTERN_RESULTS; i++)
+    mutt_pattern_free(&(*results)->entry[i].pat);
+  FREE(results);
+}
+
+/**
+ * pattern_thread_safe - Can a pattern be matched in a worker thread
+ * @param pat   Pattern
+ * @param local If true, the raw messages can be read by worker_search()
+ * @retval true If matching the pattern only reads the messages
+ *
+ * ~X parses the message, and =/ only reports an error.  ~l, ~u, ~p and ~P
+ * match the addresses against lists that log with mutt_debug(), which isn't
+ * thread-safe.  The crypt flags are read from the Header, so ~g, ~G, ~k and
+ * ~V are safe when crypto is built in.
+ */
+static bool pattern_thread_safe(const struct Pattern *pat, bool local)
+{
+  for (; pat; pat = pat->next)
+  {
+    switch (pat->op)
+    {
+      case MUTT_BODY:
+      case MUTT_HEADER:
+      case MUTT_WHOLE_MSG:
+        if (!local)
+          return false;
+        break;
+      case MUTT_MIMEATTACH:   /* parses the message */
+      case MUTT_SERVERSEARCH: /* only reports an error */
+      case MUTT_LIST:         /* the list and user checks log */
+      case MUTT_SUBSCRIBED_LIST:
+      case MUTT_PERSONAL_RECIP:
+      case MUTT_PERSONAL_FROM:
+        return false;
+      case MUTT_CRYPT_SIGN:
+      case MUTT_CRYPT_VERIFIED:
+      case MUTT_CRYPT_ENCRYPT:
+        if (!WithCrypto)
+          return false;
+        break;
+      case MUTT_PGP_KEY:
+        if (!(WithCrypto & APPLICATION_PGP))
+          return false;
+        break;
+    }
+    if (pat->child && !pattern_thread_safe(pat->child, local))
+      return false;
+  }
+  return true;
+}
+
+/**
+ * match_worker - Match the pattern against messages, until the round is done
+ * @param i    Index of the worker
+ * @param data Run, struct PatternRun
+ */
+static void match_worker(int i, void *data)
+{
+  struct PatternRun *run = data;
+  struct PatternWorker *w = &run->workers[i];
+  struct Header *h = NULL;
+  int first, last;
+
+  while ((first = __atomic_fetch_add(&run->next, PATTERN_CHUNK, __ATOMIC_RELAXED)) < run->end)
+  {
+    last = MIN(first + PATTERN_CHUNK, run->end);
+    for (int j = first; j < last; j++)
+    {
+      h = run->ctx->hdrs[run->virtual ? run->ctx->v2r[j] : j];
+      if ((run->results >= 0) && (h->results_known & (1 << run->results)))
+      {
+        run->result[j] = (h->results_matched & (1 << run->results)) ? PAT_MATCH : PAT_NO_MATCH;
+        continue;
+      }
+      w->retry = false;
+      if (mutt_pattern_exec(w->pat, MUTT_MATCH_FULL_ADDRESS, run->ctx, h, NULL))
+        run->result[j] = w->retry ? PAT_RETRY : PAT_MATCH;
+      else
+        run->result[j] = w->retry ? PAT_RETRY : PAT_NO_MATCH;
+    }
+  }
+}
+
+/**
+ * match_parallel - Match a pattern against many messages, using threads
+ * @param ctx      Mailbox
+ * @param pat      Pattern
+ * @param results  Entry of the pattern in ctx->results, or -1
+ * @param virtual  If true, match the visible messages, otherwise all of them
+ * @param count    Number of messages
+ * @param progress Progress bar, updated after each round
+ * @retval ptr  PAT_MATCH, PAT_NO_MATCH or PAT_RETRY for each message
+ * @retval NULL The pattern has to be matched by the main thread
+ *
+ * The workers only read the messages; the caller acts on the results.  The
+ * messages whose results are cached aren't matched again.
+ */
+static unsigned char *match_parallel(struct Context *ctx, struct Pattern *pat, int results,
+                                     bool virtual, int count, struct Progress *progress)
+{
+  int threads = mutt_workers_count(WorkerThreads);
+  bool mbox = (ctx->mx_ops == &mx_mbox_ops) || (ctx->mx_ops == &mx_mmdf_ops);
+  bool local = !option(OPT_THOROUGH_SRC) &&
+               (mbox || (ctx->mx_ops == &mx_maildir_ops) || (ctx->mx_ops == &mx_mh_ops));
+  enum PatternCost cost = pattern_cost(pat);
+  struct PatternRun run;
+  int i, missing;
+
+  if ((threads < 2) || (count <= PATTERN_CHUNK) || (cost == PAT_COST_FLAG) ||
+      !pattern_thread_safe(pat, local))
+    return NULL;
+
+  missing = results_missing(ctx, results, virtual, count);
+  if ((missing <= PATTERN_CHUNK) ||
+      ((cost == PAT_COST_ENVELOPE) && (missing < PATTERN_PARALLEL_MIN)))
+    return NULL;
+
+  memset(&run, 0, sizeof(run));
+  run.ctx = ctx;
+  run.virtual = virtual;
+  run.results = results;
+  run.workers = safe_calloc(threads, sizeof(struct PatternWorker));
+  for (i = 0; i < threads; i++)
+  {
+    if (!(run.workers[i].pat = pattern_dup(pat, &run.workers[i])))
+      break;
+    if (local && mbox && !(run.workers[i].fp = fopen(ctx->path, "r")))
+      break;
+  }
+
+  if (i == threads)
+  {
+    run.result = safe_malloc(count);
+    while (run.next < count)
+    {
+      run.end = MIN(run.next + PATTERN_ROUND * threads, count);
+      mutt_workers_run(threads, threads, match_worker, &run);
+      run.next = run.end;
+      mutt_progress_update(progress, run.end, -1);
+    }
+  }
+  else
+    mutt_debug(1, "match_parallel: can't set up the workers\n");
+
+  for (i = 0; i < threads; i++)
+  {
+    mutt_pattern_free(&run.workers[i].pat);
+    safe_fclose(&run.workers[i].fp);
+  }
+  FREE(&run.workers);
+  return run.result;
+}
+
+#ifdef USE_HCACHE
+/**
+ * pattern_prune - Find the messages the text patterns can match, in the index
+ * @param pat Pattern
+ *
+ * Each ~b, ~B or ~h pattern gets the messages which may contain its text, see
+ * msg_search().
+ */
+static void pattern_prune(struct Pattern *pat)
+{
+  struct ListHead literals = STAILQ_HEAD_INITIALIZER(literals);
+
+  for (; pat; pat = pat->next)
+  {
+    if ((pat->op == MUTT_BODY) || (pat->op == MUTT_HEADER) || (pat->op == MUTT_WHOLE_MSG))
+    {
+      pattern_literals(pat, &literals);
+      pat->candidates = mutt_tindex_query(SearchIndex, &literals, pattern_icase(pat));
+      mutt_list_free(&literals);
+    }
+    if (pat->child)
+      pattern_prune(pat->child);
+  }
+}
+
+/**
+ * pattern_unprune - Free the results of pattern_prune()
+ * @param pat Pattern
+ */
+static void pattern_unprune(struct Pattern *pat)
+{
+  for (; pat; pat = pat->next)
+  {
+    FREE(&pat->candidates);
+    if (pat->child)
+      pattern_unprune(pat->child);
+  }
+}
+#endif
+
+#ifdef USE_IMAP
+/**
+ * match_server - Take the results of a search on the IMAP server
+ * @param ctx     Mailbox
+ * @param server  What the server found, enum #ImapSearch
+ * @param virtual If true, the visible messages, otherwise all of them
+ * @param count   Number of messages
+ * @retval ptr PAT_MATCH, PAT_NO_MATCH or PAT_RETRY for each message
+ */
+static unsigned char *match_server(struct Context *ctx, int server, bool virtual, int count)
+{
+  unsigned char *matches = safe_malloc(count);
+  struct Header *h = NULL;
+
+  for (int i = 0; i < count; i++)
+  {
+    h = ctx->hdrs[virtual ? ctx->v2r[i] : i];
+    if (!h->matched)
+      matches[i] = PAT_NO_MATCH;
+    else
+      matches[i] = (server == IMAP_SEARCH_ALL) ? PAT_MATCH : PAT_RETRY;
+  }
+  return matches;
+}
+#endif
+
+/**
+ * match_one - Did a message match a pattern
+ * @param pat     Pattern
+ * @param results Entry of the pattern in Context->results, or -1
+ * @param h       Message
+ * @param matches Results of match_parallel(), or NULL
+ * @param i       Index of the message in @a matches
+ * @retval 1 The message matched
+ * @retval 0 Otherwise
+ *
+ * The result is taken from, or else stored in, the cache of the results,
+ * unless the message couldn't be read.
+ */
+static int match_one(struct Pattern *pat, int results, struct Header *h,
+                     const unsigned char *matches, int i)
+{
+  int rc;
+
+  if ((results >= 0) && (h->results_known & (1 << results)))
+    return (h->results_matched & (1 << results)) ? 1 : 0;
+
+  if (matches && (matches[i] != PAT_RETRY))
+    rc = (matches[i] == PAT_MATCH);
+  else
+  {
+    /* A message that couldn't be read is matched again next time */
+    SearchFailed = false;
+    rc = (mutt_pattern_exec(pat, MUTT_MATCH_FULL_ADDRESS, Context, h, NULL) > 0);
+    if (SearchFailed)
+      results = -1;
+  }
+
+  if (results >= 0)
+  {
+    h->results_known |= (1 << results);
+    if (rc)
+      h->results_matched |= (1 << results);
+    else
+      h->results_matched &= ~(1 << results);
+  }
+  return rc;
+}
+
 int mutt_pattern_func(int op, char *prompt)
 {
   struct Pattern *pat = NULL;
   char buf[LONG_STRING] = "", *simple = NULL;
   struct Buffer err;
   struct Progress progress;
+  struct timeval start, end;
+  unsigned char *matches = NULL;
+  int results;
+#ifdef USE_IMAP
+  int server = IMAP_SEARCH_TEXT;
+#endif
 
   strfcpy(buf, NONULL(Context->pattern), sizeof(buf));
   if (prompt || op != MUTT_LIMIT)
@@ -1906,8 +3261,14 @@ int mutt_pattern_func(int op, char *prompt)
     return -1;
   }
 
+  results = results_entry(Context, pat);
+
 #ifdef USE_IMAP
-  if (Context->magic == MUTT_IMAP && imap_search(Context, pat) < 0)
+  /* the server isn't asked again for the messages whose results are cached */
+  if (Context->magic == MUTT_IMAP &&
+      results_missing(Context, results, (op != MUTT_LIMIT),
+                      (op == MUTT_LIMIT) ? Context->msgcount : Context->vcount) &&
+      (server = imap_search(Context, pat)) < 0)
     return -1;
 #endif
 
@@ -1917,6 +3278,15 @@ int mutt_pattern_func(int op, char *prompt)
 
 #define THIS_BODY Context->hdrs[i]->content
 
+  gettimeofday(&start, NULL);
+
+#ifdef USE_HCACHE
+  if (pattern_cost(pat) >= PAT_COST_HEADER)
+    SearchIndex = mutt_tindex_open(Context);
+  if (SearchIndex)
+    pattern_prune(pat);
+#endif
+
   if (op == MUTT_LIMIT)
   {
     Context->vcount = 0;
@@ -1925,13 +3295,24 @@ int mutt_pattern_func(int op, char *prompt)
 
     for (int i = 0; i < Context->msgcount; i++)
     {
-      mutt_progress_update(&progress, i, -1);
       /* new limit pattern implicitly uncollapses all threads */
       Context->hdrs[i]->virtual = -1;
       Context->hdrs[i]->limited = false;
       Context->hdrs[i]->collapsed = false;
       Context->hdrs[i]->num_hidden = 0;
-      if (mutt_pattern_exec(pat, MUTT_MATCH_FULL_ADDRESS, Context, Context->hdrs[i], NULL))
+    }
+
+#ifdef USE_IMAP
+    if (server != IMAP_SEARCH_TEXT)
+      matches = match_server(Context, server, false, Context->msgcount);
+    else
+#endif
+      matches = match_parallel(Context, pat, results, false, Context->msgcount, &progress);
+    for (int i = 0; i < Context->msgcount; i++)
+    {
+      if (!matches)
+        mutt_progress_update(&progress, i, -1);
+      if (match_one(pat, results, Context->hdrs[i], matches, i))
       {
         Context->hdrs[i]->virtual = Context->vcount;
         Context->hdrs[i]->limited = true;
@@ -1943,11 +3324,17 @@ int mutt_pattern_func(int op, char *prompt)
   }
   else
   {
+#ifdef USE_IMAP
+    if (server != IMAP_SEARCH_TEXT)
+      matches = match_server(Context, server, true, Context->vcount);
+    else
+#endif
+      matches = match_parallel(Context, pat, results, true, Context->vcount, &progress);
     for (int i = 0; i < Context->vcount; i++)
     {
-      mutt_progress_update(&progress, i, -1);
-      if (mutt_pattern_exec(pat, MUTT_MATCH_FULL_ADDRESS, Context,
-                            Context->hdrs[Context->v2r[i]], NULL))
+      if (!matches)
+        mutt_progress_update(&progress, i, -1);
+      if (match_one(pat, results, Context->hdrs[Context->v2r[i]], matches, i))
       {
         switch (op)
         {
@@ -1969,6 +3356,15 @@ int mutt_pattern_func(int op, char *prompt)
 
 #undef THIS_BODY
 
+#ifdef USE_HCACHE
+  pattern_unprune(pat);
+  mutt_tindex_close(&SearchIndex);
+#endif
+  FREE(&matches);
+  gettimeofday(&end, NULL);
+  mutt_debug(2, "mutt_pattern_func: '%s' matched in %ld us\n", buf,
+             (long) ((end.tv_sec - start.tv_sec) * 1000000 + (end.tv_usec - start.tv_usec)));
+
   mutt_clear_error();
 
   if (op == MUTT_LIMIT)
@@ -2001,7 +3397,7 @@ int mutt_search_command(int cur, int op)
   int i, j;
   char buf[STRING];
   char temp[LONG_STRING];
-  int incr;
+  int incr, results;
   struct Header *h = NULL;
   struct Progress progress;
   const char *msg = NULL;
@@ -2047,13 +3443,27 @@ int mutt_search_command(int cur, int op)
     }
   }
 
+  results = results_entry(Context, SearchPattern);
+
   if (option(OPT_SEARCH_INVALID))
   {
     for (i = 0; i < Context->msgcount; i++)
       Context->hdrs[i]->searched = false;
 #ifdef USE_IMAP
-    if (Context->magic == MUTT_IMAP && imap_search(Context, SearchPattern) < 0)
-      return -1;
+    if (Context->magic == MUTT_IMAP && results_missing(Context, results, true, Context->vcount))
+    {
+      int server = imap_search(Context, SearchPattern);
+      if (server < 0)
+        return -1;
+
+      /* the messages the server decided on needn't be searched */
+      for (i = 0; i < Context->msgcount; i++)
+      {
+        h = Context->hdrs[i];
+        if ((server == IMAP_SEARCH_ALL) || ((server == IMAP_SEARCH_CANDIDATES) && !h->matched))
+          h->searched = true;
+      }
+    }
 #endif
     unset_option(OPT_SEARCH_INVALID);
   }
@@ -2107,8 +3517,7 @@ int mutt_search_command(int cur, int op)
     {
       /* remember that we've already searched this message */
       h->searched = true;
-      if ((h->matched = (mutt_pattern_exec(SearchPattern, MUTT_MATCH_FULL_ADDRESS,
-                                           Context, h, NULL) > 0)))
+      if ((h->matched = match_one(SearchPattern, results, h, NULL, 0)))
       {
         mutt_clear_error();
         if (msg && *msg)
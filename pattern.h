@@ -32,6 +32,8 @@ struct Address;
 struct Buffer;
 struct Header;
 struct Context;
+struct PatternResults;
+struct PatternWorker;
 
 /**
  * struct Pattern - A simple (non-regex) pattern
@@ -54,6 +56,10 @@ struct Pattern
     struct Group *g;
     char *str;
   } p;
+  char *expr; /**< text of the regex, to compare patterns */
+  char *literal; /**< longest text the matches contain, see set_literal() */
+  struct PatternWorker *worker; /**< thread matching this copy of the pattern */
+  unsigned char *candidates; /**< messages the text index can't rule out, see mutt_tindex_query() */
 };
 
 /**
@@ -100,6 +106,8 @@ int mutt_is_list_recipient(int alladdr, struct Address *a1, struct Address *a2);
 int mutt_is_list_cc(int alladdr, struct Address *a1, struct Address *a2);
 int mutt_pattern_func(int op, char *prompt);
 int mutt_search_command(int cur, int op);
+void mutt_pattern_results_invalidate(struct Context *ctx, struct Header *h);
+void mutt_pattern_results_free(struct PatternResults **results);
 
 bool mutt_limit_current_thread(struct Header *h);
 
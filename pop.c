@@ -969,6 +969,50 @@ fail:
   FREE(&pop_data);
 }
 
+#ifdef USE_HCACHE
+/**
+ * pop_hcache_keep - Is a header cache record still in use? - Implements ::hcache_keep_t
+ */
+static bool pop_hcache_keep(const char *key, size_t keylen, void *data)
+{
+  struct Hash *uidls = data;
+  char *uidl = mutt_substrdup(key, key + keylen);
+  bool keep = hash_find(uidls, uidl) != NULL;
+
+  FREE(&uidl);
+  return keep;
+}
+
+/**
+ * pop_hcache_compact - Remove stale header cache records - Implements MxOps::hcache_compact
+ */
+static int pop_hcache_compact(struct Context *ctx, bool force, LOFF_T *reclaimed)
+{
+  struct PopData *pop_data = (struct PopData *) ctx->data;
+  header_cache_t *hc = NULL;
+  struct Hash *uidls = NULL;
+  int rc;
+
+  if (!pop_data)
+    return -1;
+
+  hc = pop_hcache_open(pop_data, ctx->path);
+  if (!hc)
+    return -1;
+
+  uidls = hash_create(MAX(ctx->msgcount, 32), 0);
+  for (int i = 0; i < ctx->msgcount; i++)
+    if (ctx->hdrs[i]->data)
+      hash_insert(uidls, ctx->hdrs[i]->data, ctx->hdrs[i]);
+
+  rc = mutt_hcache_compact(hc, pop_hcache_keep, uidls, force, reclaimed);
+
+  hash_destroy(&uidls, NULL);
+  mutt_hcache_close(hc);
+  return rc;
+}
+#endif
+
 struct MxOps mx_pop_ops = {
   .open = pop_open_mailbox,
   .open_append = NULL,
@@ -979,4 +1023,7 @@ struct MxOps mx_pop_ops = {
   .commit_msg = NULL,
   .open_new_msg = NULL,
   .sync = pop_sync_mailbox,
+#ifdef USE_HCACHE
+  .hcache_compact = pop_hcache_compact,
+#endif
 };
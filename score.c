@@ -144,6 +144,7 @@ void mutt_score_message(struct Context *ctx, struct Header *hdr, int upd_ctx)
 {
   struct Score *tmp = NULL;
   struct PatternCache cache;
+  int old_score = hdr->score;
 
   memset(&cache, 0, sizeof(cache));
   hdr->score = 0; /* in case of re-scoring */
@@ -161,6 +162,8 @@ void mutt_score_message(struct Context *ctx, struct Header *hdr, int upd_ctx)
   }
   if (hdr->score < 0)
     hdr->score = 0;
+  if (hdr->score != old_score)
+    mutt_pattern_results_invalidate(ctx, hdr);
 
   if (hdr->score <= ScoreThresholdDelete)
     _mutt_set_flag(ctx, hdr, MUTT_DELETE, 1, upd_ctx);
@@ -21,8 +21,12 @@
  */
 
 #include "config.h"
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/time.h>
 #include "mutt.h"
 #include "sort.h"
 #include "address.h"
@@ -296,6 +300,373 @@ sort_t *mutt_get_sort_func(int method)
   /* not reached */
 }
 
+/* Below this many messages, sorting isn't worth starting threads */
+#define SORT_PARALLEL_MIN 8192
+/* Runs this short are sorted by insertion before merging */
+#define SORT_RUN 16
+
+/**
+ * struct SortKey - Precomputed sort key of a message
+ *
+ * Keys are extracted once per message, so that comparing two messages doesn't
+ * have to look up names or fold the case of strings again.  Most comparisons
+ * are decided by the fixed-width prefixes; the strings are only compared when
+ * their first eight bytes are equal.
+ */
+struct SortKey
+{
+  uint64_t prefix[2];    /**< $sort and $sort_aux keys: a number, or the start of a string */
+  size_t str[2];         /**< Offset of the casefolded string in the pool, or SORT_NO_STR */
+  unsigned char rank[2]; /**< Compared before the prefix, e.g. messages without a label */
+  struct Header *h;      /**< Message */
+};
+
+#define SORT_NO_STR ((size_t) -1)
+
+/**
+ * struct SortKeys - The sort keys of a mailbox
+ */
+struct SortKeys
+{
+  struct SortKey *keys; /**< One key per message */
+  struct SortKey *tmp;  /**< Scratch space for merging */
+  size_t count;         /**< Number of keys */
+  char *pool;           /**< Casefolded strings */
+  size_t pool_len;      /**< Length of the pool */
+  size_t pool_max;      /**< Size of the pool */
+  int nkeys;            /**< Number of keys to compare: 1, or 2 with $sort_aux */
+  bool reverse;         /**< $sort is reversed */
+  size_t width;         /**< Length of the sorted runs being merged */
+};
+
+/**
+ * sort_key_supported - Can a sort method use precomputed keys?
+ * @param method Sort method, e.g. #SORT_DATE
+ * @retval true if it can
+ *
+ * Spam scores mix numeric and lexical comparisons, so they keep using
+ * compare_spam().
+ */
+static bool sort_key_supported(int method)
+{
+  switch (method & SORT_MASK)
+  {
+    case SORT_DATE:
+    case SORT_RECEIVED:
+    case SORT_SIZE:
+    case SORT_SCORE:
+    case SORT_ORDER:
+    case SORT_SUBJECT:
+    case SORT_FROM:
+    case SORT_TO:
+    case SORT_LABEL:
+      return true;
+    default:
+      return false;
+  }
+}
+
+/**
+ * sort_key_num - Turn a signed number into an unsigned key
+ * @param v Number
+ * @retval num Key, in the same order as the numbers
+ */
+static uint64_t sort_key_num(int64_t v)
+{
+  return (uint64_t) v ^ ((uint64_t) 1 << 63);
+}
+
+/**
+ * sort_key_string - Set a string key
+ * @param sk     Sort keys
+ * @param key    Key to set
+ * @param k      0 for $sort, 1 for $sort_aux
+ * @param s      String
+ * @param maxlen Compare at most this many characters
+ *
+ * The string is casefolded into the pool, and its first eight bytes are
+ * stored big-endian in the prefix, so that comparing the prefixes as numbers
+ * orders them like strcmp().
+ */
+static void sort_key_string(struct SortKeys *sk, struct SortKey *key, int k,
+                            const char *s, size_t maxlen)
+{
+  size_t len = mutt_strlen(s);
+  if (len > maxlen)
+    len = maxlen;
+
+  if (sk->pool_len + len + 1 > sk->pool_max)
+  {
+    sk->pool_max = MAX(2 * sk->pool_max, sk->pool_len + len + 1 + 4096);
+    safe_realloc(&sk->pool, sk->pool_max);
+  }
+
+  char *d = sk->pool + sk->pool_len;
+  for (size_t i = 0; i < len; i++)
+    d[i] = tolower((unsigned char) s[i]);
+  d[len] = '\0';
+
+  key->prefix[k] = 0;
+  for (size_t i = 0; i < 8; i++)
+    key->prefix[k] = (key->prefix[k] << 8) | ((i < len) ? (unsigned char) d[i] : 0);
+
+  key->str[k] = sk->pool_len;
+  sk->pool_len += len + 1;
+}
+
+/**
+ * sort_key_extract - Compute the key of a message for one sort method
+ * @param sk     Sort keys
+ * @param ctx    Mailbox
+ * @param key    Key to set
+ * @param k      0 for $sort, 1 for $sort_aux
+ * @param method Sort method, e.g. #SORT_FROM
+ *
+ * The keys order the messages like the compare_*() functions.
+ */
+static void sort_key_extract(struct SortKeys *sk, struct Context *ctx,
+                             struct SortKey *key, int k, int method)
+{
+  struct Header *h = key->h;
+
+  key->str[k] = SORT_NO_STR;
+  key->rank[k] = 0;
+  key->prefix[k] = 0;
+
+  switch (method & SORT_MASK)
+  {
+    case SORT_DATE:
+      key->prefix[k] = sort_key_num(h->date_sent);
+      break;
+    case SORT_RECEIVED:
+      key->prefix[k] = sort_key_num(h->received);
+      break;
+    case SORT_SIZE:
+      key->prefix[k] = sort_key_num(h->content->length);
+      break;
+    case SORT_SCORE:
+      /* the highest scores come first */
+      key->prefix[k] = sort_key_num(-(int64_t) h->score);
+      break;
+    case SORT_ORDER:
+#ifdef USE_NNTP
+      if (ctx->magic == MUTT_NNTP)
+      {
+        key->prefix[k] = NHDR(h)->article_num;
+        break;
+      }
+#endif
+      key->prefix[k] = sort_key_num(h->index);
+      break;
+    case SORT_SUBJECT:
+      /* messages without a subject come first, by date; compare_subject()
+       * applies the reversal of $sort to their dates once more */
+      if (h->env->real_subj)
+      {
+        key->rank[k] = 1;
+        sort_key_string(sk, key, k, h->env->real_subj, SIZE_MAX);
+      }
+      else if (sk->reverse)
+        key->prefix[k] = sort_key_num(-(int64_t) h->date_sent);
+      else
+        key->prefix[k] = sort_key_num(h->date_sent);
+      break;
+    case SORT_FROM:
+      sort_key_string(sk, key, k, mutt_get_name(h->env->from), SHORT_STRING - 1);
+      break;
+    case SORT_TO:
+      sort_key_string(sk, key, k, mutt_get_name(h->env->to), SHORT_STRING - 1);
+      break;
+    case SORT_LABEL:
+      /* messages with a label come first */
+      if (h->env && h->env->x_label && *h->env->x_label)
+        sort_key_string(sk, key, k, h->env->x_label, SIZE_MAX);
+      else
+        key->rank[k] = 1;
+      break;
+  }
+}
+
+/**
+ * sort_key_cmp - Compare two sort keys
+ * @param sk Sort keys
+ * @param a  First key
+ * @param b  Second key
+ * @retval <0 @a a sorts before @a b
+ * @retval >0 @a a sorts after @a b
+ *
+ * Like the AUXSORT() chain: $sort (possibly reversed), then $sort_aux, then
+ * the order of the messages in the mailbox.
+ */
+static int sort_key_cmp(const struct SortKeys *sk, const struct SortKey *a,
+                        const struct SortKey *b)
+{
+  for (int k = 0; k < sk->nkeys; k++)
+  {
+    int rc = 0;
+
+    if (a->rank[k] != b->rank[k])
+      rc = (a->rank[k] < b->rank[k]) ? -1 : 1;
+    else if (a->prefix[k] != b->prefix[k])
+      rc = (a->prefix[k] < b->prefix[k]) ? -1 : 1;
+    else if ((a->str[k] != SORT_NO_STR) && (b->str[k] != SORT_NO_STR))
+      rc = strcmp(sk->pool + a->str[k], sk->pool + b->str[k]);
+
+    if (rc != 0)
+      return ((k == 0) && sk->reverse) ? -rc : rc;
+  }
+
+  return a->h->index - b->h->index;
+}
+
+/**
+ * sort_keys_merge - Merge two sorted runs
+ * @param sk  Sort keys
+ * @param src Source array
+ * @param dst Destination array
+ * @param lo  Start of the first run
+ * @param mid Start of the second run
+ * @param hi  End of the second run
+ */
+static void sort_keys_merge(const struct SortKeys *sk, const struct SortKey *src,
+                            struct SortKey *dst, size_t lo, size_t mid, size_t hi)
+{
+  size_t i = lo, j = mid, o = lo;
+
+  while ((i < mid) && (j < hi))
+  {
+    if (sort_key_cmp(sk, &src[j], &src[i]) < 0)
+      dst[o++] = src[j++];
+    else
+      dst[o++] = src[i++];
+  }
+  memcpy(dst + o, src + i, (mid - i) * sizeof(struct SortKey));
+  o += mid - i;
+  memcpy(dst + o, src + j, (hi - j) * sizeof(struct SortKey));
+}
+
+/**
+ * sort_keys_range - Sort a range of keys
+ * @param sk Sort keys
+ * @param lo Start of the range
+ * @param hi End of the range
+ *
+ * Bottom-up merge sort of sk->keys[lo..hi), using the same range of sk->tmp.
+ * The result is left in sk->keys.
+ */
+static void sort_keys_range(const struct SortKeys *sk, size_t lo, size_t hi)
+{
+  struct SortKey *src = sk->keys, *dst = sk->tmp;
+
+  for (size_t r = lo; r < hi; r += SORT_RUN)
+  {
+    size_t end = MIN(r + SORT_RUN, hi);
+    for (size_t i = r + 1; i < end; i++)
+    {
+      struct SortKey key = src[i];
+      size_t j = i;
+      for (; (j > r) && (sort_key_cmp(sk, &key, &src[j - 1]) < 0); j--)
+        src[j] = src[j - 1];
+      src[j] = key;
+    }
+  }
+
+  for (size_t w = SORT_RUN; w < hi - lo; w *= 2)
+  {
+    for (size_t i = lo; i < hi; i += 2 * w)
+      sort_keys_merge(sk, src, dst, i, MIN(i + w, hi), MIN(i + 2 * w, hi));
+
+    struct SortKey *t = src;
+    src = dst;
+    dst = t;
+  }
+
+  if (src != sk->keys)
+    memcpy(sk->keys + lo, src + lo, (hi - lo) * sizeof(struct SortKey));
+}
+
+/**
+ * sort_keys_chunk - Sort one chunk of the keys - Implements ::worker_fn_t
+ */
+static void sort_keys_chunk(int i, void *data)
+{
+  struct SortKeys *sk = data;
+  size_t lo = i * sk->width;
+
+  sort_keys_range(sk, lo, MIN(lo + sk->width, sk->count));
+}
+
+/**
+ * sort_keys_merge_pair - Merge two sorted chunks - Implements ::worker_fn_t
+ *
+ * The chunks are merged from sk->keys into sk->tmp.
+ */
+static void sort_keys_merge_pair(int i, void *data)
+{
+  struct SortKeys *sk = data;
+  size_t lo = i * 2 * sk->width;
+
+  sort_keys_merge(sk, sk->keys, sk->tmp, lo, MIN(lo + sk->width, sk->count),
+                  MIN(lo + 2 * sk->width, sk->count));
+}
+
+/**
+ * sort_keys - Sort the messages of a mailbox using precomputed keys
+ * @param ctx Mailbox
+ *
+ * The keys are extracted once per message, sorted by a stable merge sort
+ * (in parallel for large mailboxes, see $worker_threads), then the sorted
+ * order is applied to ctx->hdrs.
+ */
+static void sort_keys(struct Context *ctx)
+{
+  struct SortKeys sk;
+  int threads = mutt_workers_count(WorkerThreads);
+
+  memset(&sk, 0, sizeof(sk));
+  sk.count = ctx->msgcount;
+  sk.keys = safe_malloc(sk.count * sizeof(struct SortKey));
+  sk.tmp = safe_malloc(sk.count * sizeof(struct SortKey));
+  sk.reverse = (Sort & SORT_REVERSE);
+  sk.nkeys = ((SortAux & SORT_MASK) == (Sort & SORT_MASK)) ? 1 : 2;
+
+  /* mutt_get_name() isn't reentrant: extract the keys here */
+  for (size_t i = 0; i < sk.count; i++)
+  {
+    sk.keys[i].h = ctx->hdrs[i];
+    sort_key_extract(&sk, ctx, &sk.keys[i], 0, Sort);
+    if (sk.nkeys > 1)
+      sort_key_extract(&sk, ctx, &sk.keys[i], 1, SortAux);
+  }
+
+  if ((threads < 2) || (sk.count < SORT_PARALLEL_MIN))
+    sort_keys_range(&sk, 0, sk.count);
+  else
+  {
+    /* sort one chunk per thread, then merge the chunks pairwise */
+    sk.width = (sk.count + threads - 1) / threads;
+    int chunks = (sk.count + sk.width - 1) / sk.width;
+    mutt_workers_run(threads, chunks, sort_keys_chunk, &sk);
+
+    for (; sk.width < sk.count; sk.width *= 2)
+    {
+      int pairs = (sk.count + 2 * sk.width - 1) / (2 * sk.width);
+      mutt_workers_run(threads, pairs, sort_keys_merge_pair, &sk);
+
+      struct SortKey *t = sk.keys;
+      sk.keys = sk.tmp;
+      sk.tmp = t;
+    }
+  }
+
+  for (size_t i = 0; i < sk.count; i++)
+    ctx->hdrs[i] = sk.keys[i].h;
+
+  FREE(&sk.keys);
+  FREE(&sk.tmp);
+  FREE(&sk.pool);
+}
+
 void mutt_sort_headers(struct Context *ctx, int init)
 {
   int i;
@@ -362,7 +733,21 @@ void mutt_sort_headers(struct Context *ctx, int init)
     return;
   }
   else
-    qsort((void *) ctx->hdrs, ctx->msgcount, sizeof(struct Header *), sortfunc);
+  {
+    struct timeval start, end;
+    gettimeofday(&start, NULL);
+
+    if (sort_key_supported(Sort) && sort_key_supported(SortAux))
+      sort_keys(ctx);
+    else
+      qsort((void *) ctx->hdrs, ctx->msgcount, sizeof(struct Header *), sortfunc);
+
+    gettimeofday(&end, NULL);
+    mutt_debug(2, "mutt_sort_headers: %d messages sorted by %s/%s in %ld us\n",
+               ctx->msgcount, NONULL(mutt_getnamebyvalue(Sort & SORT_MASK, SortMethods)),
+               NONULL(mutt_getnamebyvalue(SortAux & SORT_MASK, SortMethods)),
+               (long) ((end.tv_sec - start.tv_sec) * 1000000 + (end.tv_usec - start.tv_usec)));
+  }
 
   /* adjust the virtual message numbers */
   ctx->vcount = 0;
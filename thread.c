@@ -139,31 +139,24 @@ static void linearize_tree(struct Context *ctx)
  * this calculates whether a node is the root of a subtree that has visible
  * nodes, whether a node itself is visible, whether, if invisible, it has
  * depth anyway, and whether any of its later siblings are roots of visible
- * subtrees.  while it's at it, it frees the old thread display, so we can
- * skip parts of the tree in mutt_draw_tree() if we've decided here that we
- * don't care about them any more.
+ * subtrees.  mutt_thread_tree() draws the tree of a message from these flags
+ * alone.
  */
-static void calculate_visibility(struct Context *ctx, int *max_depth)
+static void calculate_visibility(struct Context *ctx, struct MuttThread *top)
 {
-  struct MuttThread *tmp = NULL, *tree = ctx->tree;
+  struct MuttThread *tmp = NULL, *tree = top;
   int hide_top_missing = option(OPT_HIDE_TOP_MISSING) && !option(OPT_HIDE_MISSING);
   int hide_top_limited = option(OPT_HIDE_TOP_LIMITED) && !option(OPT_HIDE_LIMITED);
-  int depth = 0;
 
   /* we walk each level backwards to make it easier to compute next_subtree_visible */
   while (tree->next)
     tree = tree->next;
-  *max_depth = 0;
 
   while (true)
   {
-    if (depth > *max_depth)
-      *max_depth = depth;
-
     tree->subtree_visible = 0;
     if (tree->message)
     {
-      FREE(&tree->message->tree);
       if (VISIBLE(tree->message, ctx))
       {
         tree->deep = true;
@@ -196,7 +189,6 @@ static void calculate_visibility(struct Context *ctx, int *max_depth)
         tree->next && (tree->next->next_subtree_visible || tree->next->subtree_visible);
     if (tree->child)
     {
-      depth++;
       tree = tree->child;
       while (tree->next)
         tree = tree->next;
@@ -206,10 +198,7 @@ static void calculate_visibility(struct Context *ctx, int *max_depth)
     else
     {
       while (tree && !tree->prev)
-      {
-        depth--;
         tree = tree->parent;
-      }
       if (!tree)
         break;
       else
@@ -220,7 +209,7 @@ static void calculate_visibility(struct Context *ctx, int *max_depth)
   /* now fix up for the OPTHIDETOP* options if necessary */
   if (hide_top_limited || hide_top_missing)
   {
-    tree = ctx->tree;
+    tree = top;
     while (true)
     {
       if (!tree->visible && tree->deep && tree->subtree_visible < 2 &&
@@ -244,7 +233,99 @@ static void calculate_visibility(struct Context *ctx, int *max_depth)
 }
 
 /**
- * mutt_draw_tree - Draw a tree of threaded emails
+ * struct TreeCache - Thread tree of an index row
+ */
+struct TreeCache
+{
+  const struct Header *hdr; /**< Message the tree belongs to */
+  unsigned int gen;         /**< TreeGeneration the tree was drawn in */
+  char *tree;               /**< Tree characters */
+  size_t size;              /**< Allocated size of tree */
+};
+
+#define TREE_CACHE_SIZE 128
+
+/* Only the rows on screen are ever drawn, so a small cache indexed by the row
+ * number keeps them all.  Changing the visibility of the nodes starts a new
+ * generation, which makes all the cached trees stale at once. */
+static struct TreeCache TreeCache[TREE_CACHE_SIZE];
+static unsigned int TreeGeneration;
+
+/**
+ * mutt_draw_tree - Prepare the thread trees of a mailbox for drawing
+ * @param ctx Mailbox
+ *
+ * The tree of each message is drawn on demand by mutt_thread_tree().
+ */
+void mutt_draw_tree(struct Context *ctx)
+{
+  calculate_visibility(ctx, ctx->tree);
+  TreeGeneration++;
+}
+
+/**
+ * draw_thread - Prepare the tree of one thread for drawing
+ * @param ctx  Mailbox
+ * @param root Top of the thread
+ *
+ * The trees of the threads are independent: the thread is done on its own,
+ * as if it was the only one.
+ */
+static void draw_thread(struct Context *ctx, struct MuttThread *root)
+{
+  struct MuttThread *prev = root->prev, *next = root->next;
+
+  root->prev = NULL;
+  root->next = NULL;
+  calculate_visibility(ctx, root);
+  root->prev = prev;
+  root->next = next;
+  TreeGeneration++;
+}
+
+/**
+ * prev_subtree_visible - Has a node an earlier sibling with visible messages
+ * @param tree Thread node
+ * @retval true If one of the earlier siblings is drawn
+ */
+static bool prev_subtree_visible(const struct MuttThread *tree)
+{
+  for (tree = tree->prev; tree; tree = tree->prev)
+    if (tree->subtree_visible)
+      return true;
+  return false;
+}
+
+/**
+ * tree_node_flags - How is a node connected to its column
+ * @param[in]  tree     Deep thread node
+ * @param[out] nextdisp Set if more messages are drawn below, in the same column
+ * @param[out] pseudo   Set if the node hangs off its parent by subject only
+ *
+ * The node shares its column with the ancestors that aren't deep, up to the
+ * node drawn before it.
+ */
+static void tree_node_flags(const struct MuttThread *tree, bool *nextdisp, bool *pseudo)
+{
+  *nextdisp = false;
+  *pseudo = false;
+  while (true)
+  {
+    if (tree->next_subtree_visible)
+      *nextdisp = true;
+    if (tree->fake_thread)
+      *pseudo = true;
+    if (!tree->parent || tree->parent->deep || prev_subtree_visible(tree))
+      break;
+    tree = tree->parent;
+  }
+}
+
+/**
+ * mutt_thread_tree - Draw the thread tree of a message
+ * @param hdr Message
+ * @retval ptr  Tree characters, valid until the next call
+ * @retval NULL The message has no tree
  *
  * Since the graphics characters have a value >255, I have to resort to using
  * escape sequences to pass the information to print_enriched_string().  These
@@ -253,116 +334,85 @@ static void calculate_visibility(struct Context *ctx, int *max_depth)
  * ncurses should automatically use the default ASCII characters instead of
  * graphics chars on terminals which don't support them (see the man page for
  * curs_addch).
+ *
+ * Each column of the tree stands for a deep ancestor of the message.  The
+ * columns left of the start depth continue the lines of the messages drawn
+ * above; from the start depth on, they show how the message hangs off the
+ * last message drawn before it, through any hidden or missing ancestors.
  */
-void mutt_draw_tree(struct Context *ctx)
+const char *mutt_thread_tree(const struct Header *hdr)
 {
-  char *pfx = NULL, *mypfx = NULL, *arrow = NULL, *myarrow = NULL, *new_tree = NULL;
   char corner = (Sort & SORT_REVERSE) ? MUTT_TREE_ULCORNER : MUTT_TREE_LLCORNER;
   char vtee = (Sort & SORT_REVERSE) ? MUTT_TREE_BTEE : MUTT_TREE_TTEE;
-  int depth = 0, start_depth = 0, max_depth = 0, width = option(OPT_NARROW_TREE) ? 1 : 2;
-  struct MuttThread *nextdisp = NULL, *pseudo = NULL, *parent = NULL, *tree = ctx->tree;
+  int depth = 0, start_depth = -1, width = option(OPT_NARROW_TREE) ? 1 : 2;
+  struct MuttThread *tree = NULL, *parent = NULL;
+  struct TreeCache *tc = NULL;
+  bool nextdisp, pseudo;
+  char *p = NULL;
 
-  /* Do the visibility calculations and free the old thread chars.
-   * From now on we can simply ignore invisible subtrees
-   */
-  calculate_visibility(ctx, &max_depth);
-  pfx = safe_malloc(width * max_depth + 2);
-  arrow = safe_malloc(width * max_depth + 2);
-  while (tree)
+  if (!hdr->thread || !hdr->thread->visible)
+    return NULL;
+
+  tc = &TreeCache[(hdr->virtual >= 0 ? hdr->virtual : hdr->msgno) % TREE_CACHE_SIZE];
+  if (tc->hdr == hdr && tc->gen == TreeGeneration)
+    return (tc->size && tc->tree[0]) ? tc->tree : NULL;
+
+  /* The start depth is that of the first node up the thread that follows a
+   * drawn sibling or a visible parent. */
+  for (tree = hdr->thread; tree->parent; tree = tree->parent)
   {
-    if (depth)
-    {
-      myarrow = arrow + (depth - start_depth - (start_depth ? 0 : 1)) * width;
-      if (depth && start_depth == depth)
-        myarrow[0] = nextdisp ? MUTT_TREE_LTEE : corner;
-      else if (parent->message && !option(OPT_HIDE_LIMITED))
-        myarrow[0] = MUTT_TREE_HIDDEN;
-      else if (!parent->message && !option(OPT_HIDE_MISSING))
-        myarrow[0] = MUTT_TREE_MISSING;
-      else
-        myarrow[0] = vtee;
-      if (width == 2)
-        myarrow[1] = pseudo ? MUTT_TREE_STAR :
-                              (tree->duplicate_thread ? MUTT_TREE_EQUALS : MUTT_TREE_HLINE);
-      if (tree->visible)
-      {
-        myarrow[width] = MUTT_TREE_RARROW;
-        myarrow[width + 1] = 0;
-        new_tree = safe_malloc((2 + depth * width));
-        if (start_depth > 1)
-        {
-          strncpy(new_tree, pfx, (start_depth - 1) * width);
-          strfcpy(new_tree + (start_depth - 1) * width, arrow,
-                  (1 + depth - start_depth) * width + 2);
-        }
-        else
-          strfcpy(new_tree, arrow, 2 + depth * width);
-        tree->message->tree = new_tree;
-      }
-    }
-    if (tree->child && depth)
+    if (start_depth < 0 && (tree->parent->visible || prev_subtree_visible(tree)))
+      start_depth = depth;
+    if (tree->parent->deep)
+      depth++;
+  }
+  start_depth = (start_depth < 0) ? 0 : depth - start_depth;
+
+  tc->hdr = hdr;
+  tc->gen = TreeGeneration;
+  if (!depth)
+  {
+    if (tc->size)
+      tc->tree[0] = '\0';
+    return NULL;
+  }
+
+  if (tc->size < (size_t) depth * width + 2)
+  {
+    tc->size = depth * width + 2;
+    safe_realloc(&tc->tree, tc->size);
+  }
+  tc->tree[depth * width] = MUTT_TREE_RARROW;
+  tc->tree[depth * width + 1] = '\0';
+
+  for (tree = hdr->thread; depth; depth--, tree = parent)
+  {
+    for (parent = tree->parent; !parent->deep; parent = parent->parent)
+      ;
+    tree_node_flags(tree, &nextdisp, &pseudo);
+    p = tc->tree + (depth - 1) * width;
+    if (depth < start_depth)
     {
-      mypfx = pfx + (depth - 1) * width;
-      mypfx[0] = nextdisp ? MUTT_TREE_VLINE : MUTT_TREE_SPACE;
+      p[0] = nextdisp ? MUTT_TREE_VLINE : MUTT_TREE_SPACE;
       if (width == 2)
-        mypfx[1] = MUTT_TREE_SPACE;
+        p[1] = MUTT_TREE_SPACE;
+      continue;
     }
-    parent = tree;
-    nextdisp = NULL;
-    pseudo = NULL;
-    do
-    {
-      if (tree->child && tree->subtree_visible)
-      {
-        if (tree->deep)
-          depth++;
-        if (tree->visible)
-          start_depth = depth;
-        tree = tree->child;
 
-        /* we do this here because we need to make sure that the first child thread
-         * of the old tree that we deal with is actually displayed if any are,
-         * or we might set the parent variable wrong while going through it. */
-        while (!tree->subtree_visible && tree->next)
-          tree = tree->next;
-      }
-      else
-      {
-        while (!tree->next && tree->parent)
-        {
-          if (tree == pseudo)
-            pseudo = NULL;
-          if (tree == nextdisp)
-            nextdisp = NULL;
-          if (tree->visible)
-            start_depth = depth;
-          tree = tree->parent;
-          if (tree->deep)
-          {
-            if (start_depth == depth)
-              start_depth--;
-            depth--;
-          }
-        }
-        if (tree == pseudo)
-          pseudo = NULL;
-        if (tree == nextdisp)
-          nextdisp = NULL;
-        if (tree->visible)
-          start_depth = depth;
-        tree = tree->next;
-        if (!tree)
-          break;
-      }
-      if (!pseudo && tree->fake_thread)
-        pseudo = tree;
-      if (!nextdisp && tree->next_subtree_visible)
-        nextdisp = tree;
-    } while (!tree->deep);
+    if (depth == start_depth)
+      p[0] = nextdisp ? MUTT_TREE_LTEE : corner;
+    else if (parent->message && !option(OPT_HIDE_LIMITED))
+      p[0] = MUTT_TREE_HIDDEN;
+    else if (!parent->message && !option(OPT_HIDE_MISSING))
+      p[0] = MUTT_TREE_MISSING;
+    else
+      p[0] = vtee;
+    if (width == 2)
+      p[1] = pseudo ? MUTT_TREE_STAR :
+                      (tree->duplicate_thread ? MUTT_TREE_EQUALS : MUTT_TREE_HLINE);
   }
 
-  FREE(&pfx);
-  FREE(&arrow);
+  return tc->tree;
 }
 
 /**
@@ -521,6 +571,66 @@ static struct Hash *make_subj_hash(struct Context *ctx)
   return hash;
 }
 
+/**
+ * pseudo_thread - Thread a message by subject
+ * @param ctx Mailbox
+ * @param top Top-level threads
+ * @param cur Top-level thread to attach by subject
+ * @retval ptr  New parent of @a cur
+ * @retval NULL @a cur wasn't moved
+ */
+static struct MuttThread *pseudo_thread(struct Context *ctx,
+                                        struct MuttThread **top, struct MuttThread *cur)
+{
+  struct MuttThread *tmp = NULL, *parent = NULL, *curchild = NULL, *nextchild = NULL;
+
+  if ((parent = find_subject(ctx, cur)) == NULL)
+    return NULL;
+
+  cur->fake_thread = true;
+  unlink_message(top, cur);
+  insert_message(&parent->child, parent, cur);
+  parent->sort_children = true;
+  tmp = cur;
+  while (true)
+  {
+    while (!tmp->message)
+      tmp = tmp->child;
+
+    /* if the message we're attaching has pseudo-children, they
+     * need to be attached to its parent, so move them up a level.
+     * but only do this if they have the same real subject as the
+     * parent, since otherwise they rightly belong to the message
+     * we're attaching. */
+    if (tmp == cur || (mutt_strcmp(tmp->message->env->real_subj,
+                                   parent->message->env->real_subj) == 0))
+    {
+      tmp->message->subject_changed = false;
+
+      for (curchild = tmp->child; curchild;)
+      {
+        nextchild = curchild->next;
+        if (curchild->fake_thread)
+        {
+          unlink_message(&tmp->child, curchild);
+          insert_message(&parent->child, parent, curchild);
+        }
+        curchild = nextchild;
+      }
+    }
+
+    while (!tmp->next && tmp != cur)
+    {
+      tmp = tmp->parent;
+    }
+    if (tmp == cur)
+      break;
+    tmp = tmp->next;
+  }
+
+  return parent;
+}
+
 /**
  * pseudo_threads - Thread messages by subject
  *
@@ -529,8 +639,7 @@ static struct Hash *make_subj_hash(struct Context *ctx)
 static void pseudo_threads(struct Context *ctx)
 {
   struct MuttThread *tree = ctx->tree, *top = tree;
-  struct MuttThread *tmp = NULL, *cur = NULL, *parent = NULL, *curchild = NULL,
-                    *nextchild = NULL;
+  struct MuttThread *cur = NULL;
 
   if (!ctx->subj_hash)
     ctx->subj_hash = make_subj_hash(ctx);
@@ -539,49 +648,7 @@ static void pseudo_threads(struct Context *ctx)
   {
     cur = tree;
     tree = tree->next;
-    if ((parent = find_subject(ctx, cur)) != NULL)
-    {
-      cur->fake_thread = true;
-      unlink_message(&top, cur);
-      insert_message(&parent->child, parent, cur);
-      parent->sort_children = true;
-      tmp = cur;
-      while (true)
-      {
-        while (!tmp->message)
-          tmp = tmp->child;
-
-        /* if the message we're attaching has pseudo-children, they
-         * need to be attached to its parent, so move them up a level.
-         * but only do this if they have the same real subject as the
-         * parent, since otherwise they rightly belong to the message
-         * we're attaching. */
-        if (tmp == cur || (mutt_strcmp(tmp->message->env->real_subj,
-                                       parent->message->env->real_subj) == 0))
-        {
-          tmp->message->subject_changed = false;
-
-          for (curchild = tmp->child; curchild;)
-          {
-            nextchild = curchild->next;
-            if (curchild->fake_thread)
-            {
-              unlink_message(&tmp->child, curchild);
-              insert_message(&parent->child, parent, curchild);
-            }
-            curchild = nextchild;
-          }
-        }
-
-        while (!tmp->next && tmp != cur)
-        {
-          tmp = tmp->parent;
-        }
-        if (tmp == cur)
-          break;
-        tmp = tmp->next;
-      }
-    }
+    pseudo_thread(ctx, &top, cur);
   }
   ctx->tree = top;
 }
@@ -748,34 +815,248 @@ struct MuttThread *mutt_sort_subthreads(struct MuttThread *thread, int init)
   }
 }
 
+/**
+ * check_subject - Does a message have a different subject than its parent?
+ * @param cur Message
+ */
+static void check_subject(struct Header *cur)
+{
+  struct MuttThread *tmp = cur->thread->parent;
+
+  cur->thread->check_subject = false;
+
+  /* figure out which messages have subjects different than their parents' */
+  while (tmp && !tmp->message)
+  {
+    tmp = tmp->parent;
+  }
+
+  if (!tmp)
+    cur->subject_changed = true;
+  else if (cur->env->real_subj && tmp->message->env->real_subj)
+    cur->subject_changed =
+        (mutt_strcmp(cur->env->real_subj, tmp->message->env->real_subj) != 0) ? true : false;
+  else
+    cur->subject_changed =
+        (cur->env->real_subj || tmp->message->env->real_subj) ? true : false;
+}
+
 static void check_subjects(struct Context *ctx, int init)
 {
   struct Header *cur = NULL;
-  struct MuttThread *tmp = NULL;
   for (int i = 0; i < ctx->msgcount; i++)
   {
     cur = ctx->hdrs[i];
-    if (cur->thread->check_subject)
-      cur->thread->check_subject = false;
-    else if (!init)
+    if (init || cur->thread->check_subject)
+      check_subject(cur);
+  }
+}
+
+/**
+ * struct ThreadUpdate - Threads affected by new messages
+ *
+ * When new messages arrive, only the threads they join, and the pseudo-threads
+ * they may take over, are rethreaded, resorted and redrawn.
+ */
+struct ThreadUpdate
+{
+  struct MuttThread **nodes; /**< Nodes in the affected threads */
+  size_t count;              /**< Number of nodes */
+  size_t max;                /**< Size of @a nodes */
+};
+
+static void thread_update_add(struct ThreadUpdate *tu, struct MuttThread *cur)
+{
+  if (tu->count == tu->max)
+  {
+    tu->max = tu->max ? 2 * tu->max : 64;
+    safe_realloc(&tu->nodes, tu->max * sizeof(struct MuttThread *));
+  }
+  tu->nodes[tu->count++] = cur;
+}
+
+/**
+ * thread_root - Find the top of a thread
+ * @param cur Node of the thread
+ * @param top Temporary top node, or NULL
+ * @retval ptr Top-level node
+ */
+static struct MuttThread *thread_root(struct MuttThread *cur, struct MuttThread *top)
+{
+  while (cur->parent && (cur->parent != top))
+    cur = cur->parent;
+  return cur;
+}
+
+/**
+ * unlink_pseudo_thread - Move a pseudo-thread back to the top
+ * @param top  Temporary top node
+ * @param cur  Pseudo-thread
+ * @param tu   The thread it leaves is affected
+ * @param cand Top-level threads to thread by subject again
+ */
+static void unlink_pseudo_thread(struct MuttThread *top, struct MuttThread *cur,
+                                 struct ThreadUpdate *tu, struct ThreadUpdate *cand)
+{
+  thread_update_add(tu, cur->parent);
+  unlink_message(&cur->parent->child, cur);
+  insert_message(&top->child, top, cur);
+  cur->fake_thread = false;
+  cur->changed = true;
+  thread_update_add(cand, cur);
+}
+
+/**
+ * unlink_pseudo_threads - Prepare the pseudo-threading of new messages
+ * @param ctx  Mailbox
+ * @param top  Temporary top node
+ * @param news New messages, already threaded by references
+ * @param nnew Number of new messages
+ * @param tu   Affected threads
+ * @param cand Top-level threads to thread by subject again
+ *
+ * A new message may be a better parent for the pseudo-threads, or top-level
+ * threads, whose subject it shares.  Those pseudo-threads are moved back to
+ * the top, and become candidates for pseudo_thread() with the top-level
+ * threads.  The other pseudo-threads can't be affected and keep their place.
+ */
+static void unlink_pseudo_threads(struct Context *ctx, struct MuttThread *top,
+                                  struct Header **news, int nnew,
+                                  struct ThreadUpdate *tu, struct ThreadUpdate *cand)
+{
+  struct MuttThread *tmp = NULL;
+
+  if (!ctx->subj_hash)
+    ctx->subj_hash = make_subj_hash(ctx);
+
+  for (int i = 0; i < nnew; i++)
+  {
+    struct Header *cur = news[i];
+
+    /* the pseudo-thread the new message joined */
+    for (tmp = cur->thread; tmp->parent != top; tmp = tmp->parent)
+    {
+      if (tmp->fake_thread)
+      {
+        unlink_pseudo_thread(top, tmp, tu, cand);
+        break;
+      }
+    }
+    if ((tmp->parent == top) && !tmp->changed)
+    {
+      tmp->changed = true;
+      thread_update_add(cand, tmp);
+    }
+
+    if (!cur->env->real_subj)
       continue;
 
-    /* figure out which messages have subjects different than their parents' */
-    tmp = cur->thread->parent;
-    while (tmp && !tmp->message)
+    /* the threads whose subject list contains the new subject */
+    for (struct HashElem *ptr = hash_find_bucket(ctx->subj_hash, cur->env->real_subj);
+         ptr; ptr = ptr->next)
     {
-      tmp = tmp->parent;
+      struct Header *h = ptr->data;
+      if (!h->thread || (mutt_strcmp(h->env->real_subj, cur->env->real_subj) != 0))
+        continue;
+
+      tmp = h->thread;
+      while (!tmp->fake_thread && (tmp->parent != top) && !tmp->parent->message)
+        tmp = tmp->parent;
+
+      if (tmp->changed)
+        continue;
+      if (tmp->fake_thread)
+        unlink_pseudo_thread(top, tmp, tu, cand);
+      else if (tmp->parent == top)
+      {
+        tmp->changed = true;
+        thread_update_add(cand, tmp);
+      }
     }
+  }
 
-    if (!tmp)
-      cur->subject_changed = true;
-    else if (cur->env->real_subj && tmp->message->env->real_subj)
-      cur->subject_changed =
-          (mutt_strcmp(cur->env->real_subj, tmp->message->env->real_subj) != 0) ? true : false;
-    else
-      cur->subject_changed =
-          (cur->env->real_subj || tmp->message->env->real_subj) ? true : false;
+  for (size_t i = 0; i < cand->count; i++)
+    cand->nodes[i]->changed = false;
+}
+
+/**
+ * insert_thread - Insert a thread among the sorted top-level threads
+ * @param tree Top-level threads
+ * @param tail Last top-level thread
+ * @param cur  Thread to insert
+ *
+ * New threads usually go at one end of the list, so it's searched from the
+ * end.
+ */
+static void insert_thread(struct MuttThread **tree, struct MuttThread **tail,
+                          struct MuttThread *cur)
+{
+  struct MuttThread *pos = *tail;
+
+  if (!*tree || (compare_threads(&cur, tree) < 0))
+  {
+    insert_message(tree, NULL, cur);
+    if (!*tail)
+      *tail = cur;
+    return;
   }
+
+  while (compare_threads(&cur, &pos) < 0)
+    pos = pos->prev;
+
+  cur->parent = NULL;
+  cur->prev = pos;
+  cur->next = pos->next;
+  if (pos->next)
+    pos->next->prev = cur;
+  pos->next = cur;
+  if (pos == *tail)
+    *tail = cur;
+}
+
+/**
+ * update_threads - Resort the threads affected by new messages
+ * @param ctx Mailbox
+ * @param tu  Affected threads; on return, their top-level nodes
+ *
+ * Each affected thread is taken out of the top-level list, sorted on its own,
+ * and put back in its place.  The other threads are left alone.
+ */
+static void update_threads(struct Context *ctx, struct ThreadUpdate *tu)
+{
+  struct MuttThread *root = NULL, *tail = NULL;
+  struct ThreadUpdate roots;
+
+  memset(&roots, 0, sizeof(roots));
+  for (size_t i = 0; i < tu->count; i++)
+  {
+    root = thread_root(tu->nodes[i], NULL);
+    if (!root->changed)
+    {
+      root->changed = true;
+      thread_update_add(&roots, root);
+      unlink_message(&ctx->tree, root);
+    }
+  }
+
+  for (tail = ctx->tree; tail && tail->next; tail = tail->next)
+    ;
+
+  for (size_t i = 0; i < roots.count; i++)
+  {
+    root = roots.nodes[i];
+    root->changed = false;
+    root->next = NULL;
+    root->prev = NULL;
+    root->parent = NULL;
+    mutt_sort_subthreads(root, 0);
+
+    compare_threads(NULL, NULL);
+    insert_thread(&ctx->tree, &tail, root);
+  }
+
+  FREE(&tu->nodes);
+  *tu = roots;
 }
 
 void mutt_sort_threads(struct Context *ctx, int init)
@@ -785,6 +1066,11 @@ void mutt_sort_threads(struct Context *ctx, int init)
   struct MuttThread *thread = NULL, *new = NULL, *tmp = NULL, top;
   memset(&top, 0, sizeof(top));
   struct ListNode *ref = NULL;
+  struct Header **news = NULL;
+  int nnew = 0;
+  struct ThreadUpdate tu, cand;
+  memset(&tu, 0, sizeof(tu));
+  memset(&cand, 0, sizeof(cand));
 
   /* set Sort to the secondary method to support the set sort_aux=reverse-*
    * settings.  The sorting functions just look at the value of
@@ -799,6 +1085,22 @@ void mutt_sort_threads(struct Context *ctx, int init)
   if (init)
     ctx->thread_hash = hash_create(ctx->msgcount * 2, MUTT_HASH_ALLOW_DUPS);
 
+  /* If messages were only added, link just them into the existing threads.
+   * This isn't possible if a new message takes the place of a missing one:
+   * the subjects of its descendants must be checked again. */
+  bool incremental = !init && ctx->tree;
+  if (incremental)
+  {
+    for (i = 0; i < ctx->msgcount; i++)
+      if (!ctx->hdrs[i]->thread)
+        nnew++;
+    if (nnew == 0)
+      incremental = false;
+    else
+      news = safe_malloc(nnew * sizeof(struct Header *));
+    nnew = 0;
+  }
+
   /* we want a quick way to see if things are actually attached to the top of the
    * thread tree or if they're just dangling, so we attach everything to a top
    * node temporarily */
@@ -817,6 +1119,9 @@ void mutt_sort_threads(struct Context *ctx, int init)
 
     if (!cur->thread)
     {
+      if (news)
+        news[nnew++] = cur;
+
       if ((!init || option(OPT_DUP_THREADS)) && cur->env->message_id)
         thread = hash_find(ctx->thread_hash, cur->env->message_id);
       else
@@ -825,6 +1130,7 @@ void mutt_sort_threads(struct Context *ctx, int init)
       if (thread && !thread->message)
       {
         /* this is a message which was missing before */
+        incremental = false;
         thread->message = cur;
         cur->thread = thread;
         thread->check_subject = true;
@@ -883,11 +1189,15 @@ void mutt_sort_threads(struct Context *ctx, int init)
         }
       }
     }
-    else
+  }
+
+  if (!incremental)
+  {
+    /* unlink pseudo-threads because they might be children of newly
+     * arrived messages */
+    for (i = 0; i < ctx->msgcount; i++)
     {
-      /* unlink pseudo-threads because they might be children of newly
-       * arrived messages */
-      thread = cur->thread;
+      thread = ctx->hdrs[i]->thread;
       for (new = thread->child; new;)
       {
         tmp = new->next;
@@ -903,9 +1213,9 @@ void mutt_sort_threads(struct Context *ctx, int init)
   }
 
   /* thread by references */
-  for (i = 0; i < ctx->msgcount; i++)
+  for (i = 0; i < (incremental ? nnew : ctx->msgcount); i++)
   {
-    cur = ctx->hdrs[i];
+    cur = incremental ? news[i] : ctx->hdrs[i];
     if (cur->threaded)
       continue;
     cur->threaded = true;
@@ -977,6 +1287,14 @@ void mutt_sort_threads(struct Context *ctx, int init)
       insert_message(&top.child, &top, thread);
   }
 
+  if (incremental)
+  {
+    for (i = 0; i < nnew; i++)
+      thread_update_add(&tu, news[i]->thread);
+    if (!option(OPT_STRICT_THREADS))
+      unlink_pseudo_threads(ctx, &top, news, nnew, &tu, &cand);
+  }
+
   /* detach everything from the temporary top node */
   for (thread = top.child; thread; thread = thread->next)
   {
@@ -984,6 +1302,35 @@ void mutt_sort_threads(struct Context *ctx, int init)
   }
   ctx->tree = top.child;
 
+  if (incremental)
+  {
+    for (i = 0; i < nnew; i++)
+      check_subject(news[i]);
+
+    /* thread by subject the candidates, they are all top-level */
+    for (size_t j = 0; j < cand.count; j++)
+    {
+      pseudo_thread(ctx, &ctx->tree, cand.nodes[j]);
+      thread_update_add(&tu, cand.nodes[j]);
+    }
+
+    update_threads(ctx, &tu);
+
+    /* restore the oldsort order. */
+    Sort = oldsort;
+    linearize_tree(ctx);
+
+    /* Draw only the affected threads. */
+    for (size_t j = 0; j < tu.count; j++)
+      draw_thread(ctx, tu.nodes[j]);
+
+    FREE(&tu.nodes);
+    FREE(&cand.nodes);
+    FREE(&news);
+    return;
+  }
+  FREE(&news);
+
   check_subjects(ctx, init);
 
   if (!option(OPT_STRICT_THREADS))
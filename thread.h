@@ -41,6 +41,7 @@ struct MuttThread
   bool deep : 1;
   unsigned int subtree_visible : 2;
   bool next_subtree_visible : 1;
+  bool changed : 1; /**< Marked while threading new messages */
   struct MuttThread *parent;
   struct MuttThread *child;
   struct MuttThread *next;
@@ -67,6 +68,7 @@ void mutt_break_thread(struct Header *hdr);
 int mutt_link_threads(struct Header *cur, struct Header *last, struct Context *ctx);
 int mutt_messages_in_thread(struct Context *ctx, struct Header *hdr, int flag);
 void mutt_draw_tree(struct Context *ctx);
+const char *mutt_thread_tree(const struct Header *hdr);
 
 void mutt_clear_threads(struct Context *ctx);
 struct MuttThread *mutt_sort_subthreads(struct MuttThread *thread, int init);
@@ -40,6 +40,7 @@
 const char *mutt_make_version(void);
 /* #include "hcache/hcache.h" */
 const char *mutt_hcache_backend_list(void);
+const char *mutt_hcache_compress_list(void);
 
 const int SCREEN_WIDTH = 80;
 
@@ -148,6 +149,11 @@ static struct CompileOptions comp_opts[] = {
 #else
   { "color", 0 },
 #endif
+#ifdef USE_COMPRESS_NATIVE
+  { "compress_native", 1 },
+#else
+  { "compress_native", 0 },
+#endif
 #ifdef HAVE_CURS_SET
   { "curs_set", 1 },
 #else
@@ -213,6 +219,16 @@ static struct CompileOptions comp_opts[] = {
 #else
   { "idn", 0 },
 #endif
+#ifdef USE_INOTIFY
+  { "inotify", 1 },
+#else
+  { "inotify", 0 },
+#endif
+#ifdef USE_IO_URING
+  { "io_uring", 1 },
+#else
+  { "io_uring", 0 },
+#endif
 #ifdef LOCALES_HACK
   { "locales_hack", 1 },
 #else
@@ -253,6 +269,11 @@ static struct CompileOptions comp_opts[] = {
 #else
   { "pgp", 0 },
 #endif
+#ifdef USE_PTHREAD
+  { "pthread", 1 },
+#else
+  { "pthread", 0 },
+#endif
 #ifdef HAVE_RESIZETERM
   { "resizeterm", 1 },
 #else
@@ -393,6 +414,10 @@ void print_version(void)
   const char *backends = mutt_hcache_backend_list();
   printf("\nhcache backends: %s", backends);
   FREE(&backends);
+  const char *compress = mutt_hcache_compress_list();
+  if (*compress)
+    printf("\nhcache compression: %s", compress);
+  FREE(&compress);
 #endif
 
   puts("\n\nCompiler:");